@@ -3,12 +3,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include "boot_info.h"
 UART_HandleTypeDef huart1;
 
 void        SystemClock_Config(void);
 static void MX_GPIO_Init(void);
 static void MX_USART1_UART_Init(void);
 static void UART1_SendString(const char *str);
+static void print_boot_info(void);
+static bool is_clock_preserved(void);
 
 /**
  * @brief  The application entry point.
@@ -17,12 +20,19 @@ static void UART1_SendString(const char *str);
 int
 main(void)
 {
+    // If the bootloader left its clock tree configured, start at its clock speed and skip the clock bring-up
+    bool clock_preserved = is_clock_preserved();
     HAL_Init();
-    SystemClock_Config();
+    if (!clock_preserved)
+    {
+        SystemClock_Config();
+    }
     MX_GPIO_Init();
     MX_USART1_UART_Init();
     // Send a hello message via UART1
     UART1_SendString("Hello from STM32!\r\n");
+    // Report how the bootloader booted this application
+    print_boot_info();
 
     // Counter variable
     int counter = 0;
@@ -51,6 +61,86 @@ UART1_SendString(const char *str)
     HAL_UART_Transmit(&huart1, (uint8_t *)str, strlen(str), HAL_MAX_DELAY);
 }
 
+/**
+ * @brief Checks if the bootloader handed over its clock tree (BL_KEEP_CLOCKS). If so, SystemCoreClock is updated from
+ *        the clock registers, so that HAL_Init configures the tick for the actual core clock.
+ * @retval true if the clock bring-up can be skipped
+ */
+static bool
+is_clock_preserved(void)
+{
+    struct boot_info_s const *boot_info = boot_info_get();
+
+    if ((boot_info == NULL) || !(boot_info->clock_flags & BOOT_INFO_CLOCKS_PRESERVED))
+    {
+        return false;
+    }
+
+    SystemCoreClockUpdate();
+    // The clock registers must match the handed over clock tree
+    return (SystemCoreClock == boot_info->core_clock_hz) && (HAL_RCC_GetHCLKFreq() == boot_info->hclk_hz);
+}
+
+/**
+ * @brief Prints the boot info record handed over by the bootloader: the boot time, the path taken and the verified
+ *        image. The image digest can be used as is, instead of hashing the image again.
+ * @retval None
+ */
+static void
+print_boot_info(void)
+{
+    char                      buffer[96];
+    struct boot_info_s const *boot_info = boot_info_get();
+
+    if (boot_info == NULL)
+    {
+        UART1_SendString("No boot info from the bootloader\r\n");
+        return;
+    }
+
+    snprintf(buffer,
+             sizeof(buffer),
+             "Boot: v%u.%u.%u in %lu us, path flags: 0x%08lX\r\n",
+             boot_info->fw_version_major,
+             boot_info->fw_version_minor,
+             boot_info->fw_version_patch,
+             (unsigned long)boot_info->handoff_us,
+             (unsigned long)boot_info->path_flags);
+    UART1_SendString(buffer);
+
+    snprintf(buffer,
+             sizeof(buffer),
+             "  clocks: core %lu Hz%s\r\n",
+             (unsigned long)SystemCoreClock,
+             (boot_info->clock_flags & BOOT_INFO_CLOCKS_PRESERVED) ? " (kept from the bootloader)" : "");
+    UART1_SendString(buffer);
+
+    // The bootloader points the vector table to the booted slot (primary, or secondary with direct XIP)
+    snprintf(buffer, sizeof(buffer), "  slot: 0x%08lX\r\n", (unsigned long)SCB->VTOR);
+    UART1_SendString(buffer);
+
+    for (uint32_t stage = 0; stage < BOOT_INFO_STAGE_COUNT; stage++)
+    {
+        if (boot_info->stages_visited & (1UL << stage))
+        {
+            snprintf(buffer,
+                     sizeof(buffer),
+                     "  stage %lu entered at %lu us\r\n",
+                     (unsigned long)stage,
+                     (unsigned long)boot_info->stage_entry_us[stage]);
+            UART1_SendString(buffer);
+        }
+    }
+
+    UART1_SendString("  image digest: ");
+    for (uint32_t i = 0; i < BOOT_INFO_DIGEST_SIZE_BYTES; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "%02X", boot_info->image_digest[i]);
+        UART1_SendString(buffer);
+    }
+    UART1_SendString("\r\n");
+}
+
 /**
  * @brief System Clock Configuration
  * @retval None
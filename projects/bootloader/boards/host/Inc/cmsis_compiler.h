@@ -0,0 +1,24 @@
+/**
+ * @file cmsis_compiler.h
+ * @brief Host stand-in of the CMSIS core intrinsics used by the bootloader core (interrupt masking). On the host, the
+ *        uart "interrupt" is dispatched from sys_delay_ms, only while the interrupts are not masked.
+ * @version 0.1
+ * @date 2024-08-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef CMSIS_COMPILER_H
+#define CMSIS_COMPILER_H
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "host_platform.h"
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#define __disable_irq()        host_platform_irq_disable()
+#define __enable_irq()         host_platform_irq_enable()
+#define __get_PRIMASK()        host_platform_get_primask()
+#define __set_PRIMASK(primask) host_platform_set_primask(primask)
+
+#endif // CMSIS_COMPILER_H
@@ -0,0 +1,57 @@
+/**
+ * @file host_platform.h
+ * @brief Emulated platform of the host (Linux) build of the bootloader: command line options, time base and timing
+ *        model, interrupt masking, reset. The flash is a file mapped at the flash addresses of the stm32f401re, and the
+ *        uart is a pseudo terminal.
+ * @version 0.1
+ * @date 2024-08-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef HOST_PLATFORM_H
+#define HOST_PLATFORM_H
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+// Clock tree of the stm32f401re bootloader (see sys_init.c): the cycle counter and the baud rates follow it
+#define HOST_CORE_CLOCK_HZ 84000000
+#define HOST_PCLK1_HZ      42000000
+#define HOST_PCLK2_HZ      84000000
+
+// --- structs ---------------------------------------------------------------------------------------------------------
+/**
+ * @brief Command line options of the host bootloader
+ *
+ */
+struct host_platform_options_s
+{
+    char const *flash_path;     /**< File that backs the flash (created erased, if missing) */
+    char const *primary_path;   /**< Image programmed to the primary slot before booting (NULL: none) */
+    char const *secondary_path; /**< Image programmed to the secondary slot before booting (NULL: none) */
+    bool        is_recovery;    /**< The recovery button is pressed during boot */
+    double      time_scale;     /**< Scale of the modeled flash and uart timings (0: no modeled delays) */
+};
+
+// --- function declarations -------------------------------------------------------------------------------------------
+void                                  host_platform_init(void);
+struct host_platform_options_s const *host_platform_get_options(void);
+uint64_t                              host_platform_get_time_ns(void);
+void                                  host_platform_model_delay_ns(uint64_t delay_ns);
+void                                  host_platform_irq_disable(void);
+void                                  host_platform_irq_enable(void);
+uint32_t                              host_platform_get_primask(void);
+void                                  host_platform_set_primask(uint32_t primask);
+void                                  host_platform_reset(void) __attribute__((noreturn));
+
+// Emulated peripherals
+bool flash_driver_host_init(char const *path);
+bool flash_driver_host_load(uint32_t start_address, uint32_t end_address, char const *image_path);
+void flash_driver_host_sync(void);
+void uart_driver_host_poll(uint32_t timeout_ms);
+
+#endif // HOST_PLATFORM_H
@@ -0,0 +1,21 @@
+/**
+ * @file stm32f4xx_hal.h
+ * @brief Host stand-in of the HAL header, for the bootloader core files that include it (through sys_init.h). Only
+ *        what they use is provided.
+ * @version 0.1
+ * @date 2024-08-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef STM32F4XX_HAL_H
+#define STM32F4XX_HAL_H
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include <stdint.h>
+
+// --- external variables ----------------------------------------------------------------------------------------------
+extern uint32_t SystemCoreClock;
+
+#endif // STM32F4XX_HAL_H
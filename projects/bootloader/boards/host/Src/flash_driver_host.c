@@ -0,0 +1,308 @@
+/**
+ * @file flash_driver_host.c
+ * @brief Emulated flash of the host build: a file with the sector geometry of the stm32f401re (flash_driver.h), mapped
+ *        read only at the flash addresses, so that the bootloader core reads it in place as on the target. Only the
+ *        driver writes it, through a second (writable) mapping of the file. The erase and program operations take the
+ *        typical durations of the datasheet (scaled by the time scale option), and a programmed location can only
+ *        clear bits until its sector is erased again.
+ * @version 0.1
+ * @date 2024-08-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define _GNU_SOURCE // MAP_FIXED_NOREPLACE
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "flash_driver.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "host_platform.h"
+#include "common.h"
+#include "stats/stats.h"
+#include "trace/trace.h"
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#define FLASH_PROGRAM_WORD_SIZE (4)
+#define FLASH_ERASED_BYTE       (0xFF)
+#define FLASH_BASE_ADDRESS      FLASH_SECTOR_0_START
+#define FLASH_SIZE_BYTES        (FLASH_SECTOR_7_START + FLASH_SECTOR_7_SIZE - FLASH_SECTOR_0_START)
+
+// Timing model: typical durations of the stm32f401re datasheet, for x32 parallelism (FLASH_VOLTAGE_RANGE_3)
+#define FLASH_PROGRAM_TIME_NS    (16000ULL)      // Per word (or byte)
+#define FLASH_ERASE_16K_TIME_NS  (250000000ULL)  // 16kB sector
+#define FLASH_ERASE_64K_TIME_NS  (550000000ULL)  // 64kB sector
+#define FLASH_ERASE_128K_TIME_NS (1000000000ULL) // 128kB sector
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+static uint8_t *flash_rw = NULL; // Writable mapping of the flash file (the read only one is at FLASH_BASE_ADDRESS)
+
+// --- static function declarations ------------------------------------------------------------------------------------
+static uint32_t flash_driver_get_sector(uint32_t address);
+static uint64_t flash_driver_get_erase_time_ns(uint32_t sector_size);
+
+// --- static function definitions -------------------------------------------------------------------------------------
+/**
+ * @brief Function to get the index of the sector that an address belongs to
+ *
+ * @param address
+ * @return uint32_t The sector index, or FLASH_SECTOR_COUNT if the address is not in the flash
+ */
+static uint32_t
+flash_driver_get_sector(uint32_t address)
+{
+    for (uint32_t i = 0; i < FLASH_SECTOR_COUNT; i++)
+    {
+        if (address >= flash_sectors[i].start_address
+            && address < flash_sectors[i].start_address + flash_sectors[i].size)
+        {
+            return i;
+        }
+    }
+
+    return FLASH_SECTOR_COUNT;
+}
+
+/**
+ * @brief Function to get the modeled erase duration of a sector
+ *
+ * @param sector_size
+ * @return uint64_t
+ */
+static uint64_t
+flash_driver_get_erase_time_ns(uint32_t sector_size)
+{
+    if (sector_size <= FLASH_SECTOR_0_SIZE)
+    {
+        return FLASH_ERASE_16K_TIME_NS;
+    }
+    if (sector_size <= FLASH_SECTOR_4_SIZE)
+    {
+        return FLASH_ERASE_64K_TIME_NS;
+    }
+
+    return FLASH_ERASE_128K_TIME_NS;
+}
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to map the flash file. A missing (or empty) file is created erased.
+ *
+ * @param path
+ * @return true
+ * @return false
+ */
+bool
+flash_driver_host_init(char const *path)
+{
+    struct stat st;
+    int         fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if ((fd < 0) || (fstat(fd, &st) != 0))
+    {
+        perror(path);
+        return false;
+    }
+
+    bool is_new = (st.st_size == 0);
+    if (is_new && (ftruncate(fd, FLASH_SIZE_BYTES) != 0))
+    {
+        perror(path);
+        close(fd);
+        return false;
+    }
+    if (!is_new && (st.st_size != FLASH_SIZE_BYTES))
+    {
+        fprintf(stderr, "%s: a flash file must be %u bytes\n", path, (unsigned)FLASH_SIZE_BYTES);
+        close(fd);
+        return false;
+    }
+
+    flash_rw = mmap(NULL, FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    void *flash_ro
+        = mmap((void *)FLASH_BASE_ADDRESS, FLASH_SIZE_BYTES, PROT_READ, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    close(fd);
+    if ((flash_rw == MAP_FAILED) || (flash_ro != (void *)FLASH_BASE_ADDRESS))
+    {
+        fprintf(stderr, "%s: cannot map the flash at 0x%08X\n", path, (unsigned)FLASH_BASE_ADDRESS);
+        return false;
+    }
+
+    if (is_new)
+    {
+        memset(flash_rw, FLASH_ERASED_BYTE, FLASH_SIZE_BYTES);
+    }
+    printf("Flash: %s (%u kB at 0x%08X)\n", path, (unsigned)(FLASH_SIZE_BYTES / 1024), (unsigned)FLASH_BASE_ADDRESS);
+
+    return true;
+}
+
+/**
+ * @brief Function to program an image to a slot, as a debugger would: the slot is erased first. No timing model.
+ *
+ * @param start_address First address of the slot
+ * @param end_address Last address of the slot
+ * @param image_path
+ * @return true
+ * @return false
+ */
+bool
+flash_driver_host_load(uint32_t start_address, uint32_t end_address, char const *image_path)
+{
+    uint32_t slot_size = end_address - start_address + 1;
+    uint8_t *slot      = flash_rw + (start_address - FLASH_BASE_ADDRESS);
+    FILE    *file      = fopen(image_path, "rb");
+
+    if (file == NULL)
+    {
+        perror(image_path);
+        return false;
+    }
+
+    memset(slot, FLASH_ERASED_BYTE, slot_size);
+    size_t len     = fread(slot, 1, slot_size, file);
+    bool   is_tail = (fgetc(file) != EOF);
+    fclose(file);
+    if (is_tail)
+    {
+        fprintf(stderr, "%s: larger than the slot at 0x%08X (%u bytes)\n", image_path, (unsigned)start_address,
+                (unsigned)slot_size);
+        return false;
+    }
+    printf("Flash: %s programmed at 0x%08X (%u bytes)\n", image_path, (unsigned)start_address, (unsigned)len);
+
+    return true;
+}
+
+/**
+ * @brief Function to write the flash content back to the file (before a reset or an exit)
+ *
+ */
+void
+flash_driver_host_sync(void)
+{
+    if (flash_rw != NULL)
+    {
+        msync(flash_rw, FLASH_SIZE_BYTES, MS_SYNC);
+    }
+}
+
+/**
+ * @brief Function to erase the flash content in the specified address range. As on the stm32f401re, the whole sectors
+ *        that the range belongs to are erased.
+ *
+ * @param start_address
+ * @param end_address
+ * @return true
+ * @return false
+ */
+bool
+flash_driver_erase(uint32_t start_address, uint32_t end_address)
+{
+    uint32_t start_sector = flash_driver_get_sector(start_address);
+    uint32_t end_sector   = flash_driver_get_sector(end_address);
+
+    // If the start or end sector is not found, return false
+    if (start_sector == FLASH_SECTOR_COUNT || end_sector == FLASH_SECTOR_COUNT)
+    {
+        return false;
+    }
+
+    uint32_t stats_start = stats_timer_start();
+    for (uint32_t i = start_sector; i <= end_sector; i++)
+    {
+        memset(flash_rw + (flash_sectors[i].start_address - FLASH_BASE_ADDRESS),
+               FLASH_ERASED_BYTE,
+               flash_sectors[i].size);
+        host_platform_model_delay_ns(flash_driver_get_erase_time_ns(flash_sectors[i].size));
+    }
+    stats_timer_stop(STATS_TIMER_ERASE, PROF_REGION_FLASH_ERASE, stats_start);
+
+    return true;
+}
+
+/**
+ * @brief Function to read the flash content from the specified address to the destination buffer.
+ *
+ * @param p_dest
+ * @param p_src
+ * @param length_bytes
+ */
+void
+flash_driver_read(uint8_t *p_dest, const uint8_t *p_src, uint32_t length_bytes)
+{
+    memcpy(p_dest, p_src, length_bytes);
+}
+
+/**
+ * @brief Function to write the data from the source RAM to the flash memory, a word at a time wherever the flash
+ *        address is word aligned, and a byte at a time for the unaligned head and tail (as the target driver).
+ *        Programming can only clear bits: a location that holds data must be erased before it is programmed with
+ *        other data. The target would silently keep the AND of the old and new data; the emulation fails instead.
+ *
+ * @param p_src_ram
+ * @param flash_address
+ * @param length_bytes
+ * @return true
+ * @return false
+ */
+bool
+flash_driver_program(const uint8_t *p_src_ram, uint32_t flash_address, uint32_t length_bytes)
+{
+    uint32_t i;
+
+    if (p_src_ram == NULL)
+    {
+        TRACE_LOG("Flash write: null pointer input\n");
+        return false;
+    }
+
+    // check if data will be written in a valid address (without overflowing the end of the data)
+    if ((flash_address < (SYM_ADDR(__flash_app_start__)))
+        || (flash_address > (SYM_ADDR(__flash_app_secondary_end__)))
+        || (length_bytes > ((SYM_ADDR(__flash_app_secondary_end__)) - flash_address + 1)))
+    {
+        TRACE_LOG("Flash write: failed\n");
+        return false;
+    }
+
+    uint32_t stats_start = stats_timer_start();
+    uint8_t *p_dest      = flash_rw + (flash_address - FLASH_BASE_ADDRESS);
+    i                    = 0;
+    while (i < length_bytes)
+    {
+        uint32_t step_bytes = 1;
+
+        // Program a full word when possible
+        if ((((flash_address + i) & (FLASH_PROGRAM_WORD_SIZE - 1)) == 0)
+            && ((length_bytes - i) >= FLASH_PROGRAM_WORD_SIZE))
+        {
+            step_bytes = FLASH_PROGRAM_WORD_SIZE;
+        }
+
+        for (uint32_t byte = i; byte < i + step_bytes; byte++)
+        {
+            if ((p_dest[byte] & p_src_ram[byte]) != p_src_ram[byte])
+            {
+                TRACE_LOG("Flash program: 0x%08lX is not erased\n", (unsigned long)(flash_address + byte));
+                stats_timer_stop(STATS_TIMER_PROGRAM, PROF_REGION_FLASH_PROGRAM, stats_start);
+                return false;
+            }
+            p_dest[byte] = p_src_ram[byte];
+        }
+        host_platform_model_delay_ns(FLASH_PROGRAM_TIME_NS);
+
+        // Move to the next byte/word
+        i += step_bytes;
+    }
+    stats_timer_stop(STATS_TIMER_PROGRAM, PROF_REGION_FLASH_PROGRAM, stats_start);
+    return true;
+}
@@ -0,0 +1,296 @@
+/**
+ * @file host_platform.c
+ * @brief Emulated platform of the host (Linux) build of the bootloader. The command line is read from
+ *        /proc/self/cmdline, since the bootloader core owns main(void). A reset re-executes the bootloader: the ram
+ *        state is lost, the flash file and the uart pseudo terminal are kept.
+ * @version 0.1
+ * @date 2024-08-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define _GNU_SOURCE // execv, nanosleep, clock_gettime
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "host_platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "common.h"
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#define HOST_CMDLINE_MAX_BYTES  4096
+#define HOST_CMDLINE_MAX_ARGS   16
+#define HOST_DEFAULT_FLASH_PATH "flash.bin"
+// The modeled delays are slept in batches of at least 1 ms, so that the per word programming time (us) is not lost in
+// the overhead of the sleeps
+#define HOST_MODEL_DELAY_MIN_NS 1000000LL
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+static char  cmdline[HOST_CMDLINE_MAX_BYTES];
+static char *cmdline_args[HOST_CMDLINE_MAX_ARGS + 1];
+static int   cmdline_argc = 0;
+
+static struct host_platform_options_s options = {
+    .flash_path     = HOST_DEFAULT_FLASH_PATH,
+    .primary_path   = NULL,
+    .secondary_path = NULL,
+    .is_recovery    = false,
+    .time_scale     = 1.0,
+};
+
+static int64_t  model_delay_debt_ns = 0; // Modeled time not slept yet (negative: overslept)
+static uint32_t irq_primask         = 0; // 1: the uart "interrupt" is masked
+
+// --- static function declarations ------------------------------------------------------------------------------------
+static void host_platform_read_cmdline(void);
+static void host_platform_parse_options(void);
+static void host_platform_usage(void) __attribute__((noreturn));
+
+// --- static function definitions -------------------------------------------------------------------------------------
+/**
+ * @brief Function to read the command line of the process (NUL separated arguments)
+ *
+ */
+static void
+host_platform_read_cmdline(void)
+{
+    int fd = open("/proc/self/cmdline", O_RDONLY);
+    if (fd < 0)
+    {
+        perror("/proc/self/cmdline");
+        exit(EXIT_FAILURE);
+    }
+
+    ssize_t len = read(fd, cmdline, sizeof(cmdline) - 1);
+    close(fd);
+    if (len <= 0)
+    {
+        fprintf(stderr, "Cannot read the command line\n");
+        exit(EXIT_FAILURE);
+    }
+    cmdline[len] = '\0';
+
+    for (ssize_t i = 0; (i < len) && (cmdline_argc < HOST_CMDLINE_MAX_ARGS); i += strlen(&cmdline[i]) + 1)
+    {
+        cmdline_args[cmdline_argc++] = &cmdline[i];
+    }
+    cmdline_args[cmdline_argc] = NULL;
+}
+
+/**
+ * @brief Function to print the command line options and exit
+ *
+ */
+static void
+host_platform_usage(void)
+{
+    fprintf(stderr,
+            "Usage: %s [--flash FILE] [--primary IMAGE] [--secondary IMAGE] [--recovery] [--time-scale X]\n"
+            "  --flash FILE       File that backs the flash (default: %s, created erased if missing)\n"
+            "  --primary IMAGE    Program a DFU image to the primary slot before booting\n"
+            "  --secondary IMAGE  Program a DFU image to the secondary slot before booting\n"
+            "  --recovery         Boot with the recovery button pressed (boot loop)\n"
+            "  --time-scale X     Scale of the modeled flash and uart timings (default: 1, 0: none)\n",
+            cmdline_args[0],
+            HOST_DEFAULT_FLASH_PATH);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Function to parse the command line options
+ *
+ */
+static void
+host_platform_parse_options(void)
+{
+    for (int i = 1; i < cmdline_argc; i++)
+    {
+        char const *arg   = cmdline_args[i];
+        char const *value = (i + 1 < cmdline_argc) ? cmdline_args[i + 1] : NULL;
+
+        if (strcmp(arg, "--recovery") == 0)
+        {
+            options.is_recovery = true;
+            continue;
+        }
+        if (value == NULL)
+        {
+            host_platform_usage();
+        }
+
+        if (strcmp(arg, "--flash") == 0)
+        {
+            options.flash_path = value;
+        }
+        else if (strcmp(arg, "--primary") == 0)
+        {
+            options.primary_path = value;
+        }
+        else if (strcmp(arg, "--secondary") == 0)
+        {
+            options.secondary_path = value;
+        }
+        else if (strcmp(arg, "--time-scale") == 0)
+        {
+            char *end          = NULL;
+            options.time_scale = strtod(value, &end);
+            if ((end == value) || (*end != '\0') || (options.time_scale < 0))
+            {
+                host_platform_usage();
+            }
+        }
+        else
+        {
+            host_platform_usage();
+        }
+        i++;
+    }
+}
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to initialize the emulated platform: parse the command line, map the flash file and program the
+ *        requested images to their slots (as a debugger would, before the bootloader runs).
+ *
+ */
+void
+host_platform_init(void)
+{
+    // The console is usually piped to the host tools: one line at a time
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    host_platform_read_cmdline();
+    host_platform_parse_options();
+
+    if (!flash_driver_host_init(options.flash_path))
+    {
+        exit(EXIT_FAILURE);
+    }
+    if ((options.primary_path != NULL)
+        && !flash_driver_host_load(
+            SYM_ADDR(__flash_app_start__), SYM_ADDR(__flash_app_end__), options.primary_path))
+    {
+        exit(EXIT_FAILURE);
+    }
+    if ((options.secondary_path != NULL)
+        && !flash_driver_host_load(
+            SYM_ADDR(__flash_app_secondary_start__), SYM_ADDR(__flash_app_secondary_end__), options.secondary_path))
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function to get the command line options
+ *
+ * @return struct host_platform_options_s const*
+ */
+struct host_platform_options_s const *
+host_platform_get_options(void)
+{
+    return &options;
+}
+
+/**
+ * @brief Function to get the time of the monotonic clock, in ns
+ *
+ * @return uint64_t
+ */
+uint64_t
+host_platform_get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Function to spend the modeled duration of a hardware operation (flash erase/program, uart line time), scaled
+ *        by the time scale option. Short delays are accumulated and slept in batches.
+ *
+ * @param delay_ns
+ */
+void
+host_platform_model_delay_ns(uint64_t delay_ns)
+{
+    if (options.time_scale <= 0)
+    {
+        return;
+    }
+
+    model_delay_debt_ns += (int64_t)((double)delay_ns * options.time_scale);
+    if (model_delay_debt_ns < HOST_MODEL_DELAY_MIN_NS)
+    {
+        return;
+    }
+
+    uint64_t        start = host_platform_get_time_ns();
+    struct timespec ts    = { .tv_sec  = model_delay_debt_ns / 1000000000LL,
+                              .tv_nsec = model_delay_debt_ns % 1000000000LL };
+    nanosleep(&ts, NULL);
+    model_delay_debt_ns -= (int64_t)(host_platform_get_time_ns() - start);
+}
+
+/**
+ * @brief Functions to mask and unmask the uart "interrupt" (see cmsis_compiler.h)
+ *
+ */
+void
+host_platform_irq_disable(void)
+{
+    irq_primask = 1;
+}
+
+void
+host_platform_irq_enable(void)
+{
+    irq_primask = 0;
+}
+
+uint32_t
+host_platform_get_primask(void)
+{
+    return irq_primask;
+}
+
+void
+host_platform_set_primask(uint32_t primask)
+{
+    irq_primask = primask;
+}
+
+/**
+ * @brief Function to reset the emulated device: the bootloader is executed again, with the flash and timing options.
+ *        The images are not programmed again, and the recovery button is released. The uart pseudo terminal is
+ *        inherited (see uart_driver_host.c), so the host keeps its connection across the reset.
+ *
+ */
+void
+host_platform_reset(void)
+{
+    char *args[HOST_CMDLINE_MAX_ARGS + 1];
+    int   argc = 0;
+
+    args[argc++] = cmdline_args[0];
+    for (int i = 1; i < cmdline_argc; i++)
+    {
+        if (((strcmp(cmdline_args[i], "--flash") == 0) || (strcmp(cmdline_args[i], "--time-scale") == 0))
+            && (i + 1 < cmdline_argc))
+        {
+            args[argc++] = cmdline_args[i];
+            args[argc++] = cmdline_args[++i];
+        }
+    }
+    args[argc] = NULL;
+
+    fflush(stdout);
+    flash_driver_host_sync();
+    execv("/proc/self/exe", args);
+    perror("Reset");
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,194 @@
+/**
+ * @file sys_host.c
+ * @brief Emulated system layer of the host build (sys.h and sys_init.h). The cycle counter counts the cycles of the
+ *        84MHz core clock of the target, out of the monotonic clock, so that the timings reported by the bootloader
+ *        (statistics, boot info) are in the same units as on the target. The idle time (sys_delay_ms) receives from
+ *        the uart. The application cannot run on the host: the handoff prints the boot info record and ends the
+ *        process.
+ * @version 0.1
+ * @date 2024-08-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "sys.h"
+#include "sys_init.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host_platform.h"
+#include "boot_info/boot_info.h"
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+static uint64_t sys_start_ns = 0; // Reset of the tick and cycle counters
+
+// clang-format off
+static const char * const sys_boot_stage_names[BOOT_INFO_STAGE_COUNT] = {
+    [BOOT_INFO_STAGE_INIT]      = "init",
+    [BOOT_INFO_STAGE_CRC_CHECK] = "crc check",
+    [BOOT_INFO_STAGE_AUTH]      = "auth",
+    [BOOT_INFO_STAGE_BOOT_APP]  = "boot app",
+    [BOOT_INFO_STAGE_BOOTLOOP]  = "boot loop",
+};
+// clang-format on
+
+// --- variable definitions --------------------------------------------------------------------------------------------
+uint32_t SystemCoreClock = HOST_CORE_CLOCK_HZ;
+
+// --- static function declarations ------------------------------------------------------------------------------------
+static void sys_print_boot_info(uint32_t vector_table_addr);
+
+// --- static function definitions -------------------------------------------------------------------------------------
+/**
+ * @brief Function to print the boot info record, as the application would receive it
+ *
+ * @param vector_table_addr Start of the booted image slot
+ */
+static void
+sys_print_boot_info(uint32_t vector_table_addr)
+{
+    struct boot_info_s const *info = boot_info_get();
+
+    if (info == NULL)
+    {
+        printf("Boot: slot 0x%08X, no valid boot info record\n", (unsigned)vector_table_addr);
+        return;
+    }
+
+    printf("Boot: slot 0x%08X, version %u.%u.%u, path flags 0x%08X\n",
+           (unsigned)vector_table_addr,
+           (unsigned)info->fw_version_major,
+           (unsigned)info->fw_version_minor,
+           (unsigned)info->fw_version_patch,
+           (unsigned)info->path_flags);
+    for (uint32_t stage = 0; stage < BOOT_INFO_STAGE_COUNT; stage++)
+    {
+        if (info->stages_visited & (1UL << stage))
+        {
+            printf("Boot: %-9s at %10u us\n", sys_boot_stage_names[stage], (unsigned)info->stage_entry_us[stage]);
+        }
+    }
+    printf("Boot: handoff   at %10u us\n", (unsigned)info->handoff_us);
+}
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function that encapsulates the system initialization process: the emulated platform (command line, flash)
+ *        and the cycle counter.
+ *
+ */
+void
+sys_init(void)
+{
+    host_platform_init();
+    sys_cycle_counter_init();
+}
+
+/**
+ * @brief Hand over to the application. The application cannot run on the host: its boot info record is printed, and
+ *        the process ends.
+ *
+ * @param vector_table_addr Start of the booted image slot: the vector table of the application
+ */
+void
+sys_prepare_for_application(uint32_t vector_table_addr)
+{
+    sys_print_boot_info(vector_table_addr);
+    fflush(stdout);
+    flash_driver_host_sync();
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Delay function in milliseconds. The delay is the idle time of the bootloader: the uart reception runs.
+ *
+ * @param delay
+ */
+void
+sys_delay_ms(uint32_t delay)
+{
+    uart_driver_host_poll(delay);
+}
+
+/**
+ * @brief Function to get the milliseconds elapsed since the system start.
+ *
+ * @return uint32_t
+ */
+uint32_t
+sys_get_tick_ms(void)
+{
+    return (uint32_t)((host_platform_get_time_ns() - sys_start_ns) / 1000000ULL);
+}
+
+/**
+ * @brief Function to start the cycle counter.
+ *
+ */
+void
+sys_cycle_counter_init(void)
+{
+    sys_start_ns = host_platform_get_time_ns();
+}
+
+/**
+ * @brief Function to get the current value of the cycle counter: the cycles of the core clock since the system start.
+ *        The counter wraps around every 2^32 cycles, as on the target.
+ *
+ * @return uint32_t
+ */
+uint32_t
+sys_get_cycles(void)
+{
+    return (uint32_t)(((host_platform_get_time_ns() - sys_start_ns) * (SystemCoreClock / 1000000)) / 1000ULL);
+}
+
+/**
+ * @brief Function to convert a number of cycles (e.g. the difference of two sys_get_cycles values) to microseconds.
+ *
+ * @param cycles
+ * @return uint32_t
+ */
+uint32_t
+sys_cycles_to_us(uint32_t cycles)
+{
+    return cycles / (SystemCoreClock / 1000000);
+}
+
+/**
+ * @brief Function to get the bus clock frequencies (the clock tree of the target)
+ *
+ * @param hclk_hz
+ * @param pclk1_hz
+ * @param pclk2_hz
+ */
+void
+sys_get_bus_clocks(uint32_t *hclk_hz, uint32_t *pclk1_hz, uint32_t *pclk2_hz)
+{
+    *hclk_hz  = HOST_CORE_CLOCK_HZ;
+    *pclk1_hz = HOST_PCLK1_HZ;
+    *pclk2_hz = HOST_PCLK2_HZ;
+}
+
+/**
+ * @brief Function to set the MSP register. There is no application stack on the host.
+ *
+ * @param addr
+ */
+void
+sys_set_msp(size_t addr)
+{
+    (void)addr;
+}
+
+/**
+ * @brief Function to reset the device (see host_platform_reset). Does not return.
+ *
+ */
+void
+sys_reset(void)
+{
+    host_platform_reset();
+}
@@ -0,0 +1,393 @@
+/**
+ * @file uart_driver_host.c
+ * @brief Emulated uart of the host build: a pseudo terminal, whose path is printed at startup for the host tools (e.g.
+ *        bootloader_tool.py --port). The reception works as the interrupt driven reception of the target: a frame
+ *        header, then the rest of the frame, then the rx callback. It runs from uart_driver_host_poll (the idle time of
+ *        sys_delay_ms), while the interrupts are not masked. The bytes take their line time at the current baud rate
+ *        (scaled by the time scale option), in both directions.
+ * @version 0.1
+ * @date 2024-08-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define _GNU_SOURCE // posix_openpt, ptsname, cfmakeraw, setenv
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "uart_driver.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "host_platform.h"
+#include "stats/stats.h"
+#include "trace/trace.h"
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#define UART_WDG_TIMEOUT_MS   15000         // Same as the TIM1 watchdog of the target
+#define UART_BITS_PER_BYTE    10            // Start bit, 8 data bits, stop bit
+#define UART_TX_TIMEOUT_MS    100           // With nobody reading the pty, the bytes are dropped (as on an open line)
+#define UART_PTY_ENV_VARIABLE "BL_HOST_PTY" // File descriptors of the pty, inherited across a reset
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+static uint8_t uart_rx_buffer[RX_BUFFER_SIZE_BYTES] = { 0 };
+static struct uart_driver_data_s uart_buf = { .data_buffer = uart_rx_buffer, .len = RX_BUFFER_SIZE_BYTES };
+
+static process_rx_data  data_rx_cb        = NULL;
+static get_rx_frame_len frame_len_cb      = NULL;
+static uint16_t         rx_header_len     = RX_BUFFER_SIZE_BYTES;
+static bool             is_rx_in_header   = true; // True while receiving the frame header, false for the body
+static uint16_t         rx_received_bytes = 0;    // Bytes of the frame received so far
+static uint32_t         uart_baudrate     = UART_DEFAULT_BAUDRATE;
+static uint64_t         wdg_feed_ns       = 0;
+
+static int pty_master_fd = -1;
+static int pty_slave_fd  = -1; // Kept open, so that the pty outlives the sessions of the host tools
+
+// --- static function declarations ------------------------------------------------------------------------------------
+static void     uart_rx_start_header(void);
+static void     uart_rx_complete(void);
+static bool     uart_driver_open_pty(void);
+static uint64_t uart_driver_line_time_ns(uint32_t length);
+
+// --- static function definitions -------------------------------------------------------------------------------------
+/**
+ * @brief Function to (re)start the reception of a new frame, by receiving its header.
+ *
+ */
+static void
+uart_rx_start_header(void)
+{
+    is_rx_in_header   = true;
+    uart_buf.len      = rx_header_len;
+    rx_received_bytes = 0;
+}
+
+/**
+ * @brief Function called when the expected bytes are received (HAL_UART_RxCpltCallback of the target). When a frame
+ *        header is received, the rest of the frame is requested based on the decoded frame length. When a full frame
+ *        is received, it is processed and the reception restarts from the next frame header.
+ *
+ */
+static void
+uart_rx_complete(void)
+{
+    if (is_rx_in_header && (frame_len_cb != NULL))
+    {
+        uint16_t frame_len = frame_len_cb(uart_buf.data_buffer, rx_header_len);
+        if ((frame_len > rx_header_len) && (frame_len <= RX_BUFFER_SIZE_BYTES))
+        {
+            // Receive the rest of the frame, right after the header
+            is_rx_in_header = false;
+            uart_buf.len    = frame_len;
+            return;
+        }
+
+        if (frame_len != rx_header_len)
+        {
+            // Invalid header: drop it and wait for the next one
+            uart_rx_start_header();
+            return;
+        }
+    }
+
+    // Call the register callback function if it is set
+    if (data_rx_cb != NULL)
+    {
+        data_rx_cb(&uart_buf);
+    }
+    // Restart the reception, from the next frame header
+    uart_rx_start_header();
+}
+
+/**
+ * @brief Function to open the pseudo terminal, or to take over the one of the bootloader before a reset
+ *
+ * @return true
+ * @return false
+ */
+static bool
+uart_driver_open_pty(void)
+{
+    char const *inherited = getenv(UART_PTY_ENV_VARIABLE);
+    if ((inherited != NULL) && (sscanf(inherited, "%d,%d", &pty_master_fd, &pty_slave_fd) == 2)
+        && (fcntl(pty_master_fd, F_GETFD) != -1) && (fcntl(pty_slave_fd, F_GETFD) != -1))
+    {
+        printf("UART: %s (kept across the reset)\n", ptsname(pty_master_fd));
+        fflush(stdout);
+        return true;
+    }
+
+    pty_master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((pty_master_fd < 0) || (grantpt(pty_master_fd) != 0) || (unlockpt(pty_master_fd) != 0))
+    {
+        perror("UART: pty");
+        return false;
+    }
+    pty_slave_fd = open(ptsname(pty_master_fd), O_RDWR | O_NOCTTY);
+    if (pty_slave_fd < 0)
+    {
+        perror("UART: pty");
+        return false;
+    }
+
+    // Raw bytes, no echo: the line discipline of the pty must not touch the frames
+    struct termios tio;
+    tcgetattr(pty_slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(pty_slave_fd, TCSANOW, &tio);
+    fcntl(pty_master_fd, F_SETFL, fcntl(pty_master_fd, F_GETFL) | O_NONBLOCK);
+
+    char fds[32];
+    snprintf(fds, sizeof(fds), "%d,%d", pty_master_fd, pty_slave_fd);
+    setenv(UART_PTY_ENV_VARIABLE, fds, 1);
+
+    printf("UART: %s\n", ptsname(pty_master_fd));
+    fflush(stdout);
+    return true;
+}
+
+/**
+ * @brief Function to get the line time of a number of bytes, at the current baud rate
+ *
+ * @param length
+ * @return uint64_t
+ */
+static uint64_t
+uart_driver_line_time_ns(uint32_t length)
+{
+    return ((uint64_t)length * UART_BITS_PER_BYTE * 1000000000ULL) / uart_baudrate;
+}
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to initialize the emulated uart: open the pseudo terminal and start the reception.
+ *
+ */
+void
+uart_driver_init(void)
+{
+    if (!uart_driver_open_pty())
+    {
+        TRACE_LOG("Error initializing uart\n");
+        return;
+    }
+    uart_rx_start_header(); // Start reception
+    uart_driver_feed_wdg();
+}
+
+/**
+ * @brief Function to register an rx callback function. This will be used by the com_protocol to register a callback
+ *        function and process the received message.
+ *
+ */
+void
+uart_driver_register_rx_callback(process_rx_data rx_cb)
+{
+    data_rx_cb = rx_cb;
+}
+
+/**
+ * @brief Function to register the callback that decodes the length of a frame, out of its header. This must be
+ *        registered before the uart reception is started.
+ *
+ */
+void
+uart_driver_register_rx_frame_len_callback(get_rx_frame_len frame_len_cb_in, uint16_t header_len)
+{
+    if ((header_len == 0) || (header_len > RX_BUFFER_SIZE_BYTES))
+    {
+        return;
+    }
+
+    frame_len_cb  = frame_len_cb_in;
+    rx_header_len = header_len;
+}
+
+/**
+ * @brief Function to transmit a buffer of data via the pseudo terminal. Blocking, for the line time of the data.
+ *
+ * @param buffer The data buffer to be transmitted.
+ * @param length The length of the data buffer.
+ * @return none.
+ */
+void
+uart_tx_data(uint8_t *buffer, uint16_t length)
+{
+    uint16_t sent = 0;
+
+    while ((pty_master_fd >= 0) && (sent < length))
+    {
+        ssize_t written = write(pty_master_fd, buffer + sent, length - sent);
+        if (written > 0)
+        {
+            sent += (uint16_t)written;
+            continue;
+        }
+
+        struct pollfd pfd = { .fd = pty_master_fd, .events = POLLOUT };
+        if ((written < 0) && ((errno == EINTR) || ((errno == EAGAIN) && (poll(&pfd, 1, UART_TX_TIMEOUT_MS) > 0))))
+        {
+            continue;
+        }
+        break;
+    }
+    host_platform_model_delay_ns(uart_driver_line_time_ns(length));
+}
+
+/**
+ * @brief Function to receive from the pseudo terminal, for the given time (the idle time of the bootloader). The
+ *        received frames are processed as soon as they are complete, unless the interrupts are masked. Stands in for
+ *        the uart and TIM1 interrupts of the target.
+ *
+ * @param timeout_ms
+ */
+void
+uart_driver_host_poll(uint32_t timeout_ms)
+{
+    uint64_t deadline_ns = host_platform_get_time_ns() + ((uint64_t)timeout_ms * 1000000ULL);
+
+    for (uint64_t now_ns = host_platform_get_time_ns(); now_ns < deadline_ns; now_ns = host_platform_get_time_ns())
+    {
+        int wait_ms = (int)((deadline_ns - now_ns + 999999ULL) / 1000000ULL);
+
+        if ((pty_master_fd < 0) || (host_platform_get_primask() != 0))
+        {
+            poll(NULL, 0, wait_ms);
+            continue;
+        }
+
+        // The uart watchdog expires after UART_WDG_TIMEOUT_MS without reception
+        if ((now_ns - wdg_feed_ns) >= ((uint64_t)UART_WDG_TIMEOUT_MS * 1000000ULL))
+        {
+            uart_driver_rx_recover();
+            uart_driver_feed_wdg();
+            continue;
+        }
+
+        struct pollfd pfd = { .fd = pty_master_fd, .events = POLLIN };
+        if (poll(&pfd, 1, wait_ms) <= 0)
+        {
+            continue;
+        }
+
+        // Only the bytes that the ongoing reception expects are read: the rest wait in the pty (on the line)
+        ssize_t received
+            = read(pty_master_fd, uart_buf.data_buffer + rx_received_bytes, uart_buf.len - rx_received_bytes);
+        if (received <= 0)
+        {
+            continue;
+        }
+        uart_driver_feed_wdg();
+        host_platform_model_delay_ns(uart_driver_line_time_ns((uint32_t)received));
+        rx_received_bytes += (uint16_t)received;
+        if (rx_received_bytes == uart_buf.len)
+        {
+            uart_rx_complete();
+        }
+    }
+}
+
+// --- application specific functions ----------------------------------------------------------------------------------
+/**
+ * @brief Function to feed the uart watchdog. Called every time something is being received.
+ *
+ */
+void
+uart_driver_feed_wdg(void)
+{
+    wdg_feed_ns = host_platform_get_time_ns();
+}
+
+/**
+ * @brief Function to recover the uart reception.
+ *
+ */
+void
+uart_driver_rx_recover(void)
+{
+    // Only count the recoveries that drop a partially received frame (the watchdog also expires on an idle line)
+    if (!is_rx_in_header || (rx_received_bytes != 0))
+    {
+        stats_inc(STATS_COUNTER_UART_RECOVERY);
+    }
+    // Restart the reception, from a frame header
+    uart_rx_start_header();
+}
+
+/**
+ * @brief Function to get the highest baud rate the uart can run at: PCLK1 / 8, as USART2 of the target.
+ *
+ * @return uint32_t The max baud rate.
+ */
+uint32_t
+uart_driver_get_max_baudrate(void)
+{
+    return HOST_PCLK1_HZ / 8;
+}
+
+/**
+ * @brief Function to get the baud rate the uart currently runs at.
+ *
+ * @return uint32_t The current baud rate.
+ */
+uint32_t
+uart_driver_get_baudrate(void)
+{
+    return uart_baudrate;
+}
+
+/**
+ * @brief Function to check if the uart can run at the given baud rate, with the BRR register of the target (8x
+ *        oversampling) and its clock tree.
+ *
+ * @param baudrate
+ * @return true
+ * @return false
+ */
+bool
+uart_driver_is_baudrate_supported(uint32_t baudrate)
+{
+    uint32_t pclk = HOST_PCLK1_HZ;
+
+    if ((baudrate == 0) || (baudrate > uart_driver_get_max_baudrate()))
+    {
+        return false;
+    }
+
+    // With 8x oversampling, BRR holds USARTDIV in 1/8 steps: baud = pclk / (8 * USARTDIV) = pclk / div
+    uint32_t div    = (pclk + (baudrate / 2)) / baudrate;
+    uint32_t actual = pclk / div;
+    uint32_t error  = (actual > baudrate) ? (actual - baudrate) : (baudrate - actual);
+
+    return ((error * 1000) <= (baudrate * UART_BAUDRATE_MAX_ERROR_PERMILLE));
+}
+
+/**
+ * @brief Function to switch the uart to a new baud rate. Any ongoing reception is dropped and restarts from a frame
+ *        header. The pty itself has no baud rate: the new one sets the line time of the bytes.
+ *
+ * @param baudrate The new baud rate.
+ * @return true If the uart runs at the new baud rate.
+ * @return false If the baud rate is not supported. The uart keeps running at the current baud rate.
+ */
+bool
+uart_driver_set_baudrate(uint32_t baudrate)
+{
+    if (!uart_driver_is_baudrate_supported(baudrate))
+    {
+        return false;
+    }
+
+    uart_baudrate = baudrate;
+    uart_rx_start_header();
+
+    return true;
+}
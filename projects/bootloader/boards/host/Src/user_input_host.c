@@ -0,0 +1,23 @@
+/**
+ * @file user_input_host.c
+ * @brief Emulated user input of the host build: the recovery button is pressed when the bootloader is started with
+ *        --recovery. It is released after a reset.
+ * @version 0.1
+ * @date 2024-08-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "user_input.h"
+
+#include <stdbool.h>
+#include "host_platform.h"
+
+// --- function definitions --------------------------------------------------------------------------------------------
+bool
+user_input_is_pressed(void)
+{
+    return host_platform_get_options()->is_recovery;
+}
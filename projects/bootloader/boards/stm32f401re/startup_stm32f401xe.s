@@ -78,6 +78,23 @@ LoopCopyDataInit:
   adds r4, r0, r3
   cmp r4, r1
   bcc CopyDataInit
+
+/* Copy the code executed from SRAM (.ramfunc) from flash to SRAM */
+  ldr r0, =_sramfunc
+  ldr r1, =_eramfunc
+  ldr r2, =_siramfunc
+  movs r3, #0
+  b LoopCopyRamfuncInit
+
+CopyRamfuncInit:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyRamfuncInit:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyRamfuncInit
   
 /* Zero fill the bss segment. */
   ldr r2, =_sbss
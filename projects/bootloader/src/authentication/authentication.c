@@ -19,6 +19,12 @@
 #include "ecdsa_pub_key.h"
 #include "uECC.h"
 #include "sha256.h"
+#include "stats/stats.h"
+#include "profiling/profiling.h"
+#include "decompress/lz_decompress.h"
+#include "crc/crc_driver.h"
+#include "trace/trace.h"
+#include "merkle.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -28,10 +34,120 @@
 // --- external variables ----------------------------------------------------------------------------------------------
 extern const uint8_t ecdsa_public_key[];
 
+// --- structs ---------------------------------------------------------------------------------------------------------
+/**
+ * @brief Digests of a decompressed image, computed on the fly
+ *
+ */
+struct decompressed_digest_s
+{
+    SHA256_CTX sha_ctx;
+    uint32_t   crc;
+};
+
+// --- static function declarations ------------------------------------------------------------------------------------
+static bool verify_image_digest(const BYTE hash[SHA256_BLOCK_SIZE], const uint8_t *signature);
+static bool decompressed_digest_sink(void *sink_ctx, uint8_t const *data, uint32_t len);
+static bool authenticate_merkle_tree(struct merkle_tree_s const *tree, const uint8_t *signature);
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+static BYTE last_image_digest[SHA256_BLOCK_SIZE]; // SHA-256 of the last image that was authenticated
+// Merkle image root of the last image whose signature was valid, so that the signature of an image is verified once
+// when its chunks are checked region by region (authenticate_application_region)
+static BYTE verified_image_root[MERKLE_HASH_SIZE];
+static bool is_image_root_verified = false;
+
+// --- static function definitions -------------------------------------------------------------------------------------
+/**
+ * @brief Function to verify the ECDSA signature of an image digest. The digest is kept as the last image digest.
+ *
+ * @param hash SHA-256 digest of the image
+ * @param signature
+ * @return true The signature is valid.
+ * @return false The signature is invalid.
+ */
+static bool
+verify_image_digest(const BYTE hash[SHA256_BLOCK_SIZE], const uint8_t *signature)
+{
+    memcpy(last_image_digest, hash, sizeof(last_image_digest));
+
+    // First check if public key is valid
+    uint32_t stats_start = stats_timer_start();
+    if (!uECC_valid_public_key(ecdsa_public_key, uECC_secp256r1()))
+    {
+        stats_timer_stop(STATS_TIMER_ECDSA, PROF_REGION_ECDSA_VERIFY, stats_start);
+        return false;
+    }
+
+    // Verify the signature using the ECDSA algorithm
+    int ret = uECC_verify(ecdsa_public_key, hash, SHA256_BLOCK_SIZE, signature, uECC_secp256r1());
+    stats_timer_stop(STATS_TIMER_ECDSA, PROF_REGION_ECDSA_VERIFY, stats_start);
+
+    // True if the signature is valid
+    return ret == 1;
+}
+
+/**
+ * @brief Decompression sink: hashes the decompressed image
+ *
+ * @param sink_ctx struct decompressed_digest_s
+ * @param data
+ * @param len
+ * @return true
+ */
+static bool
+decompressed_digest_sink(void *sink_ctx, uint8_t const *data, uint32_t len)
+{
+    struct decompressed_digest_s *digest = sink_ctx;
+
+    uint32_t stats_start = stats_timer_start();
+    sha256_update(&digest->sha_ctx, data, len);
+    stats_timer_stop(STATS_TIMER_SHA, PROF_REGION_SHA256, stats_start);
+    digest->crc = crc32_driver_update(digest->crc, data, len);
+
+    return true;
+}
+
+/**
+ * @brief Function to verify an image that has a Merkle tree: the image root (tree root and image index) is
+ *        authenticated first, then the stored tree and every chunk are checked against it. Stops at the first mismatch.
+ *
+ * @param tree
+ * @param signature
+ * @return true
+ * @return false
+ */
+static bool
+authenticate_merkle_tree(struct merkle_tree_s const *tree, const uint8_t *signature)
+{
+    uint8_t image_root[MERKLE_HASH_SIZE];
+
+    merkle_get_image_root(tree, image_root);
+    if (!verify_image_digest(image_root, signature) || !merkle_check_nodes(tree))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < tree->leaf_count; i++)
+    {
+        if (!merkle_check_chunk(tree, i))
+        {
+            TRACE_LOG("Merkle chunk %" PRIu32 " mismatch (0x%08" PRIX32 ")\r\n",
+                      i,
+                      tree->image_start_addr + i * MERKLE_CHUNK_SIZE);
+            return false;
+        }
+    }
+
+    memcpy(verified_image_root, image_root, sizeof(verified_image_root));
+    is_image_root_verified = true;
+    return true;
+}
+
 // --- function definitions --------------------------------------------------------------------------------------------
 /**
  * @brief Function to verify the signature of the application image. The signature is verified using the ECDSA
- * algorithm.
+ * algorithm. For an image with a Merkle tree, the signature covers the image root (tree root and image index).
  *
  * @param app_image_start_addr The start address of the application image.
  * @param app_image_size_bytes The size of the application image in bytes.
@@ -43,26 +159,146 @@ extern const uint8_t ecdsa_public_key[];
 bool
 authenticate_application(uint32_t app_image_start_addr, uint32_t app_image_size_bytes, const uint8_t *signature)
 {
+    struct merkle_tree_s tree;
+
+    PROF_BEGIN(auth);
+    if (merkle_get_tree(app_image_start_addr, app_image_size_bytes, &tree))
+    {
+        bool ret = authenticate_merkle_tree(&tree, signature);
+        PROF_END(auth, PROF_REGION_AUTHENTICATE);
+        return ret;
+    }
 
     // Calculate the SHA-256 hash of the application image
     SHA256_CTX ctx;
     BYTE       hash[SHA256_BLOCK_SIZE];
 
+    uint32_t stats_start = stats_timer_start();
     sha256_init(&ctx);
-    sha256_update(&ctx, (const BYTE *)app_image_start_addr, app_image_size_bytes);
+    sha256_update(&ctx, (const BYTE *)(uintptr_t)app_image_start_addr, app_image_size_bytes);
     sha256_final(&ctx, hash);
+    stats_timer_stop(STATS_TIMER_SHA, PROF_REGION_SHA256, stats_start);
 
-    // First check if public key is valid
-    if (!uECC_valid_public_key(ecdsa_public_key, uECC_secp256r1()))
+    bool ret = verify_image_digest(hash, signature);
+    PROF_END(auth, PROF_REGION_AUTHENTICATE);
+
+    return ret;
+}
+
+/**
+ * @brief Function to verify a region of an image that has a Merkle tree, e.g. a region that is copied to the download
+ * space (FWUG_COPY). Only the chunks that overlap the region are hashed, with their path to the root: the rest of the
+ * image is not read. The signature is verified once per image root.
+ *
+ * @param app_image_start_addr The start address of the application image.
+ * @param app_image_size_bytes The size of the application image in bytes.
+ * @param signature The signature of the application image.
+ * @param region_offset The start of the region, from the image start.
+ * @param region_size The size of the region in bytes.
+ *
+ * @return true The signature is valid, and so are the chunks of the region.
+ * @return false Otherwise, or if the image has no Merkle tree (it can only be verified as a whole).
+ */
+bool
+authenticate_application_region(uint32_t       app_image_start_addr,
+                                uint32_t       app_image_size_bytes,
+                                const uint8_t *signature,
+                                uint32_t       region_offset,
+                                uint32_t       region_size)
+{
+    struct merkle_tree_s tree;
+    uint8_t              image_root[MERKLE_HASH_SIZE];
+
+    if (!merkle_get_tree(app_image_start_addr, app_image_size_bytes, &tree))
     {
         return false;
     }
 
-    // Verify the signature using the ECDSA algorithm
-    int ret = uECC_verify(ecdsa_public_key, hash, sizeof(hash), signature, uECC_secp256r1());
+    PROF_BEGIN(auth);
+    merkle_get_image_root(&tree, image_root);
+    bool ret = is_image_root_verified && (memcmp(image_root, verified_image_root, sizeof(image_root)) == 0);
+    if (!ret && verify_image_digest(image_root, signature))
+    {
+        memcpy(verified_image_root, image_root, sizeof(verified_image_root));
+        is_image_root_verified = true;
+        ret                    = true;
+    }
 
-    // True if the signature is valid
-    return ret == 1;
+    // The image index is covered by the image root. The stored nodes are only checked if the region holds them.
+    uint32_t const region_end = region_offset + region_size;
+    if (ret && (region_end > tree.tree_offset) && (region_offset < tree.tree_end))
+    {
+        ret = merkle_check_nodes(&tree);
+    }
+    for (uint32_t offset = region_offset - (region_offset % MERKLE_CHUNK_SIZE);
+         ret && (offset < region_end) && (offset < tree.tree_offset);
+         offset += MERKLE_CHUNK_SIZE)
+    {
+        ret = merkle_check_chunk_path(&tree, offset / MERKLE_CHUNK_SIZE);
+    }
+    PROF_END(auth, PROF_REGION_AUTHENTICATE);
+
+    return ret;
+}
+
+/**
+ * @brief Function to verify the signature of a compressed application image. The image is decompressed on the fly, to
+ * compute its SHA-256 digest and CRC32: it is verified before it is installed.
+ *
+ * @param slot_start_addr The start address of the slot, that holds the compressed image.
+ * @param slot_size_bytes The size of the slot (including the footer).
+ * @param image_crc The CRC32 of the decompressed image.
+ * @param signature The signature of the decompressed image.
+ *
+ * @return true The image decompresses, its CRC32 matches and the signature is valid.
+ * @return false Otherwise.
+ */
+bool
+authenticate_compressed_application(uint32_t       slot_start_addr,
+                                    uint32_t       slot_size_bytes,
+                                    uint32_t       image_crc,
+                                    const uint8_t *signature)
+{
+    struct lz_image_header_s const *header = lz_image_get_header(slot_start_addr, slot_size_bytes);
+    struct decompressed_digest_s    digest = { .crc = 0 };
+    BYTE                            hash[SHA256_BLOCK_SIZE];
+
+    if (header == NULL)
+    {
+        return false;
+    }
+
+    PROF_BEGIN(auth);
+    sha256_init(&digest.sha_ctx);
+    bool ret = lz_decompress((uint8_t const *)(header + 1),
+                             header->compressed_size,
+                             header->image_size,
+                             decompressed_digest_sink,
+                             &digest);
+    sha256_final(&digest.sha_ctx, hash);
+    if (!ret || (digest.crc != image_crc))
+    {
+        PROF_END(auth, PROF_REGION_AUTHENTICATE);
+        return false;
+    }
+
+    ret = verify_image_digest(hash, signature);
+    PROF_END(auth, PROF_REGION_AUTHENTICATE);
+
+    return ret;
+}
+
+/**
+ * @brief Function to get the SHA-256 digest of the last image that authenticate_application processed (whether the
+ * signature was valid or not), or its Merkle image root. Used to hand the digest over to the application, so that
+ * it does not recompute it.
+ *
+ * @return const uint8_t* The SHA-256 digest (32 bytes).
+ */
+const uint8_t *
+get_last_image_digest(void)
+{
+    return last_image_digest;
 }
 
 /**
@@ -20,7 +20,7 @@
 // --- function declarations -------------------------------------------------------------------------------------------
 /**
  * @brief Function to verify the signature of the application image. The signature is verified using the ECDSA
- * algorithm.
+ * algorithm. For an image with a Merkle tree (see merkle.h), the signature covers the image root.
  *
  * @param app_image_start_addr: The start address of the application image.
  * @param app_image_size_bytes: The size of the application image in bytes.
@@ -33,6 +33,52 @@ bool authenticate_application(uint32_t       app_image_start_addr,
                               uint32_t       app_image_size_bytes,
                               const uint8_t *der_signature);
 
+/**
+ * @brief Function to verify a region of an application image that has a Merkle tree (e.g. a region that is copied),
+ *        without reading the rest of the image: only the chunks of the region and their path to the root are hashed.
+ *        The signature is verified once per image root.
+ *
+ * @param app_image_start_addr: The start address of the application image.
+ * @param app_image_size_bytes: The size of the application image in bytes.
+ * @param signature: The signature of the application image.
+ * @param region_offset: The start of the region, from the image start.
+ * @param region_size: The size of the region in bytes.
+ *
+ * @return true: The signature is valid, and so are the chunks of the region.
+ * @return false: Otherwise, or if the image has no Merkle tree.
+ */
+bool authenticate_application_region(uint32_t       app_image_start_addr,
+                                     uint32_t       app_image_size_bytes,
+                                     const uint8_t *signature,
+                                     uint32_t       region_offset,
+                                     uint32_t       region_size);
+
+/**
+ * @brief Function to verify the signature of a compressed application image (compressed secondary slot). The image is
+ *        decompressed on the fly (not stored): the SHA-256 digest and the CRC32 are computed over the decompressed
+ *        image.
+ *
+ * @param slot_start_addr: The start address of the slot, that holds the compressed image.
+ * @param slot_size_bytes: The size of the slot (including the footer).
+ * @param image_crc: The CRC32 of the decompressed image (footer).
+ * @param signature: The signature of the decompressed image (footer).
+ *
+ * @return true: The image decompresses, its CRC32 matches and the signature is valid.
+ * @return false: Otherwise.
+ */
+bool authenticate_compressed_application(uint32_t       slot_start_addr,
+                                         uint32_t       slot_size_bytes,
+                                         uint32_t       image_crc,
+                                         const uint8_t *signature);
+
+/**
+ * @brief Function to get the SHA-256 digest (or the Merkle image root) of the last image processed by
+ *        authenticate_application.
+ *
+ * @return uint8_t*: The SHA-256 digest (32 bytes).
+ */
+const uint8_t *get_last_image_digest(void);
+
 /**
  * @brief Function to get the public key used for verifying the signature of the application image. The public key is
  *        stored in the bootloader.
@@ -0,0 +1,360 @@
+/**
+ * @file merkle.c
+ * @brief Merkle tree of an application image (see merkle.h).
+ * @version 0.1
+ * @date 2024-08-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "merkle.h"
+
+#include <stddef.h>
+#include <string.h>
+#include "sha256.h"
+#include "stats/stats.h"
+#include "image_index/image_index.h"
+#include "trace/trace.h"
+
+// --- static function declarations ------------------------------------------------------------------------------------
+static uint32_t       merkle_get_node_count(uint32_t leaf_count);
+static uint8_t const *merkle_get_erased_leaf(void);
+static bool           merkle_is_chunk_erased(uint32_t chunk_addr);
+static void           merkle_hash_chunk(struct merkle_tree_s const *tree, uint32_t chunk_index, uint8_t *hash);
+static void           merkle_hash_node(uint8_t const *left, uint8_t const *right, uint8_t *hash);
+
+// --- static function definitions -------------------------------------------------------------------------------------
+/**
+ * @brief Function to get the number of nodes of a tree (leaves and root included)
+ *
+ * @param leaf_count
+ * @return uint32_t
+ */
+static uint32_t
+merkle_get_node_count(uint32_t leaf_count)
+{
+    uint32_t node_count = leaf_count;
+
+    while (leaf_count > 1)
+    {
+        leaf_count = (leaf_count + 1) / 2;
+        node_count += leaf_count;
+    }
+
+    return node_count;
+}
+
+/**
+ * @brief Function to get the leaf of an erased chunk (MERKLE_CHUNK_SIZE bytes of 0xFF). It is hashed once.
+ *
+ * @return uint8_t const* MERKLE_HASH_SIZE bytes
+ */
+static uint8_t const *
+merkle_get_erased_leaf(void)
+{
+    static uint8_t erased_leaf[MERKLE_HASH_SIZE];
+    static bool    is_erased_leaf_set = false;
+
+    if (!is_erased_leaf_set)
+    {
+        BYTE const prefix = MERKLE_LEAF_PREFIX;
+        BYTE       erased[64];
+        SHA256_CTX ctx;
+
+        memset(erased, 0xFF, sizeof(erased));
+        uint32_t stats_start = stats_timer_start();
+        sha256_init(&ctx);
+        sha256_update(&ctx, &prefix, sizeof(prefix));
+        for (uint32_t i = 0; i < (MERKLE_CHUNK_SIZE / sizeof(erased)); i++)
+        {
+            sha256_update(&ctx, erased, sizeof(erased));
+        }
+        sha256_final(&ctx, erased_leaf);
+        stats_timer_stop(STATS_TIMER_SHA, PROF_REGION_SHA256, stats_start);
+        is_erased_leaf_set = true;
+    }
+
+    return erased_leaf;
+}
+
+/**
+ * @brief Function to check if a whole chunk is erased. Stops at the first programmed word.
+ *
+ * @param chunk_addr Address of the chunk (word aligned)
+ * @return true
+ * @return false
+ */
+static bool
+merkle_is_chunk_erased(uint32_t chunk_addr)
+{
+    uint32_t const *word = (uint32_t const *)(uintptr_t)chunk_addr;
+
+    for (uint32_t i = 0; i < (MERKLE_CHUNK_SIZE / sizeof(uint32_t)); i++)
+    {
+        if (word[i] != 0xFFFFFFFF)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Function to hash a chunk of the image (leaf). Most of a slot is erased: an erased chunk is only read, and gets
+ *        the leaf of an erased chunk, instead of being hashed.
+ *
+ * @param tree
+ * @param chunk_index
+ * @param hash MERKLE_HASH_SIZE bytes
+ */
+static void
+merkle_hash_chunk(struct merkle_tree_s const *tree, uint32_t chunk_index, uint8_t *hash)
+{
+    BYTE const       prefix      = MERKLE_LEAF_PREFIX;
+    uint32_t const   chunk_start = chunk_index * MERKLE_CHUNK_SIZE;
+    uint32_t         chunk_size  = tree->tree_offset - chunk_start;
+    SHA256_CTX       ctx;
+
+    if (chunk_size >= MERKLE_CHUNK_SIZE)
+    {
+        chunk_size = MERKLE_CHUNK_SIZE;
+        if (merkle_is_chunk_erased(tree->image_start_addr + chunk_start))
+        {
+            memcpy(hash, merkle_get_erased_leaf(), MERKLE_HASH_SIZE);
+            return;
+        }
+    }
+
+    uint32_t stats_start = stats_timer_start();
+    sha256_init(&ctx);
+    sha256_update(&ctx, &prefix, sizeof(prefix));
+    sha256_update(&ctx, (BYTE const *)(uintptr_t)(tree->image_start_addr + chunk_start), chunk_size);
+    sha256_final(&ctx, hash);
+    stats_timer_stop(STATS_TIMER_SHA, PROF_REGION_SHA256, stats_start);
+}
+
+/**
+ * @brief Function to hash two sibling nodes to their parent node
+ *
+ * @param left
+ * @param right
+ * @param hash MERKLE_HASH_SIZE bytes
+ */
+static void
+merkle_hash_node(uint8_t const *left, uint8_t const *right, uint8_t *hash)
+{
+    BYTE const prefix = MERKLE_NODE_PREFIX;
+    SHA256_CTX ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, &prefix, sizeof(prefix));
+    sha256_update(&ctx, left, MERKLE_HASH_SIZE);
+    sha256_update(&ctx, right, MERKLE_HASH_SIZE);
+    sha256_final(&ctx, hash);
+}
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to find the Merkle tree of an image. The tree ends where the image index starts (or at the end of
+ *        the image, if it has no index). Only the layout is validated, not the hashes.
+ *
+ * @param image_start_addr
+ * @param image_size_bytes Size of the image, without the footer
+ * @param tree Set to the tree of the image
+ * @return true The image has a tree.
+ * @return false
+ */
+bool
+merkle_get_tree(uint32_t image_start_addr, uint32_t image_size_bytes, struct merkle_tree_s *tree)
+{
+    uint32_t                          index_chunk_count = 0;
+    struct image_index_chunk_s const *index = image_index_get(image_start_addr, image_size_bytes, &index_chunk_count);
+    uint32_t const tree_end = (index != NULL) ? ((uint32_t)(uintptr_t)index - image_start_addr) : image_size_bytes;
+
+    if (tree_end < sizeof(struct merkle_trailer_s))
+    {
+        return false;
+    }
+
+    struct merkle_trailer_s const *trailer
+        = (struct merkle_trailer_s const *)(image_start_addr + tree_end - sizeof(struct merkle_trailer_s));
+    if ((trailer->magic != MERKLE_MAGIC) || (trailer->chunk_size != MERKLE_CHUNK_SIZE) || (trailer->leaf_count == 0)
+        || (trailer->leaf_count > MERKLE_MAX_LEAVES))
+    {
+        return false;
+    }
+
+    // The chunks must cover the image up to the tree: only the last chunk can be shorter
+    uint32_t const node_count = merkle_get_node_count(trailer->leaf_count);
+    uint32_t const tree_size  = node_count * MERKLE_HASH_SIZE + sizeof(struct merkle_trailer_s);
+    if ((tree_size > tree_end) || ((tree_end - tree_size) <= ((trailer->leaf_count - 1) * MERKLE_CHUNK_SIZE))
+        || ((tree_end - tree_size) > (trailer->leaf_count * MERKLE_CHUNK_SIZE)))
+    {
+        return false;
+    }
+
+    tree->image_start_addr = image_start_addr;
+    tree->tree_offset      = tree_end - tree_size;
+    tree->tree_end         = tree_end;
+    tree->image_size       = image_size_bytes;
+    tree->leaf_count       = trailer->leaf_count;
+    tree->node_count       = node_count;
+    tree->nodes            = (uint8_t const *)(uintptr_t)(image_start_addr + tree->tree_offset);
+    return true;
+}
+
+/**
+ * @brief Function to get the root of a tree (stored in the image)
+ *
+ * @param tree
+ * @return uint8_t const* MERKLE_HASH_SIZE bytes
+ */
+uint8_t const *
+merkle_get_root(struct merkle_tree_s const *tree)
+{
+    return &tree->nodes[(tree->node_count - 1) * MERKLE_HASH_SIZE];
+}
+
+/**
+ * @brief Function to compute the image root: the node of the tree root and of the leaf of the rest of the image (the
+ *        image index, or nothing for an image without an index). This is the digest that the image signature covers.
+ *
+ * @param tree
+ * @param image_root MERKLE_HASH_SIZE bytes
+ */
+void
+merkle_get_image_root(struct merkle_tree_s const *tree, uint8_t *image_root)
+{
+    BYTE const prefix = MERKLE_LEAF_PREFIX;
+    uint8_t    tail_hash[MERKLE_HASH_SIZE];
+    SHA256_CTX ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, &prefix, sizeof(prefix));
+    sha256_update(&ctx,
+                  (BYTE const *)(uintptr_t)(tree->image_start_addr + tree->tree_end),
+                  tree->image_size - tree->tree_end);
+    sha256_final(&ctx, tail_hash);
+    merkle_hash_node(merkle_get_root(tree), tail_hash, image_root);
+}
+
+/**
+ * @brief Function to check that every node of the stored tree is the hash of its children, up to the root. The leaves
+ *        are not checked against the chunks. Stops at the first mismatch.
+ *
+ * @param tree
+ * @return true
+ * @return false
+ */
+bool
+merkle_check_nodes(struct merkle_tree_s const *tree)
+{
+    uint8_t  hash[MERKLE_HASH_SIZE];
+    uint32_t level_start = 0;
+    uint32_t level_size  = tree->leaf_count;
+
+    while (level_size > 1)
+    {
+        uint8_t const *level  = &tree->nodes[level_start * MERKLE_HASH_SIZE];
+        uint8_t const *parent = &tree->nodes[(level_start + level_size) * MERKLE_HASH_SIZE];
+
+        for (uint32_t i = 0; i < level_size; i += 2)
+        {
+            if ((i + 1) < level_size)
+            {
+                merkle_hash_node(&level[i * MERKLE_HASH_SIZE], &level[(i + 1) * MERKLE_HASH_SIZE], hash);
+            }
+            else
+            {
+                memcpy(hash, &level[i * MERKLE_HASH_SIZE], MERKLE_HASH_SIZE);
+            }
+
+            if (memcmp(hash, &parent[(i / 2) * MERKLE_HASH_SIZE], MERKLE_HASH_SIZE) != 0)
+            {
+                TRACE_LOG("Merkle node mismatch: level offset %" PRIu32 ", node %" PRIu32 "\r\n",
+                          level_start + level_size,
+                          i / 2);
+                return false;
+            }
+        }
+
+        level_start += level_size;
+        level_size = (level_size + 1) / 2;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Function to check a chunk against its stored leaf. The chunk is authentic only if the stored nodes were
+ *        checked (merkle_check_nodes) and the root was authenticated. Used to check every chunk of an image.
+ *
+ * @param tree
+ * @param chunk_index
+ * @return true
+ * @return false
+ */
+bool
+merkle_check_chunk(struct merkle_tree_s const *tree, uint32_t chunk_index)
+{
+    uint8_t hash[MERKLE_HASH_SIZE];
+
+    if (chunk_index >= tree->leaf_count)
+    {
+        return false;
+    }
+
+    merkle_hash_chunk(tree, chunk_index, hash);
+    return memcmp(hash, &tree->nodes[chunk_index * MERKLE_HASH_SIZE], MERKLE_HASH_SIZE) == 0;
+}
+
+/**
+ * @brief Function to check a chunk through its path to the root: only the chunk and the nodes on its path are hashed,
+ *        with the siblings taken from the stored tree. The rest of the tree does not need to be checked: the chunk is
+ *        authentic if the root was authenticated. Used to check a few chunks of an image.
+ *
+ * @param tree
+ * @param chunk_index
+ * @return true
+ * @return false
+ */
+bool
+merkle_check_chunk_path(struct merkle_tree_s const *tree, uint32_t chunk_index)
+{
+    uint8_t  hash[MERKLE_HASH_SIZE];
+    uint32_t node_index  = chunk_index;
+    uint32_t level_start = 0;
+    uint32_t level_size  = tree->leaf_count;
+
+    if (chunk_index >= tree->leaf_count)
+    {
+        return false;
+    }
+
+    merkle_hash_chunk(tree, chunk_index, hash);
+    while (level_size > 1)
+    {
+        uint32_t const sibling_index = node_index ^ 1;
+        if (sibling_index < level_size)
+        {
+            uint8_t const *sibling = &tree->nodes[(level_start + sibling_index) * MERKLE_HASH_SIZE];
+            if (node_index & 1)
+            {
+                merkle_hash_node(sibling, hash, hash);
+            }
+            else
+            {
+                merkle_hash_node(hash, sibling, hash);
+            }
+        }
+
+        level_start += level_size;
+        level_size = (level_size + 1) / 2;
+        node_index /= 2;
+    }
+
+    return memcmp(hash, merkle_get_root(tree), MERKLE_HASH_SIZE) == 0;
+}
@@ -0,0 +1,74 @@
+/**
+ * @file merkle.h
+ * @brief Merkle tree of an application image. The image is split in MERKLE_CHUNK_SIZE chunks: the leaves are the
+ *        SHA-256 of the chunks, and each node is the SHA-256 of its two children (a node without a sibling is carried
+ *        to the next level as is). A chunk can be verified on its own: against its leaf once the stored nodes are
+ *        checked, or through its path to the root. The tree is created by scripts/build_tools/create_dfu_image.py.
+ *
+ *        The ECDSA signature of the footer covers the image root: the node of the tree root and of a leaf over the rest
+ *        of the image (the image index). The index cannot be a chunk of the tree, since it holds the CRC32 of the image
+ *        up to itself, tree included: it is hashed after the tree instead.
+ *
+ *        Image layout (slot, without the footer):
+ *        | chunk 0 | ... | chunk n-1 | nodes (leaves first, level by level, root last) | struct merkle_trailer_s |
+ *        | image index (see image_index.h) |
+ *        The chunks cover the image up to the tree (the last chunk can be shorter). The leaves and the nodes are
+ *        prefixed (MERKLE_LEAF_PREFIX, MERKLE_NODE_PREFIX) before they are hashed, so a node cannot pass as a chunk.
+ * @version 0.1
+ * @date 2024-08-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef MERKLE_H
+#define MERKLE_H
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#define MERKLE_MAGIC       0x4C4B524D // "MRKL"
+#define MERKLE_CHUNK_SIZE  4096       // Must match create_dfu_image.py
+#define MERKLE_MAX_LEAVES  128        // 512K image
+#define MERKLE_HASH_SIZE   32         // SHA-256
+#define MERKLE_LEAF_PREFIX 0x00
+#define MERKLE_NODE_PREFIX 0x01
+
+// --- structs ---------------------------------------------------------------------------------------------------------
+/**
+ * @brief Trailer of the tree, right after the root
+ *
+ */
+struct merkle_trailer_s
+{
+    uint32_t leaf_count;
+    uint32_t chunk_size; /**< MERKLE_CHUNK_SIZE */
+    uint32_t magic;      /**< MERKLE_MAGIC */
+} __attribute__((packed));
+
+/**
+ * @brief Tree of an image, as found by merkle_get_tree
+ *
+ */
+struct merkle_tree_s
+{
+    uint32_t       image_start_addr;
+    uint32_t       tree_offset; /**< End of the chunks, from the image start */
+    uint32_t       tree_end;    /**< End of the tree (start of the image index), from the image start */
+    uint32_t       image_size;  /**< Size of the image, without the footer */
+    uint32_t       leaf_count;
+    uint32_t       node_count;  /**< Including the leaves and the root */
+    uint8_t const *nodes;
+};
+
+// --- function declarations -------------------------------------------------------------------------------------------
+bool           merkle_get_tree(uint32_t image_start_addr, uint32_t image_size_bytes, struct merkle_tree_s *tree);
+uint8_t const *merkle_get_root(struct merkle_tree_s const *tree);
+void           merkle_get_image_root(struct merkle_tree_s const *tree, uint8_t *image_root);
+bool           merkle_check_nodes(struct merkle_tree_s const *tree);
+bool           merkle_check_chunk(struct merkle_tree_s const *tree, uint32_t chunk_index);
+bool           merkle_check_chunk_path(struct merkle_tree_s const *tree, uint32_t chunk_index);
+
+#endif // MERKLE_H
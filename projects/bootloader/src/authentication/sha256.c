@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <memory.h>
 #include "sha256.h"
+#include "common.h"
 
 // --- defines ---------------------------------------------------------------------------------------------------------
 #define ROTLEFT(a, b)  (((a) << (b)) | ((a) >> (32 - (b))))
@@ -36,7 +37,7 @@ static const WORD k[64]
         0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
 
 // --- function definitions --------------------------------------------------------------------------------------------
-void
+RAMFUNC_SHA256 void
 sha256_transform(SHA256_CTX *ctx, const BYTE data[])
 {
     WORD a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
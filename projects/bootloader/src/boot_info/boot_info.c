@@ -0,0 +1,179 @@
+/**
+ * @file boot_info.c
+ * @brief The boot info record, handed over from the bootloader to the application through a .noinit RAM region. This
+ *        source file is built by both the bootloader and the application, so it must not depend on any bootloader
+ *        module (e.g. the CRC32 is computed locally, with the same polynomial as the bootloader crc driver).
+ * @version 0.1
+ * @date 2024-07-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "boot_info.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#define BOOT_INFO_CRC32_POLYNOMIAL 0xEDB88320 // Reflected 0x04C11DB7
+
+// --- static function declarations ------------------------------------------------------------------------------------
+static uint32_t boot_info_crc32(uint8_t const *data, uint32_t length);
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+// Placed in the .noinit BOOT_INFO memory region: neither zeroed nor initialized by the startup code of either image.
+static struct boot_info_s boot_info __attribute__((section(BOOT_INFO_SECTION)));
+
+// --- static function definitions -------------------------------------------------------------------------------------
+/**
+ * @brief Function to compute the CRC32 of the record
+ *
+ * @param data
+ * @param length
+ * @return uint32_t
+ */
+static uint32_t
+boot_info_crc32(uint8_t const *data, uint32_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ BOOT_INFO_CRC32_POLYNOMIAL) : (crc >> 1);
+        }
+    }
+
+    return ~crc;
+}
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to start a new record. Any record left from a previous boot is discarded.
+ *
+ * @param core_clock_hz
+ */
+void
+boot_info_init(uint32_t core_clock_hz)
+{
+    memset(&boot_info, 0, sizeof(boot_info));
+    boot_info.magic         = BOOT_INFO_MAGIC;
+    boot_info.version       = BOOT_INFO_VERSION;
+    boot_info.size          = sizeof(struct boot_info_s);
+    boot_info.core_clock_hz = core_clock_hz;
+}
+
+/**
+ * @brief Function to record the entry to a boot stage. Only the first entry of each stage is recorded (e.g. the CRC
+ *        check stage runs again, when the primary image has to be recovered).
+ *
+ * @param stage
+ * @param timestamp_us
+ */
+void
+boot_info_record_stage(enum boot_info_stage_e stage, uint32_t timestamp_us)
+{
+    if ((stage >= BOOT_INFO_STAGE_COUNT) || (boot_info.stages_visited & (1UL << stage)))
+    {
+        return;
+    }
+
+    boot_info.stages_visited |= (1UL << stage);
+    boot_info.stage_entry_us[stage] = timestamp_us;
+}
+
+/**
+ * @brief Function to add flags of the boot path taken
+ *
+ * @param path_flags enum boot_info_path_flags_e
+ */
+void
+boot_info_add_path_flags(uint32_t path_flags)
+{
+    boot_info.path_flags |= path_flags;
+}
+
+/**
+ * @brief Function to get the flags of the boot path taken so far (e.g. reported to the host in the boot loop)
+ *
+ * @return uint32_t enum boot_info_path_flags_e
+ */
+uint32_t
+boot_info_get_path_flags(void)
+{
+    return boot_info.path_flags;
+}
+
+/**
+ * @brief Function to set the clock tree handed over to the application
+ *
+ * @param clock_flags enum boot_info_clock_flags_e
+ * @param hclk_hz
+ * @param pclk1_hz
+ * @param pclk2_hz
+ */
+void
+boot_info_set_clocks(uint32_t clock_flags, uint32_t hclk_hz, uint32_t pclk1_hz, uint32_t pclk2_hz)
+{
+    boot_info.clock_flags = clock_flags;
+    boot_info.hclk_hz     = hclk_hz;
+    boot_info.pclk1_hz    = pclk1_hz;
+    boot_info.pclk2_hz    = pclk2_hz;
+}
+
+/**
+ * @brief Function to set the information of the image that is about to boot
+ *
+ * @param fw_version_footer The 4 version bytes of the image footer (major, minor big endian, patch)
+ * @param image_digest The SHA-256 digest of the image, computed during its authentication. May be NULL.
+ */
+void
+boot_info_set_image(uint8_t const *fw_version_footer, uint8_t const *image_digest)
+{
+    if (fw_version_footer != NULL)
+    {
+        boot_info.fw_version_major = fw_version_footer[0];
+        boot_info.fw_version_minor = (uint16_t)((fw_version_footer[1] << 8) | fw_version_footer[2]);
+        boot_info.fw_version_patch = fw_version_footer[3];
+    }
+
+    if (image_digest != NULL)
+    {
+        memcpy(boot_info.image_digest, image_digest, BOOT_INFO_DIGEST_SIZE_BYTES);
+    }
+}
+
+/**
+ * @brief Function to complete the record, right before jumping to the application
+ *
+ * @param handoff_us
+ */
+void
+boot_info_seal(uint32_t handoff_us)
+{
+    boot_info.handoff_us = handoff_us;
+    boot_info.crc32      = boot_info_crc32((uint8_t const *)&boot_info, offsetof(struct boot_info_s, crc32));
+}
+
+/**
+ * @brief Function to get the record handed over by the bootloader
+ *
+ * @return struct boot_info_s const* The record, or NULL if there is no valid record (e.g. the application was not
+ *         booted by the bootloader, or the record is of a different version).
+ */
+struct boot_info_s const *
+boot_info_get(void)
+{
+    if ((boot_info.magic != BOOT_INFO_MAGIC) || (boot_info.version != BOOT_INFO_VERSION)
+        || (boot_info.size != sizeof(struct boot_info_s))
+        || (boot_info.crc32 != boot_info_crc32((uint8_t const *)&boot_info, offsetof(struct boot_info_s, crc32))))
+    {
+        return NULL;
+    }
+
+    return &boot_info;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file boot_info.h
+ * @brief The boot info record is handed over from the bootloader to the application, through a RAM region that is not
+ *        initialized by the startup code (.noinit, at the same address in both linker scripts). It describes how the
+ *        bootloader booted the application: the time spent in each boot state, the path taken, the version and the
+ *        SHA-256 digest of the verified image. This header is shared by the bootloader and the application, so it must
+ *        not depend on any bootloader module.
+ * @version 0.1
+ * @date 2024-07-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BOOT_INFO_H
+#define BOOT_INFO_H
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#define BOOT_INFO_MAGIC             0xB0071AF0
+#define BOOT_INFO_VERSION           2   // Increase on any change of struct boot_info_s
+#define BOOT_INFO_DIGEST_SIZE_BYTES 32  // SHA-256
+#define BOOT_INFO_SECTION           ".noinit.boot_info"
+#define BOOT_INFO_REGION_SIZE_BYTES 256 // Size of the BOOT_INFO memory region in the linker scripts
+
+// --- enums -----------------------------------------------------------------------------------------------------------
+/**
+ * @brief Enumeration of the boot stages. They follow the order of the bootloader FSM states (see main.c).
+ *
+ */
+enum boot_info_stage_e
+{
+    BOOT_INFO_STAGE_INIT = 0,
+    BOOT_INFO_STAGE_CRC_CHECK,
+    BOOT_INFO_STAGE_AUTH,
+    BOOT_INFO_STAGE_BOOT_APP,
+    BOOT_INFO_STAGE_BOOTLOOP,
+    BOOT_INFO_STAGE_COUNT
+};
+
+/**
+ * @brief Flags of the path that the bootloader took, until booting the application
+ *
+ */
+enum boot_info_path_flags_e
+{
+    BOOT_INFO_PATH_NEWER_ON_SECONDARY = 0x00000001, /* A newer version was found on the secondary slot */
+    BOOT_INFO_PATH_UPDATE_INSTALLED   = 0x00000002, /* The newer version was verified and installed to the primary */
+    BOOT_INFO_PATH_UPDATE_REJECTED    = 0x00000004, /* The newer version failed the CRC or the authentication */
+    BOOT_INFO_PATH_PRIMARY_CRC_FAIL   = 0x00000008, /* The primary image failed the CRC check */
+    BOOT_INFO_PATH_PRIMARY_AUTH_FAIL  = 0x00000010, /* The primary image failed the authentication */
+    BOOT_INFO_PATH_RECOVERED          = 0x00000020, /* The primary image was recovered from the secondary slot */
+    BOOT_INFO_PATH_SECONDARY_BOOTED   = 0x00000040, /* The secondary slot was booted in place (BL_DIRECT_XIP) */
+};
+
+/**
+ * @brief Flags of the clock tree handed over to the application
+ *
+ */
+enum boot_info_clock_flags_e
+{
+    BOOT_INFO_CLOCKS_PRESERVED = 0x00000001, /* The bootloader left its clock tree configured (BL_KEEP_CLOCKS) */
+};
+
+// --- structs ---------------------------------------------------------------------------------------------------------
+/**
+ * @brief The boot info record. The timestamps are in us, since the bootloader started its cycle counter (sys_init).
+ *        NOTE: Fixed layout. Any change must increase BOOT_INFO_VERSION and fit in BOOT_INFO_REGION_SIZE_BYTES.
+ *
+ */
+struct boot_info_s
+{
+    uint32_t magic;                                     /**< BOOT_INFO_MAGIC */
+    uint16_t version;                                   /**< BOOT_INFO_VERSION */
+    uint16_t size;                                      /**< sizeof(struct boot_info_s) */
+    uint32_t core_clock_hz;                             /**< Core clock of the bootloader */
+    uint32_t clock_flags;                               /**< enum boot_info_clock_flags_e */
+    uint32_t hclk_hz;                                   /**< Bus clocks left configured, if the clocks are preserved */
+    uint32_t pclk1_hz;
+    uint32_t pclk2_hz;
+    uint32_t path_flags;                                /**< enum boot_info_path_flags_e */
+    uint32_t stages_visited;                            /**< Bitmask of enum boot_info_stage_e */
+    uint32_t stage_entry_us[BOOT_INFO_STAGE_COUNT];     /**< First entry of each stage */
+    uint32_t handoff_us;                                /**< Right before jumping to the application */
+    uint8_t  fw_version_major;                          /**< Version of the verified image */
+    uint8_t  fw_version_patch;
+    uint16_t fw_version_minor;
+    uint8_t  image_digest[BOOT_INFO_DIGEST_SIZE_BYTES]; /**< Signed digest of the image: SHA-256, or Merkle root */
+    uint32_t crc32;                                     /**< CRC32 of all the previous fields */
+} __attribute__((packed));
+
+// --- function declarations -------------------------------------------------------------------------------------------
+// Bootloader side: build the record while booting
+void     boot_info_init(uint32_t core_clock_hz);
+void     boot_info_record_stage(enum boot_info_stage_e stage, uint32_t timestamp_us);
+void     boot_info_add_path_flags(uint32_t path_flags);
+void     boot_info_set_clocks(uint32_t clock_flags, uint32_t hclk_hz, uint32_t pclk1_hz, uint32_t pclk2_hz);
+void     boot_info_set_image(uint8_t const *fw_version_footer, uint8_t const *image_digest);
+uint32_t boot_info_get_path_flags(void);
+void     boot_info_seal(uint32_t handoff_us);
+
+// Application side: read the record handed over by the bootloader
+struct boot_info_s const *boot_info_get(void);
+
+#endif // BOOT_INFO_H
@@ -12,14 +12,46 @@
 #include "com_protocol.h"
 
 #include <stdio.h>
+#include <string.h>
+#include "common.h"
 #include "uart/uart_driver.h"
+#include "sys/sys.h"
 #include "crc/crc_driver.h"
+#include "flash/flash_driver.h"
 #include "firmware_update/firmware_update.h"
+#include "stats/stats.h"
+#include "profiling/profiling.h"
+#include "trace/trace.h"
+#include "image_index/image_index.h"
+#include "boot_info/boot_info.h"
+#include "crc/crc_apis.h"
+#include "flash/flash_apis.h"
 
 // --- defines ---------------------------------------------------------------------------------------------------------
 #define MSG_TYPE_POS 0
 #define MSG_LEN_POS  1
 
+#if COM_PROTO_MAX_FRAME_SIZE > RX_BUFFER_SIZE_BYTES
+#error "The uart rx buffer cannot hold the largest com protocol frame"
+#endif
+
+#if defined(BL_BUS_ADDRESS) && (COM_PROTO_MAX_ADDRESSED_FRAME_SIZE > RX_BUFFER_SIZE_BYTES)
+#error "The uart rx buffer cannot hold the largest addressed frame"
+#endif
+
+#if defined(BL_BUS_ADDRESS) && ((BL_BUS_ADDRESS < 1) || (BL_BUS_ADDRESS >= COM_PROTO_ADDRESS_BROADCAST))
+#error "BL_BUS_ADDRESS must be within 1 - 254"
+#endif
+
+// is_active, packet_size, packet_count, missing_count, then the bitmap
+#if (7 + FIRMWARE_UPDATE_MAX_PACKET_COUNT / 8) > COM_PROTO_MAX_DATA_PAYLOAD_SIZE
+#error "The missing packets report cannot cover all the packets of a firmware update"
+#endif
+
+#if IMAGE_INDEX_MAX_CHUNKS > COM_PROTO_MAX_IMAGE_CHUNKS
+#error "The image check cannot report all the chunks of an image index"
+#endif
+
 #define IS_COM_PROTO_MSG_TYPE_FWUG_START_ENC false
 #define IS_COM_PROTO_MSG_TYPE_FWUG_DATA_ENC true
 #define IS_COM_PROTO_MSG_TYPE_FWUG_STATUS_ENC false
@@ -28,28 +60,96 @@
 #define IS_COM_PROTO_MSG_TYPE_DATA_ENC true
 #define IS_COM_PROTO_MSG_TYPE_CMD_ENC true
 #define IS_COM_PROTO_MSG_TYPE_OP_RESULT_ENC false
+#define IS_COM_PROTO_MSG_TYPE_ADDRESSED_ENC false
+#define IS_COM_PROTO_MSG_TYPE_FWUG_PARITY_ENC true
+#define IS_COM_PROTO_MSG_TYPE_FWUG_DATA_AT_ENC true
+#define IS_COM_PROTO_MSG_TYPE_FWUG_COPY_ENC false
 
 
 // --- typedefs --------------------------------------------------------------------------------------------------------
 typedef void (*com_proto_msg_handler_t)(void *data);
 typedef void (*com_proto_msg_response_handler_t)(void);
+/**
+ * @brief Handler of a REQ_DATA data type. Gets the request message and fills the payload of the DATA response.
+ *        Returns the payload length, or 0 if the request cannot be served.
+ *
+ */
+typedef uint16_t (*com_proto_data_handler_t)(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len);
+
+/**
+ * @brief Maps a data type (REQ_DATA/DATA) to its handler
+ *
+ */
+struct com_proto_data_type_handler_s
+{
+    enum com_protocol_data_types_e data_type;
+    com_proto_data_handler_t       handler;
+};
+
+/**
+ * @brief Handler of a CMD command type. Gets the command message and returns the operation result
+ *        (enum com_protocol_op_results_e).
+ *
+ */
+typedef uint8_t (*com_proto_cmd_handler_t)(uint8_t const *cmd, uint16_t cmd_len);
+
+/**
+ * @brief Maps a command type (CMD) to its handler
+ *
+ */
+struct com_proto_cmd_type_handler_s
+{
+    enum com_protocol_cmd_types_e cmd;
+    com_proto_cmd_handler_t       handler;
+};
 
 // --- static function declarations ------------------------------------------------------------------------------------
-static void com_process_rx_data(struct uart_driver_data_s * const rx_data);
-static bool is_msg_type_valid(enum com_protocol_msg_types_e msg_type);
-static bool is_msg_len_valid(uint8_t msg_len);
-static bool is_crc_valid(uint8_t const * const rx_buffer, uint8_t msg_len);
+static void     com_process_rx_data(struct uart_driver_data_s * const rx_data);
+static uint16_t com_get_rx_frame_len(uint8_t const * const header, uint16_t header_len);
+static uint16_t get_msg_len(uint8_t const * const rx_buffer);
+static bool     is_msg_type_valid(enum com_protocol_msg_types_e msg_type);
+static bool     is_msg_len_valid(enum com_protocol_msg_types_e msg_type, uint16_t msg_len);
+static bool     is_crc_valid(uint8_t const * const rx_buffer, uint16_t msg_len);
+#ifdef BL_BUS_ADDRESS
+static bool com_bus_get_addressed_frame(uint8_t **rx_buffer, uint16_t *msg_len);
+#endif
 
 static void fwug_start_handler(void *data);
 static void fwug_data_handler(void *data);
+static void fwug_parity_handler(void *data);
+static void fwug_data_at_handler(void *data);
+static void fwug_copy_handler(void *data);
 static void fwug_cancel_handler(void *data);
-static void unsupported_msg_handler(void *data);
+static void req_data_handler(void *data);
+static void cmd_handler(void *data);
+
+static uint16_t capabilities_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len);
+static uint16_t debug_inf_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len);
+#ifdef BL_TRACE
+static uint16_t trace_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len);
+#endif
+static uint16_t image_check_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len);
+static uint16_t missing_packets_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len);
+static uint16_t download_progress_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload,
+                                               uint16_t max_len);
+static uint16_t chunk_checksums_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len);
+static uint16_t slot_info_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len);
+#ifdef BL_PROFILING
+static uint16_t profile_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len);
+#endif
+
+static uint8_t set_baudrate_cmd_handler(uint8_t const *cmd, uint16_t cmd_len);
+static uint8_t reboot_cmd_handler(uint8_t const *cmd, uint16_t cmd_len);
 
 static void fwug_status_response_handler(void);
 static void data_response_handler(void);
 static void op_result_response_handler(void);
 
 static void com_proto_message_handle_encryption(uint8_t *rx_buffer, enum com_protocol_msg_types_e msg_type);
+static void com_proto_send_response(uint8_t *tx_buffer, uint16_t msg_len);
+static void com_proto_apply_pending_baudrate(void);
+static void com_proto_apply_pending_reboot(void);
+static void get_slot_footer(uint32_t footer_addr, bool is_crc_ok, struct com_proto_slot_footer_s *footer);
 
 // --- static variable definitions -------------------------------------------------------------------------------------
 // Define an array of structures to map message types to their settings
@@ -92,8 +192,8 @@ static const struct com_proto_msg_type_settings_s com_proto_msg_type_settings[]
     // DATA
     [COM_PROTO_MSG_TYPE_DATA] = { // TODO: GPA: TBD
         .is_encrypted = IS_COM_PROTO_MSG_TYPE_DATA_ENC,
-        .enc_start_byte = offsetof(struct com_proto_fwug_data_s, payload),
-        .enc_end_byte = offsetof(struct com_proto_fwug_data_s, payload) + sizeof(((struct com_proto_fwug_data_s*)0)->payload) - 1,
+        .enc_start_byte = offsetof(struct com_proto_data_s, payload),
+        .enc_end_byte = offsetof(struct com_proto_data_s, payload) + sizeof(((struct com_proto_data_s*)0)->payload) - 1,
         .response_msg_type = COM_PROTO_MSG_TYPE_NONE // No response expected
     },
     // CMD
@@ -109,6 +209,34 @@ static const struct com_proto_msg_type_settings_s com_proto_msg_type_settings[]
         .enc_start_byte = 0,
         .enc_end_byte = 0,
         .response_msg_type = COM_PROTO_MSG_TYPE_NONE // No response expected
+    },
+    // ADDRESSED
+    [COM_PROTO_MSG_TYPE_ADDRESSED] = {
+        .is_encrypted = IS_COM_PROTO_MSG_TYPE_ADDRESSED_ENC,
+        .enc_start_byte = 0,
+        .enc_end_byte = 0,
+        .response_msg_type = COM_PROTO_MSG_TYPE_NONE // The carried frame is answered (BL_BUS_ADDRESS builds)
+    },
+    // FWUG_PARITY
+    [COM_PROTO_MSG_TYPE_FWUG_PARITY] = {
+        .is_encrypted = IS_COM_PROTO_MSG_TYPE_FWUG_PARITY_ENC,
+        .enc_start_byte = offsetof(struct com_proto_fwug_parity_s, payload),
+        .enc_end_byte = offsetof(struct com_proto_fwug_parity_s, payload) + sizeof(((struct com_proto_fwug_parity_s*)0)->payload) - 1,
+        .response_msg_type = COM_PROTO_MSG_TYPE_FWUG_STATUS
+    },
+    // FWUG_DATA_AT
+    [COM_PROTO_MSG_TYPE_FWUG_DATA_AT] = {
+        .is_encrypted = IS_COM_PROTO_MSG_TYPE_FWUG_DATA_AT_ENC,
+        .enc_start_byte = offsetof(struct com_proto_fwug_data_at_s, payload),
+        .enc_end_byte = offsetof(struct com_proto_fwug_data_at_s, payload) + sizeof(((struct com_proto_fwug_data_at_s*)0)->payload) - 1,
+        .response_msg_type = COM_PROTO_MSG_TYPE_FWUG_STATUS
+    },
+    // FWUG_COPY
+    [COM_PROTO_MSG_TYPE_FWUG_COPY] = {
+        .is_encrypted = IS_COM_PROTO_MSG_TYPE_FWUG_COPY_ENC,
+        .enc_start_byte = 0,
+        .enc_end_byte = 0,
+        .response_msg_type = COM_PROTO_MSG_TYPE_FWUG_STATUS
     }
 };
 
@@ -124,10 +252,14 @@ static const com_proto_msg_handler_t com_proto_msg_handler_map[] = {
 /* 2 */[COM_PROTO_MSG_TYPE_FWUG_DATA]   = fwug_data_handler,
 /* 3 */[COM_PROTO_MSG_TYPE_FWUG_STATUS] = NULL,                    /* No handler for this message type */
 /* 4 */[COM_PROTO_MSG_TYPE_FWUG_CANCEL] = fwug_cancel_handler,
-/* 5 */[COM_PROTO_MSG_TYPE_REQ_DATA]    = unsupported_msg_handler,
+/* 5 */[COM_PROTO_MSG_TYPE_REQ_DATA]    = req_data_handler,
 /* 6 */[COM_PROTO_MSG_TYPE_DATA]        = NULL,                    /* No handler for this message type */
-/* 7 */[COM_PROTO_MSG_TYPE_CMD]         = unsupported_msg_handler,
+/* 7 */[COM_PROTO_MSG_TYPE_CMD]         = cmd_handler,
 /* 8 */[COM_PROTO_MSG_TYPE_OP_RESULT]   = NULL,                    /* No handler for this message type */
+/* 9 */[COM_PROTO_MSG_TYPE_ADDRESSED]   = NULL,                    /* Unwrapped before the handlers (BL_BUS_ADDRESS) */
+/* A */[COM_PROTO_MSG_TYPE_FWUG_PARITY] = fwug_parity_handler,
+/* B */[COM_PROTO_MSG_TYPE_FWUG_DATA_AT] = fwug_data_at_handler,
+/* C */[COM_PROTO_MSG_TYPE_FWUG_COPY]   = fwug_copy_handler,
 };
 
 /**
@@ -144,11 +276,53 @@ static const com_proto_msg_response_handler_t com_proto_response_msg_handler_map
 /* 6 */[COM_PROTO_MSG_TYPE_DATA]        = data_response_handler,
 /* 7 */[COM_PROTO_MSG_TYPE_CMD]         = NULL,                    /* No handler for this message type */
 /* 8 */[COM_PROTO_MSG_TYPE_OP_RESULT]   = op_result_response_handler,
+/* 9 */[COM_PROTO_MSG_TYPE_ADDRESSED]   = NULL,                    /* No handler for this message type */
+/* A */[COM_PROTO_MSG_TYPE_FWUG_PARITY] = NULL,                    /* No handler for this message type */
+/* B */[COM_PROTO_MSG_TYPE_FWUG_DATA_AT] = NULL,                   /* No handler for this message type */
+/* C */[COM_PROTO_MSG_TYPE_FWUG_COPY]   = NULL,                    /* No handler for this message type */
+};
+
+/**
+ * @brief Map of the data types that can be requested through REQ_DATA, to the handler that provides the data
+ *
+ */
+static const struct com_proto_data_type_handler_s com_proto_data_type_handler_map[] = {
+    { COM_PROTO_DATA_TYPE_DEBUG_INF,         debug_inf_data_handler },
+    { COM_PROTO_DATA_TYPE_CAPABILITIES,      capabilities_data_handler },
+#ifdef BL_TRACE
+    { COM_PROTO_DATA_TYPE_TRACE,             trace_data_handler },
+#endif
+    { COM_PROTO_DATA_TYPE_IMAGE_CHECK,       image_check_data_handler },
+    { COM_PROTO_DATA_TYPE_MISSING_PACKETS,   missing_packets_data_handler },
+    { COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS, download_progress_data_handler },
+    { COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS,   chunk_checksums_data_handler },
+    { COM_PROTO_DATA_TYPE_SLOT_INFO,         slot_info_data_handler },
+#ifdef BL_PROFILING
+    { COM_PROTO_DATA_TYPE_PROFILE,           profile_data_handler },
+#endif
+};
+
+/**
+ * @brief Map of the commands that can be requested through CMD, to the handler that executes them
+ *
+ */
+static const struct com_proto_cmd_type_handler_s com_proto_cmd_type_handler_map[] = {
+    { COM_PROTO_CMD_SET_BAUDRATE, set_baudrate_cmd_handler },
+    { COM_PROTO_CMD_REBOOT,       reboot_cmd_handler },
 };
 // clang-format on
 
 static uint8_t                        op_result_status = 0;
 static struct firmware_update_state_s firmware_update_state;
+static struct com_proto_data_s        data_response_msg; // DATA response, prepared by the REQ_DATA handler
+// The frame being processed was broadcast on a shared bus: it is not answered (BL_BUS_ADDRESS builds)
+static bool is_broadcast_frame = false;
+
+// Baud rate switch: the new baud rate is applied after the response is sent, and must be confirmed by a valid frame
+static uint32_t          pending_baudrate        = 0;
+static volatile bool     is_baudrate_unconfirmed = false;
+static volatile uint32_t baudrate_switch_tick_ms = 0;
+static bool              is_reboot_pending       = false;
 
 // --- static function definitions -------------------------------------------------------------------------------------
 /**
@@ -167,14 +341,56 @@ is_msg_type_valid(enum com_protocol_msg_types_e msg_type)
 /**
  * @brief Function to check if the message length is valid
  *
+ * @param msg_type
  * @param msg_len
  * @return true
  * @return false
  */
 static bool
-is_msg_len_valid(uint8_t msg_len)
+is_msg_len_valid(enum com_protocol_msg_types_e msg_type, uint16_t msg_len)
 {
-    return (msg_len >= sizeof(struct com_proto_msg_header_s) + sizeof(struct com_proto_msg_footer_s));
+    uint16_t const max_len
+        = (msg_type == COM_PROTO_MSG_TYPE_ADDRESSED) ? COM_PROTO_MAX_ADDRESSED_FRAME_SIZE : COM_PROTO_MAX_FRAME_SIZE;
+
+    return (msg_len >= sizeof(struct com_proto_msg_header_s) + sizeof(struct com_proto_msg_footer_s))
+           && (msg_len <= max_len);
+}
+
+/**
+ * @brief Function to get the message length (little endian) out of the message header
+ *
+ * @param rx_buffer
+ * @return uint16_t
+ */
+static uint16_t
+get_msg_len(uint8_t const * const rx_buffer)
+{
+    return (uint16_t)(rx_buffer[MSG_LEN_POS] | (rx_buffer[MSG_LEN_POS + 1] << 8));
+}
+
+/**
+ * @brief Function to decode the length of a frame, out of its header. Registered to the uart driver, so that it knows
+ *        how many bytes to receive after the header.
+ *
+ * @param header
+ * @param header_len
+ * @return uint16_t The frame length, or 0 if the header is invalid.
+ */
+static uint16_t
+com_get_rx_frame_len(uint8_t const * const header, uint16_t header_len)
+{
+    if ((header == NULL) || (header_len < sizeof(struct com_proto_msg_header_s)))
+    {
+        return 0;
+    }
+
+    uint16_t msg_len = get_msg_len(header);
+    if (!is_msg_type_valid(header[MSG_TYPE_POS]) || !is_msg_len_valid(header[MSG_TYPE_POS], msg_len))
+    {
+        return 0;
+    }
+
+    return msg_len;
 }
 
 /**
@@ -186,16 +402,58 @@ is_msg_len_valid(uint8_t msg_len)
  * @return false
  */
 static bool
-is_crc_valid(uint8_t const * const rx_buffer, uint8_t msg_len)
+is_crc_valid(uint8_t const * const rx_buffer, uint16_t msg_len)
 {
     uint16_t crc_16_calc = 0;
     uint16_t crc_16_msg  = 0;
-    // Each message has a header (2 bytes: msg type and msg len), payload and CRC (2 bytes)
+    // Each message has a header (3 bytes: msg type and msg len), payload and CRC (2 bytes, big endian)
     crc_16_calc = crc16_driver_calculate(rx_buffer, msg_len - 2);
     crc_16_msg  = (rx_buffer[msg_len - 2] << 8) | rx_buffer[msg_len - 1];
     return (crc_16_calc == crc_16_msg);
 }
 
+#ifdef BL_BUS_ADDRESS
+/**
+ * @brief Function to get the frame carried by an addressed message (shared bus). Every node of the bus receives every
+ *        frame: the ones that are not addressed to this node (or broadcast) are dropped without a response, and so are
+ *        the ones that cannot be trusted (CRC error, the address might be wrong).
+ *
+ * @param rx_buffer The received message. Set to the carried frame.
+ * @param msg_len Length of the received message. Set to the length of the carried frame.
+ * @return true The frame is for this node.
+ * @return false
+ */
+static bool
+com_bus_get_addressed_frame(uint8_t **rx_buffer, uint16_t *msg_len)
+{
+    struct com_proto_addressed_s const *addressed = (struct com_proto_addressed_s const *)*rx_buffer;
+
+    if ((addressed->msg_header.type != COM_PROTO_MSG_TYPE_ADDRESSED) || (*msg_len < COM_PROTO_ADDRESSED_MSG_LEN(0))
+        || !is_crc_valid(*rx_buffer, *msg_len))
+    {
+        return false;
+    }
+
+    if ((addressed->address != BL_BUS_ADDRESS) && (addressed->address != COM_PROTO_ADDRESS_BROADCAST))
+    {
+        return false;
+    }
+
+    // The carried frame must fill the addressed message
+    uint8_t       *frame     = &(*rx_buffer)[offsetof(struct com_proto_addressed_s, frame)];
+    uint16_t const frame_len = *msg_len - COM_PROTO_ADDRESSED_MSG_LEN(0);
+    if ((frame_len < sizeof(struct com_proto_msg_header_s)) || (get_msg_len(frame) != frame_len))
+    {
+        return false;
+    }
+
+    is_broadcast_frame = (addressed->address == COM_PROTO_ADDRESS_BROADCAST);
+    *rx_buffer         = frame;
+    *msg_len           = frame_len;
+    return true;
+}
+#endif
+
 /**
  * @brief Function to process a received message
  *
@@ -207,32 +465,39 @@ com_process_rx_data(struct uart_driver_data_s * const rx_data)
     // Input check
     if ((rx_data == NULL) || (rx_data->len < sizeof(struct com_proto_msg_header_s)))
     {
-#ifdef DEBUG_LOG
-        printf("Received empty buffer\r\n");
-#endif
+        TRACE_LOG("Received empty buffer\r\n");
         return;
     }
-    uint8_t *rx_buffer = rx_data->data_buffer;
-    uint8_t  msg_type  = rx_buffer[MSG_TYPE_POS];
-    uint8_t  msg_len   = rx_buffer[MSG_LEN_POS]; /* Message len includes: header + payload + crc16 size */
+    uint32_t stats_start = stats_timer_start();
+    uint8_t *rx_buffer   = rx_data->data_buffer;
+    uint8_t  msg_type    = rx_buffer[MSG_TYPE_POS];
+    uint16_t msg_len     = get_msg_len(rx_buffer); /* Message len includes: header + payload + crc16 size */
 
-    // Check if the message type and len are valid
-    if (!is_msg_type_valid(msg_type) || !is_msg_len_valid(msg_len))
+    // Check if the message type and len are valid. The message must also fit in the received frame.
+    if (!is_msg_type_valid(msg_type) || !is_msg_len_valid(msg_type, msg_len) || (msg_len > rx_data->len))
     {
-#ifdef DEBUG_LOG
-        printf("Invalid msg type or msg len\r\n");
-#endif
+        TRACE_LOG("Invalid msg type or msg len\r\n");
         return;
     }
 
+#ifdef BL_BUS_ADDRESS
+    // Shared bus: only the frames addressed to this node are processed
+    is_broadcast_frame = false;
+    if (!com_bus_get_addressed_frame(&rx_buffer, &msg_len))
+    {
+        return;
+    }
+    msg_type = rx_buffer[MSG_TYPE_POS];
+#endif
+    stats_inc(STATS_COUNTER_FRAMES_RX);
+
     // Get the settings based on the message type
     struct com_proto_msg_type_settings_s const *settings;
     settings = get_msg_type_settings(msg_type);
     if (settings == NULL)
     {
-#ifdef DEBUG_LOG
-        printf("Unsupported msg type\r\n");
-#endif
+        TRACE_LOG("Unsupported msg type\r\n");
+        op_result_status = COM_PROTO_OP_RESULT_UNKNOWN_MSG_ERR;
         op_result_response_handler();
         return;
     }
@@ -246,13 +511,16 @@ com_process_rx_data(struct uart_driver_data_s * const rx_data)
     // 2. --- CRC validation ---
     if (!is_crc_valid(rx_buffer, msg_len))
     {
-#ifdef DEBUG_LOG
-        printf("CRC validation failed\r\n");
-#endif
+        TRACE_LOG("CRC validation failed\r\n");
+        stats_inc(STATS_COUNTER_CRC_ERR);
+        op_result_status = COM_PROTO_OP_RESULT_CRC_ERR;
         op_result_response_handler();
         return;
     }
 
+    // A valid frame confirms that the host follows the last baud rate switch
+    is_baudrate_unconfirmed = false;
+
     // 3. --- Handle received message ---
     com_proto_msg_handler_t handler = com_proto_msg_handler_map[msg_type];
     if (handler != NULL)
@@ -261,9 +529,8 @@ com_process_rx_data(struct uart_driver_data_s * const rx_data)
     }
     else
     {
-#ifdef DEBUG_LOG
-        printf("No handler for this message type\r\n");
-#endif
+        TRACE_LOG("No handler for this message type\r\n");
+        op_result_status = COM_PROTO_OP_RESULT_UNKNOWN_MSG_ERR;
         op_result_response_handler();
         return;
     }
@@ -277,9 +544,17 @@ com_process_rx_data(struct uart_driver_data_s * const rx_data)
     }
     else
     {
-#ifdef DEBUG_LOG
-        printf("No response handler for this message type\r\n");
-#endif
+        TRACE_LOG("No response handler for this message type\r\n");
+    }
+
+    // 5. Apply any action that must follow the response (the response is sent at the current baud rate)
+    com_proto_apply_pending_baudrate();
+    com_proto_apply_pending_reboot();
+
+    if ((msg_type == COM_PROTO_MSG_TYPE_FWUG_DATA) || (msg_type == COM_PROTO_MSG_TYPE_FWUG_DATA_AT))
+    {
+        // Processing latency of a firmware update packet, from its reception until its response is sent
+        stats_record_packet_latency(stats_start);
     }
 
     return;
@@ -294,14 +569,31 @@ com_process_rx_data(struct uart_driver_data_s * const rx_data)
 static void
 fwug_start_handler(void *data)
 {
-    // Check if the received msg data len is correct
-    if (((uint8_t *)data)[MSG_LEN_POS] != sizeof(struct com_proto_fwug_start_s))
+    // Check if the received msg data len is correct. The FEC group size and the resume point are optional.
+    uint16_t msg_len        = get_msg_len(data);
+    uint8_t  fec_group_size = 0;
+    bool     ret            = false;
+    if (msg_len == sizeof(struct com_proto_fwug_start_resume_s))
+    {
+        struct com_proto_fwug_start_resume_s *fwug_start = (struct com_proto_fwug_start_resume_s *)data;
+        ret = firmware_update_resume(fwug_start->packet_size, fwug_start->fec_group_size, fwug_start->packet_count,
+                                     fwug_start->prefix_crc32);
+    }
+    else if ((msg_len == sizeof(struct com_proto_fwug_start_s))
+             || (msg_len == sizeof(struct com_proto_fwug_start_fec_s)))
+    {
+        if (msg_len == sizeof(struct com_proto_fwug_start_fec_s))
+        {
+            fec_group_size = ((struct com_proto_fwug_start_fec_s *)data)->fec_group_size;
+        }
+        ret = firmware_update_start(((struct com_proto_fwug_start_s *)data)->packet_size, fec_group_size);
+    }
+    else
     {
         op_result_status = COM_PROTO_OP_RESULT_GENERIC_ERR;
         return;
     }
 
-    bool ret         = firmware_update_start();
     op_result_status = ret ? COM_PROTO_OP_RESULT_NO_ERR : COM_PROTO_OP_RESULT_GENERIC_ERR;
 
     // Get the status of the firmware update process
@@ -316,15 +608,100 @@ fwug_start_handler(void *data)
 static void
 fwug_data_handler(void *data)
 {
-    // Check if the received msg data len is correct. This also checks, implicitly, if the fwug packet size is correct
-    if (((uint8_t *)data)[MSG_LEN_POS] != sizeof(struct com_proto_fwug_data_s))
+    // Check if the received msg data len is correct. The payload length must match the negotiated packet size, which
+    // is checked by the firmware update module.
+    uint16_t msg_len = get_msg_len(data);
+    if (msg_len < COM_PROTO_FWUG_DATA_MSG_LEN(0))
     {
         op_result_status = COM_PROTO_OP_RESULT_GENERIC_ERR;
         return;
     }
 
-    struct com_proto_fwug_data_s *fwug_data = (struct com_proto_fwug_data_s *)data;
-    bool                          ret = firmware_update_process_packet(fwug_data->payload, fwug_data->packet_number);
+    struct com_proto_fwug_data_s *fwug_data   = (struct com_proto_fwug_data_s *)data;
+    uint32_t                      payload_len = msg_len - COM_PROTO_FWUG_DATA_MSG_LEN(0);
+    // A broadcast packet can arrive with gaps (shared bus), a point to point packet must follow the previous one
+    bool ret = is_broadcast_frame
+                   ? firmware_update_process_broadcast_packet(fwug_data->payload, fwug_data->packet_number, payload_len)
+                   : firmware_update_process_packet(fwug_data->payload, fwug_data->packet_number, payload_len);
+
+    op_result_status = ret ? COM_PROTO_OP_RESULT_NO_ERR : COM_PROTO_OP_RESULT_GENERIC_ERR;
+
+    // Get the status of the firmware update process
+    firmware_update_status(&firmware_update_state);
+}
+
+/**
+ * @brief Handler for the FWUG_PARITY message. The response is an error if the group still misses packets, after the
+ *        parity was applied.
+ *
+ * @param data
+ */
+static void
+fwug_parity_handler(void *data)
+{
+    // Check if the received msg data len is correct. The payload length must match the negotiated packet size, which
+    // is checked by the firmware update module.
+    uint16_t msg_len = get_msg_len(data);
+    if (msg_len < COM_PROTO_FWUG_PARITY_MSG_LEN(0))
+    {
+        op_result_status = COM_PROTO_OP_RESULT_GENERIC_ERR;
+        return;
+    }
+
+    struct com_proto_fwug_parity_s *fwug_parity = (struct com_proto_fwug_parity_s *)data;
+    uint32_t                        payload_len = msg_len - COM_PROTO_FWUG_PARITY_MSG_LEN(0);
+    bool ret = firmware_update_process_parity_packet(fwug_parity->payload, fwug_parity->packet_number,
+                                                     fwug_parity->group_size, payload_len);
+
+    op_result_status = ret ? COM_PROTO_OP_RESULT_NO_ERR : COM_PROTO_OP_RESULT_GENERIC_ERR;
+
+    // Get the status of the firmware update process
+    firmware_update_status(&firmware_update_state);
+}
+
+/**
+ * @brief Handler for the FWUG_DATA_AT message
+ *
+ * @param data
+ */
+static void
+fwug_data_at_handler(void *data)
+{
+    // Check if the received msg data len is correct. The payload length is checked by the firmware update module.
+    uint16_t msg_len = get_msg_len(data);
+    if (msg_len < COM_PROTO_FWUG_DATA_AT_MSG_LEN(0))
+    {
+        op_result_status = COM_PROTO_OP_RESULT_GENERIC_ERR;
+        return;
+    }
+
+    struct com_proto_fwug_data_at_s *fwug_data_at = (struct com_proto_fwug_data_at_s *)data;
+    uint32_t                         payload_len  = msg_len - COM_PROTO_FWUG_DATA_AT_MSG_LEN(0);
+    bool ret = firmware_update_process_range(fwug_data_at->payload, fwug_data_at->offset, payload_len);
+
+    op_result_status = ret ? COM_PROTO_OP_RESULT_NO_ERR : COM_PROTO_OP_RESULT_GENERIC_ERR;
+
+    // Get the status of the firmware update process
+    firmware_update_status(&firmware_update_state);
+}
+
+/**
+ * @brief Handler for the FWUG_COPY message
+ *
+ * @param data
+ */
+static void
+fwug_copy_handler(void *data)
+{
+    // Check if the received msg data len is correct
+    if (get_msg_len(data) != sizeof(struct com_proto_fwug_copy_s))
+    {
+        op_result_status = COM_PROTO_OP_RESULT_GENERIC_ERR;
+        return;
+    }
+
+    struct com_proto_fwug_copy_s *fwug_copy = (struct com_proto_fwug_copy_s *)data;
+    bool                          ret       = firmware_update_copy_range(fwug_copy->offset, fwug_copy->length);
 
     op_result_status = ret ? COM_PROTO_OP_RESULT_NO_ERR : COM_PROTO_OP_RESULT_GENERIC_ERR;
 
@@ -341,7 +718,7 @@ static void
 fwug_cancel_handler(void *data)
 {
     // Check if the received msg data len is correct
-    if (((uint8_t *)data)[MSG_LEN_POS] != sizeof(struct com_proto_fwug_cancel_s))
+    if (get_msg_len(data) != sizeof(struct com_proto_fwug_cancel_s))
     {
         op_result_status = COM_PROTO_OP_RESULT_GENERIC_ERR;
         return;
@@ -355,15 +732,583 @@ fwug_cancel_handler(void *data)
 }
 
 /**
- * @brief Handler for the unsupported message type
+ * @brief Handler for the REQ_DATA message. Prepares the DATA response, based on the requested data type.
+ *
+ * @param data
+ */
+static void
+req_data_handler(void *data)
+{
+    uint16_t msg_len = get_msg_len(data);
+    // Check if the received msg data len is correct. Some data types carry extra request parameters.
+    if (msg_len < sizeof(struct com_proto_req_data_s))
+    {
+        op_result_status = COM_PROTO_OP_RESULT_GENERIC_ERR;
+        return;
+    }
+
+    struct com_proto_req_data_s *req_data = (struct com_proto_req_data_s *)data;
+    com_proto_data_handler_t     handler  = NULL;
+    for (uint32_t i = 0; i < sizeof(com_proto_data_type_handler_map) / sizeof(com_proto_data_type_handler_map[0]); i++)
+    {
+        if (com_proto_data_type_handler_map[i].data_type == req_data->data_type)
+        {
+            handler = com_proto_data_type_handler_map[i].handler;
+            break;
+        }
+    }
+
+    if (handler == NULL)
+    {
+        op_result_status = COM_PROTO_OP_RESULT_UNKNOWN_MSG_ERR;
+        return;
+    }
+
+    uint16_t payload_len
+        = handler((uint8_t const *)data, msg_len, data_response_msg.payload, COM_PROTO_MAX_DATA_PAYLOAD_SIZE);
+    if (payload_len == 0)
+    {
+        op_result_status = COM_PROTO_OP_RESULT_GENERIC_ERR;
+        return;
+    }
+
+    data_response_msg.msg_header.type = COM_PROTO_MSG_TYPE_DATA;
+    data_response_msg.msg_header.len  = COM_PROTO_DATA_MSG_LEN(payload_len);
+    data_response_msg.data_type       = req_data->data_type;
+    op_result_status                  = COM_PROTO_OP_RESULT_NO_ERR;
+}
+
+/**
+ * @brief Handler for the CMD message. Executes the requested command. The OP_RESULT response carries the result.
  *
  * @param data
  */
 static void
-unsupported_msg_handler(void *data)
+cmd_handler(void *data)
 {
-    (void)data;
-    // Empty function
+    uint16_t msg_len = get_msg_len(data);
+    // Check if the received msg data len is correct. Some commands carry extra parameters.
+    if (msg_len < sizeof(struct com_proto_cmd_s))
+    {
+        op_result_status = COM_PROTO_OP_RESULT_GENERIC_ERR;
+        return;
+    }
+
+    struct com_proto_cmd_s *cmd     = (struct com_proto_cmd_s *)data;
+    com_proto_cmd_handler_t handler = NULL;
+    for (uint32_t i = 0; i < sizeof(com_proto_cmd_type_handler_map) / sizeof(com_proto_cmd_type_handler_map[0]); i++)
+    {
+        if (com_proto_cmd_type_handler_map[i].cmd == cmd->cmd)
+        {
+            handler = com_proto_cmd_type_handler_map[i].handler;
+            break;
+        }
+    }
+
+    if (handler == NULL)
+    {
+        op_result_status = COM_PROTO_OP_RESULT_UNKNOWN_MSG_ERR;
+        return;
+    }
+
+    op_result_status = handler((uint8_t const *)data, msg_len);
+}
+
+// --- DATA TYPE HANDLERS ---
+/**
+ * @brief Handler for the COM_PROTO_DATA_TYPE_CAPABILITIES data type. Reports what this bootloader build supports, so
+ *        that the host can select the fastest options (e.g. the packet size) the device supports.
+ *
+ * @param req
+ * @param req_len
+ * @param payload
+ * @param max_len
+ * @return uint16_t
+ */
+static uint16_t
+capabilities_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len)
+{
+    (void)req;
+    (void)req_len;
+    struct com_proto_capabilities_s capabilities = { 0 };
+    uint8_t                         sector_count = FLASH_SECTOR_COUNT;
+
+    if (sector_count > COM_PROTO_MAX_FLASH_SECTORS)
+    {
+        sector_count = COM_PROTO_MAX_FLASH_SECTORS;
+    }
+
+    uint16_t payload_len = offsetof(struct com_proto_capabilities_s, flash_sectors)
+                           + sector_count * sizeof(struct com_proto_flash_sector_s);
+    if (payload_len > max_len)
+    {
+        return 0;
+    }
+
+    capabilities.proto_version       = COM_PROTO_VERSION;
+    capabilities.max_packet_size     = FIRMWARE_UPDATE_MAX_PACKET_SIZE;
+    capabilities.window_depth        = COM_PROTO_WINDOW_DEPTH;
+    capabilities.compression_formats = COM_PROTO_COMPRESSION_LZ;
+    capabilities.delta_formats       = COM_PROTO_DELTA_CHUNK_COPY;
+    capabilities.max_baudrate        = uart_driver_get_max_baudrate();
+    capabilities.features            = COM_PROTO_FEATURE_BAUDRATE_SWITCH | COM_PROTO_FEATURE_FEC
+                                       | COM_PROTO_FEATURE_RESUME | COM_PROTO_FEATURE_SPARSE
+                                       | COM_PROTO_FEATURE_CHUNK_CHECKSUMS | COM_PROTO_FEATURE_SLOT_INFO;
+#ifdef BL_DIRECT_INSTALL
+    capabilities.features |= COM_PROTO_FEATURE_DIRECT_INSTALL;
+    // The primary slot is the download space: there is no installed image to copy the unchanged chunks from
+    capabilities.delta_formats = COM_PROTO_DELTA_NONE;
+#endif
+#ifdef BL_DIRECT_XIP
+    capabilities.features |= COM_PROTO_FEATURE_DIRECT_XIP;
+#endif
+#ifdef BL_BUS_ADDRESS
+    capabilities.features |= COM_PROTO_FEATURE_BUS_ADDRESSING;
+#endif
+    capabilities.app_primary_start   = SYM_ADDR(__flash_app_start__);
+    capabilities.app_primary_size    = (SYM_ADDR(__flash_app_end__)) - (SYM_ADDR(__flash_app_start__)) + 1;
+    capabilities.app_secondary_start = SYM_ADDR(__flash_app_secondary_start__);
+    capabilities.app_secondary_size
+        = (SYM_ADDR(__flash_app_secondary_end__)) - (SYM_ADDR(__flash_app_secondary_start__)) + 1;
+    capabilities.flash_sector_count = sector_count;
+    for (uint8_t i = 0; i < sector_count; i++)
+    {
+        capabilities.flash_sectors[i].start_address = flash_sectors[i].start_address;
+        capabilities.flash_sectors[i].size          = flash_sectors[i].size;
+    }
+
+    memcpy(payload, &capabilities, payload_len);
+    return payload_len;
+}
+
+/**
+ * @brief Handler for the COM_PROTO_DATA_TYPE_DEBUG_INF data type. Reports the bootloader statistics (counters, timings
+ *        and the firmware update packet latency histogram). The statistics are cleared after reading them, if requested.
+ *
+ * @param req
+ * @param req_len
+ * @param payload
+ * @param max_len
+ * @return uint16_t
+ */
+static uint16_t
+debug_inf_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len)
+{
+    struct stats_s stats;
+    uint8_t        flags = COM_PROTO_DEBUG_INF_FLAG_NONE;
+
+    if (sizeof(struct stats_s) > max_len)
+    {
+        return 0;
+    }
+
+    // The flags are optional
+    if (req_len == sizeof(struct com_proto_req_debug_inf_s))
+    {
+        flags = ((struct com_proto_req_debug_inf_s const *)req)->flags;
+    }
+
+    stats_get(&stats);
+    if (flags & COM_PROTO_DEBUG_INF_FLAG_CLEAR)
+    {
+        stats_reset();
+    }
+
+    memcpy(payload, &stats, sizeof(struct stats_s));
+    return sizeof(struct stats_s);
+}
+
+#ifdef BL_TRACE
+/**
+ * @brief Handler for the COM_PROTO_DATA_TYPE_TRACE data type. Drains the trace buffer: as many whole records as fit in
+ *        the payload are sent and removed. An empty trace is still a valid response (no records).
+ *
+ * @param req
+ * @param req_len
+ * @param payload
+ * @param max_len
+ * @return uint16_t
+ */
+static uint16_t
+trace_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len)
+{
+    (void)req;
+    (void)req_len;
+    uint32_t dropped = trace_get_dropped();
+
+    if (max_len < sizeof(struct com_proto_trace_s))
+    {
+        return 0;
+    }
+
+    memcpy(payload, &dropped, sizeof(dropped));
+    return sizeof(dropped)
+           + trace_read(&payload[offsetof(struct com_proto_trace_s, records)],
+                        sizeof(((struct com_proto_trace_s *)0)->records));
+}
+#endif
+
+/**
+ * @brief Handler for the COM_PROTO_DATA_TYPE_IMAGE_CHECK data type. Checks every chunk of the image index of the
+ *        requested slot, and reports the chunks along with the damaged ones. An image without an index is reported
+ *        without chunks.
+ *
+ * @param req
+ * @param req_len
+ * @param payload
+ * @param max_len
+ * @return uint16_t
+ */
+static uint16_t
+image_check_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len)
+{
+    struct com_proto_image_check_s image_check = { 0 };
+    uint32_t                       slot_start;
+    uint32_t                       slot_end;
+    uint32_t                       chunk_count = 0;
+
+    if (req_len != sizeof(struct com_proto_req_image_check_s))
+    {
+        return 0;
+    }
+
+    image_check.slot = ((struct com_proto_req_image_check_s const *)req)->slot;
+    if (image_check.slot == COM_PROTO_SLOT_PRIMARY)
+    {
+        slot_start = SYM_ADDR(__flash_app_start__);
+        slot_end   = SYM_ADDR(__flash_app_end__);
+    }
+    else if (image_check.slot == COM_PROTO_SLOT_SECONDARY)
+    {
+        slot_start = SYM_ADDR(__flash_app_secondary_start__);
+        slot_end   = SYM_ADDR(__flash_app_secondary_end__);
+    }
+    else
+    {
+        return 0;
+    }
+
+    uint32_t const image_size = slot_end - slot_start - (SYM_ADDR(__header_size_bytes__)) + 1;
+    struct image_index_chunk_s const *chunks = image_index_get(slot_start, image_size, &chunk_count);
+    uint16_t payload_len = offsetof(struct com_proto_image_check_s, chunks)
+                           + chunk_count * sizeof(struct com_proto_image_chunk_s);
+    if (payload_len > max_len)
+    {
+        return 0;
+    }
+
+    uint32_t chunk_start = 0;
+    for (uint32_t i = 0; i < chunk_count; i++)
+    {
+        image_check.chunks[i].start_address = slot_start + chunk_start;
+        image_check.chunks[i].size          = chunks[i].end_offset - chunk_start;
+        chunk_start                         = chunks[i].end_offset;
+    }
+    image_check.chunk_count    = chunk_count;
+    image_check.damaged_chunks = image_index_get_damaged_chunks(slot_start, image_size);
+
+    memcpy(payload, &image_check, payload_len);
+    return payload_len;
+}
+
+/**
+ * @brief Handler for the COM_PROTO_DATA_TYPE_MISSING_PACKETS data type. Reports the packets of the firmware update that
+ *        were not received yet, out of the packet count of the image (as known by the host). After a broadcast
+ *        firmware update, the host resends only the packets that some node is missing.
+ *
+ * @param req
+ * @param req_len
+ * @param payload
+ * @param max_len
+ * @return uint16_t
+ */
+static uint16_t
+missing_packets_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len)
+{
+    struct com_proto_missing_packets_s missing_packets = { 0 };
+
+    if (req_len != sizeof(struct com_proto_req_missing_packets_s))
+    {
+        return 0;
+    }
+
+    uint32_t packet_count = ((struct com_proto_req_missing_packets_s const *)req)->packet_count;
+    if (packet_count > FIRMWARE_UPDATE_MAX_PACKET_COUNT)
+    {
+        packet_count = FIRMWARE_UPDATE_MAX_PACKET_COUNT;
+    }
+
+    uint16_t payload_len = offsetof(struct com_proto_missing_packets_s, missing) + (packet_count + 7) / 8;
+    if (payload_len > max_len)
+    {
+        return 0;
+    }
+
+    firmware_update_status(&firmware_update_state);
+    missing_packets.is_active     = firmware_update_state.is_update_started;
+    missing_packets.packet_size   = firmware_update_state.packet_size;
+    missing_packets.packet_count  = packet_count;
+    missing_packets.missing_count = firmware_update_get_missing_packets(packet_count, missing_packets.missing);
+
+    memcpy(payload, &missing_packets, payload_len);
+    return payload_len;
+}
+
+/**
+ * @brief Handler for the COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS data type. Reports the packets of an interrupted
+ *        download that are in the download space, and their CRC32, in the packet size requested by the host.
+ *
+ * @param req
+ * @param req_len
+ * @param payload
+ * @param max_len
+ * @return uint16_t
+ */
+static uint16_t
+download_progress_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len)
+{
+    struct com_proto_download_progress_s progress = { 0 };
+    uint32_t                             packet_count;
+    uint32_t                             prefix_crc32;
+
+    if ((req_len != sizeof(struct com_proto_req_download_progress_s))
+        || (sizeof(struct com_proto_download_progress_s) > max_len))
+    {
+        return 0;
+    }
+
+    progress.packet_size = firmware_update_get_download_progress(
+        ((struct com_proto_req_download_progress_s const *)req)->packet_size, &packet_count, &prefix_crc32);
+    progress.packet_count = packet_count;
+    progress.prefix_crc32 = prefix_crc32;
+
+    memcpy(payload, &progress, sizeof(progress));
+    return sizeof(progress);
+}
+
+/**
+ * @brief Handler for the COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS data type. Reports the CRC32 of each chunk of the
+ *        requested range of a slot, so that the host sends only the chunks of an update that differ.
+ *
+ * @param req
+ * @param req_len
+ * @param payload
+ * @param max_len
+ * @return uint16_t
+ */
+static uint16_t
+chunk_checksums_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len)
+{
+    struct com_proto_req_chunk_checksums_s const *request   = (struct com_proto_req_chunk_checksums_s const *)req;
+    struct com_proto_chunk_checksums_s            checksums = { 0 };
+    uint32_t                                      slot_start;
+    uint32_t                                      slot_size;
+
+    if (req_len != sizeof(struct com_proto_req_chunk_checksums_s))
+    {
+        return 0;
+    }
+
+    if (request->slot == COM_PROTO_SLOT_PRIMARY)
+    {
+        slot_start = SYM_ADDR(__flash_app_start__);
+        slot_size  = SYM_ADDR(__flash_app_end__) - slot_start + 1;
+    }
+    else if (request->slot == COM_PROTO_SLOT_SECONDARY)
+    {
+        slot_start = SYM_ADDR(__flash_app_secondary_start__);
+        slot_size  = SYM_ADDR(__flash_app_secondary_end__) - slot_start + 1;
+    }
+    else
+    {
+        return 0;
+    }
+
+    uint16_t payload_len = offsetof(struct com_proto_chunk_checksums_s, crc32)
+                           + request->chunk_count * sizeof(uint32_t);
+    if ((request->chunk_size == 0) || (request->chunk_count > COM_PROTO_MAX_CHUNK_CHECKSUMS)
+        || (request->offset > slot_size)
+        || (request->chunk_count > ((slot_size - request->offset) / request->chunk_size)) || (payload_len > max_len))
+    {
+        return 0;
+    }
+
+    checksums.slot        = request->slot;
+    checksums.offset      = request->offset;
+    checksums.chunk_size  = request->chunk_size;
+    checksums.chunk_count = request->chunk_count;
+    for (uint32_t i = 0; i < request->chunk_count; i++)
+    {
+        uint32_t const chunk_addr = slot_start + request->offset + i * request->chunk_size;
+        checksums.crc32[i]        = crc32_driver_calculate((uint8_t const *)(uintptr_t)chunk_addr, request->chunk_size);
+    }
+
+    memcpy(payload, &checksums, payload_len);
+    return payload_len;
+}
+
+/**
+ * @brief Function to fill the footer of a slot, as reported in COM_PROTO_DATA_TYPE_SLOT_INFO
+ *
+ * @param footer_addr Start address of the footer of the slot
+ * @param is_crc_ok Result of the CRC32 check of the image of the slot
+ * @param footer
+ */
+static void
+get_slot_footer(uint32_t footer_addr, bool is_crc_ok, struct com_proto_slot_footer_s *footer)
+{
+    uint8_t const *header = (uint8_t const *)(uintptr_t)footer_addr;
+
+    memcpy(&footer->crc32, header, sizeof(footer->crc32));
+    memcpy(footer->fw_version, header + SYM_ADDR(__header_crc_size_bytes__), sizeof(footer->fw_version));
+    memcpy(footer->signature,
+           header + SYM_ADDR(__header_crc_size_bytes__) + SYM_ADDR(__header_fw_ver_size_bytes__),
+           sizeof(footer->signature));
+    footer->is_crc_ok = is_crc_ok;
+}
+
+/**
+ * @brief Handler for the COM_PROTO_DATA_TYPE_SLOT_INFO data type. Reports the footer of the image of each slot, whether
+ *        each image matches its CRC32 (checked now), the outcome of the checks of the last boot, and the slot that the
+ *        next update is downloaded to.
+ *
+ * @param req
+ * @param req_len
+ * @param payload
+ * @param max_len
+ * @return uint16_t
+ */
+static uint16_t
+slot_info_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len)
+{
+    (void)req;
+    (void)req_len;
+    struct com_proto_slot_info_s slot_info = { 0 };
+
+    if (sizeof(struct com_proto_slot_info_s) > max_len)
+    {
+        return 0;
+    }
+
+    slot_info.boot_path_flags = boot_info_get_path_flags();
+#ifndef BL_DIRECT_INSTALL
+    // With BL_DIRECT_INSTALL the secondary slot is never installed
+    slot_info.is_secondary_newer = flash_api_is_secondary_newer();
+#endif
+    get_slot_footer(SYM_ADDR(__header_app_start__), crc_api_check_primary_app(),
+                    &slot_info.slots[COM_PROTO_SLOT_PRIMARY]);
+    get_slot_footer(SYM_ADDR(__header_app_secondary_start__), crc_api_check_secondary_app(),
+                    &slot_info.slots[COM_PROTO_SLOT_SECONDARY]);
+    slot_info.download_slot = (flash_api_find_download_slot() == FLASH_API_SLOT_PRIMARY) ? COM_PROTO_SLOT_PRIMARY
+                                                                                         : COM_PROTO_SLOT_SECONDARY;
+
+    memcpy(payload, &slot_info, sizeof(slot_info));
+    return sizeof(slot_info);
+}
+
+#ifdef BL_PROFILING
+/**
+ * @brief Handler for the COM_PROTO_DATA_TYPE_PROFILE data type. Reports the accumulated measurements of the profiled
+ *        regions, from the requested first region on, as many as fit in the payload.
+ *
+ * @param req
+ * @param req_len
+ * @param payload
+ * @param max_len
+ * @return uint16_t
+ */
+static uint16_t
+profile_data_handler(uint8_t const *req, uint16_t req_len, uint8_t *payload, uint16_t max_len)
+{
+    struct com_proto_profile_s profile      = { 0 };
+    uint8_t                    first_region = 0;
+
+    // The first region is optional
+    if (req_len == sizeof(struct com_proto_req_profile_s))
+    {
+        first_region = ((struct com_proto_req_profile_s const *)req)->first_region;
+    }
+    if (first_region > PROF_REGION_COUNT)
+    {
+        return 0;
+    }
+
+    uint8_t region_count = PROF_REGION_COUNT - first_region;
+    if (region_count > COM_PROTO_MAX_PROFILE_REGIONS)
+    {
+        region_count = COM_PROTO_MAX_PROFILE_REGIONS;
+    }
+
+    uint16_t payload_len
+        = offsetof(struct com_proto_profile_s, regions) + region_count * sizeof(struct com_proto_profile_region_s);
+    if (payload_len > max_len)
+    {
+        return 0;
+    }
+
+    profile.region_count = PROF_REGION_COUNT;
+    profile.first_region = first_region;
+    for (uint8_t i = 0; i < region_count; i++)
+    {
+        struct prof_region_stats_s stats;
+        prof_get_region_stats(first_region + i, &stats);
+        profile.regions[i].calls        = stats.calls;
+        profile.regions[i].total_cycles = stats.total_ticks;
+        profile.regions[i].min_cycles   = stats.min_ticks;
+        profile.regions[i].max_cycles   = stats.max_ticks;
+    }
+
+    memcpy(payload, &profile, payload_len);
+    return payload_len;
+}
+#endif
+
+// --- CMD TYPE HANDLERS ---
+/**
+ * @brief Handler for the COM_PROTO_CMD_SET_BAUDRATE command. Only validates the baud rate: the switch happens after
+ *        the OP_RESULT response is sent at the current baud rate.
+ *
+ * @param cmd
+ * @param cmd_len
+ * @return uint8_t
+ */
+static uint8_t
+set_baudrate_cmd_handler(uint8_t const *cmd, uint16_t cmd_len)
+{
+    if (cmd_len != sizeof(struct com_proto_cmd_set_baudrate_s))
+    {
+        return COM_PROTO_OP_RESULT_GENERIC_ERR;
+    }
+
+    struct com_proto_cmd_set_baudrate_s const *set_baudrate = (struct com_proto_cmd_set_baudrate_s const *)cmd;
+    if (!uart_driver_is_baudrate_supported(set_baudrate->baudrate))
+    {
+        return COM_PROTO_OP_RESULT_GENERIC_ERR;
+    }
+
+    pending_baudrate = set_baudrate->baudrate;
+    return COM_PROTO_OP_RESULT_NO_ERR;
+}
+
+/**
+ * @brief Handler for the COM_PROTO_CMD_REBOOT command. The reset follows the response (see
+ *        com_proto_apply_pending_reboot): the next boot installs a newer secondary image, or boots the application.
+ *
+ * @param cmd
+ * @param cmd_len
+ * @return uint8_t enum com_protocol_op_results_e
+ */
+static uint8_t
+reboot_cmd_handler(uint8_t const *cmd, uint16_t cmd_len)
+{
+    (void)cmd;
+    if (cmd_len != sizeof(struct com_proto_cmd_s))
+    {
+        return COM_PROTO_OP_RESULT_GENERIC_ERR;
+    }
+
+    is_reboot_pending = true;
+    return COM_PROTO_OP_RESULT_NO_ERR;
 }
 
 // --- RESPONSE HANDLERS ---
@@ -382,6 +1327,7 @@ fwug_status_response_handler(void)
         .op_result        = op_result_status,
         .is_active        = firmware_update_state.is_update_started,
         .packets_received = firmware_update_state.packets_received,
+        .packet_size      = firmware_update_state.packet_size,
         .msg_footer.crc16 = 0,
     };
 
@@ -390,23 +1336,31 @@ fwug_status_response_handler(void)
     com_proto_message_handle_encryption((uint8_t *)&response_msg, COM_PROTO_MSG_TYPE_FWUG_STATUS);
 #endif
 
-    // Calculate the CRC16
-    response_msg.msg_footer.crc16
-        = crc16_driver_calculate((uint8_t *)&response_msg, sizeof(struct com_proto_fwug_status_s) - 1);
-
-    // Send the response message
-    uart_tx_data((uint8_t *)&response_msg, response_msg.msg_header.len);
+    // Calculate the CRC16 and send the response message
+    com_proto_send_response((uint8_t *)&response_msg, response_msg.msg_header.len);
 }
 
 /**
- * @brief Handler for the DATA response message
+ * @brief Handler for the DATA response message. Sends the DATA message prepared by the REQ_DATA handler, or the
+ *        operation result if the request could not be served.
  *
  * @param data
  */
 static void
 data_response_handler(void)
 {
-    // Empty function
+    if (op_result_status != COM_PROTO_OP_RESULT_NO_ERR)
+    {
+        op_result_response_handler();
+        return;
+    }
+
+#if IS_COM_PROTO_MSG_TYPE_DATA_ENC
+    // Handle possible encryption of the response message
+    com_proto_message_handle_encryption((uint8_t *)&data_response_msg, COM_PROTO_MSG_TYPE_DATA);
+#endif
+
+    com_proto_send_response((uint8_t *)&data_response_msg, data_response_msg.msg_header.len);
 }
 
 /**
@@ -428,9 +1382,68 @@ op_result_response_handler(void)
     // Handle possible encryption of the response message
     com_proto_message_handle_encryption((uint8_t *)&response_msg, COM_PROTO_MSG_TYPE_OP_RESULT);
 #endif
-    response_msg.msg_footer.crc16
-        = crc16_driver_calculate((uint8_t *)&response_msg, sizeof(struct com_proto_op_result_s) - 1);
-    uart_tx_data((uint8_t *)&response_msg, response_msg.msg_header.len);
+    com_proto_send_response((uint8_t *)&response_msg, response_msg.msg_header.len);
+}
+
+/**
+ * @brief Function to append the CRC16 to a response message and send it. The CRC16 covers the whole message except
+ *        the footer and is stored big endian, the same way as in the received messages.
+ *
+ * @param tx_buffer The response message, including space for the footer.
+ * @param msg_len The total response message length.
+ */
+static void
+com_proto_send_response(uint8_t *tx_buffer, uint16_t msg_len)
+{
+    if (is_broadcast_frame)
+    {
+        // No node answers a broadcast frame: the answers would collide on the bus
+        return;
+    }
+
+    uint16_t crc_16 = crc16_driver_calculate(tx_buffer, msg_len - sizeof(struct com_proto_msg_footer_s));
+    tx_buffer[msg_len - 2] = (uint8_t)(crc_16 >> 8);
+    tx_buffer[msg_len - 1] = (uint8_t)(crc_16 & 0xFF);
+
+    uart_tx_data(tx_buffer, msg_len);
+}
+
+/**
+ * @brief Function to reset the device once the response to COM_PROTO_CMD_REBOOT is sent (the uart transmission is
+ *        blocking).
+ *
+ */
+static void
+com_proto_apply_pending_reboot(void)
+{
+    if (!is_reboot_pending)
+    {
+        return;
+    }
+
+    TRACE_LOG("Rebooting...\r\n");
+    sys_reset();
+}
+
+/**
+ * @brief Function to switch to the baud rate requested by COM_PROTO_CMD_SET_BAUDRATE, once its response is sent. The
+ *        switch stays unconfirmed until a valid frame is received at the new baud rate (see com_protocol_process).
+ *
+ */
+static void
+com_proto_apply_pending_baudrate(void)
+{
+    if (pending_baudrate == 0)
+    {
+        return;
+    }
+
+    if (uart_driver_set_baudrate(pending_baudrate))
+    {
+        baudrate_switch_tick_ms = sys_get_tick_ms();
+        is_baudrate_unconfirmed = true;
+    }
+    pending_baudrate = 0;
 }
 
 /**
@@ -470,6 +1483,25 @@ com_protocol_init(void)
 {
     // Register the RX callback function with the UART driver
     uart_driver_register_rx_callback(com_process_rx_data);
+    // Frames are of variable length: the uart driver decodes the frame length from the msg header
+    uart_driver_register_rx_frame_len_callback(com_get_rx_frame_len, sizeof(struct com_proto_msg_header_s));
+}
+
+/**
+ * @brief Periodic processing of the communication protocol, out of the uart interrupt context. If the host does not
+ *        send a valid frame within COM_PROTO_BAUDRATE_CONFIRM_TIMEOUT_MS after a baud rate switch, the uart falls back
+ *        to the default baud rate, so that the host can always reach the bootloader again.
+ */
+void
+com_protocol_process(void)
+{
+    if (is_baudrate_unconfirmed
+        && ((sys_get_tick_ms() - baudrate_switch_tick_ms) >= COM_PROTO_BAUDRATE_CONFIRM_TIMEOUT_MS))
+    {
+        is_baudrate_unconfirmed = false;
+        uart_driver_set_baudrate(UART_DEFAULT_BAUDRATE);
+        TRACE_LOG("Baud rate switch not confirmed, falling back to %lu\r\n", (unsigned long)UART_DEFAULT_BAUDRATE);
+    }
 }
 
 /**
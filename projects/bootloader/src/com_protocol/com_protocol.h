@@ -14,7 +14,44 @@
 #include <stddef.h>
 
 // --- defines ---------------------------------------------------------------------------------------------------------
-#define FIRMWARE_UPDATE_PACKET_SIZE 128
+#define COM_PROTO_VERSION 2 // Protocol revision 2: 16-bit msg length, negotiable firmware update packet size
+
+// Firmware update packet size limits. The actual packet size is negotiated during FWUG_START: the host proposes a size
+// and the bootloader answers (FWUG_STATUS) with the size it accepted. Sizes are powers of two within the limits below.
+#define FIRMWARE_UPDATE_MIN_PACKET_SIZE     128
+#define FIRMWARE_UPDATE_MAX_PACKET_SIZE     2048 // Bounded by the RAM reserved for the uart rx buffer
+#define FIRMWARE_UPDATE_DEFAULT_PACKET_SIZE FIRMWARE_UPDATE_MIN_PACKET_SIZE
+
+// Packets of a firmware update that can be received out of order (broadcast on a shared bus) and reported as missing:
+// application slot size (224K) / FIRMWARE_UPDATE_MIN_PACKET_SIZE. Bounds the map of the received packets (see
+// firmware_update_get_missing_packets). A larger download space (BL_DIRECT_INSTALL) needs larger broadcast packets.
+#define FIRMWARE_UPDATE_MAX_PACKET_COUNT 1792
+
+// Largest frame that can be received (FWUG_DATA_AT): header (3 bytes) + offset (4 bytes) + payload + crc16 (2 bytes)
+#define COM_PROTO_MAX_FRAME_SIZE (3 + 4 + FIRMWARE_UPDATE_MAX_PACKET_SIZE + 2)
+// Largest addressed frame (shared bus): header (3 bytes) + address (1 byte) + frame + crc16 (2 bytes)
+#define COM_PROTO_MAX_ADDRESSED_FRAME_SIZE (3 + 1 + COM_PROTO_MAX_FRAME_SIZE + 2)
+// Address of an addressed frame, that every node of the bus processes (and none answers)
+#define COM_PROTO_ADDRESS_BROADCAST 0xFF
+
+// Largest payload of a DATA message (response to REQ_DATA)
+#define COM_PROTO_MAX_DATA_PAYLOAD_SIZE 256
+// Max number of flash sectors that can be reported in the capabilities
+#define COM_PROTO_MAX_FLASH_SECTORS 16
+// Max number of image chunks that can be reported in an image check
+#define COM_PROTO_MAX_IMAGE_CHUNKS 16
+// Size of the signature stored in the image footer (ECDSA P-256: r and s)
+#define COM_PROTO_SIGNATURE_SIZE 64
+// Max number of chunk checksums per COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS request: what fits a DATA payload after the
+// slot, offset, chunk size and chunk count
+#define COM_PROTO_MAX_CHUNK_CHECKSUMS ((COM_PROTO_MAX_DATA_PAYLOAD_SIZE - 10) / 4)
+// Max number of profiled regions per COM_PROTO_DATA_TYPE_PROFILE response: what fits a DATA payload after the region
+// count and the first region (20 bytes per region)
+#define COM_PROTO_MAX_PROFILE_REGIONS ((COM_PROTO_MAX_DATA_PAYLOAD_SIZE - 2) / 20)
+// Number of frames the host may send before waiting for a response (stop-and-wait)
+#define COM_PROTO_WINDOW_DEPTH 1
+// Time to receive a valid frame at a new baud rate, before falling back to the default baud rate
+#define COM_PROTO_BAUDRATE_CONFIRM_TIMEOUT_MS 2000
 
 // --- enums -----------------------------------------------------------------------------------------------------------
 // clang-format off
@@ -35,7 +72,70 @@ enum com_protocol_op_results_e {
  *
  */
 enum com_protocol_data_types_e {
-    COM_PROTO_DATA_TYPE_DEBUG_INF = 0xD0, /* Data type: debug statistics */
+    COM_PROTO_DATA_TYPE_DEBUG_INF       = 0xD0, /* Data type: debug statistics */
+    COM_PROTO_DATA_TYPE_CAPABILITIES    = 0xD1, /* Data type: bootloader capabilities (HELLO) */
+    COM_PROTO_DATA_TYPE_TRACE           = 0xD2, /* Data type: deferred trace records (BL_TRACE builds) */
+    COM_PROTO_DATA_TYPE_IMAGE_CHECK     = 0xD3, /* Data type: damaged chunks of an application image */
+    COM_PROTO_DATA_TYPE_MISSING_PACKETS = 0xD4, /* Data type: packets of the firmware update not received yet */
+    COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS = 0xD5, /* Data type: packets of an interrupted download, to resume it */
+    COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS   = 0xD6, /* Data type: CRC32 of the chunks of a slot range */
+    COM_PROTO_DATA_TYPE_SLOT_INFO         = 0xD7, /* Data type: footers of both slots and their verification */
+    COM_PROTO_DATA_TYPE_PROFILE           = 0xD8, /* Data type: profiled regions summary (BL_PROFILING builds) */
+};
+
+/**
+ * @brief Application slots, as selected in the COM_PROTO_DATA_TYPE_IMAGE_CHECK and CHUNK_CHECKSUMS requests
+ *
+ */
+enum com_protocol_slots_e {
+    COM_PROTO_SLOT_PRIMARY   = 0x00,
+    COM_PROTO_SLOT_SECONDARY = 0x01,
+    COM_PROTO_SLOT_COUNT,
+};
+
+/**
+ * @brief Flags of the COM_PROTO_DATA_TYPE_DEBUG_INF request
+ *
+ */
+enum com_protocol_debug_inf_flags_e {
+    COM_PROTO_DEBUG_INF_FLAG_NONE  = 0x00,
+    COM_PROTO_DEBUG_INF_FLAG_CLEAR = 0x01, /* Clear the statistics, after reading them */
+};
+
+/**
+ * @brief Optional protocol features, reported as a bitmask in the capabilities (COM_PROTO_DATA_TYPE_CAPABILITIES)
+ *
+ */
+enum com_protocol_features_e {
+    COM_PROTO_FEATURE_NONE            = 0x00000000,
+    COM_PROTO_FEATURE_BAUDRATE_SWITCH = 0x00000001, /* COM_PROTO_CMD_SET_BAUDRATE is supported */
+    COM_PROTO_FEATURE_DIRECT_INSTALL  = 0x00000002, /* The updates are downloaded to the primary slot (no fallback) */
+    COM_PROTO_FEATURE_BUS_ADDRESSING  = 0x00000004, /* Node of a shared bus: addressed frames only (BL_BUS_ADDRESS) */
+    COM_PROTO_FEATURE_FEC             = 0x00000008, /* FWUG_PARITY, FEC sessions (com_proto_fwug_start_fec_s) */
+    COM_PROTO_FEATURE_RESUME          = 0x00000010, /* Resumable downloads (com_proto_fwug_start_resume_s) */
+    COM_PROTO_FEATURE_SPARSE          = 0x00000020, /* FWUG_DATA_AT: only the populated ranges of an image are sent */
+    COM_PROTO_FEATURE_CHUNK_CHECKSUMS = 0x00000040, /* COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS is supported */
+    COM_PROTO_FEATURE_SLOT_INFO       = 0x00000080, /* COM_PROTO_DATA_TYPE_SLOT_INFO and COM_PROTO_CMD_REBOOT */
+    COM_PROTO_FEATURE_DIRECT_XIP      = 0x00000100, /* Both slots boot in place: download to the reported slot */
+};
+
+/**
+ * @brief Image compression formats, reported as a bitmask in the capabilities. No compression is always supported.
+ *
+ */
+enum com_protocol_compression_formats_e {
+    COM_PROTO_COMPRESSION_NONE = 0x00,
+    COM_PROTO_COMPRESSION_LZ   = 0x01, /* Compressed secondary image (lz_decompress.h), decompressed on install */
+};
+
+/**
+ * @brief Image delta (differential update) formats, reported as a bitmask in the capabilities. A full image is always
+ *        supported.
+ *
+ */
+enum com_protocol_delta_formats_e {
+    COM_PROTO_DELTA_NONE       = 0x00,
+    COM_PROTO_DELTA_CHUNK_COPY = 0x01, /* FWUG_COPY: the unchanged ranges are copied from the primary slot */
 };
 
 /**
@@ -47,6 +147,8 @@ enum com_protocol_cmd_types_e {
     COM_PROTO_CMD_TEST_BACKUP_IMG     = 0xC1,
     COM_PROTO_CMD_VALIDATE_BACKUP_IMG = 0xC2,
     COM_PROTO_CMD_ERASE_BACKUP_IMG    = 0xC3,
+    COM_PROTO_CMD_SET_BAUDRATE        = 0xC4, /* Switch the uart to a new baud rate (confirmed by the next frame) */
+    COM_PROTO_CMD_REBOOT              = 0xC5, /* Reset, once the response is sent (e.g. to install a staged image) */
 };
 
 /**
@@ -68,7 +170,13 @@ enum com_protocol_msg_types_e {
     COM_PROTO_MSG_TYPE_CMD         = 0x07, /* Message that will contain a command for the bootloader */
     /* Operation result */
     COM_PROTO_MSG_TYPE_OP_RESULT   = 0x08, /* Message that contains the operation result (error codes) */
-    COM_PROTO_MSG_TYPE_END         = 0x09, /* End of the message types */
+    /* Shared bus */
+    COM_PROTO_MSG_TYPE_ADDRESSED   = 0x09, /* Message that carries a frame for one node of the bus, or for all nodes */
+    /* Firmware update forward error correction */
+    COM_PROTO_MSG_TYPE_FWUG_PARITY = 0x0A, /* Message that contains the parity of a group of firmware update packets */
+    COM_PROTO_MSG_TYPE_FWUG_DATA_AT = 0x0B, /* Message that contains firmware update data, at an offset of the image */
+    COM_PROTO_MSG_TYPE_FWUG_COPY   = 0x0C, /* Message to copy a range of the primary image to the download space */
+    COM_PROTO_MSG_TYPE_END         = 0x0D, /* End of the message types */
 };
 // clang-format on
 
@@ -85,10 +193,10 @@ enum com_protocol_msg_types_e {
  */
 struct com_proto_msg_type_settings_s
 {
-    uint8_t is_encrypted : 1;
-    uint8_t response_msg_type : 7;
-    uint8_t enc_start_byte;
-    uint8_t enc_end_byte;
+    uint8_t  is_encrypted : 1;
+    uint8_t  response_msg_type : 7;
+    uint16_t enc_start_byte;
+    uint16_t enc_end_byte;
 } __attribute__((packed));
 
 // TODO: GPA: pack the structures!!!
@@ -98,8 +206,8 @@ struct com_proto_msg_type_settings_s
  */
 struct com_proto_msg_header_s
 {
-    uint8_t type;
-    uint8_t len; // Message length can be at most 255 bytes
+    uint8_t  type;
+    uint16_t len; // Message length (header + payload + crc16), little endian
 } __attribute__((packed));
 
 /**
@@ -118,18 +226,111 @@ struct com_proto_msg_footer_s
 struct com_proto_fwug_start_s
 {
     struct com_proto_msg_header_s msg_header;
+    uint16_t                      packet_size; // Packet size proposed by the host (0: use the default)
     struct com_proto_msg_footer_s msg_footer;
 } __attribute__((packed));
 
 /**
- * @brief Structure of COM_PROTO_MSG_TYPE_FWUG_DATA
+ * @brief Structure of COM_PROTO_MSG_TYPE_FWUG_START, for a FEC session (COM_PROTO_FEATURE_FEC). The host sends a
+ *        FWUG_PARITY packet after every fec_group_size FWUG_DATA packets, without waiting for their responses: the
+ *        packets are accepted with gaps, and a single lost packet of a group is rebuilt from the parity packet.
+ *
+ */
+struct com_proto_fwug_start_fec_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint16_t                      packet_size;    // Packet size proposed by the host (0: use the default)
+    uint8_t                       fec_group_size; // FWUG_DATA packets per FWUG_PARITY packet (0: no FEC)
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_FWUG_START, to resume an interrupted download (COM_PROTO_FEATURE_RESUME).
+ *        The host identifies the packets it expects to find in the download space by their CRC32 (see
+ *        COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS). If the download space holds exactly them, the session starts after
+ *        them, without an erase. Otherwise, the session starts from the first packet, as a regular FWUG_START. The
+ *        FWUG_STATUS response tells which one (packets_received).
+ *
+ */
+struct com_proto_fwug_start_resume_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint16_t                      packet_size;    // Packet size proposed by the host (0: use the default)
+    uint8_t                       fec_group_size; // FWUG_DATA packets per FWUG_PARITY packet (0: no FEC)
+    uint16_t                      packet_count;   // Packets already in the download space
+    uint32_t                      prefix_crc32;   // CRC32 of these packets (the last one padded with 0xFF)
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_FWUG_DATA. NOTE: The payload length is the negotiated packet size, so the
+ *        footer directly follows the last payload byte. The msg_footer member is only valid for the max packet size.
  *
  */
 struct com_proto_fwug_data_s
 {
     struct com_proto_msg_header_s msg_header;
     uint16_t                      packet_number; // This number is 0-based
-    uint8_t                       payload[FIRMWARE_UPDATE_PACKET_SIZE];
+    uint8_t                       payload[FIRMWARE_UPDATE_MAX_PACKET_SIZE];
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+// Length of a FWUG_DATA message, carrying a payload of the given packet size
+#define COM_PROTO_FWUG_DATA_MSG_LEN(packet_size) \
+    (offsetof(struct com_proto_fwug_data_s, payload) + (packet_size) + sizeof(struct com_proto_msg_footer_s))
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_FWUG_PARITY. The payload is the XOR of the group_size packets that start at
+ *        packet_number (the last packet of the image is padded with 0xFF, as in its FWUG_DATA message). NOTE: The
+ *        payload length is the negotiated packet size, so the footer directly follows the last payload byte. The
+ *        msg_footer member is only valid for the max packet size.
+ *
+ */
+struct com_proto_fwug_parity_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint16_t                      packet_number; // First packet of the group (0-based)
+    uint8_t                       group_size;    // Packets of the group (the last group of the image can be shorter)
+    uint8_t                       payload[FIRMWARE_UPDATE_MAX_PACKET_SIZE];
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+// Length of a FWUG_PARITY message, carrying a payload of the given packet size
+#define COM_PROTO_FWUG_PARITY_MSG_LEN(packet_size) \
+    (offsetof(struct com_proto_fwug_parity_s, payload) + (packet_size) + sizeof(struct com_proto_msg_footer_s))
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_FWUG_DATA_AT (COM_PROTO_FEATURE_SPARSE). A populated range of the image (or a
+ *        part of it), at its offset from the start of the image. The ranges of an image must be sent in ascending
+ *        order: the gaps between them keep the erased value of the download space, so they are neither sent nor
+ *        programmed. NOTE: The payload length (word multiple, up to the negotiated packet size) is given by the
+ *        message length, so the footer directly follows the last payload byte. The msg_footer member is only valid for
+ *        the max packet size.
+ *
+ */
+struct com_proto_fwug_data_at_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint32_t                      offset; // Offset of the payload from the start of the image (word aligned)
+    uint8_t                       payload[FIRMWARE_UPDATE_MAX_PACKET_SIZE];
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+// Length of a FWUG_DATA_AT message, carrying a payload of the given length
+#define COM_PROTO_FWUG_DATA_AT_MSG_LEN(payload_len) \
+    (offsetof(struct com_proto_fwug_data_at_s, payload) + (payload_len) + sizeof(struct com_proto_msg_footer_s))
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_FWUG_COPY (COM_PROTO_DELTA_CHUNK_COPY). A range of the update that the primary
+ *        slot already holds at the same offset (see COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS): the bootloader copies it to
+ *        the download space, instead of receiving it. Sent in ascending order, along with the FWUG_DATA_AT ranges.
+ *
+ */
+struct com_proto_fwug_copy_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint32_t                      offset; // Offset of the range from the start of the image (word aligned)
+    uint32_t                      length; // Length of the range (word multiple)
     struct com_proto_msg_footer_s msg_footer;
 } __attribute__((packed));
 
@@ -143,6 +344,7 @@ struct com_proto_fwug_status_s
     uint8_t                       op_result; // Same error code as in COM_PROTO_MSG_TYPE_OP_RESULT
     uint8_t                       is_active;
     uint16_t                      packets_received; // This number is 1-based
+    uint16_t                      packet_size;      // Packet size accepted by the bootloader for this session
     struct com_proto_msg_footer_s msg_footer;
 } __attribute__((packed));
 
@@ -156,6 +358,302 @@ struct com_proto_fwug_cancel_s
     struct com_proto_msg_footer_s msg_footer;
 } __attribute__((packed));
 
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_REQ_DATA
+ *
+ */
+struct com_proto_req_data_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       data_type; // enum com_protocol_data_types_e
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_REQ_DATA, for COM_PROTO_DATA_TYPE_DEBUG_INF. The flags are optional
+ *        (enum com_protocol_debug_inf_flags_e). The DATA payload is struct stats_s (see stats.h).
+ *
+ */
+struct com_proto_req_debug_inf_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       data_type; // COM_PROTO_DATA_TYPE_DEBUG_INF
+    uint8_t                       flags;
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_DATA. NOTE: The payload length depends on the data type, so the footer
+ *        directly follows the last payload byte. The msg_footer member is only valid for the max payload size.
+ *
+ */
+struct com_proto_data_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       data_type; // enum com_protocol_data_types_e
+    uint8_t                       payload[COM_PROTO_MAX_DATA_PAYLOAD_SIZE];
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+// Length of a DATA message, carrying a payload of the given size
+#define COM_PROTO_DATA_MSG_LEN(payload_size) \
+    (offsetof(struct com_proto_data_s, payload) + (payload_size) + sizeof(struct com_proto_msg_footer_s))
+
+/**
+ * @brief Flash sector description, as reported in the capabilities
+ *
+ */
+struct com_proto_flash_sector_s
+{
+    uint32_t start_address;
+    uint32_t size;
+} __attribute__((packed));
+
+/**
+ * @brief Payload of a DATA message of type COM_PROTO_DATA_TYPE_CAPABILITIES. Lets the host discover what this
+ *        bootloader build supports, before starting any operation. Only flash_sector_count sectors are sent.
+ *
+ */
+struct com_proto_capabilities_s
+{
+    uint8_t                         proto_version;       // COM_PROTO_VERSION
+    uint16_t                        max_packet_size;     // Max firmware update packet size
+    uint8_t                         window_depth;        // Frames in flight before a response is needed
+    uint8_t                         compression_formats; // Bitmask of enum com_protocol_compression_formats_e
+    uint8_t                         delta_formats;       // Bitmask of enum com_protocol_delta_formats_e
+    uint32_t                        max_baudrate;        // Highest uart baud rate the bootloader can switch to
+    uint32_t                        features;            // Bitmask of enum com_protocol_features_e
+    uint32_t                        app_primary_start;   // Primary application slot start address
+    uint32_t                        app_primary_size;    // Primary application slot size in bytes
+    uint32_t                        app_secondary_start; // Secondary application slot start address
+    uint32_t                        app_secondary_size;  // Secondary application slot size in bytes
+    uint8_t                         flash_sector_count;
+    struct com_proto_flash_sector_s flash_sectors[COM_PROTO_MAX_FLASH_SECTORS];
+} __attribute__((packed));
+
+/**
+ * @brief Payload of a DATA message of type COM_PROTO_DATA_TYPE_TRACE. Carries as many whole trace records as fit, and
+ *        removes them from the trace buffer. The host repeats the request until no records are returned. Each record
+ *        is: header word (format string id: bits 0-23, number of arguments: bits 24-31), timestamp (us), arguments
+ *        (32bit words). The format string id is its offset in the .trace_fmt section of the bootloader elf.
+ *
+ */
+struct com_proto_trace_s
+{
+    uint32_t dropped; // Records dropped since boot, because the trace buffer was full
+    uint32_t records[(COM_PROTO_MAX_DATA_PAYLOAD_SIZE - sizeof(uint32_t)) / sizeof(uint32_t)];
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_REQ_DATA, for COM_PROTO_DATA_TYPE_IMAGE_CHECK
+ *
+ */
+struct com_proto_req_image_check_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       data_type; // COM_PROTO_DATA_TYPE_IMAGE_CHECK
+    uint8_t                       slot;      // enum com_protocol_slots_e
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+/**
+ * @brief Image chunk description, as reported in an image check
+ *
+ */
+struct com_proto_image_chunk_s
+{
+    uint32_t start_address;
+    uint32_t size;
+} __attribute__((packed));
+
+/**
+ * @brief Payload of a DATA message of type COM_PROTO_DATA_TYPE_IMAGE_CHECK. Every chunk of the image index (see
+ *        image_index.h) is checked, and the damaged ones are reported. Only chunk_count chunks are sent: no chunks
+ *        means that the image in the slot has no index (or the slot holds a compressed image).
+ *
+ */
+struct com_proto_image_check_s
+{
+    uint8_t                        slot;           // enum com_protocol_slots_e
+    uint32_t                       damaged_chunks; // Bitmask of the damaged chunks (bit i: chunks[i])
+    uint8_t                        chunk_count;
+    struct com_proto_image_chunk_s chunks[COM_PROTO_MAX_IMAGE_CHUNKS];
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_REQ_DATA, for COM_PROTO_DATA_TYPE_MISSING_PACKETS
+ *
+ */
+struct com_proto_req_missing_packets_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       data_type;    // COM_PROTO_DATA_TYPE_MISSING_PACKETS
+    uint16_t                      packet_count; // Number of packets of the image, as known by the host
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+/**
+ * @brief Payload of a DATA message of type COM_PROTO_DATA_TYPE_MISSING_PACKETS. After a broadcast firmware update, each
+ *        node reports the packets it has not received, so that the host only resends those. Only the bytes of the
+ *        bitmap that cover packet_count packets are sent.
+ *
+ */
+struct com_proto_missing_packets_s
+{
+    uint8_t  is_active;     // A firmware update session is active
+    uint16_t packet_size;   // Packet size of the session
+    uint16_t packet_count;  // As requested (bounded by FIRMWARE_UPDATE_MAX_PACKET_COUNT)
+    uint16_t missing_count; // Number of bits set in missing
+    uint8_t  missing[FIRMWARE_UPDATE_MAX_PACKET_COUNT / 8]; // Bit i (byte i / 8, bit i % 8): packet i is missing
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_REQ_DATA, for COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS
+ *
+ */
+struct com_proto_req_download_progress_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       data_type;   // COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS
+    uint16_t                      packet_size; // Packet size the host will propose in FWUG_START
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+/**
+ * @brief Payload of a DATA message of type COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS. The packets written to the download
+ *        space (up to its last programmed word), by a download that was cancelled or interrupted by a reset. The host
+ *        compares the CRC32 with the one of the same packets of its image, to decide whether to resume the download.
+ *
+ */
+struct com_proto_download_progress_s
+{
+    uint16_t packet_size;  // Packet size that the bootloader will accept in FWUG_START
+    uint16_t packet_count; // Packets in the download space
+    uint32_t prefix_crc32; // CRC32 of these packets
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_REQ_DATA, for COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS
+ *
+ */
+struct com_proto_req_chunk_checksums_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       data_type;   // COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS
+    uint8_t                       slot;        // enum com_protocol_slots_e
+    uint32_t                      offset;      // Offset of the first chunk, from the start of the slot
+    uint32_t                      chunk_size;  // Bytes per chunk
+    uint8_t                       chunk_count; // Up to COM_PROTO_MAX_CHUNK_CHECKSUMS
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+/**
+ * @brief Payload of a DATA message of type COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS. The CRC32 of each chunk of the
+ *        requested range: the host compares them with the chunks of its image, to send only the chunks that differ.
+ *        Only chunk_count checksums are sent.
+ *
+ */
+struct com_proto_chunk_checksums_s
+{
+    uint8_t  slot;
+    uint32_t offset;
+    uint32_t chunk_size;
+    uint8_t  chunk_count;
+    uint32_t crc32[COM_PROTO_MAX_CHUNK_CHECKSUMS];
+} __attribute__((packed));
+
+/**
+ * @brief Footer of the image in a slot, as reported in the COM_PROTO_DATA_TYPE_SLOT_INFO data type
+ *
+ */
+struct com_proto_slot_footer_s
+{
+    uint32_t crc32;                               // CRC32 of the image, as stored in the footer
+    uint8_t  fw_version[4];                       // Version bytes of the footer
+    uint8_t  signature[COM_PROTO_SIGNATURE_SIZE]; // Signature of the image
+    uint8_t  is_crc_ok;                           // The image matches its CRC32 (checked on request)
+} __attribute__((packed));
+
+/**
+ * @brief Payload of a DATA message of type COM_PROTO_DATA_TYPE_SLOT_INFO. The footers identify the images of the slots:
+ *        the host compares them with the footer of its image, to skip an update that a slot already holds. The boot
+ *        path flags are the outcome of the checks of the last boot (enum boot_info_path_flags_e, e.g. an update that
+ *        was rejected), and is_secondary_newer tells whether the next boot installs the secondary image (or boots it in
+ *        place, with COM_PROTO_FEATURE_DIRECT_XIP). The next update is downloaded to download_slot: with
+ *        COM_PROTO_FEATURE_DIRECT_XIP, the slot that does not hold the booted image, and the host sends the image built
+ *        for that slot.
+ *
+ */
+struct com_proto_slot_info_s
+{
+    uint32_t                       boot_path_flags;
+    uint8_t                        is_secondary_newer;
+    struct com_proto_slot_footer_s slots[COM_PROTO_SLOT_COUNT]; // Indexed by enum com_protocol_slots_e
+    uint8_t                        download_slot;               // enum com_protocol_slots_e
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_REQ_DATA, for COM_PROTO_DATA_TYPE_PROFILE. The first region is optional (0 if
+ *        omitted): the host requests the following regions, until it has all the region_count regions.
+ *
+ */
+struct com_proto_req_profile_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       data_type; // COM_PROTO_DATA_TYPE_PROFILE
+    uint8_t                       first_region;
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+/**
+ * @brief Accumulated measurements of a profiled region, as reported in the COM_PROTO_DATA_TYPE_PROFILE data type
+ *
+ */
+struct com_proto_profile_region_s
+{
+    uint32_t calls;        // Number of times the region was executed
+    uint64_t total_cycles; // Sum of the cycles spent in the region
+    uint32_t min_cycles;   // Fastest execution
+    uint32_t max_cycles;   // Slowest execution
+} __attribute__((packed));
+
+/**
+ * @brief Payload of a DATA message of type COM_PROTO_DATA_TYPE_PROFILE (BL_PROFILING builds). Carries the profiled
+ *        regions from first_region on (enum prof_region_e order, see profiling.h), as many as fit.
+ *
+ */
+struct com_proto_profile_s
+{
+    uint8_t                           region_count; // Number of profiled regions of the bootloader
+    uint8_t                           first_region;
+    struct com_proto_profile_region_s regions[COM_PROTO_MAX_PROFILE_REGIONS];
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_CMD. Some commands carry extra parameters after the command type.
+ *
+ */
+struct com_proto_cmd_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       cmd; // enum com_protocol_cmd_types_e
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_CMD, for COM_PROTO_CMD_SET_BAUDRATE. The OP_RESULT response is sent at the
+ *        current baud rate. Then the bootloader switches to the new baud rate and expects a valid frame within
+ *        COM_PROTO_BAUDRATE_CONFIRM_TIMEOUT_MS. Otherwise, it falls back to the default baud rate.
+ *
+ */
+struct com_proto_cmd_set_baudrate_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       cmd; // COM_PROTO_CMD_SET_BAUDRATE
+    uint32_t                      baudrate;
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
 /**
  * @brief Structure of COM_PROTO_MSG_TYPE_OP_RESULT
  *
@@ -167,6 +665,27 @@ struct com_proto_op_result_s
     struct com_proto_msg_footer_s msg_footer;
 } __attribute__((packed));
 
+/**
+ * @brief Structure of COM_PROTO_MSG_TYPE_ADDRESSED (BL_BUS_ADDRESS builds). Every node of a shared bus receives every
+ *        frame: a node only processes the frames addressed to it, or broadcast (COM_PROTO_ADDRESS_BROADCAST), and only
+ *        answers the ones addressed to it. The carried frame keeps its own header and CRC16. NOTE: The frame length
+ *        depends on its type, so the footer directly follows the frame. The msg_footer member is only valid for the
+ *        max frame size.
+ *
+ */
+struct com_proto_addressed_s
+{
+    struct com_proto_msg_header_s msg_header;
+    uint8_t                       address; // Node address (BL_BUS_ADDRESS), or COM_PROTO_ADDRESS_BROADCAST
+    uint8_t                       frame[COM_PROTO_MAX_FRAME_SIZE];
+    struct com_proto_msg_footer_s msg_footer;
+} __attribute__((packed));
+
+// Length of an addressed message, carrying a frame of the given length
+#define COM_PROTO_ADDRESSED_MSG_LEN(frame_len) \
+    (offsetof(struct com_proto_addressed_s, frame) + (frame_len) + sizeof(struct com_proto_msg_footer_s))
+
 // --- function declarations -------------------------------------------------------------------------------------------
 void                                        com_protocol_init(void);
+void                                        com_protocol_process(void);
 const struct com_proto_msg_type_settings_s *get_msg_type_settings(enum com_protocol_msg_types_e msg_type);
@@ -0,0 +1,200 @@
+/**
+ * @file lz_decompress.c
+ * @brief Streaming decompression of the compressed (at rest) secondary image (see lz_decompress.h).
+ * @version 0.1
+ * @date 2024-08-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "lz_decompress.h"
+
+#include <stddef.h>
+#include "common.h"
+#include "trace/trace.h"
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#define LZ_WINDOW_MASK        (LZ_WINDOW_SIZE - 1)
+#define LZ_TOKEN_LENGTH_MASK  0x0F
+#define LZ_TOKEN_LITERALS_POS 4
+#define LZ_LENGTH_EXTENDED    15  // A 4bit length of 15 is followed by extension bytes
+#define LZ_LENGTH_BYTE_MAX    255 // An extension byte of 255 is followed by another extension byte
+
+// --- structs ---------------------------------------------------------------------------------------------------------
+/**
+ * @brief State of the decompression output: the window holds the last LZ_WINDOW_SIZE bytes of output
+ *
+ */
+struct lz_output_s
+{
+    uint32_t             len;
+    lz_decompress_sink_t sink;
+    void                *sink_ctx;
+    bool                 is_sink_ok;
+};
+
+// --- static function declarations ------------------------------------------------------------------------------------
+static bool lz_read_length(uint8_t const *src, uint32_t src_len, uint32_t *in, uint32_t *length);
+static void lz_output_byte(struct lz_output_s *output, uint8_t byte);
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+static uint8_t lz_window[LZ_WINDOW_SIZE];
+
+// --- static function definitions -------------------------------------------------------------------------------------
+/**
+ * @brief Function to read the extension bytes of a literals or match length, and add them to the length.
+ *
+ * @param src
+ * @param src_len
+ * @param in Read position in src, advanced past the extension bytes
+ * @param length
+ * @return true
+ * @return false The stream ended in the middle of the length
+ */
+static bool
+lz_read_length(uint8_t const *src, uint32_t src_len, uint32_t *in, uint32_t *length)
+{
+    uint8_t byte;
+
+    do
+    {
+        if (*in >= src_len)
+        {
+            return false;
+        }
+        byte = src[(*in)++];
+        *length += byte;
+    } while (byte == LZ_LENGTH_BYTE_MAX);
+
+    return true;
+}
+
+/**
+ * @brief Function to append a byte to the output window. The window is handed over to the sink, every time it fills.
+ *
+ * @param output
+ * @param byte
+ */
+static void
+lz_output_byte(struct lz_output_s *output, uint8_t byte)
+{
+    lz_window[output->len & LZ_WINDOW_MASK] = byte;
+    output->len++;
+    if (((output->len & LZ_WINDOW_MASK) == 0) && output->is_sink_ok)
+    {
+        output->is_sink_ok = output->sink(output->sink_ctx, lz_window, LZ_WINDOW_SIZE);
+    }
+}
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to get the header of the compressed image in a slot.
+ *
+ * @param slot_start_addr
+ * @param slot_size_bytes Size of the slot, including the footer
+ * @return struct lz_image_header_s const* The header, or NULL if the slot does not hold a (valid) compressed image
+ */
+struct lz_image_header_s const *
+lz_image_get_header(uint32_t slot_start_addr, uint32_t slot_size_bytes)
+{
+    struct lz_image_header_s const *header = (struct lz_image_header_s const *)(uintptr_t)slot_start_addr;
+    uint32_t max_compressed_size = slot_size_bytes - (SYM_ADDR(__header_size_bytes__)) - sizeof(*header);
+
+    if ((header->magic != LZ_IMAGE_MAGIC) || (header->compressed_size > max_compressed_size))
+    {
+        return NULL;
+    }
+
+    return header;
+}
+
+/**
+ * @brief Function to decompress a stream. The output is handed over to the sink, in LZ_WINDOW_SIZE chunks (the last
+ *        one can be shorter). The stream is validated while decompressing: a stream that is truncated, references
+ *        data out of the window or does not decompress to exactly out_len bytes is rejected.
+ *
+ * @param src Compressed stream
+ * @param src_len
+ * @param out_len Expected size of the decompressed output
+ * @param sink
+ * @param sink_ctx Passed to the sink
+ * @return true The whole stream was decompressed and accepted by the sink
+ * @return false
+ */
+bool
+lz_decompress(uint8_t const *src, uint32_t src_len, uint32_t out_len, lz_decompress_sink_t sink, void *sink_ctx)
+{
+    struct lz_output_s output = { .len = 0, .sink = sink, .sink_ctx = sink_ctx, .is_sink_ok = true };
+    uint32_t           in     = 0;
+
+    if ((src == NULL) || (sink == NULL))
+    {
+        return false;
+    }
+
+    while ((in < src_len) && output.is_sink_ok)
+    {
+        uint8_t const token       = src[in++];
+        uint32_t      literal_len = token >> LZ_TOKEN_LITERALS_POS;
+
+        if ((literal_len == LZ_LENGTH_EXTENDED) && !lz_read_length(src, src_len, &in, &literal_len))
+        {
+            return false;
+        }
+        if ((literal_len > (src_len - in)) || (literal_len > (out_len - output.len)))
+        {
+            TRACE_LOG("LZ: literals out of bounds\r\n");
+            return false;
+        }
+        for (uint32_t i = 0; i < literal_len; i++)
+        {
+            lz_output_byte(&output, src[in++]);
+        }
+
+        // The last sequence has no match
+        if (in == src_len)
+        {
+            break;
+        }
+
+        if ((src_len - in) < 2)
+        {
+            return false;
+        }
+        uint32_t const offset    = src[in] | ((uint32_t)src[in + 1] << 8);
+        uint32_t       match_len = (token & LZ_TOKEN_LENGTH_MASK) + LZ_MIN_MATCH;
+        in += 2;
+
+        if (((token & LZ_TOKEN_LENGTH_MASK) == LZ_LENGTH_EXTENDED) && !lz_read_length(src, src_len, &in, &match_len))
+        {
+            return false;
+        }
+        if ((offset == 0) || (offset > LZ_WINDOW_SIZE) || (offset > output.len)
+            || (match_len > (out_len - output.len)))
+        {
+            TRACE_LOG("LZ: match out of bounds (offset %" PRIu32 ", length %" PRIu32 ")\r\n", offset, match_len);
+            return false;
+        }
+        // Byte by byte: the match may overlap the bytes it produces
+        for (uint32_t i = 0; i < match_len; i++)
+        {
+            lz_output_byte(&output, lz_window[(output.len - offset) & LZ_WINDOW_MASK]);
+        }
+    }
+
+    if (!output.is_sink_ok || (output.len != out_len))
+    {
+        TRACE_LOG("LZ: decompressed %" PRIu32 " of %" PRIu32 " bytes\r\n", output.len, out_len);
+        return false;
+    }
+
+    // Hand over the last (partial) window
+    if ((output.len & LZ_WINDOW_MASK) != 0)
+    {
+        return sink(sink_ctx, lz_window, output.len & LZ_WINDOW_MASK);
+    }
+
+    return true;
+}
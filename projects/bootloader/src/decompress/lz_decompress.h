@@ -0,0 +1,54 @@
+/**
+ * @file lz_decompress.h
+ * @brief Streaming decompression of the compressed (at rest) secondary image. The stream is made of LZ4 block format
+ *        sequences (token, literals, 16bit offset, match), with the match offsets limited to LZ_WINDOW_SIZE: the
+ *        decompressed output only needs a window of that size in RAM, and is handed over to a sink, one window at a
+ *        time. The image is compressed by scripts/build_tools/create_dfu_image.py.
+ *
+ *        Compressed secondary slot layout:
+ *        | struct lz_image_header_s | compressed stream | padding (0xFF) | footer (of the decompressed image) |
+ *        The footer (CRC32, version, signature) is the one of the decompressed image, at its usual place.
+ * @version 0.1
+ * @date 2024-08-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef LZ_DECOMPRESS_H
+#define LZ_DECOMPRESS_H
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#define LZ_IMAGE_MAGIC 0x495A4C42 // "BLZI"
+#define LZ_WINDOW_SIZE 4096       // Max match offset. Must be a power of 2 (and match create_dfu_image.py)
+#define LZ_MIN_MATCH   4
+
+// --- structs ---------------------------------------------------------------------------------------------------------
+/**
+ * @brief Header of a compressed image, at the start of the secondary slot
+ *
+ */
+struct lz_image_header_s
+{
+    uint32_t magic;           /**< LZ_IMAGE_MAGIC */
+    uint32_t compressed_size; /**< Size of the compressed stream, right after the header */
+    uint32_t compressed_crc;  /**< CRC32 of the compressed stream */
+    uint32_t image_size;      /**< Size of the decompressed image (without the footer) */
+} __attribute__((packed));
+
+// --- typedefs --------------------------------------------------------------------------------------------------------
+/**
+ * @brief Receives the decompressed output, in order. Returns false to abort the decompression.
+ *
+ */
+typedef bool (*lz_decompress_sink_t)(void *sink_ctx, uint8_t const *data, uint32_t len);
+
+// --- function declarations -------------------------------------------------------------------------------------------
+struct lz_image_header_s const *lz_image_get_header(uint32_t slot_start_addr, uint32_t slot_size_bytes);
+bool lz_decompress(uint8_t const *src, uint32_t src_len, uint32_t out_len, lz_decompress_sink_t sink, void *sink_ctx);
+
+#endif // LZ_DECOMPRESS_H
@@ -14,6 +14,27 @@
 // --- includes --------------------------------------------------------------------------------------------------------
 #include <stdint.h>
 
+// --- defines ---------------------------------------------------------------------------------------------------------
+// Places a function in the .ramfunc section: copied to RAM by the startup code and executed from there. long_call: the
+// function is out of the branch range of the code in flash.
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline, long_call))
+
+// Address of a linker script symbol. Flash addresses are 32bit: the host build maps the flash below 4GB.
+#define SYM_ADDR(symbol) ((uint32_t)(uintptr_t)&(symbol))
+
+// Per function selection of the code executed from RAM (BL_RAMFUNC build option)
+#ifdef BL_RAMFUNC_CRC32
+#define RAMFUNC_CRC32 RAMFUNC
+#else
+#define RAMFUNC_CRC32
+#endif
+
+#ifdef BL_RAMFUNC_SHA256
+#define RAMFUNC_SHA256 RAMFUNC
+#else
+#define RAMFUNC_SHA256
+#endif
+
 // --- external variables ----------------------------------------------------------------------------------------------
 extern uint32_t __flash_app_start__;
 extern uint32_t __flash_app_end__;
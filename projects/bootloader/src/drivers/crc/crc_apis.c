@@ -16,11 +16,14 @@
 #include <stdio.h>
 #include "crc_driver.h"
 #include "common.h"
+#include "trace/trace.h"
+#include "decompress/lz_decompress.h"
+#include "image_index/image_index.h"
 
 // --- function definitions --------------------------------------------------------------------------------------------
 /**
  * @brief Function that checks the primary application's CRC. It calculates the CRC of the primary application and
- * compares it with the stored CRC.
+ * compares it with the stored CRC. An image with an index (see image_index.h) is checked chunk by chunk.
  *
  * @return true
  * @return false
@@ -28,29 +31,43 @@
 bool
 crc_api_check_primary_app(void)
 {
+    uint32_t image_size = (SYM_ADDR(__flash_app_end__)) - (SYM_ADDR(__flash_app_start__))
+                          - (SYM_ADDR(__header_size_bytes__)) + 1;
+    uint32_t stored_crc = *((uint32_t *)(&__header_app_crc_start__));
+    uint32_t chunk_count;
+
+    // An image with an index is checked chunk by chunk, stopping at the first damaged chunk
+    if (image_index_get(SYM_ADDR(__flash_app_start__), image_size, &chunk_count) != NULL)
+    {
+        if (!image_index_check_crc(SYM_ADDR(__flash_app_start__), image_size, stored_crc))
+        {
+            TRACE_LOG("CRC mismatch for primary app (%" PRIu32 " chunks)\r\n", chunk_count);
+            return false;
+        }
+        TRACE_LOG("CRC match for primary app (%" PRIu32 " chunks)\r\n", chunk_count);
+        return true;
+    }
+
     // Calculate the CRC of the primary application
-    uint32_t crc = crc32_driver_calculate((uint8_t *)((uint32_t)&__flash_app_start__),
-                                        ((uint32_t)&__flash_app_end__) - ((uint32_t)&__flash_app_start__)
-                                            - ((uint32_t)&__header_size_bytes__) + 1);
+    uint32_t crc = crc32_driver_calculate((uint8_t *)(SYM_ADDR(__flash_app_start__)), image_size);
 
     // Compare the calculated CRC with the stored CRC
-    uint32_t stored_crc = *((uint32_t *)(&__header_app_crc_start__));
     if (crc != stored_crc)
     {
-#ifdef DEBUG_LOG
-        printf("CRC mismatch for primary app: calculated 0x%08lX, stored 0x%08lX\r\n", crc, stored_crc);
-#endif
+        TRACE_LOG("CRC mismatch for primary app: calculated 0x%08" PRIX32 ", stored 0x%08" PRIX32 "\r\n",
+                  crc,
+                  stored_crc);
         return false;
     }
-#ifdef DEBUG_LOG
-    printf("CRC match for primary app: calculated 0x%08lX, stored 0x%08lX\r\n", crc, stored_crc);
-#endif
+    TRACE_LOG("CRC match for primary app: calculated 0x%08" PRIX32 ", stored 0x%08" PRIX32 "\r\n", crc, stored_crc);
     return true;
 }
 
 /**
  * @brief Function that checks the secondary application's CRC. It calculates the CRC of the secondary application and
- * compares it with the stored CRC.
+ * compares it with the stored CRC. For a compressed secondary image, the CRC of the compressed stream is checked (the
+ * decompressed image is checked during its authentication, see authenticate_compressed_application). An image with an
+ * index (see image_index.h) is checked chunk by chunk.
  *
  * @return true
  * @return false
@@ -58,23 +75,52 @@ crc_api_check_primary_app(void)
 bool
 crc_api_check_secondary_app(void)
 {
+    struct lz_image_header_s const *lz_header = lz_image_get_header(
+        SYM_ADDR(__flash_app_secondary_start__),
+        (SYM_ADDR(__flash_app_secondary_end__)) - (SYM_ADDR(__flash_app_secondary_start__)) + 1);
+    if (lz_header != NULL)
+    {
+        uint32_t lz_crc = crc32_driver_calculate((uint8_t const *)(lz_header + 1), lz_header->compressed_size);
+        if (lz_crc != lz_header->compressed_crc)
+        {
+            TRACE_LOG("CRC mismatch for compressed secondary app: calculated 0x%08" PRIX32
+                      ", stored 0x%08" PRIX32 "\r\n",
+                      lz_crc,
+                      lz_header->compressed_crc);
+            return false;
+        }
+        TRACE_LOG("CRC match for compressed secondary app: 0x%08" PRIX32 "\r\n", lz_crc);
+        return true;
+    }
+
+    uint32_t image_size = (SYM_ADDR(__flash_app_secondary_end__)) - (SYM_ADDR(__flash_app_secondary_start__))
+                          - (SYM_ADDR(__header_size_bytes__)) + 1;
+    uint32_t stored_crc = *((uint32_t *)(&__header_app_secondary_crc_start__));
+    uint32_t chunk_count;
+
+    // An image with an index is checked chunk by chunk, stopping at the first damaged chunk
+    if (image_index_get(SYM_ADDR(__flash_app_secondary_start__), image_size, &chunk_count) != NULL)
+    {
+        if (!image_index_check_crc(SYM_ADDR(__flash_app_secondary_start__), image_size, stored_crc))
+        {
+            TRACE_LOG("CRC mismatch for secondary app (%" PRIu32 " chunks)\r\n", chunk_count);
+            return false;
+        }
+        TRACE_LOG("CRC match for secondary app (%" PRIu32 " chunks)\r\n", chunk_count);
+        return true;
+    }
+
     // Calculate the CRC of the secondary application
-    uint32_t crc
-        = crc32_driver_calculate((uint8_t *)((uint32_t)&__flash_app_secondary_start__),
-                               ((uint32_t)&__flash_app_secondary_end__) - ((uint32_t)&__flash_app_secondary_start__)
-                                   - ((uint32_t)&__header_size_bytes__) + 1);
+    uint32_t crc = crc32_driver_calculate((uint8_t *)(SYM_ADDR(__flash_app_secondary_start__)), image_size);
 
     // Compare the calculated CRC with the stored CRC
-    uint32_t stored_crc = *((uint32_t *)(&__header_app_secondary_crc_start__));
     if (crc != stored_crc)
     {
-#ifdef DEBUG_LOG
-        printf("CRC mismatch for secondary app: calculated 0x%08lX, stored 0x%08lX\r\n", crc, stored_crc);
-#endif
+        TRACE_LOG("CRC mismatch for secondary app: calculated 0x%08" PRIX32 ", stored 0x%08" PRIX32 "\r\n",
+                  crc,
+                  stored_crc);
         return false;
     }
-#ifdef DEBUG_LOG
-    printf("CRC match for secondary app: calculated 0x%08lX, stored 0x%08lX\r\n", crc, stored_crc);
-#endif
+    TRACE_LOG("CRC match for secondary app: calculated 0x%08" PRIX32 ", stored 0x%08" PRIX32 "\r\n", crc, stored_crc);
     return true;
 }
\ No newline at end of file
@@ -12,9 +12,12 @@
 #include "crc_driver.h"
 
 #include <stdio.h>
+#include "stats/stats.h"
+#include "common.h"
+#include "trace/trace.h"
 
 // --- static function declarations ------------------------------------------------------------------------------------
-static uint32_t compute_crc32(const uint8_t *data, uint32_t length);
+static RAMFUNC_CRC32 uint32_t compute_crc32(uint32_t crc, const uint8_t *data, uint32_t length);
 static uint16_t compute_crc16(const uint8_t *data, uint32_t length);
 
 // --- static function definitions -------------------------------------------------------------------------------------
@@ -22,14 +25,15 @@ static uint16_t compute_crc16(const uint8_t *data, uint32_t length);
  * @brief Function to compute the CRC32 of the given data. It uses the CRC32 software implementation. The data is passed
  * as a pointer to the start of the data and the length of the data. Returns the calculated CRC.
  *
+ * @param crc CRC of the preceding data (0 for the start of the data)
  * @param data
  * @param length
  * @return uint32_t
  */
-static uint32_t
-compute_crc32(const uint8_t *data, uint32_t length)
+static RAMFUNC_CRC32 uint32_t
+compute_crc32(uint32_t crc, const uint8_t *data, uint32_t length)
 {
-    uint32_t crc = 0xFFFFFFFF;
+    crc ^= 0xFFFFFFFF;
 
     for (uint32_t i = 0; i < length; i++)
     {
@@ -87,10 +91,28 @@ uint32_t
 crc32_driver_calculate(uint8_t const *data, uint32_t size)
 {
     uint32_t crc = 0;
-#ifdef DEBUG_LOG
-    printf("Calculating CRC32 of %lu bytes from address %p to %p\r\n", size, data, data + size);
-#endif
-    crc = compute_crc32(data, size);
+    TRACE_LOG("Calculating CRC32 of %" PRIu32 " bytes from address %p to %p\r\n", size, data, data + size);
+    uint32_t stats_start = stats_timer_start();
+    crc                  = compute_crc32(0, data, size);
+    stats_timer_stop(STATS_TIMER_CRC, PROF_REGION_CRC32, stats_start);
+    return crc;
+}
+
+/**
+ * @brief Function to continue a CRC32 calculation over the next chunk of the data, for data that is not available at
+ * once (e.g. decompressed on the fly). Returns the CRC of all the data so far.
+ *
+ * @param crc CRC of the preceding chunks (0 for the first chunk)
+ * @param data
+ * @param size
+ * @return uint32_t calculated CRC
+ */
+uint32_t
+crc32_driver_update(uint32_t crc, uint8_t const *data, uint32_t size)
+{
+    uint32_t stats_start = stats_timer_start();
+    crc                  = compute_crc32(crc, data, size);
+    stats_timer_stop(STATS_TIMER_CRC, PROF_REGION_CRC32, stats_start);
     return crc;
 }
 
@@ -106,9 +128,9 @@ uint16_t
 crc16_driver_calculate(uint8_t const *data, uint32_t size)
 {
     uint16_t crc = 0;
-#ifdef DEBUG_LOG
-    printf("Calculating CRC16 of %lu bytes from address %p to %p\r\n", size, data, data + size);
-#endif
-    crc = compute_crc16(data, size);
+    TRACE_LOG("Calculating CRC16 of %" PRIu32 " bytes from address %p to %p\r\n", size, data, data + size);
+    uint32_t stats_start = stats_timer_start();
+    crc                  = compute_crc16(data, size);
+    stats_timer_stop(STATS_TIMER_CRC, PROF_REGION_CRC16, stats_start);
     return crc;
 }
\ No newline at end of file
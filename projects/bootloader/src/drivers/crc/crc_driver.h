@@ -16,6 +16,7 @@
 
 // --- function declarations -------------------------------------------------------------------------------------------
 uint32_t crc32_driver_calculate(uint8_t const *data, uint32_t size);
+uint32_t crc32_driver_update(uint32_t crc, uint8_t const *data, uint32_t size);
 uint16_t crc16_driver_calculate(uint8_t const *data, uint32_t size);
 
 #endif // CRC_DRIVER_H
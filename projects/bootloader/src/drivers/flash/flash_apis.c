@@ -16,9 +16,50 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "common.h"
+#include "trace/trace.h"
+#include "decompress/lz_decompress.h"
+#include "crc/crc_driver.h"
+#include "crc/crc_apis.h"
+#include "authentication.h"
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+// Slot the firmware updates are downloaded to, and slot the copied ranges are read from. With BL_DIRECT_INSTALL, the
+// updates are written straight to the primary slot: there is no fallback image, and no transfer from the secondary
+// slot. With BL_DIRECT_XIP, the download slot is selected when an update starts (see flash_api_find_download_slot()).
+#ifdef BL_DIRECT_INSTALL
+#define FLASH_API_DOWNLOAD_START (SYM_ADDR(__flash_app_start__))
+#define FLASH_API_DOWNLOAD_END   (SYM_ADDR(__flash_app_end__))
+#elif defined(BL_DIRECT_XIP)
+#define FLASH_API_IS_DOWNLOAD_PRIMARY (flash_api_download_slot == FLASH_API_SLOT_PRIMARY)
+#define FLASH_API_DOWNLOAD_START                                                                              \
+    (FLASH_API_IS_DOWNLOAD_PRIMARY ? SYM_ADDR(__flash_app_start__) : SYM_ADDR(__flash_app_secondary_start__))
+#define FLASH_API_DOWNLOAD_END                                                                            \
+    (FLASH_API_IS_DOWNLOAD_PRIMARY ? SYM_ADDR(__flash_app_end__) : SYM_ADDR(__flash_app_secondary_end__))
+#define FLASH_API_SOURCE_START                                                                                \
+    (FLASH_API_IS_DOWNLOAD_PRIMARY ? SYM_ADDR(__flash_app_secondary_start__) : SYM_ADDR(__flash_app_start__))
+#define FLASH_API_SOURCE_END                                                                              \
+    (FLASH_API_IS_DOWNLOAD_PRIMARY ? SYM_ADDR(__flash_app_secondary_end__) : SYM_ADDR(__flash_app_end__))
+#define FLASH_API_SOURCE_SIGNATURE                                                 \
+    (FLASH_API_IS_DOWNLOAD_PRIMARY ? SYM_ADDR(__header_app_secondary_hash_start__) \
+                                   : SYM_ADDR(__header_app_hash_start__))
+#else
+#define FLASH_API_DOWNLOAD_START   (SYM_ADDR(__flash_app_secondary_start__))
+#define FLASH_API_DOWNLOAD_END     (SYM_ADDR(__flash_app_secondary_end__))
+#define FLASH_API_SOURCE_START     (SYM_ADDR(__flash_app_start__))
+#define FLASH_API_SOURCE_END       (SYM_ADDR(__flash_app_end__))
+#define FLASH_API_SOURCE_SIGNATURE (SYM_ADDR(__header_app_hash_start__))
+#endif
+#define FLASH_API_DOWNLOAD_SIZE (FLASH_API_DOWNLOAD_END - FLASH_API_DOWNLOAD_START + 1)
 
 // --- static function declarations ------------------------------------------------------------------------------------
 static bool flash_api_erase_primary_space(void);
+static bool flash_api_program_sink(void *sink_ctx, uint8_t const *data, uint32_t len);
+static bool flash_api_install_compressed_secondary(struct lz_image_header_s const *lz_header);
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+#ifdef BL_DIRECT_XIP
+static enum flash_api_slots_e flash_api_download_slot = FLASH_API_SLOT_SECONDARY;
+#endif
 
 // --- static function definitions -------------------------------------------------------------------------------------
 /**
@@ -32,21 +73,93 @@ flash_api_erase_primary_space(void)
 {
     bool ret = true;
     // Erase the selected sectors
-    ret = flash_driver_erase(((uint32_t)&__flash_app_start__), ((uint32_t)&__flash_app_end__));
+    ret = flash_driver_erase((SYM_ADDR(__flash_app_start__)), (SYM_ADDR(__flash_app_end__)));
     if (!ret)
     {
-#ifdef DEBUG_LOG
-        printf("Error while erasing app primary flash data\r\n");
-#endif
+        TRACE_LOG("Error while erasing app primary flash data\r\n");
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Decompression sink: programs the decompressed output to consecutive flash addresses
+ *
+ * @param sink_ctx uint32_t flash address of the next output byte
+ * @param data
+ * @param len
+ * @return true
+ * @return false
+ */
+static bool
+flash_api_program_sink(void *sink_ctx, uint8_t const *data, uint32_t len)
+{
+    uint32_t *flash_address = sink_ctx;
+
+    if (!flash_driver_program(data, *flash_address, len))
+    {
+        return false;
+    }
+    *flash_address += len;
+
+    return true;
+}
+
+/**
+ * @brief Function to install a compressed secondary image: the image is decompressed while programming the primary
+ * space, then the footer of the secondary slot (CRC, version and signature of the decompressed image) is copied to the
+ * primary footer. The primary space can be larger than the secondary: the decompressed image must fill it exactly.
+ *
+ * @param lz_header
+ * @return true
+ * @return false
+ */
+static bool
+flash_api_install_compressed_secondary(struct lz_image_header_s const *lz_header)
+{
+    uint32_t primary_start_addr = (SYM_ADDR(__flash_app_start__));
+    uint32_t primary_img_size_bytes
+        = (SYM_ADDR(__flash_app_end__)) - (SYM_ADDR(__flash_app_start__)) + 1 - (SYM_ADDR(__header_size_bytes__));
+    uint32_t flash_address = primary_start_addr;
+
+    TRACE_LOG("Attempt to install the compressed secondary to primary...\r\n");
+    if (lz_header->image_size != primary_img_size_bytes)
+    {
+        TRACE_LOG("Compressed img size != primary img size: check configuration\r\n");
+        return false;
+    }
+
+    __disable_irq();
+    if (!flash_api_erase_primary_space())
+    {
+        __enable_irq();
+        return false;
     }
 
+    bool ret = lz_decompress((uint8_t const *)(lz_header + 1),
+                             lz_header->compressed_size,
+                             lz_header->image_size,
+                             flash_api_program_sink,
+                             &flash_address);
+    if (ret)
+    {
+        ret = flash_driver_program((uint8_t const *)&__header_app_secondary_start__,
+                                   SYM_ADDR(__header_app_start__),
+                                   SYM_ADDR(__header_size_bytes__));
+    }
+    __enable_irq();
+
+    if (!ret)
+    {
+        TRACE_LOG("Failed while decompressing secondary slot to primary...\r\n");
+    }
     return ret;
 }
 
 // --- function definitions --------------------------------------------------------------------------------------------
 /**
  * @brief Function to transfer the app data from secondary space to primary. Can be used to recover the primary app, if
- * the secondary is valid.
+ * the secondary is valid. A compressed secondary image is decompressed to the primary space.
  *
  * @return true
  * @return false
@@ -56,21 +169,24 @@ flash_api_transfer_secondary_to_primary(void)
 {
     bool ret = true;
 
-    uint32_t secondary_start_addr = ((uint32_t)&__flash_app_secondary_start__);
+    uint32_t secondary_start_addr = (SYM_ADDR(__flash_app_secondary_start__));
     uint32_t secondary_img_size_bytes
-        = ((uint32_t)&__flash_app_secondary_end__) - ((uint32_t)&__flash_app_secondary_start__) + 1;
+        = (SYM_ADDR(__flash_app_secondary_end__)) - (SYM_ADDR(__flash_app_secondary_start__)) + 1;
 
-    uint32_t primary_start_addr     = ((uint32_t)&__flash_app_start__);
-    uint32_t primary_img_size_bytes = ((uint32_t)&__flash_app_end__) - ((uint32_t)&__flash_app_start__) + 1;
-#ifdef DEBUG_LOG
-    printf("Attempt to transfer secondary to primary...\r\n");
-#endif
+    uint32_t primary_start_addr     = (SYM_ADDR(__flash_app_start__));
+    uint32_t primary_img_size_bytes = (SYM_ADDR(__flash_app_end__)) - (SYM_ADDR(__flash_app_start__)) + 1;
+
+    struct lz_image_header_s const *lz_header = lz_image_get_header(secondary_start_addr, secondary_img_size_bytes);
+    if (lz_header != NULL)
+    {
+        return flash_api_install_compressed_secondary(lz_header);
+    }
+
+    TRACE_LOG("Attempt to transfer secondary to primary...\r\n");
     // Just make sure that primary img size is equal to secondary img size
     if (primary_img_size_bytes != secondary_img_size_bytes)
     {
-#ifdef DEBUG_LOG
-        printf("Primary img size != secondary img size: check configuration\n");
-#endif
+        TRACE_LOG("Primary img size != secondary img size: check configuration\n");
         return false;
     }
 
@@ -79,18 +195,15 @@ flash_api_transfer_secondary_to_primary(void)
     ret = flash_api_erase_primary_space();
     if (!ret)
     {
-#ifdef DEBUG_LOG
-        printf("Error while erasing app primary space\r\n");
-#endif
+        TRACE_LOG("Error while erasing app primary space\r\n");
         return false;
     }
 
-    bool rv = flash_driver_program((uint8_t *)secondary_start_addr, primary_start_addr, secondary_img_size_bytes);
+    bool rv = flash_driver_program(
+        (uint8_t *)(uintptr_t)secondary_start_addr, primary_start_addr, secondary_img_size_bytes);
     if (rv == false)
     {
-#ifdef DEBUG_LOG
-        printf("Failed while transfering secondary slot to primary...\r\n");
-#endif
+        TRACE_LOG("Failed while transfering secondary slot to primary...\r\n");
         __enable_irq();
         return false;
     }
@@ -109,53 +222,246 @@ flash_api_erase_secondary_space(void)
 {
     bool ret = true;
     // Erase the selected sectors
-    ret = flash_driver_erase(((uint32_t)&__flash_app_secondary_start__), ((uint32_t)&__flash_app_secondary_end__));
+    ret = flash_driver_erase((SYM_ADDR(__flash_app_secondary_start__)), (SYM_ADDR(__flash_app_secondary_end__)));
 
     if (!ret)
     {
-#ifdef DEBUG_LOG
-        printf("Error while erasing app secondary flash data\n");
-#endif
+        TRACE_LOG("Error while erasing app secondary flash data\n");
     }
     return ret;
 }
 
 /**
- * @brief Function to write a firmware packet to the secondary space. Will be used by the firmware update process.
+ * @brief Function to find the slot that the next firmware update is downloaded to: the secondary slot, or the primary
+ *        slot with BL_DIRECT_INSTALL. With BL_DIRECT_XIP, the slot that does not hold the image booted by the
+ *        bootloader (the valid image of the higher version, see main.c): the primary slot if the secondary slot holds
+ *        a valid image that is newer than the primary one, or that replaces a damaged primary image. A compressed
+ *        secondary image is installed to the primary slot, so the download slot stays the secondary slot.
+ *
+ * @return enum flash_api_slots_e The download slot.
+ */
+enum flash_api_slots_e
+flash_api_find_download_slot(void)
+{
+#ifdef BL_DIRECT_INSTALL
+    return FLASH_API_SLOT_PRIMARY;
+#elif defined(BL_DIRECT_XIP)
+    uint32_t const secondary_size = SYM_ADDR(__flash_app_secondary_end__) - SYM_ADDR(__flash_app_secondary_start__) + 1;
+
+    if ((lz_image_get_header(SYM_ADDR(__flash_app_secondary_start__), secondary_size) == NULL)
+        && crc_api_check_secondary_app() && (flash_api_is_secondary_newer() || !crc_api_check_primary_app()))
+    {
+        return FLASH_API_SLOT_PRIMARY;
+    }
+
+    return FLASH_API_SLOT_SECONDARY;
+#else
+    return FLASH_API_SLOT_SECONDARY;
+#endif
+}
+
+/**
+ * @brief Function to select the slot that the firmware update is downloaded to, for the download space functions
+ *        below. Only used with BL_DIRECT_XIP: the download slot is fixed otherwise.
+ *
+ * @param slot Slot found by flash_api_find_download_slot()
+ */
+void
+flash_api_set_download_slot(enum flash_api_slots_e slot)
+{
+#ifdef BL_DIRECT_XIP
+    flash_api_download_slot = slot;
+#else
+    (void)slot;
+#endif
+}
+
+/**
+ * @brief Function to erase the flash space that the firmware updates are downloaded to: the secondary space, the
+ *        primary space with BL_DIRECT_INSTALL, or the selected slot with BL_DIRECT_XIP.
+ *
+ * @return true
+ * @return false
+ */
+bool
+flash_api_erase_download_space(void)
+{
+#ifdef BL_DIRECT_INSTALL
+    return flash_api_erase_primary_space();
+#elif defined(BL_DIRECT_XIP)
+    return FLASH_API_IS_DOWNLOAD_PRIMARY ? flash_api_erase_primary_space() : flash_api_erase_secondary_space();
+#else
+    return flash_api_erase_secondary_space();
+#endif
+}
+
+/**
+ * @brief Function to write a firmware packet to the download space (see flash_api_find_download_slot()). Will be used
+ *        by the firmware update process.
  *        NOTE: it is a responsibility of the caller to make sure that starting address offset is correct.
- *        This function will receive an offset and write the packet data to that offset, starting from the secondary
+ *        This function will receive an offset and write the packet data to that offset, starting from the download
  * space.
  *
  * @param packet_data Pointer to the packet data
  * @param packet_size Size of the packet data
- * @param addr_offset Offset in the secondary space where the packet data should be written
+ * @param addr_offset Offset in the download space where the packet data should be written
  *
  */
 bool
 flash_api_write_firmware_update_packet(uint8_t *packet_data, uint32_t packet_size, uint32_t addr_offset)
 {
     bool ret = true;
-    // Create the flash address
-    uint32_t flash_addr_offset = ((uint32_t)&__flash_app_secondary_start__) + addr_offset;
-    // Check if the packet is to be written within the secondary space
-    if ((flash_addr_offset + packet_size - 1) > ((uint32_t)&__flash_app_secondary_end__))
+    // Check if the packet is to be written within the download space (without overflowing the end of the packet)
+    if ((packet_size > FLASH_API_DOWNLOAD_SIZE) || (addr_offset > (FLASH_API_DOWNLOAD_SIZE - packet_size)))
     {
-#ifdef DEBUG_LOG
-        printf("Error: Packet size exceeds secondary space\r\n");
-#endif
+        TRACE_LOG("Error: Packet size exceeds download space\r\n");
         return false;
     }
 
-    // Then write the packet data to the secondary space
-    ret = flash_driver_program(packet_data, flash_addr_offset, packet_size);
+    // Then write the packet data to the download space
+    ret = flash_driver_program(packet_data, FLASH_API_DOWNLOAD_START + addr_offset, packet_size);
     if (!ret)
     {
-#ifdef DEBUG_LOG
-        printf("Error while writing firmware update packet to flash\r\n");
-#endif
+        TRACE_LOG("Error while writing firmware update packet to flash\r\n");
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Function to XOR a firmware packet of the download space into a buffer (forward error correction: a lost
+ *        packet is rebuilt from the parity of its group and the other packets of the group).
+ *
+ * @param buffer Packet size bytes, XORed in place
+ * @param packet_size Size of the packet data
+ * @param addr_offset Offset of the packet in the download space
+ * @return true
+ * @return false The packet is not within the download space.
+ */
+bool
+flash_api_xor_firmware_update_packet(uint8_t *buffer, uint32_t packet_size, uint32_t addr_offset)
+{
+    if ((packet_size > FLASH_API_DOWNLOAD_SIZE) || (addr_offset > (FLASH_API_DOWNLOAD_SIZE - packet_size)))
+    {
+        return false;
+    }
+
+    uint8_t const *packet = (uint8_t const *)(uintptr_t)(FLASH_API_DOWNLOAD_START + addr_offset);
+    for (uint32_t i = 0; i < packet_size; i++)
+    {
+        buffer[i] ^= packet[i];
+    }
+
+    return true;
+}
+
+/**
+ * @brief Function to get the size of the download space, i.e. the largest image a firmware update can write.
+ *
+ * @return uint32_t Size in bytes
+ */
+uint32_t
+flash_api_get_download_size(void)
+{
+    return FLASH_API_DOWNLOAD_SIZE;
+}
+
+/**
+ * @brief Function to get the size of the written part of the download space: up to its last programmed (not erased)
+ *        word. The download space is erased when a firmware update starts, and programmed packet by packet, so it
+ *        keeps the progress of an interrupted download across a cancel or a reset.
+ *
+ * @return uint32_t Size in bytes, from the start of the download space (0 if it is erased).
+ */
+uint32_t
+flash_api_get_download_written_size(void)
+{
+    uint32_t const *word = (uint32_t const *)(uintptr_t)(FLASH_API_DOWNLOAD_END + 1);
+
+    while ((uint32_t)(uintptr_t)word > FLASH_API_DOWNLOAD_START)
+    {
+        word--;
+        if (*word != 0xFFFFFFFF)
+        {
+            return (uint32_t)(uintptr_t)(word + 1) - FLASH_API_DOWNLOAD_START;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Function to calculate the CRC32 of the start of the download space
+ *
+ * @param size Bytes to cover, from the start of the download space
+ * @param crc32 Set to the CRC32
+ * @return true
+ * @return false The size exceeds the download space.
+ */
+bool
+flash_api_get_download_crc32(uint32_t size, uint32_t *crc32)
+{
+    if (size > FLASH_API_DOWNLOAD_SIZE)
+    {
+        return false;
+    }
+
+    *crc32 = crc32_driver_calculate((uint8_t const *)(uintptr_t)FLASH_API_DOWNLOAD_START, size);
+    return true;
+}
+
+/**
+ * @brief Function to copy a range of the installed image to the same offset of the download space, so that the ranges
+ *        of an update that the installed image already holds are not downloaded again. The installed image is the
+ *        primary slot, or the slot that is not the download slot with BL_DIRECT_XIP. The chunks of the range are
+ *        checked against the signed Merkle root of the installed image first, so that a damaged chunk is not copied.
+ *        Not available with BL_DIRECT_INSTALL, where the primary slot is the download space.
+ *
+ * @param addr_offset Offset of the range, from the start of the slots
+ * @param size Size of the range
+ * @return true
+ * @return false The range exceeds the slots, fails its check (or the installed image has no Merkle tree), or the copy
+ *         failed.
+ */
+bool
+flash_api_copy_to_download_space(uint32_t addr_offset, uint32_t size)
+{
+#ifdef BL_DIRECT_INSTALL
+    (void)addr_offset;
+    (void)size;
+    return false;
+#else
+    uint32_t const source_size = FLASH_API_SOURCE_END - FLASH_API_SOURCE_START + 1;
+
+    // The range must fit in both slots, without overflowing its end
+    if ((size == 0) || (size > FLASH_API_DOWNLOAD_SIZE) || (addr_offset > (FLASH_API_DOWNLOAD_SIZE - size))
+        || (size > source_size) || (addr_offset > (source_size - size)))
+    {
+        TRACE_LOG("Error: Copied range exceeds the slots\r\n");
+        return false;
+    }
+
+    if (!authenticate_application_region(FLASH_API_SOURCE_START,
+                                         source_size - SYM_ADDR(__header_size_bytes__),
+                                         (uint8_t const *)(uintptr_t)FLASH_API_SOURCE_SIGNATURE,
+                                         addr_offset,
+                                         size))
+    {
+        TRACE_LOG("Error: Copied range does not match the installed image\r\n");
+        return false;
+    }
+
+    // The source is read straight from flash
+    uint32_t const src_addr  = FLASH_API_SOURCE_START + addr_offset;
+    uint32_t const dest_addr = FLASH_API_DOWNLOAD_START + addr_offset;
+    bool           ret       = flash_driver_program((uint8_t const *)(uintptr_t)src_addr, dest_addr, size);
+    if (!ret)
+    {
+        TRACE_LOG("Error while copying an installed image range to the download space\r\n");
     }
 
     return ret;
+#endif
 }
 
 /**
@@ -174,11 +480,9 @@ flash_api_is_secondary_newer(void)
     uint8_t  secondary_version_major = *((uint8_t *)(&__header_app_secondary_fw_version_start__));
     uint16_t secondary_version_minor = *((uint16_t *)(&__header_app_secondary_fw_version_start__) + 1);
     uint8_t  secondary_version_patch = *((uint8_t *)(&__header_app_secondary_fw_version_start__) + 3);
-#ifdef DEBUG_LOG
-    printf("Primary version: %d.%d.%d\r\n", primary_version_major, primary_version_minor, primary_version_patch);
-    printf(
+    TRACE_LOG("Primary version: %d.%d.%d\r\n", primary_version_major, primary_version_minor, primary_version_patch);
+    TRACE_LOG(
         "Secondary version: %d.%d.%d\r\n", secondary_version_major, secondary_version_minor, secondary_version_patch);
-#endif
 
     // Compare the versions
     if (secondary_version_major > primary_version_major)
@@ -15,10 +15,25 @@
 #include "flash_driver.h"
 #include <stdbool.h>
 
+// --- enums -----------------------------------------------------------------------------------------------------------
+enum flash_api_slots_e
+{
+    FLASH_API_SLOT_PRIMARY   = 0,
+    FLASH_API_SLOT_SECONDARY = 1,
+};
+
 // --- function declarations -------------------------------------------------------------------------------------------
 bool flash_api_transfer_secondary_to_primary(void);
 bool flash_api_erase_secondary_space(void);
+enum flash_api_slots_e flash_api_find_download_slot(void);
+void flash_api_set_download_slot(enum flash_api_slots_e slot);
+bool flash_api_erase_download_space(void);
 bool flash_api_write_firmware_update_packet(uint8_t *packet_data, uint32_t packet_size, uint32_t addr_offset);
+bool flash_api_xor_firmware_update_packet(uint8_t *buffer, uint32_t packet_size, uint32_t addr_offset);
+uint32_t flash_api_get_download_size(void);
+uint32_t flash_api_get_download_written_size(void);
+bool flash_api_get_download_crc32(uint32_t size, uint32_t *crc32);
+bool flash_api_copy_to_download_space(uint32_t addr_offset, uint32_t size);
 bool flash_api_is_secondary_newer(void);
 
 #endif // FLASH_APIS_H
\ No newline at end of file
@@ -15,10 +15,14 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "common.h"
+#include "stats/stats.h"
+#include "trace/trace.h"
 
 // --- defines ---------------------------------------------------------------------------------------------------------
-#define FLASH_ERASE_NO_ERROR (0xFFFFFFFF)
+#define FLASH_ERASE_NO_ERROR    (0xFFFFFFFF)
+#define FLASH_PROGRAM_WORD_SIZE (4)
 
 // --- static function declarations ------------------------------------------------------------------------------------
 static bool flash_driver_write_enable(void);
@@ -30,9 +34,7 @@ flash_driver_write_enable(void)
 {
     if (HAL_FLASH_Unlock() != HAL_OK)
     {
-#ifdef DEBUG_LOG
-        printf("Flash write enable: failed\r\n");
-#endif
+        TRACE_LOG("Flash write enable: failed\r\n");
         return false;
     }
 
@@ -44,9 +46,7 @@ flash_driver_write_disable(void)
 {
     if (HAL_FLASH_Lock() != HAL_OK)
     {
-#ifdef DEBUG_LOG
-        printf("Flash write disable: failed\r\n");
-#endif
+        TRACE_LOG("Flash write disable: failed\r\n");
         return false;
     }
 
@@ -102,14 +102,17 @@ flash_driver_erase(uint32_t start_address, uint32_t end_address)
         return false;
     }
 
+    uint32_t stats_start = stats_timer_start();
     if (HAL_FLASHEx_Erase(&erase, &sector_error) == HAL_OK)
     {
         if (sector_error == FLASH_ERASE_NO_ERROR)
         {
+            stats_timer_stop(STATS_TIMER_ERASE, PROF_REGION_FLASH_ERASE, stats_start);
             flash_driver_write_disable();
             return true;
         }
     }
+    stats_timer_stop(STATS_TIMER_ERASE, PROF_REGION_FLASH_ERASE, stats_start);
     flash_driver_write_disable();
 
     return false;
@@ -134,7 +137,8 @@ flash_driver_read(uint8_t *p_dest, const uint8_t *p_src, uint32_t length_bytes)
 
 /**
  * @brief Function to write the data from the source RAM to the flash memory. The data is written to the specified
- * address. The function writes the data byte by byte. The function returns true if the write is successful, otherwise
+ * address. The function writes the data a word at a time, wherever the flash address is word aligned, and falls back to
+ * byte programming for the unaligned head and tail. The function returns true if the write is successful, otherwise
  * false.
  *
  * @param p_src_ram
@@ -150,38 +154,53 @@ flash_driver_program(const uint8_t *p_src_ram, uint32_t flash_address, uint32_t
 
     if (p_src_ram == NULL)
     {
-#ifdef DEBUG_LOG
-        printf("Flash write: null pointer input\n");
-#endif
+        TRACE_LOG("Flash write: null pointer input\n");
     }
 
-    // check if data will be written in a valid address
-    if ((flash_address < ((uint32_t)&__flash_app_start__))
-        || ((flash_address + length_bytes - 1) > ((uint32_t)&__flash_app_secondary_end__)))
+    // check if data will be written in a valid address (without overflowing the end of the data)
+    if ((flash_address < (SYM_ADDR(__flash_app_start__)))
+        || (flash_address > (SYM_ADDR(__flash_app_secondary_end__)))
+        || (length_bytes > ((SYM_ADDR(__flash_app_secondary_end__)) - flash_address + 1)))
     {
-#ifdef DEBUG_LOG
-        printf("Flash write: failed\n");
-#endif
+        TRACE_LOG("Flash write: failed\n");
         return false;
     }
 
     flash_driver_write_enable();
+    uint32_t stats_start = stats_timer_start();
     // Programming flash only when address is valid
-    for (i = 0; i < length_bytes; i++)
+    i = 0;
+    while (i < length_bytes)
     {
+        uint32_t type_program = FLASH_TYPEPROGRAM_BYTE;
+        uint64_t data         = (uint64_t)p_src_ram[i];
+        uint32_t step_bytes   = 1;
+
+        // Program a full word when possible (x32 parallelism is allowed for FLASH_VOLTAGE_RANGE_3)
+        if (((flash_address & (FLASH_PROGRAM_WORD_SIZE - 1)) == 0) && ((length_bytes - i) >= FLASH_PROGRAM_WORD_SIZE))
+        {
+            uint32_t word = 0;
+            // The source buffer might not be word aligned
+            memcpy(&word, &p_src_ram[i], FLASH_PROGRAM_WORD_SIZE);
+            type_program = FLASH_TYPEPROGRAM_WORD;
+            data         = (uint64_t)word;
+            step_bytes   = FLASH_PROGRAM_WORD_SIZE;
+        }
+
         // Write data to flash
-        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, flash_address, (uint64_t)p_src_ram[i]) != HAL_OK)
+        if (HAL_FLASH_Program(type_program, flash_address, data) != HAL_OK)
         {
-#ifdef DEBUG_LOG
-            printf("Flash program: failed\n");
-#endif
+            TRACE_LOG("Flash program: failed\n");
+            stats_timer_stop(STATS_TIMER_PROGRAM, PROF_REGION_FLASH_PROGRAM, stats_start);
             flash_driver_write_disable();
             return false;
         }
 
-        // Move to the next byte
-        flash_address += 1;
+        // Move to the next byte/word
+        flash_address += step_bytes;
+        i += step_bytes;
     }
+    stats_timer_stop(STATS_TIMER_PROGRAM, PROF_REGION_FLASH_PROGRAM, stats_start);
     flash_driver_write_disable();
     return true;
 }
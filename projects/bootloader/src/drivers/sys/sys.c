@@ -26,6 +26,69 @@ sys_delay_ms(uint32_t delay)
     HAL_Delay(delay);
 }
 
+/**
+ * @brief Function to get the milliseconds elapsed since the system start. Currently using HAL_GetTick.
+ *
+ * @return uint32_t
+ */
+uint32_t
+sys_get_tick_ms(void)
+{
+    return HAL_GetTick();
+}
+
+/**
+ * @brief Function to enable the DWT cycle counter. Unlike the HAL tick, the cycle counter keeps counting inside
+ *        interrupts (the com protocol runs in the uart interrupt, which the SysTick interrupt cannot preempt).
+ *
+ */
+void
+sys_cycle_counter_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * @brief Function to get the current value of the cycle counter. The counter wraps around every 2^32 cycles (~51
+ *        seconds at 84MHz), so only the difference of two values (modulo 2^32) is meaningful.
+ *
+ * @return uint32_t
+ */
+uint32_t
+sys_get_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+/**
+ * @brief Function to convert a number of cycles (e.g. the difference of two sys_get_cycles values) to microseconds.
+ *
+ * @param cycles
+ * @return uint32_t
+ */
+uint32_t
+sys_cycles_to_us(uint32_t cycles)
+{
+    return cycles / (SystemCoreClock / 1000000);
+}
+
+/**
+ * @brief Function to get the current bus clock frequencies
+ *
+ * @param hclk_hz
+ * @param pclk1_hz
+ * @param pclk2_hz
+ */
+void
+sys_get_bus_clocks(uint32_t *hclk_hz, uint32_t *pclk1_hz, uint32_t *pclk2_hz)
+{
+    *hclk_hz  = HAL_RCC_GetHCLKFreq();
+    *pclk1_hz = HAL_RCC_GetPCLK1Freq();
+    *pclk2_hz = HAL_RCC_GetPCLK2Freq();
+}
+
 /**
  * @brief Function to set the MSP register to the given address. This is used to jump to the application.
  *
@@ -36,3 +99,13 @@ sys_set_msp(size_t addr)
 {
     __set_MSP(*(uint32_t *)addr);
 }
+
+/**
+ * @brief Function to reset the device (system reset request). Does not return.
+ *
+ */
+void
+sys_reset(void)
+{
+    NVIC_SystemReset();
+}
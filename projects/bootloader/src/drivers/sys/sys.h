@@ -16,7 +16,13 @@
 #include <stddef.h>
 
 // --- function declarations -------------------------------------------------------------------------------------------
-void sys_delay_ms(uint32_t delay);
-void sys_set_msp(size_t addr);
+void     sys_delay_ms(uint32_t delay);
+uint32_t sys_get_tick_ms(void);
+void     sys_cycle_counter_init(void);
+uint32_t sys_get_cycles(void);
+uint32_t sys_cycles_to_us(uint32_t cycles);
+void     sys_get_bus_clocks(uint32_t *hclk_hz, uint32_t *pclk1_hz, uint32_t *pclk2_hz);
+void     sys_set_msp(size_t addr);
+void     sys_reset(void);
 
 #endif // SYS_H
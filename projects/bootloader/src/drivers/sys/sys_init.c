@@ -16,6 +16,8 @@
 #include "stm32f4xx_hal.h"
 #include "common.h"
 #include "mpu/mpu_driver.h"
+#include "sys.h"
+#include "trace/trace.h"
 
 // --- static function declarations ------------------------------------------------------------------------------------
 static void SystemClock_Config(void);
@@ -51,9 +53,7 @@ SystemClock_Config(void)
     RCC_OscInitStruct.PLL.PLLQ            = 7;
     if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
     {
-#ifdef DEBUG_LOG
-        printf("Error initializing RCC\n");
-#endif
+        TRACE_LOG("Error initializing RCC\n");
     }
     /** Initializes the CPU, AHB and APB buses clocks
      */
@@ -65,9 +65,7 @@ SystemClock_Config(void)
 
     if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2) != HAL_OK)
     {
-#ifdef DEBUG_LOG
-        printf("Error initializing RCC\n");
-#endif
+        TRACE_LOG("Error initializing RCC\n");
     }
 }
 
@@ -81,22 +79,28 @@ sys_init(void)
 {
     SystemClock_Config();
     HAL_Init();
+    sys_cycle_counter_init();
 }
 
 /**
  * @brief Prepare the system for the application to run. This means deinitializing peripherals and preparing the vector
  *       table for the application.
  *
+ * @param vector_table_addr Start of the booted image slot: the vector table of the application
  */
 void
-sys_prepare_for_application(void)
+sys_prepare_for_application(uint32_t vector_table_addr)
 {
-#ifdef DEBUG_LOG
-    printf("Deinitializing peripherals and preparing for application start\r\n");
-#endif
+    TRACE_LOG("Deinitializing peripherals and preparing for application start\r\n");
+#ifdef BL_KEEP_CLOCKS
+    // Keep the clock tree (PLL, flash latency, ART cache), so that the application starts at full speed. The chosen
+    // clocks are handed over in the boot info record. Only the peripherals are reset.
+    HAL_DeInit();
+#else
     // Deinitialize peripherals to their reset state
     HAL_RCC_DeInit();
     HAL_DeInit();
+#endif
 
     // Disable all interrupts
     __disable_irq();
@@ -108,7 +112,7 @@ sys_prepare_for_application(void)
     }
 
     // Set the vector table to the application's vector table
-    SCB->VTOR = (uint32_t)&__flash_app_start__;
+    SCB->VTOR = vector_table_addr;
     // Enable the MPU, to protect the bootloader.
     mpu_config_lock();
     // TODO: GPA: It is important to set the unprivileged mode after the MPU is enabled, to protect bootloader.
@@ -16,6 +16,6 @@
 
 // --- function declarations -------------------------------------------------------------------------------------------
 void sys_init(void);
-void sys_prepare_for_application(void);
+void sys_prepare_for_application(uint32_t vector_table_addr);
 
 #endif // SYS_INIT_H
\ No newline at end of file
@@ -13,9 +13,12 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "stm32f4xx_hal.h"
 #include "stm32f401xe.h" // stm32f401re
 #include "sys_init.h"
+#include "stats/stats.h"
+#include "trace/trace.h"
 
 // --- defines ---------------------------------------------------------------------------------------------------------
 #define TIM1_COUNTDOWN_SEC 15 // 15 seconds timeout for the uart reception watchdog
@@ -23,10 +26,13 @@
 // --- static variable definitions -------------------------------------------------------------------------------------
 // This is the structure that will store the received buffer and the size of it. This will be used by the upper layers
 // to receive the data.
-static uint8_t uart_rx_buffer[RX_CHUNK_SIZE_BYTES] = { 0 };
-static struct uart_driver_data_s uart_buf = { .data_buffer = uart_rx_buffer, .len = RX_CHUNK_SIZE_BYTES };
+static uint8_t uart_rx_buffer[RX_BUFFER_SIZE_BYTES] = { 0 };
+static struct uart_driver_data_s uart_buf = { .data_buffer = uart_rx_buffer, .len = RX_BUFFER_SIZE_BYTES };
 
-static process_rx_data data_rx_cb = NULL;
+static process_rx_data  data_rx_cb      = NULL;
+static get_rx_frame_len frame_len_cb    = NULL;
+static uint16_t         rx_header_len   = RX_BUFFER_SIZE_BYTES;
+static bool             is_rx_in_header = true; // True while receiving the frame header, false while receiving the body
 
 // --- variable definitions --------------------------------------------------------------------------------------------
 UART_HandleTypeDef huart2;
@@ -34,8 +40,21 @@ UART_HandleTypeDef huart2;
 // --- static function declarations ------------------------------------------------------------------------------------
 static void uart_recv_it_init_wdg(void);
 static void MX_USART2_UART_Init(void);
+static void uart_rx_start_header(void);
 
 // --- static function definitions -------------------------------------------------------------------------------------
+/**
+ * @brief Function to (re)start the reception of a new frame, by receiving its header.
+ *
+ */
+static void
+uart_rx_start_header(void)
+{
+    is_rx_in_header = true;
+    uart_buf.len    = rx_header_len;
+    HAL_UART_Receive_IT(&huart2, uart_buf.data_buffer, uart_buf.len);
+}
+
 /**
  * @brief This function initializes the timer1 peripheral to be used as a watchdog for the uart reception.
  *        TODO: GPA: We can set the timer to one-pulse mode, so that it will stop after the timeout. The timer can be
@@ -93,7 +112,7 @@ MX_USART2_UART_Init(void) // Change from MX_USART1_UART_Init to MX_USART2_UART_I
 
     // Init the uart peripheral
     huart2.Instance          = USART2;
-    huart2.Init.BaudRate     = 1000000;
+    huart2.Init.BaudRate     = UART_DEFAULT_BAUDRATE;
     huart2.Init.WordLength   = UART_WORDLENGTH_8B;
     huart2.Init.StopBits     = UART_STOPBITS_1;
     huart2.Init.Parity       = UART_PARITY_NONE;
@@ -102,11 +121,9 @@ MX_USART2_UART_Init(void) // Change from MX_USART1_UART_Init to MX_USART2_UART_I
     huart2.Init.OverSampling = UART_OVERSAMPLING_8;
     if (HAL_UART_Init(&huart2) != HAL_OK)
     {
-#ifdef DEBUG_LOG
-        printf("Error initializing uart\n");
-#endif
+        TRACE_LOG("Error initializing uart\n");
     }
-    HAL_UART_Receive_IT(&huart2, uart_buf.data_buffer, uart_buf.len); // Start reception
+    uart_rx_start_header(); // Start reception
     // Init the uart watchdog
     uart_recv_it_init_wdg();
 }
@@ -133,6 +150,23 @@ uart_driver_register_rx_callback(process_rx_data rx_cb)
     data_rx_cb = rx_cb;
 }
 
+/**
+ * @brief Function to register the callback that decodes the length of a frame, out of its header. This must be
+ *        registered before the uart reception is started.
+ *
+ */
+void
+uart_driver_register_rx_frame_len_callback(get_rx_frame_len frame_len_cb_in, uint16_t header_len)
+{
+    if ((header_len == 0) || (header_len > RX_BUFFER_SIZE_BYTES))
+    {
+        return;
+    }
+
+    frame_len_cb  = frame_len_cb_in;
+    rx_header_len = header_len;
+}
+
 /**
  * @brief Function to transmit a buffer of data via UART.
  *
@@ -165,15 +199,102 @@ uart_driver_feed_wdg(void)
 void
 uart_driver_rx_recover(void)
 {
+    // Only count the recoveries that drop a partially received frame (the watchdog also expires on an idle line)
+    if (!is_rx_in_header || (huart2.RxXferCount != huart2.RxXferSize))
+    {
+        stats_inc(STATS_COUNTER_UART_RECOVERY);
+    }
     HAL_UART_DeInit(&huart2);
     HAL_UART_Init(&huart2);
-    // Restart the reception
-    HAL_UART_Receive_IT(&huart2, uart_buf.data_buffer, uart_buf.len);
+    // Restart the reception, from a frame header
+    uart_rx_start_header();
+}
+
+/**
+ * @brief Function to get the highest baud rate the uart peripheral can run at. USART2 is clocked by APB1 and uses 8x
+ *        oversampling, so the baud rate cannot exceed PCLK1 / 8.
+ *
+ * @return uint32_t The max baud rate.
+ */
+uint32_t
+uart_driver_get_max_baudrate(void)
+{
+    return HAL_RCC_GetPCLK1Freq() / 8;
 }
 
 /**
- * @brief Callback function that is being called automatically when the uart rx is finished. Processes the data and
- *        restarts the uart reception.
+ * @brief Function to get the baud rate the uart peripheral currently runs at.
+ *
+ * @return uint32_t The current baud rate.
+ */
+uint32_t
+uart_driver_get_baudrate(void)
+{
+    return huart2.Init.BaudRate;
+}
+
+/**
+ * @brief Function to check if the uart peripheral can run at the given baud rate. The baud rate is not supported if it
+ *        is above the max baud rate, or if the closest baud rate the BRR register can produce deviates more than
+ *        UART_BAUDRATE_MAX_ERROR_PERMILLE from it.
+ *
+ * @param baudrate
+ * @return true
+ * @return false
+ */
+bool
+uart_driver_is_baudrate_supported(uint32_t baudrate)
+{
+    uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+
+    if ((baudrate == 0) || (baudrate > uart_driver_get_max_baudrate()))
+    {
+        return false;
+    }
+
+    // With 8x oversampling, BRR holds USARTDIV in 1/8 steps: baud = pclk / (8 * USARTDIV) = pclk / div
+    uint32_t div    = (pclk + (baudrate / 2)) / baudrate;
+    uint32_t actual = pclk / div;
+    uint32_t error  = (actual > baudrate) ? (actual - baudrate) : (baudrate - actual);
+
+    return ((error * 1000) <= (baudrate * UART_BAUDRATE_MAX_ERROR_PERMILLE));
+}
+
+/**
+ * @brief Function to switch the uart peripheral to a new baud rate. Any ongoing reception is dropped and restarts from
+ *        a frame header.
+ *        NOTE: Any pending transmission must be completed before calling this function.
+ *
+ * @param baudrate The new baud rate.
+ * @return true If the uart runs at the new baud rate.
+ * @return false If the baud rate is not supported. The uart keeps running at the current baud rate.
+ */
+bool
+uart_driver_set_baudrate(uint32_t baudrate)
+{
+    if (!uart_driver_is_baudrate_supported(baudrate))
+    {
+        return false;
+    }
+
+    // The reception interrupt must not run, while the peripheral is reconfigured
+    NVIC_DisableIRQ(USART2_IRQn);
+    HAL_UART_AbortReceive(&huart2);
+    huart2.Init.BaudRate = baudrate;
+    if (HAL_UART_Init(&huart2) != HAL_OK)
+    {
+        TRACE_LOG("Error switching uart baud rate\n");
+    }
+    uart_rx_start_header();
+    NVIC_EnableIRQ(USART2_IRQn);
+
+    return true;
+}
+
+/**
+ * @brief Callback function that is being called automatically when the uart rx is finished. When a frame header is
+ *        received, the rest of the frame is requested based on the decoded frame length. When a full frame is received,
+ *        it is processed and the uart reception restarts from the next frame header.
  *
  * @return int
  */
@@ -182,14 +303,33 @@ HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 {
     if (huart->Instance == USART2)
     {
+        if (is_rx_in_header && (frame_len_cb != NULL))
+        {
+            uint16_t frame_len = frame_len_cb(uart_buf.data_buffer, rx_header_len);
+            if ((frame_len > rx_header_len) && (frame_len <= RX_BUFFER_SIZE_BYTES))
+            {
+                // Receive the rest of the frame, right after the header
+                is_rx_in_header = false;
+                uart_buf.len    = frame_len;
+                HAL_UART_Receive_IT(&huart2, uart_buf.data_buffer + rx_header_len, frame_len - rx_header_len);
+                return;
+            }
+
+            if (frame_len != rx_header_len)
+            {
+                // Invalid header: drop it and wait for the next one
+                uart_rx_start_header();
+                return;
+            }
+        }
+
         // Call the register callback function if it is set
         if (data_rx_cb != NULL)
         {
             data_rx_cb(&uart_buf);
         }
-        // Handle received data
-        // TODO: GPA: At this point handle the received data and restart the receptions
-        HAL_UART_Receive_IT(&huart2, uart_buf.data_buffer, uart_buf.len);
+        // Restart the reception, from the next frame header
+        uart_rx_start_header();
     }
 }
 
@@ -224,6 +364,10 @@ HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
 {
     if (huart->Instance == USART2)
     {
+        if (huart->ErrorCode & HAL_UART_ERROR_ORE)
+        {
+            stats_inc(STATS_COUNTER_UART_OVERRUN);
+        }
         uart_driver_rx_recover();
     }
 }
\ No newline at end of file
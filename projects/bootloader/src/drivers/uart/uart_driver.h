@@ -10,11 +10,16 @@
 
 // --- includes --------------------------------------------------------------------------------------------------------
 #include <stdint.h>
+#include <stdbool.h>
 
 // --- defines ---------------------------------------------------------------------------------------------------------
-#define USART_TX_Pin        GPIO_PIN_2
-#define USART_RX_Pin        GPIO_PIN_3
-#define RX_CHUNK_SIZE_BYTES 256 // TODO: GPA: Right now, we need to send a buffer of 256 bytes, even if the effective payload is smaller.
+#define USART_TX_Pin         GPIO_PIN_2
+#define USART_RX_Pin         GPIO_PIN_3
+#define RX_BUFFER_SIZE_BYTES 2080 // Largest frame that can be received. Must fit the largest com protocol frame.
+// Baud rate after reset, used for discovery. The host may then switch to a faster baud rate.
+#define UART_DEFAULT_BAUDRATE            115200
+// Max deviation of the actual baud rate (as produced by the BRR register) from the requested one, in permille
+#define UART_BAUDRATE_MAX_ERROR_PERMILLE 20
 
 // --- structs ---------------------------------------------------------------------------------------------------------
 /**
@@ -31,6 +36,12 @@ struct uart_driver_data_s
 
 // --- typedefs --------------------------------------------------------------------------------------------------------
 typedef void (*process_rx_data)(struct uart_driver_data_s * const rx_data);
+/**
+ * @brief Function that decodes the total frame length out of the first header_len bytes of a frame. Returns 0 if the
+ *        header is not valid, so that the uart driver drops it and waits for the next header.
+ *
+ */
+typedef uint16_t (*get_rx_frame_len)(uint8_t const * const header, uint16_t header_len);
 
 // --- function declarations -------------------------------------------------------------------------------------------
 /**
@@ -48,6 +59,16 @@ void uart_driver_init(void);
  */
 void uart_driver_register_rx_callback(process_rx_data rx_cb);
 
+/**
+ * @brief NOTE: Frames are of variable length. The uart driver first receives header_len bytes and asks the upper layer
+ *              (through frame_len_cb) for the total frame length, before receiving the rest of the frame. Without a
+ *              registered callback, the driver delivers fixed chunks of header_len bytes.
+ *
+ * @param frame_len_cb: The function that decodes the frame length from the frame header.
+ * @param header_len: The number of bytes needed by frame_len_cb to decode the frame length.
+ */
+void uart_driver_register_rx_frame_len_callback(get_rx_frame_len frame_len_cb, uint16_t header_len);
+
 /**
  * @brief This function is used to send data over the uart. The data is sent as a buffer of bytes.
  * 
@@ -58,5 +79,9 @@ void uart_tx_data(uint8_t *buffer, uint16_t length);
 
 // --- application specific functions ----------------------------------------------------------------------------------
 // NOTE: These functions are not necessary for the bootloader, but rather for the specific uart driver implementation.
-void uart_driver_feed_wdg(void);
-void uart_driver_rx_recover(void);
\ No newline at end of file
+void     uart_driver_feed_wdg(void);
+void     uart_driver_rx_recover(void);
+uint32_t uart_driver_get_max_baudrate(void);
+uint32_t uart_driver_get_baudrate(void);
+bool     uart_driver_is_baudrate_supported(uint32_t baudrate);
+bool     uart_driver_set_baudrate(uint32_t baudrate);
\ No newline at end of file
@@ -13,20 +13,181 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include "flash/flash_apis.h"
 #include "com_protocol/com_protocol.h"
+#include "stats/stats.h"
+#include "trace/trace.h"
+
+// --- static function declarations ------------------------------------------------------------------------------------
+static bool firmware_update_is_packet_received(uint32_t packet_number);
+static bool firmware_update_write_packet(uint8_t *packet_data, uint32_t packet_number);
+static bool firmware_update_check_range(uint32_t offset, uint32_t range_len, bool *is_written);
+static void firmware_update_set_range(uint32_t range_start, uint32_t range_end);
 
 // --- static variable definitions -------------------------------------------------------------------------------------
 static struct firmware_update_state_s firmware_update_state;
+// Map of the received packets (bit i: packet i). Broadcast packets can arrive with gaps, that are resent later.
+static uint8_t received_packets[FIRMWARE_UPDATE_MAX_PACKET_COUNT / 8];
+
+// --- static function definitions -------------------------------------------------------------------------------------
+/**
+ * @brief Function to check a range of the image (FWUG_DATA_AT or FWUG_COPY) against the ranges written so far. The
+ *        ranges must arrive in ascending order, since a flash word cannot be programmed twice. Only the range written
+ *        last can be sent again (a resend, after a lost response): any other range below the end of the written part
+ *        would be left out of the image, or land in a gap that stays erased.
+ *
+ * @param offset Offset of the range from the start of the image
+ * @param range_len Size of the range
+ * @param is_written Set to true if the range is the one written last
+ * @return true if the range can be written, or is the one written last
+ * @return false if the range is not word aligned, exceeds the download space, or starts before the end of the written
+ *         part (other than the range written last)
+ */
+static bool
+firmware_update_check_range(uint32_t offset, uint32_t range_len, bool *is_written)
+{
+    *is_written = false;
+    if (!firmware_update_state.is_update_started || (range_len == 0) || ((offset % sizeof(uint32_t)) != 0)
+        || ((range_len % sizeof(uint32_t)) != 0))
+    {
+        return false;
+    }
+
+    // Checked against the download space first, so that the end of the range below cannot overflow
+    uint32_t const slot_size = flash_api_get_download_size();
+    if ((range_len > slot_size) || (offset > (slot_size - range_len)))
+    {
+        return false;
+    }
+
+    // A resumed session starts after its packets
+    uint32_t written_end = firmware_update_state.packets_received * firmware_update_state.packet_size;
+    if (firmware_update_state.range_end > written_end)
+    {
+        written_end = firmware_update_state.range_end;
+    }
+
+    if ((offset == firmware_update_state.range_start) && ((offset + range_len) == firmware_update_state.range_end))
+    {
+        *is_written = true;
+        return true;
+    }
+
+    if (offset < written_end)
+    {
+        // Out of order, or overlaps the written part
+        stats_inc(STATS_COUNTER_SEQUENCE_ERR);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Function to record the range written last. packets_received follows its end, in whole packets.
+ *
+ * @param range_start
+ * @param range_end
+ */
+static void
+firmware_update_set_range(uint32_t range_start, uint32_t range_end)
+{
+    firmware_update_state.range_start      = range_start;
+    firmware_update_state.range_end        = range_end;
+    firmware_update_state.packets_received = range_end / firmware_update_state.packet_size;
+}
+
+/**
+ * @brief Function to check if a packet of the current session was received
+ *
+ * @param packet_number
+ * @return true
+ * @return false
+ */
+static bool
+firmware_update_is_packet_received(uint32_t packet_number)
+{
+    return (received_packets[packet_number / 8] & (1U << (packet_number % 8))) != 0;
+}
+
+/**
+ * @brief Function to write a packet to the download space, and mark it as received. packets_received follows the
+ *        packets received without a gap from the first one. Only the first FIRMWARE_UPDATE_MAX_PACKET_COUNT packets
+ *        are mapped: the packets after them can only be received in order.
+ *
+ * @param packet_data
+ * @param packet_number
+ * @return true
+ * @return false
+ */
+static bool
+firmware_update_write_packet(uint8_t *packet_data, uint32_t packet_number)
+{
+    // Calculate the flash address offset
+    uint32_t flash_address_offset = packet_number * firmware_update_state.packet_size;
+
+    // Write the packet data to the download space. The whole packet is programmed in one batch.
+    if (!flash_api_write_firmware_update_packet(packet_data, firmware_update_state.packet_size, flash_address_offset))
+    {
+        return false;
+    }
+
+    if (packet_number < FIRMWARE_UPDATE_MAX_PACKET_COUNT)
+    {
+        received_packets[packet_number / 8] |= (uint8_t)(1U << (packet_number % 8));
+    }
+    else
+    {
+        firmware_update_state.packets_received++;
+    }
+    while ((firmware_update_state.packets_received < FIRMWARE_UPDATE_MAX_PACKET_COUNT)
+           && firmware_update_is_packet_received(firmware_update_state.packets_received))
+    {
+        firmware_update_state.packets_received++;
+    }
+
+    return true;
+}
 
 // --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to select the packet size of a firmware update session, based on the size proposed by the host. The
+ *        selected size is the largest power of two that does not exceed the proposed size, bounded by
+ *        FIRMWARE_UPDATE_MIN_PACKET_SIZE and FIRMWARE_UPDATE_MAX_PACKET_SIZE. A power of two always divides the
+ *        (sector aligned) application slot size, so the last packet never exceeds the slot.
+ *
+ * @param requested_packet_size Packet size proposed by the host. 0 selects the default packet size.
+ * @return uint16_t The accepted packet size.
+ */
+uint16_t
+firmware_update_negotiate_packet_size(uint16_t requested_packet_size)
+{
+    uint16_t packet_size = FIRMWARE_UPDATE_MIN_PACKET_SIZE;
+
+    if (requested_packet_size == 0)
+    {
+        return FIRMWARE_UPDATE_DEFAULT_PACKET_SIZE;
+    }
+
+    while ((packet_size < FIRMWARE_UPDATE_MAX_PACKET_SIZE) && ((packet_size << 1) <= requested_packet_size))
+    {
+        packet_size <<= 1;
+    }
+
+    return packet_size;
+}
+
 /**
  * @brief Function to start the firmware update process.
  *
+ * @param requested_packet_size Packet size proposed by the host (see firmware_update_negotiate_packet_size).
+ * @param fec_group_size Packets per parity packet, for a FEC session (see firmware_update_process_parity_packet). 0
+ *        if the packets must follow each other.
  * @return true if erase was successful, false otherwise.
  */
 bool
-firmware_update_start(void)
+firmware_update_start(uint16_t requested_packet_size, uint8_t fec_group_size)
 {
     // Check if the update process has already started
     if (firmware_update_state.is_update_started)
@@ -37,21 +198,109 @@ firmware_update_start(void)
     // Initialize the firmware update state
     firmware_update_state.is_update_started = true;
     firmware_update_state.packets_received  = 0;
+    firmware_update_state.packet_size       = firmware_update_negotiate_packet_size(requested_packet_size);
+    firmware_update_state.fec_group_size    = fec_group_size;
+    firmware_update_state.range_start       = 0;
+    firmware_update_state.range_end         = 0;
+    memset(received_packets, 0, sizeof(received_packets));
 
-    // Erase the secondary space, to make room for the new firmware
-    bool ret = flash_api_erase_secondary_space();
+    // Erase the download space (the slot that does not hold the booted image), to make room for the new firmware
+    flash_api_set_download_slot(flash_api_find_download_slot());
+    bool ret = flash_api_erase_download_space();
     return ret;
 }
 
 /**
- * @brief Function to process a firmware update packet.
+ * @brief Function to get the progress of an interrupted download (cancelled, or interrupted by a reset): the packets
+ *        written to the download space, up to the last programmed one, and their CRC32. Outside of a session, the
+ *        download space is selected again: an interrupted download leaves an image that fails its CRC, so the same
+ *        slot is found.
  *
- * @param packet Pointer to the packet data
- * @param size Size of the packet data
+ * @param requested_packet_size Packet size proposed by the host (see firmware_update_negotiate_packet_size).
+ * @param packet_count Set to the number of packets
+ * @param prefix_crc32 Set to the CRC32 of the packets
+ * @return uint16_t The packet size that the progress is counted in (the accepted packet size).
+ */
+uint16_t
+firmware_update_get_download_progress(uint16_t requested_packet_size, uint32_t *packet_count, uint32_t *prefix_crc32)
+{
+    uint16_t const packet_size = firmware_update_negotiate_packet_size(requested_packet_size);
+
+    if (!firmware_update_state.is_update_started)
+    {
+        flash_api_set_download_slot(flash_api_find_download_slot());
+    }
+
+    *packet_count = (flash_api_get_download_written_size() + packet_size - 1) / packet_size;
+    if (!flash_api_get_download_crc32(*packet_count * packet_size, prefix_crc32))
+    {
+        *packet_count = 0;
+        *prefix_crc32 = 0;
+    }
+
+    return packet_size;
+}
+
+/**
+ * @brief Function to resume an interrupted download. The session starts after the first packet_count packets, without
+ *        erasing the download space, only if the download space holds exactly these packets: their CRC32 must match,
+ *        and nothing may be written after them. Otherwise, the session starts from the first packet (see
+ *        firmware_update_start).
+ *
+ * @param requested_packet_size Packet size proposed by the host (see firmware_update_negotiate_packet_size).
+ * @param fec_group_size Packets per parity packet, for a FEC session. 0 if the packets must follow each other.
+ * @param packet_count Packets that the host expects in the download space
+ * @param prefix_crc32 CRC32 of these packets, as sent by the host
+ * @return true if the session was started (resumed, or from the first packet), false otherwise.
+ */
+bool
+firmware_update_resume(uint16_t requested_packet_size, uint8_t fec_group_size, uint32_t packet_count,
+                       uint32_t prefix_crc32)
+{
+    uint32_t written_packets = 0;
+    uint32_t crc32           = 0;
+
+    if (firmware_update_state.is_update_started)
+    {
+        return false;
+    }
+
+    uint16_t const packet_size = firmware_update_get_download_progress(requested_packet_size, &written_packets, &crc32);
+    if ((packet_count == 0) || (written_packets > packet_count)
+        || !flash_api_get_download_crc32(packet_count * packet_size, &crc32) || (crc32 != prefix_crc32))
+    {
+        TRACE_LOG("Download not resumed: %" PRIu32 " packets written\r\n", written_packets);
+        return firmware_update_start(requested_packet_size, fec_group_size);
+    }
+
+    firmware_update_state.is_update_started = true;
+    firmware_update_state.packets_received  = packet_count;
+    firmware_update_state.packet_size       = packet_size;
+    firmware_update_state.fec_group_size    = fec_group_size;
+    firmware_update_state.range_start       = 0;
+    firmware_update_state.range_end         = 0;
+    memset(received_packets, 0, sizeof(received_packets));
+    for (uint32_t i = 0; (i < packet_count) && (i < FIRMWARE_UPDATE_MAX_PACKET_COUNT); i++)
+    {
+        received_packets[i / 8] |= (uint8_t)(1U << (i % 8));
+    }
+
+    TRACE_LOG("Download resumed after %" PRIu32 " packets\r\n", packet_count);
+    return true;
+}
+
+/**
+ * @brief Function to process a firmware update packet. In a FEC session, the host does not wait for the response of
+ *        each packet: a lost packet leaves a gap, that the parity packet of its group fills (see
+ *        firmware_update_process_parity_packet). The packets are then processed like broadcast packets.
+ *
+ * @param packet_data Pointer to the packet data
+ * @param packet_number The (0-based) number of the packet
+ * @param packet_len Size of the packet data. Must match the negotiated packet size.
  * @return true if the packet was processed successfully, false otherwise.
  */
 bool
-firmware_update_process_packet(uint8_t *packet_data, uint32_t packet_number)
+firmware_update_process_packet(uint8_t *packet_data, uint32_t packet_number, uint32_t packet_len)
 {
     // Check if the update process has started
     if (!firmware_update_state.is_update_started)
@@ -59,25 +308,220 @@ firmware_update_process_packet(uint8_t *packet_data, uint32_t packet_number)
         return false;
     }
 
+    // Every packet of the session carries exactly the negotiated packet size
+    if (packet_len != firmware_update_state.packet_size)
+    {
+        return false;
+    }
+
+    if (firmware_update_state.fec_group_size != 0)
+    {
+        return firmware_update_process_broadcast_packet(packet_data, packet_number, packet_len);
+    }
+
     /* Check if the packet number is correct: packets_received is 1-based. Packet number is 0-based.
        E.g. first packet has packet_number 0. After receiving it, packets_received is 1.
        On the next packet, packet_number should be 1 and will be checked against packets_received. */
     if (packet_number != firmware_update_state.packets_received)
     {
+        stats_inc(STATS_COUNTER_SEQUENCE_ERR);
         return false;
     }
 
-    // Calculate the flash address offset
-    uint32_t flash_address_offset = firmware_update_state.packets_received * FIRMWARE_UPDATE_PACKET_SIZE;
+    return firmware_update_write_packet(packet_data, packet_number);
+}
 
-    // Write the packet data to the secondary space
-    bool ret = flash_api_write_firmware_update_packet(packet_data, FIRMWARE_UPDATE_PACKET_SIZE, flash_address_offset);
-    if (ret)
+/**
+ * @brief Function to process a broadcast firmware update packet (shared bus). Unlike firmware_update_process_packet,
+ *        the packets can arrive with gaps (a node can miss a broadcast frame, and no node answers it): any packet that
+ *        was not received yet is written at its place. The host then resends the missing packets (see
+ *        firmware_update_get_missing_packets). A packet that was already received is skipped.
+ *
+ * @param packet_data Pointer to the packet data
+ * @param packet_number The (0-based) number of the packet
+ * @param packet_len Size of the packet data. Must match the negotiated packet size.
+ * @return true if the packet was processed successfully (or was already received), false otherwise.
+ */
+bool
+firmware_update_process_broadcast_packet(uint8_t *packet_data, uint32_t packet_number, uint32_t packet_len)
+{
+    if (!firmware_update_state.is_update_started || (packet_len != firmware_update_state.packet_size)
+        || (packet_number >= FIRMWARE_UPDATE_MAX_PACKET_COUNT))
     {
-        firmware_update_state.packets_received++;
+        return false;
     }
 
-    return ret;
+    if (firmware_update_is_packet_received(packet_number))
+    {
+        return true;
+    }
+
+    if (packet_number != firmware_update_state.packets_received)
+    {
+        // Out of order: the packets in between were missed
+        stats_inc(STATS_COUNTER_SEQUENCE_ERR);
+    }
+
+    return firmware_update_write_packet(packet_data, packet_number);
+}
+
+/**
+ * @brief Function to process a parity packet (forward error correction): the XOR of the group_size packets that start
+ *        at packet_number. If a single packet of the group is missing, it is rebuilt from the parity and the packets of
+ *        the group that were received (read back from the download space), without a resend. The parity data is
+ *        overwritten.
+ *
+ * @param parity_data Pointer to the parity data
+ * @param packet_number The (0-based) number of the first packet of the group
+ * @param group_size Packets of the group
+ * @param packet_len Size of the parity data. Must match the negotiated packet size.
+ * @return true if every packet of the group is received (after the rebuild), false otherwise.
+ */
+bool
+firmware_update_process_parity_packet(uint8_t *parity_data, uint32_t packet_number, uint32_t group_size,
+                                      uint32_t packet_len)
+{
+    uint32_t missing_count  = 0;
+    uint32_t missing_packet = 0;
+
+    if (!firmware_update_state.is_update_started || (packet_len != firmware_update_state.packet_size)
+        || (group_size == 0) || ((packet_number + group_size) > FIRMWARE_UPDATE_MAX_PACKET_COUNT))
+    {
+        return false;
+    }
+
+    for (uint32_t i = packet_number; i < (packet_number + group_size); i++)
+    {
+        if (!firmware_update_is_packet_received(i))
+        {
+            missing_count++;
+            missing_packet = i;
+        }
+    }
+
+    if (missing_count == 0)
+    {
+        return true;
+    }
+    if (missing_count > 1)
+    {
+        // More losses than the parity can correct: the host resends the missing packets
+        return false;
+    }
+
+    // The missing packet is the XOR of the parity and the other packets of the group
+    for (uint32_t i = packet_number; i < (packet_number + group_size); i++)
+    {
+        if ((i != missing_packet)
+            && !flash_api_xor_firmware_update_packet(parity_data, packet_len, i * firmware_update_state.packet_size))
+        {
+            return false;
+        }
+    }
+
+    TRACE_LOG("FEC: packet %" PRIu32 " rebuilt\r\n", missing_packet);
+    stats_inc(STATS_COUNTER_FEC_REPAIR);
+    return firmware_update_write_packet(parity_data, missing_packet);
+}
+
+/**
+ * @brief Function to process a populated range of a sparse image (or a part of it), written at its offset from the
+ *        start of the image. The ranges must arrive in ascending order: the gaps between them are left erased, so the
+ *        download space holds the whole image, and its CRC32 and signature are checked as usual. The same range as
+ *        the last one written is a resend (its response was lost), and is skipped; any other range before the end of
+ *        the written part is rejected. packets_received follows the end of the last range written, in whole packets.
+ *
+ * @param range_data Pointer to the range data
+ * @param offset Offset of the range from the start of the image. Must be word aligned.
+ * @param range_len Size of the range data. Must be a word multiple, up to the negotiated packet size.
+ * @return true if the range was processed successfully (or is the one written last), false otherwise.
+ */
+bool
+firmware_update_process_range(uint8_t *range_data, uint32_t offset, uint32_t range_len)
+{
+    bool is_written;
+
+    if ((range_len > firmware_update_state.packet_size) || !firmware_update_check_range(offset, range_len, &is_written))
+    {
+        return false;
+    }
+
+    if (is_written)
+    {
+        return true;
+    }
+
+    if (!flash_api_write_firmware_update_packet(range_data, range_len, offset))
+    {
+        return false;
+    }
+
+    firmware_update_set_range(offset, offset + range_len);
+    return true;
+}
+
+/**
+ * @brief Function to copy a range of the image from the installed image, that holds the same bytes at the same offset
+ *        (the primary slot, or the other slot with BL_DIRECT_XIP), instead of receiving it. The copied ranges follow
+ *        the same order as the FWUG_DATA_AT ranges (see firmware_update_process_range()), and are not limited to the
+ *        packet size.
+ *
+ * @param offset Offset of the range from the start of the image. Must be word aligned.
+ * @param range_len Size of the range. Must be a word multiple.
+ * @return true if the range was copied successfully (or is the one written last), false otherwise.
+ */
+bool
+firmware_update_copy_range(uint32_t offset, uint32_t range_len)
+{
+    bool is_written;
+
+    if (!firmware_update_check_range(offset, range_len, &is_written))
+    {
+        return false;
+    }
+
+    if (is_written)
+    {
+        return true;
+    }
+
+    if (!flash_api_copy_to_download_space(offset, range_len))
+    {
+        return false;
+    }
+
+    firmware_update_set_range(offset, offset + range_len);
+    return true;
+}
+
+/**
+ * @brief Function to get the packets of the current session that were not received yet.
+ *
+ * @param packet_count Number of packets of the image (bounded by FIRMWARE_UPDATE_MAX_PACKET_COUNT)
+ * @param missing Set to the bitmap of the missing packets (bit i: packet i), (packet_count + 7) / 8 bytes
+ * @return uint32_t Number of missing packets
+ */
+uint32_t
+firmware_update_get_missing_packets(uint32_t packet_count, uint8_t *missing)
+{
+    uint32_t missing_count = 0;
+
+    if (packet_count > FIRMWARE_UPDATE_MAX_PACKET_COUNT)
+    {
+        packet_count = FIRMWARE_UPDATE_MAX_PACKET_COUNT;
+    }
+
+    memset(missing, 0, (packet_count + 7) / 8);
+    for (uint32_t i = 0; i < packet_count; i++)
+    {
+        if (!firmware_update_state.is_update_started || !firmware_update_is_packet_received(i))
+        {
+            missing[i / 8] |= (uint8_t)(1U << (i % 8));
+            missing_count++;
+        }
+    }
+
+    return missing_count;
 }
 
 /**
@@ -99,6 +543,7 @@ firmware_update_status(struct firmware_update_state_s *state)
     // Just copy the firmware update state
     state->is_update_started = firmware_update_state.is_update_started;
     state->packets_received  = firmware_update_state.packets_received;
+    state->packet_size       = firmware_update_state.packet_size;
 
     return;
 }
@@ -114,6 +559,9 @@ firmware_update_cancel(void)
     // Reset the firmware update state
     firmware_update_state.is_update_started = false;
     firmware_update_state.packets_received  = 0;
+    firmware_update_state.packet_size       = 0;
+    firmware_update_state.range_start       = 0;
+    firmware_update_state.range_end         = 0;
 
     return true;
 }
\ No newline at end of file
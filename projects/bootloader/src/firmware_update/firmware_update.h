@@ -18,12 +18,27 @@
  */
 struct firmware_update_state_s
 {
-    bool    is_update_started; /**< Flag to indicate if the update process has started */
+    bool     is_update_started; /**< Flag to indicate if the update process has started */
     uint32_t packets_received;  /**< Number of packets received */
+    uint16_t packet_size;       /**< Packet size negotiated for the current update session */
+    uint8_t  fec_group_size;    /**< Packets per parity packet (FEC session), 0 if the packets must follow each other */
+    uint32_t range_start;       /**< Start of the last range written (sparse image), from the start of the image */
+    uint32_t range_end;         /**< End of the last range written (sparse image), from the start of the image */
 };
 
 // --- function declarations -------------------------------------------------------------------------------------------
-bool firmware_update_start(void);
-bool firmware_update_process_packet(uint8_t *packet, uint32_t size);
-bool firmware_update_cancel(void);
-void firmware_update_status(struct firmware_update_state_s *state);
\ No newline at end of file
+bool     firmware_update_start(uint16_t requested_packet_size, uint8_t fec_group_size);
+bool     firmware_update_resume(uint16_t requested_packet_size, uint8_t fec_group_size, uint32_t packet_count,
+                                uint32_t prefix_crc32);
+uint16_t firmware_update_get_download_progress(uint16_t requested_packet_size, uint32_t *packet_count,
+                                               uint32_t *prefix_crc32);
+bool     firmware_update_process_packet(uint8_t *packet_data, uint32_t packet_number, uint32_t packet_len);
+bool     firmware_update_process_broadcast_packet(uint8_t *packet_data, uint32_t packet_number, uint32_t packet_len);
+bool     firmware_update_process_parity_packet(uint8_t *parity_data, uint32_t packet_number, uint32_t group_size,
+                                              uint32_t packet_len);
+bool     firmware_update_process_range(uint8_t *range_data, uint32_t offset, uint32_t range_len);
+bool     firmware_update_copy_range(uint32_t offset, uint32_t range_len);
+uint32_t firmware_update_get_missing_packets(uint32_t packet_count, uint8_t *missing);
+bool     firmware_update_cancel(void);
+void     firmware_update_status(struct firmware_update_state_s *state);
+uint16_t firmware_update_negotiate_packet_size(uint16_t requested_packet_size);
\ No newline at end of file
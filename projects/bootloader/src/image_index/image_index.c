@@ -0,0 +1,150 @@
+/**
+ * @file image_index.c
+ * @brief Per-sector CRC index of an application image (see image_index.h).
+ * @version 0.1
+ * @date 2024-08-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "image_index.h"
+
+#include <stddef.h>
+#include "crc/crc_driver.h"
+#include "trace/trace.h"
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to get the index of an image. The index is validated: the chunks must cover the image, up to the
+ *        index, in order.
+ *
+ * @param image_start_addr
+ * @param image_size_bytes Size of the image, without the footer
+ * @param chunk_count Set to the number of chunks of the index
+ * @return struct image_index_chunk_s const* The index entries, or NULL if the image has no (valid) index
+ */
+struct image_index_chunk_s const *
+image_index_get(uint32_t image_start_addr, uint32_t image_size_bytes, uint32_t *chunk_count)
+{
+    struct image_index_trailer_s const *trailer = (struct image_index_trailer_s const *)(image_start_addr
+                                                                                          + image_size_bytes
+                                                                                          - sizeof(*trailer));
+
+    if ((trailer->magic != IMAGE_INDEX_MAGIC) || (trailer->chunk_count == 0)
+        || (trailer->chunk_count > IMAGE_INDEX_MAX_CHUNKS))
+    {
+        return NULL;
+    }
+
+    uint32_t const index_offset
+        = image_size_bytes - sizeof(*trailer) - (trailer->chunk_count * sizeof(struct image_index_chunk_s));
+    struct image_index_chunk_s const *chunks
+        = (struct image_index_chunk_s const *)(uintptr_t)(image_start_addr + index_offset);
+    uint32_t                          chunk_start = 0;
+
+    for (uint32_t i = 0; i < trailer->chunk_count; i++)
+    {
+        if ((chunks[i].end_offset <= chunk_start) || (chunks[i].end_offset > index_offset))
+        {
+            return NULL;
+        }
+        chunk_start = chunks[i].end_offset;
+    }
+    if (chunk_start != index_offset)
+    {
+        return NULL;
+    }
+
+    *chunk_count = trailer->chunk_count;
+    return chunks;
+}
+
+/**
+ * @brief Function to check the CRC of an image that has an index, chunk by chunk. It stops at the first damaged chunk,
+ *        instead of going through the rest of the image. The index itself is checked last, against the stored CRC.
+ *
+ * @param image_start_addr
+ * @param image_size_bytes Size of the image, without the footer
+ * @param stored_crc CRC32 of the image, from the footer
+ * @return true The image has a valid index, and its CRC matches.
+ * @return false
+ */
+bool
+image_index_check_crc(uint32_t image_start_addr, uint32_t image_size_bytes, uint32_t stored_crc)
+{
+    uint32_t                          chunk_count = 0;
+    struct image_index_chunk_s const *chunks      = image_index_get(image_start_addr, image_size_bytes, &chunk_count);
+    uint32_t                          chunk_start = 0;
+    uint32_t                          crc         = 0;
+
+    if (chunks == NULL)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < chunk_count; i++)
+    {
+        crc = crc32_driver_update(crc, (uint8_t const *)(uintptr_t)(image_start_addr + chunk_start),
+                                  chunks[i].end_offset - chunk_start);
+        if (crc != chunks[i].crc)
+        {
+            TRACE_LOG("CRC mismatch in image chunk %" PRIu32 " (0x%08" PRIX32 " - 0x%08" PRIX32 ")\r\n",
+                      i,
+                      image_start_addr + chunk_start,
+                      image_start_addr + chunks[i].end_offset - 1);
+            return false;
+        }
+        chunk_start = chunks[i].end_offset;
+    }
+
+    // The index (and its trailer)
+    crc = crc32_driver_update(
+        crc, (uint8_t const *)(uintptr_t)(image_start_addr + chunk_start), image_size_bytes - chunk_start);
+    if (crc != stored_crc)
+    {
+        TRACE_LOG("CRC mismatch in image index: calculated 0x%08" PRIX32 ", stored 0x%08" PRIX32 "\r\n",
+                  crc,
+                  stored_crc);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Function to find all the damaged chunks of an image that has an index. Each chunk is checked on its own: its
+ *        CRC starts from the CRC that the index holds for the previous chunk.
+ *
+ * @param image_start_addr
+ * @param image_size_bytes Size of the image, without the footer
+ * @return uint32_t Bitmask of the damaged chunks (bit i: chunk i). 0 if no chunk is damaged, or the image has no index.
+ */
+uint32_t
+image_index_get_damaged_chunks(uint32_t image_start_addr, uint32_t image_size_bytes)
+{
+    uint32_t                          chunk_count = 0;
+    struct image_index_chunk_s const *chunks      = image_index_get(image_start_addr, image_size_bytes, &chunk_count);
+    uint32_t                          chunk_start = 0;
+    uint32_t                          damaged     = 0;
+
+    if (chunks == NULL)
+    {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < chunk_count; i++)
+    {
+        uint32_t crc = (i == 0) ? 0 : chunks[i - 1].crc;
+        crc          = crc32_driver_update(crc, (uint8_t const *)(uintptr_t)(image_start_addr + chunk_start),
+                                  chunks[i].end_offset - chunk_start);
+        if (crc != chunks[i].crc)
+        {
+            damaged |= (1UL << i);
+        }
+        chunk_start = chunks[i].end_offset;
+    }
+
+    return damaged;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file image_index.h
+ * @brief Per-sector CRC index of an application image. The image is split in chunks that follow the flash_sectors[]
+ *        geometry of the slot the image is linked for, and the index holds the running CRC32 of the image at the end
+ *        of each chunk. The index is part of the image (it is covered by the CRC32 and the signature of the footer),
+ *        so the CRC check can stop at the first damaged chunk, and a damaged image can be diagnosed chunk by chunk.
+ *        The index is created by scripts/build_tools/create_dfu_image.py.
+ *
+ *        Image layout (slot, without the footer):
+ *        | chunk 0 | chunk 1 | ... | chunk n-1 | struct image_index_chunk_s[n] | struct image_index_trailer_s |
+ *        The chunks cover the image up to the index. Images without an index are checked as a whole.
+ * @version 0.1
+ * @date 2024-08-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef IMAGE_INDEX_H
+#define IMAGE_INDEX_H
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#define IMAGE_INDEX_MAGIC      0x58444E49 // "INDX"
+#define IMAGE_INDEX_MAX_CHUNKS 16         // Must fit in the damaged chunks bitmask (and match create_dfu_image.py)
+
+// --- structs ---------------------------------------------------------------------------------------------------------
+/**
+ * @brief Index entry of a chunk. The chunk starts where the previous one ends (the first one at the image start).
+ *
+ */
+struct image_index_chunk_s
+{
+    uint32_t end_offset; /**< End of the chunk (exclusive), from the image start */
+    uint32_t crc;        /**< CRC32 of the image, from its start up to end_offset */
+} __attribute__((packed));
+
+/**
+ * @brief Trailer of the index, right before the footer
+ *
+ */
+struct image_index_trailer_s
+{
+    uint32_t chunk_count;
+    uint32_t magic; /**< IMAGE_INDEX_MAGIC */
+} __attribute__((packed));
+
+// --- function declarations -------------------------------------------------------------------------------------------
+struct image_index_chunk_s const *image_index_get(uint32_t image_start_addr,
+                                                  uint32_t image_size_bytes,
+                                                  uint32_t *chunk_count);
+bool     image_index_check_crc(uint32_t image_start_addr, uint32_t image_size_bytes, uint32_t stored_crc);
+uint32_t image_index_get_damaged_chunks(uint32_t image_start_addr, uint32_t image_size_bytes);
+
+#endif // IMAGE_INDEX_H
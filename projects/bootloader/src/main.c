@@ -24,6 +24,10 @@
 #include "com_protocol.h"
 #include "user_input.h"
 #include "authentication.h"
+#include "profiling.h"
+#include "boot_info.h"
+#include "trace.h"
+#include "lz_decompress.h"
 
 // --- typedefs --------------------------------------------------------------------------------------------------------
 /**
@@ -66,6 +70,7 @@ typedef struct bl_fsm_ctx_t
     // Status flags
     uint8_t newer_ver_on_backup : 1;
     uint8_t recover_main_img : 1;
+    uint8_t boot_secondary : 1; // BL_DIRECT_XIP: the verified image is executed in place from the secondary slot
 } bl_fsm_ctx_s;
 
 /**
@@ -107,43 +112,126 @@ static const bl_fsm_handler bl_fsm_map[BL_FSM_STATE_COUNT][BL_FSM_EVT_COUNT] = {
 };
 // clang-format on
 
-static void boot_application(void);
+static void boot_application(uint32_t slot_start_addr, uint32_t slot_end_addr);
+static void boot_info_record_fsm_state(bl_fsm_states_e state);
+static bool is_secondary_compressed(void);
+static bool authenticate_secondary_app(void);
+static void com_start(void);
 
 // --- static function definitions -------------------------------------------------------------------------------------
 /**
- * @brief Function that boots the application
+ * @brief Function to record the entry to an FSM state, in the boot info record handed over to the application.
  *
+ * @param state
  */
 static void
-boot_application(void)
+boot_info_record_fsm_state(bl_fsm_states_e state)
+{
+    boot_info_record_stage(BOOT_INFO_STAGE_INIT + (state - BL_FSM_INIT_STATE), sys_cycles_to_us(sys_get_cycles()));
+}
+
+/**
+ * @brief Function to check if the secondary slot holds a compressed image
+ *
+ * @return true
+ * @return false
+ */
+static bool
+is_secondary_compressed(void)
+{
+    return lz_image_get_header(SYM_ADDR(__flash_app_secondary_start__),
+                               (SYM_ADDR(__flash_app_secondary_end__)) - (SYM_ADDR(__flash_app_secondary_start__)) + 1)
+           != NULL;
+}
+
+/**
+ * @brief Function to authenticate the secondary image: a plain image, or a compressed image (verified over its
+ *        decompressed output).
+ *
+ * @return true
+ * @return false
+ */
+static bool
+authenticate_secondary_app(void)
+{
+    uint32_t secondary_start_addr = (SYM_ADDR(__flash_app_secondary_start__));
+    uint32_t secondary_img_size_bytes
+        = (SYM_ADDR(__flash_app_secondary_end__)) - (SYM_ADDR(__flash_app_secondary_start__)) + 1;
+    uint8_t const *secondary_signature = (uint8_t const *)&__header_app_secondary_hash_start__;
+
+    if (is_secondary_compressed())
+    {
+        return authenticate_compressed_application(secondary_start_addr,
+                                                   secondary_img_size_bytes,
+                                                   *((uint32_t *)&__header_app_secondary_crc_start__),
+                                                   secondary_signature);
+    }
+
+    return authenticate_application(
+        secondary_start_addr, secondary_img_size_bytes - (SYM_ADDR(__header_size_bytes__)), secondary_signature);
+}
+
+/**
+ * @brief Function to bring up the serial communication (com protocol and uart). Only the recovery path (boot loop) needs
+ *        it, so a normal boot does not initialize (and then deinitialize) the uart, its watchdog timer and the com
+ *        protocol. Only the first call initializes them.
+ *
+ */
+static void
+com_start(void)
+{
+    static bool is_init = false;
+
+    if (is_init)
+    {
+        return;
+    }
+    // Initialize the com protocol. It registers the uart callbacks, so it must precede the start of the uart reception.
+    com_protocol_init();
+    // Init the uart peripheral
+    uart_driver_init();
+
+    is_init = true;
+}
+
+/**
+ * @brief Function that boots the application of an image slot. The vector table of the application is at the start of
+ *        the slot.
+ *
+ * @param slot_start_addr
+ * @param slot_end_addr
+ */
+static void
+boot_application(uint32_t slot_start_addr, uint32_t slot_end_addr)
 {
     uint32_t    jump_address;
     bl_func_ptr jump_to_application;
 
     // check if there is something "installed" in the app FLASH region
     // TODO: GPA: need to find a specific pattern to identify our application
-    if (((*(uint32_t *)((uint32_t)&__flash_app_start__)) & 0x2FFE0000) == 0x20000000)
+    if (((*(uint32_t *)(uintptr_t)slot_start_addr) & 0x2FFE0000) == 0x20000000)
     {
         // TODO: GPA: we can check here if the stack pointer is within valid RAM region
-        // TODO: GPA: we can check here if the reset handler is a valid address, within the FLASH region
-#ifdef DEBUG_LOG
-        printf("APP Start ...\r\n");
-#endif
+        jump_address = *(uint32_t *)(uintptr_t)(slot_start_addr + 4);
+        // The reset handler must be within the slot: an image linked for the other slot cannot run from this one
+        if ((jump_address < slot_start_addr) || (jump_address > slot_end_addr))
+        {
+            TRACE_LOG("APP not linked for slot 0x%08" PRIX32 "\r\n", slot_start_addr);
+            return;
+        }
+        TRACE_LOG("APP Start ...\r\n");
         // jump to the application
-        jump_address        = *(uint32_t *)(((uint32_t)&__flash_app_start__) + 4);
-        jump_to_application = (bl_func_ptr)jump_address;
+        jump_to_application = (bl_func_ptr)(uintptr_t)jump_address;
         // initialize application's stack pointer
-        sys_set_msp(((uint32_t)&__flash_app_start__));
+        sys_set_msp(slot_start_addr);
         // prepare for the application
-        sys_prepare_for_application();
+        sys_prepare_for_application(slot_start_addr);
         jump_to_application();
     }
     else
     {
         // there is no application installed
-#ifdef DEBUG_LOG
-        printf("No APP found\r\n");
-#endif
+        TRACE_LOG("No APP found\r\n");
     }
 }
 
@@ -169,23 +257,28 @@ fsm_init_hdl(bl_fsm_ctx_s * const ctx)
 
     // Initialize the system
     sys_init();
-    // Init the uart peripheral
-    uart_driver_init();
-    // Initialize the com protocol
-    com_protocol_init();
+    // Start a new boot info record, for the application
+    boot_info_init(SystemCoreClock);
+    boot_info_record_fsm_state(BL_FSM_INIT_STATE);
 #ifdef DEBUG_LOG
-    printf(" --- BOOTLOADER Start --- \r\n");
+    // The printf output (logs) goes over the uart: it is needed from the start
+    com_start();
 #endif
+    TRACE_LOG(" --- BOOTLOADER Start --- \r\n");
 
     if (user_input_is_pressed())
     {
         return BL_FSM_BUTTON_PRESSED_EVT;
     }
 
+#ifndef BL_DIRECT_INSTALL
+    // With BL_DIRECT_INSTALL the updates are downloaded straight to the primary slot: the secondary slot is not used
     if (flash_api_is_secondary_newer())
     {
         ctx->newer_ver_on_backup = true;
+        boot_info_add_path_flags(BOOT_INFO_PATH_NEWER_ON_SECONDARY);
     }
+#endif
 
     return BL_FSM_ERR_OR_NONE_EVT;
 }
@@ -207,14 +300,13 @@ fsm_crc_check_hdl(bl_fsm_ctx_s * const ctx)
     }
     // Set the current state
     ctx->curr_state = BL_FSM_CRC_CHECK_STATE;
+    boot_info_record_fsm_state(BL_FSM_CRC_CHECK_STATE);
 
     bool is_crc_ok = false;
     // First handle the case where an image of newer version is found in the backup/seconday region.
     if (ctx->newer_ver_on_backup)
     {
-#ifdef DEBUG_LOG
-        printf("Checking CRC of backup slot (newer version found)\r\n");
-#endif
+        TRACE_LOG("Checking CRC of backup slot (newer version found)\r\n");
         is_crc_ok = crc_api_check_secondary_app();
         if (is_crc_ok)
         {
@@ -224,6 +316,7 @@ fsm_crc_check_hdl(bl_fsm_ctx_s * const ctx)
 
         // If newer version is found but CRC is not ok, mark the check as failed.
         ctx->newer_ver_on_backup = false;
+        boot_info_add_path_flags(BOOT_INFO_PATH_UPDATE_REJECTED);
         return BL_FSM_CHECK_FAIL_EVT;
     }
 
@@ -231,9 +324,7 @@ fsm_crc_check_hdl(bl_fsm_ctx_s * const ctx)
     // First check if we need to recover the primary image.
     if (!ctx->recover_main_img)
     {
-#ifdef DEBUG_LOG
-        printf("Checking CRC of main application \r\n");
-#endif
+        TRACE_LOG("Checking CRC of main application \r\n");
         is_crc_ok = crc_api_check_primary_app();
         if (is_crc_ok)
         {
@@ -241,15 +332,19 @@ fsm_crc_check_hdl(bl_fsm_ctx_s * const ctx)
             return BL_FSM_CHECK_PASS_EVT;
         }
 
+        boot_info_add_path_flags(BOOT_INFO_PATH_PRIMARY_CRC_FAIL);
+#ifdef BL_DIRECT_INSTALL
+        // No fallback image (e.g. interrupted download): stay in the boot loop, until a complete and valid image lands.
+        return BL_FSM_ERR_OR_NONE_EVT;
+#else
         // If CRC is not ok, mark the check as failed and we should recover the primary image, so raise the flag.
         ctx->recover_main_img = true;
         return BL_FSM_CHECK_FAIL_EVT;
+#endif
     }
 
     // Then check if we need to recover the main image, from the secondary image.
-#ifdef DEBUG_LOG
-    printf("Checking CRC of secondary image\r\n");
-#endif
+    TRACE_LOG("Checking CRC of secondary image\r\n");
     is_crc_ok = crc_api_check_secondary_app();
     if (is_crc_ok)
     {
@@ -276,48 +371,50 @@ fsm_auth_hdl(bl_fsm_ctx_s * const ctx)
         return -1;
     }
     ctx->curr_state = BL_FSM_AUTH_STATE;
+    boot_info_record_fsm_state(BL_FSM_AUTH_STATE);
 
-    uint32_t secondary_start_addr = ((uint32_t)&__flash_app_secondary_start__);
-    uint32_t secondary_img_size_bytes
-        = ((uint32_t)&__flash_app_secondary_end__) - ((uint32_t)&__flash_app_secondary_start__) + 1;
-
-    uint32_t primary_start_addr     = ((uint32_t)&__flash_app_start__);
-    uint32_t primary_img_size_bytes = ((uint32_t)&__flash_app_end__) - ((uint32_t)&__flash_app_start__) + 1;
+    uint32_t primary_start_addr     = (SYM_ADDR(__flash_app_start__));
+    uint32_t primary_img_size_bytes = (SYM_ADDR(__flash_app_end__)) - (SYM_ADDR(__flash_app_start__)) + 1;
 
-    uint32_t primary_signature_start_addr   = ((uint32_t)&__header_app_hash_start__);
-    uint32_t secondary_signature_start_addr = ((uint32_t)&__header_app_secondary_hash_start__);
+    uint32_t primary_signature_start_addr = (SYM_ADDR(__header_app_hash_start__));
 
-    uint32_t header_size_bytes = ((uint32_t)&__header_size_bytes__);
+    uint32_t header_size_bytes = (SYM_ADDR(__header_size_bytes__));
     // First handle the case where an image of newer version is found in the backup/seconday region.
     if (ctx->newer_ver_on_backup)
     {
-#ifdef DEBUG_LOG
-        printf("Checking AUTH for secondary slot (newer version found)");
-#endif
+        TRACE_LOG("Checking AUTH for secondary slot (newer version found)");
         // Either the auth step will succeed or fail for the newer version in the backup region.
         // Either way, the bootloader will not re-try to boot the newer version, if the first try fails.
         ctx->newer_ver_on_backup = false;
         // If newer version is found and auth is ok, mark the check as passed.
-        if (authenticate_application(primary_start_addr,
-                                     primary_img_size_bytes - header_size_bytes,
-                                     (uint8_t *)primary_signature_start_addr))
+        if (authenticate_secondary_app())
         {
+#ifdef BL_DIRECT_XIP
+            // Newer version on backup + CRC ok + Auth ok = execute it in place, no transfer. The primary image is kept
+            // as the fallback. A compressed image cannot be executed in place: it is installed.
+            if (!is_secondary_compressed())
+            {
+                ctx->boot_secondary = true;
+                boot_info_add_path_flags(BOOT_INFO_PATH_SECONDARY_BOOTED);
+                return BL_FSM_CHECK_PASS_EVT;
+            }
+#endif
             // Newer version on backup + CRC ok + Auth ok = transfer the secondary to primary
             bool is_transfer_ok = flash_api_transfer_secondary_to_primary();
             if (is_transfer_ok)
             {
                 // If transfer is successful, mark the check as passed.
+                boot_info_add_path_flags(BOOT_INFO_PATH_UPDATE_INSTALLED);
                 return BL_FSM_CHECK_PASS_EVT;
             }
 
             // If transfer failed, mark the check as failed.
             return BL_FSM_CHECK_FAIL_EVT;
         }
-#ifdef DEBUG_LOG
-        printf("Secondary image auth failed\r\n");
-#endif
+        TRACE_LOG("Secondary image auth failed\r\n");
 
         // If authentication failed, mark the check as failed.
+        boot_info_add_path_flags(BOOT_INFO_PATH_UPDATE_REJECTED);
         return BL_FSM_CHECK_FAIL_EVT;
     }
 
@@ -325,20 +422,27 @@ fsm_auth_hdl(bl_fsm_ctx_s * const ctx)
     // First check if we need to recover the primary image.
     if (ctx->recover_main_img)
     {
-#ifdef DEBUG_LOG
-        printf("Checking AUTH for secondary image slot\r\n");
-#endif
+        TRACE_LOG("Checking AUTH for secondary image slot\r\n");
         ctx->recover_main_img = false;
         // Check the auth of the secondary image.
-        if (authenticate_application(secondary_start_addr,
-                                     secondary_img_size_bytes - header_size_bytes,
-                                     (uint8_t *)secondary_signature_start_addr))
+        if (authenticate_secondary_app())
         {
+#ifdef BL_DIRECT_XIP
+            // If auth is ok, execute the secondary image in place. The damaged primary image is left as is. A
+            // compressed image cannot be executed in place: it is installed.
+            if (!is_secondary_compressed())
+            {
+                ctx->boot_secondary = true;
+                boot_info_add_path_flags(BOOT_INFO_PATH_SECONDARY_BOOTED);
+                return BL_FSM_CHECK_PASS_EVT;
+            }
+#endif
             // If auth is ok, mark the check, first transfer the secondary to primary.
             bool is_transfer_ok = flash_api_transfer_secondary_to_primary();
             if (is_transfer_ok)
             {
                 // If transfer is successful, mark the check as passed.
+                boot_info_add_path_flags(BOOT_INFO_PATH_RECOVERED);
                 return BL_FSM_CHECK_PASS_EVT;
             }
 
@@ -346,33 +450,35 @@ fsm_auth_hdl(bl_fsm_ctx_s * const ctx)
         }
 
         // If authentication failed, mark the check as failed.
-#ifdef DEBUG_LOG
-        printf("Secondary image auth failed\r\n");
-#endif
+        TRACE_LOG("Secondary image auth failed\r\n");
         return BL_FSM_ERR_OR_NONE_EVT;
     }
-#ifdef DEBUG_LOG
-    printf("Checking AUTH for primary image slot\r\n");
-#endif
+    TRACE_LOG("Checking AUTH for primary image slot\r\n");
     // Then check if primary image is ok.
-    if (authenticate_application(
-            primary_start_addr, primary_img_size_bytes - header_size_bytes, (uint8_t *)primary_signature_start_addr))
+    if (authenticate_application(primary_start_addr,
+                                 primary_img_size_bytes - header_size_bytes,
+                                 (uint8_t *)(uintptr_t)primary_signature_start_addr))
     {
         // If auth is ok, mark the check as passed.
         return BL_FSM_CHECK_PASS_EVT;
     }
-#ifdef DEBUG_LOG
-    printf("Primary image auth failed\r\n");
-#endif
+    TRACE_LOG("Primary image auth failed\r\n");
+    boot_info_add_path_flags(BOOT_INFO_PATH_PRIMARY_AUTH_FAIL);
+#ifdef BL_DIRECT_INSTALL
+    // No fallback image: stay in the boot loop, until a valid image is downloaded.
+    return BL_FSM_ERR_OR_NONE_EVT;
+#else
     // If authentication failed, mark the check as failed.
     ctx->recover_main_img = true;
     return BL_FSM_CHECK_FAIL_EVT;
+#endif
 }
 
 /**
  * @brief State handler for booting the application. This handler is responsible for preparing the system to jump to the
- *        main application and eventually jump. It always boots the primary slot. During the boot process the secondary
+ *        main application and eventually jump. It boots the primary slot. During the boot process the secondary
  *        image has already been transfered to main partition, if needed (a. newer version, b. main img is damaged).
+ *        With BL_DIRECT_XIP, there is no transfer: the secondary slot is booted in place in those cases.
  *        This state will only be skipped when there is no valid application found on either main or secondary slot to
  *        boot.
  *
@@ -385,10 +491,27 @@ fsm_boot_app_hdl(bl_fsm_ctx_s * const ctx)
         return -1;
     }
     ctx->curr_state = BL_FSM_BOOT_APP_STATE;
-#ifdef DEBUG_LOG
-    printf("Booting application...\r\n");
+    boot_info_record_fsm_state(BL_FSM_BOOT_APP_STATE);
+    TRACE_LOG("Booting application...\r\n");
+    // The booted slot holds the verified image. Its digest was computed during the last authentication.
+    uint32_t       slot_start_addr   = SYM_ADDR(__flash_app_start__);
+    uint32_t       slot_end_addr     = SYM_ADDR(__flash_app_end__);
+    uint8_t const *fw_version_footer = (uint8_t const *)&__header_app_fw_version_start__;
+    if (ctx->boot_secondary)
+    {
+        slot_start_addr   = SYM_ADDR(__flash_app_secondary_start__);
+        slot_end_addr     = SYM_ADDR(__flash_app_secondary_end__);
+        fw_version_footer = (uint8_t const *)&__header_app_secondary_fw_version_start__;
+    }
+    boot_info_set_image(fw_version_footer, get_last_image_digest());
+#ifdef BL_KEEP_CLOCKS
+    // The clock tree is not reset before the jump: tell the application, so that it can skip its clock bring-up
+    uint32_t hclk_hz, pclk1_hz, pclk2_hz;
+    sys_get_bus_clocks(&hclk_hz, &pclk1_hz, &pclk2_hz);
+    boot_info_set_clocks(BOOT_INFO_CLOCKS_PRESERVED, hclk_hz, pclk1_hz, pclk2_hz);
 #endif
-    boot_application();
+    boot_info_seal(sys_cycles_to_us(sys_get_cycles()));
+    boot_application(slot_start_addr, slot_end_addr);
     return BL_FSM_ERR_OR_NONE_EVT; // Boot process finished, loop back if needed.
 }
 
@@ -404,11 +527,15 @@ fsm_bootloop_hdl(bl_fsm_ctx_s * const ctx)
     {
         return -1;
     }
+    if (ctx->curr_state != BL_FSM_BOOTLOOP_STATE)
+    {
+        // Entering the boot loop: start the serial communication (recovery)
+        com_start();
+    }
     ctx->curr_state = BL_FSM_BOOTLOOP_STATE;
-#ifdef DEBUG_LOG
-    printf("Bootloader loop...\r\n");
-#endif
-    // TODO: GPA: we need to enable the uart communication here for serial dfu support
+    boot_info_record_fsm_state(BL_FSM_BOOTLOOP_STATE);
+    TRACE_LOG("Bootloader loop...\r\n");
+    com_protocol_process();
     sys_delay_ms(1000);
     return BL_FSM_ERR_OR_NONE_EVT; // Stay in bootloop
 }
@@ -428,17 +555,15 @@ main(void)
         if (curr_state >= BL_FSM_STATE_COUNT || evt >= BL_FSM_EVT_COUNT || bl_fsm_map[curr_state][evt] == NULL)
         {
             // Invalid state
-#ifdef DEBUG_LOG
-            printf("Current state: %d - event: %d\r\n", curr_state, evt);
-#endif
+            TRACE_LOG("Current state: %d - event: %d\r\n", curr_state, evt);
             break;
         }
 
-        // Execute the state handler
+        // Execute the state handler. Each handler stores its own state, which identifies the profiled region.
+        PROF_BEGIN(fsm);
         evt = bl_fsm_map[curr_state][evt](&fsm_ctx);
+        PROF_END(fsm, PROF_REGION_FSM_INIT + (fsm_ctx.curr_state - BL_FSM_INIT_STATE));
     }
-#ifdef DEBUG_LOG
-    printf("Bootloader: fatal error... Terminating.");
-#endif
+    TRACE_LOG("Bootloader: fatal error... Terminating.");
     return 0;
 }
\ No newline at end of file
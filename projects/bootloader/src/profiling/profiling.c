@@ -0,0 +1,68 @@
+/**
+ * @file profiling.c
+ * @brief Lightweight profiling of the bootloader hot paths. The ticks are the cycles of the cycle counter (DWT on
+ *        target, enabled by sys_init; emulated from the monotonic clock on host builds). The per-region summary is
+ *        read by the host through REQ_DATA (COM_PROTO_DATA_TYPE_PROFILE).
+ * @version 0.1
+ * @date 2024-07-21
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "profiling.h"
+
+#include <stddef.h>
+
+#ifdef BL_PROFILING
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+static struct prof_region_stats_s prof_regions[PROF_REGION_COUNT];
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to account an execution of a region
+ *
+ * @param region
+ * @param ticks The ticks spent in the region
+ */
+void
+prof_record(enum prof_region_e region, uint32_t ticks)
+{
+    if (region >= PROF_REGION_COUNT)
+    {
+        return;
+    }
+
+    struct prof_region_stats_s *stats = &prof_regions[region];
+    if ((stats->calls == 0) || (ticks < stats->min_ticks))
+    {
+        stats->min_ticks = ticks;
+    }
+    if (ticks > stats->max_ticks)
+    {
+        stats->max_ticks = ticks;
+    }
+    stats->total_ticks += ticks;
+    stats->calls++;
+}
+
+/**
+ * @brief Function to get the accumulated measurements of a region
+ *
+ * @param region
+ * @param stats
+ */
+void
+prof_get_region_stats(enum prof_region_e region, struct prof_region_stats_s *stats)
+{
+    if ((region >= PROF_REGION_COUNT) || (stats == NULL))
+    {
+        return;
+    }
+
+    *stats = prof_regions[region];
+}
+
+#endif // BL_PROFILING
@@ -0,0 +1,81 @@
+/**
+ * @file profiling.h
+ * @brief Lightweight profiling of the bootloader hot paths. Code regions are wrapped with PROF_BEGIN/PROF_END markers,
+ *        which accumulate the elapsed cycles per region. The operations timed by the stats module (crc, sha256, ecdsa,
+ *        flash) are not marked: stats_timer_stop accounts them to their region. The markers compile to nothing,
+ *        unless BL_PROFILING is defined (cmake -DBL_PROFILING=ON). The host reads the per region summary through
+ *        REQ_DATA (COM_PROTO_DATA_TYPE_PROFILE).
+ * @version 0.1
+ * @date 2024-07-21
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef PROFILING_H
+#define PROFILING_H
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include <stdint.h>
+#include "sys/sys.h"
+
+// --- enums -----------------------------------------------------------------------------------------------------------
+/**
+ * @brief Enumeration of the profiled regions. The FSM regions follow the order of the FSM states (see main.c). The
+ *        host tools name the regions in this order (bootloader_tool.py).
+ *
+ */
+enum prof_region_e
+{
+    PROF_REGION_FSM_INIT = 0,
+    PROF_REGION_FSM_CRC_CHECK,
+    PROF_REGION_FSM_AUTH,
+    PROF_REGION_FSM_BOOT_APP,
+    PROF_REGION_FSM_BOOTLOOP,
+    PROF_REGION_CRC32,
+    PROF_REGION_CRC16,
+    PROF_REGION_AUTHENTICATE,
+    PROF_REGION_SHA256,
+    PROF_REGION_ECDSA_VERIFY,
+    PROF_REGION_FLASH_ERASE,
+    PROF_REGION_FLASH_PROGRAM,
+    PROF_REGION_COUNT
+};
+
+// --- structs ---------------------------------------------------------------------------------------------------------
+/**
+ * @brief Accumulated measurements of a profiled region
+ *
+ */
+struct prof_region_stats_s
+{
+    uint32_t calls;       /**< Number of times the region was executed */
+    uint64_t total_ticks; /**< Sum of the cycles spent in the region */
+    uint32_t min_ticks;   /**< Fastest execution */
+    uint32_t max_ticks;   /**< Slowest execution */
+};
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+#ifdef BL_PROFILING
+/**
+ * @brief Scoped profiling markers. PROF_BEGIN(tag) declares the start point of a region in the current scope, and
+ *        PROF_END(tag, region) accounts the cycles elapsed since then to the given region. The same tag can be closed
+ *        on several exit paths. PROF_RECORD(region, cycles) accounts an already measured duration.
+ *
+ */
+#define PROF_BEGIN(tag)            uint32_t const prof_start_##tag = sys_get_cycles()
+#define PROF_END(tag, region)      prof_record((region), sys_get_cycles() - prof_start_##tag)
+#define PROF_RECORD(region, ticks) prof_record((region), (ticks))
+#else
+#define PROF_BEGIN(tag)            ((void)0)
+#define PROF_END(tag, region)      ((void)0)
+#define PROF_RECORD(region, ticks) ((void)(region))
+#endif
+
+// --- function declarations -------------------------------------------------------------------------------------------
+#ifdef BL_PROFILING
+void     prof_record(enum prof_region_e region, uint32_t ticks);
+void     prof_get_region_stats(enum prof_region_e region, struct prof_region_stats_s *stats);
+#endif
+
+#endif // PROFILING_H
@@ -0,0 +1,127 @@
+/**
+ * @file stats.c
+ * @brief This module keeps counters and timings of the bootloader operations (e.g. the firmware update). The timings
+ *        are based on the cycle counter, since most of the operations run inside the uart interrupt. The timers
+ *        accumulate cycles, and are converted to us only when reported: short operations (e.g. the CRC16 of a frame)
+ *        would otherwise be rounded down to 0 on each call.
+ * @version 0.1
+ * @date 2024-07-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "stats.h"
+
+#include <stddef.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "sys/sys.h"
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+static struct stats_s stats_data;
+static uint64_t       stats_timer_cycles[STATS_TIMER_COUNT]; // Accumulated cycles (stats_data.timers_us is unused)
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to increase an event counter
+ *
+ * @param counter
+ */
+void
+stats_inc(enum stats_counter_e counter)
+{
+    if (counter >= STATS_COUNTER_COUNT)
+    {
+        return;
+    }
+
+    stats_data.counters[counter]++;
+}
+
+/**
+ * @brief Function to start timing an operation. The returned value must be passed to stats_timer_stop or
+ *        stats_record_packet_latency.
+ *
+ * @return uint32_t
+ */
+uint32_t
+stats_timer_start(void)
+{
+    return sys_get_cycles();
+}
+
+/**
+ * @brief Function to stop timing an operation, and add its duration to the given timer. With BL_PROFILING, the
+ *        duration is also accounted to the given profiled region (the timers aggregate several regions, e.g. CRC32
+ *        and CRC16).
+ *
+ * @param timer
+ * @param region
+ * @param start The value returned by stats_timer_start.
+ */
+void
+stats_timer_stop(enum stats_timer_e timer, enum prof_region_e region, uint32_t start)
+{
+    uint32_t cycles = sys_get_cycles() - start;
+
+    PROF_RECORD(region, cycles);
+    if (timer >= STATS_TIMER_COUNT)
+    {
+        return;
+    }
+
+    stats_timer_cycles[timer] += cycles;
+}
+
+/**
+ * @brief Function to record the processing latency of a firmware update packet, in the log2 bucketed histogram.
+ *
+ * @param start The value returned by stats_timer_start, when the packet was received.
+ */
+void
+stats_record_packet_latency(uint32_t start)
+{
+    uint32_t latency_us = sys_cycles_to_us(sys_get_cycles() - start);
+    uint32_t bucket     = 0;
+
+    while ((latency_us > 1) && (bucket < (STATS_LATENCY_BUCKET_COUNT - 1)))
+    {
+        latency_us >>= 1;
+        bucket++;
+    }
+
+    stats_data.packet_latency_hist[bucket]++;
+}
+
+/**
+ * @brief Function to get a snapshot of the statistics. The accumulated cycles of the timers are converted to us.
+ *
+ * @param stats
+ */
+void
+stats_get(struct stats_s *stats)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    memcpy(stats, &stats_data, sizeof(struct stats_s));
+    for (uint32_t i = 0; i < STATS_TIMER_COUNT; i++)
+    {
+        stats->timers_us[i] = (uint32_t)(stats_timer_cycles[i] / (SystemCoreClock / 1000000));
+    }
+}
+
+/**
+ * @brief Function to clear all the statistics
+ *
+ */
+void
+stats_reset(void)
+{
+    memset(&stats_data, 0, sizeof(struct stats_s));
+    memset(stats_timer_cycles, 0, sizeof(stats_timer_cycles));
+}
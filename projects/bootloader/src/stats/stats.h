@@ -0,0 +1,75 @@
+/**
+ * @file stats.h
+ * @brief This module keeps counters and timings of the bootloader operations (e.g. the firmware update). They can be
+ *        read by the host, through REQ_DATA (COM_PROTO_DATA_TYPE_DEBUG_INF).
+ * @version 0.1
+ * @date 2024-07-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include <stdint.h>
+#include "profiling/profiling.h"
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+// Number of buckets of the packet latency histogram. Bucket i counts latencies in [2^i, 2^(i+1)) us (bucket 0 also
+// counts 0 us). The last bucket also counts any longer latency.
+#define STATS_LATENCY_BUCKET_COUNT 24
+
+// --- enums -----------------------------------------------------------------------------------------------------------
+/**
+ * @brief Enumeration of the event counters
+ *
+ */
+enum stats_counter_e
+{
+    STATS_COUNTER_FRAMES_RX = 0,   /* Frames received (valid header) */
+    STATS_COUNTER_CRC_ERR,         /* Frames dropped due to CRC16 failure */
+    STATS_COUNTER_SEQUENCE_ERR,    /* Firmware update packets with an unexpected packet number */
+    STATS_COUNTER_UART_OVERRUN,    /* Uart overrun errors */
+    STATS_COUNTER_UART_RECOVERY,   /* Uart reception recoveries (errors or reception watchdog) */
+    STATS_COUNTER_FEC_REPAIR,      /* Firmware update packets rebuilt from a parity packet */
+    STATS_COUNTER_COUNT
+};
+
+/**
+ * @brief Enumeration of the accumulated timers
+ *
+ */
+enum stats_timer_e
+{
+    STATS_TIMER_ERASE = 0, /* Flash erase */
+    STATS_TIMER_PROGRAM,   /* Flash program */
+    STATS_TIMER_CRC,       /* CRC32 and CRC16 calculation */
+    STATS_TIMER_SHA,       /* SHA-256 calculation */
+    STATS_TIMER_ECDSA,     /* ECDSA signature verification */
+    STATS_TIMER_COUNT
+};
+
+// --- structs ---------------------------------------------------------------------------------------------------------
+/**
+ * @brief Snapshot of the statistics. This is also the payload of the COM_PROTO_DATA_TYPE_DEBUG_INF DATA message
+ *        (little endian).
+ *
+ */
+struct stats_s
+{
+    uint32_t counters[STATS_COUNTER_COUNT];                  /**< enum stats_counter_e */
+    uint32_t timers_us[STATS_TIMER_COUNT];                   /**< enum stats_timer_e, accumulated time in us */
+    uint32_t packet_latency_hist[STATS_LATENCY_BUCKET_COUNT]; /**< Firmware update packet processing latency */
+} __attribute__((packed));
+
+// --- function declarations -------------------------------------------------------------------------------------------
+void     stats_inc(enum stats_counter_e counter);
+uint32_t stats_timer_start(void);
+void     stats_timer_stop(enum stats_timer_e timer, enum prof_region_e region, uint32_t start);
+void     stats_record_packet_latency(uint32_t start);
+void     stats_get(struct stats_s *stats);
+void     stats_reset(void);
+
+#endif // STATS_H
@@ -0,0 +1,113 @@
+/**
+ * @file trace.c
+ * @brief Deferred (binary) trace logging. The records are kept in a ram ring buffer, until the host reads them. When
+ *        the buffer is full, new records are dropped (and counted), so that the early boot records are kept.
+ * @version 0.1
+ * @date 2024-07-23
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include "trace.h"
+
+#include <string.h>
+#include <cmsis_compiler.h>
+#include "sys/sys.h"
+
+#ifdef BL_TRACE
+
+// --- static variable definitions -------------------------------------------------------------------------------------
+static uint32_t trace_buffer[TRACE_BUFFER_WORDS];
+static uint32_t trace_head;  // Next word to write
+static uint32_t trace_tail;  // Next word to read
+static uint32_t trace_count; // Words in the buffer
+static uint32_t trace_dropped;
+
+// --- function definitions --------------------------------------------------------------------------------------------
+/**
+ * @brief Function to store a trace record. Called through TRACE_LOG. It can be called from interrupt context.
+ *
+ * @param id Offset of the format string in the TRACE_FMT_SECTION
+ * @param nargs
+ * @param a
+ * @param b
+ * @param c
+ * @param d
+ */
+void
+trace_record(uint32_t id, uint32_t nargs, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    uint32_t const args[TRACE_MAX_ARGS] = { a, b, c, d };
+    uint32_t const record_words         = TRACE_RECORD_HEADER_WORDS + nargs;
+    uint32_t const timestamp_us         = sys_cycles_to_us(sys_get_cycles());
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if ((trace_count + record_words) > TRACE_BUFFER_WORDS)
+    {
+        trace_dropped++;
+        __set_PRIMASK(primask);
+        return;
+    }
+
+    trace_buffer[trace_head] = (id & TRACE_RECORD_ID_MASK) | (nargs << TRACE_RECORD_NARGS_POS);
+    trace_head               = (trace_head + 1) % TRACE_BUFFER_WORDS;
+    trace_buffer[trace_head] = timestamp_us;
+    trace_head               = (trace_head + 1) % TRACE_BUFFER_WORDS;
+    for (uint32_t i = 0; i < nargs; i++)
+    {
+        trace_buffer[trace_head] = args[i];
+        trace_head               = (trace_head + 1) % TRACE_BUFFER_WORDS;
+    }
+    trace_count += record_words;
+    __set_PRIMASK(primask);
+}
+
+/**
+ * @brief Function to read (and remove) whole records from the trace buffer.
+ *
+ * @param buf
+ * @param max_len
+ * @return uint16_t Number of bytes copied to buf (a multiple of 4)
+ */
+uint16_t
+trace_read(uint8_t *buf, uint16_t max_len)
+{
+    uint16_t len = 0;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    while (trace_count > 0)
+    {
+        uint32_t const record_words = TRACE_RECORD_HEADER_WORDS + (trace_buffer[trace_tail] >> TRACE_RECORD_NARGS_POS);
+        if ((len + (record_words * sizeof(uint32_t))) > max_len)
+        {
+            break;
+        }
+
+        for (uint32_t i = 0; i < record_words; i++)
+        {
+            memcpy(&buf[len], &trace_buffer[trace_tail], sizeof(uint32_t));
+            len += sizeof(uint32_t);
+            trace_tail = (trace_tail + 1) % TRACE_BUFFER_WORDS;
+        }
+        trace_count -= record_words;
+    }
+    __set_PRIMASK(primask);
+
+    return len;
+}
+
+/**
+ * @brief Function to get the number of records dropped, because the trace buffer was full
+ *
+ * @return uint32_t
+ */
+uint32_t
+trace_get_dropped(void)
+{
+    return trace_dropped;
+}
+#endif // BL_TRACE
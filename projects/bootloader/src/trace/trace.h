@@ -0,0 +1,94 @@
+/**
+ * @file trace.h
+ * @brief Deferred (binary) trace logging. Each log site only stores the id of its format string and its raw arguments
+ *        in a ram ring buffer: the message is formatted on the host, from the format strings kept in the elf. The
+ *        trace is read by the host, through REQ_DATA (COM_PROTO_DATA_TYPE_TRACE).
+ *
+ *        The log backend is selected at build time:
+ *        BL_TRACE:  deferred trace (this module).
+ *        DEBUG_LOG: printf over the uart (formatted on the target).
+ *        none:      the log sites compile to nothing.
+ * @version 0.1
+ * @date 2024-07-23
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// --- includes --------------------------------------------------------------------------------------------------------
+#include <inttypes.h> // PRIu32/PRIX32, for the uint32_t arguments of the log sites
+#include <stdint.h>
+
+// --- defines ---------------------------------------------------------------------------------------------------------
+// Size of the trace ring buffer, in 32bit words
+#define TRACE_BUFFER_WORDS 256
+// Max number of arguments of a log site. The arguments are stored as 32bit words: %s is not supported.
+#define TRACE_MAX_ARGS 4
+// Section of the format strings. It is not loaded to the target (INFO section): the id of a log site is the offset of
+// its format string in this section.
+#define TRACE_FMT_SECTION ".trace_fmt"
+
+// A record is: header word (id: bits 0-23, number of arguments: bits 24-31), timestamp (us) and the arguments
+#define TRACE_RECORD_HEADER_WORDS 2
+#define TRACE_RECORD_ID_MASK      0x00FFFFFFU
+#define TRACE_RECORD_NARGS_POS    24
+
+#if defined(BL_TRACE)
+// Number of arguments after the format string (0 to TRACE_MAX_ARGS)
+#define TRACE_NARGS(...)                           TRACE_NARGS_(__VA_ARGS__, 4, 3, 2, 1, 0, ~)
+#define TRACE_NARGS_(fmt, a1, a2, a3, a4, n, ...) n
+#define TRACE_CAT(a, b)                            TRACE_CAT_(a, b)
+#define TRACE_CAT_(a, b)                           a##b
+
+#define TRACE_LOG_0(fmt)             TRACE_LOG_SITE(fmt, 0, 0, 0, 0, 0)
+#define TRACE_LOG_1(fmt, a)          TRACE_LOG_SITE(fmt, 1, a, 0, 0, 0)
+#define TRACE_LOG_2(fmt, a, b)       TRACE_LOG_SITE(fmt, 2, a, b, 0, 0)
+#define TRACE_LOG_3(fmt, a, b, c)    TRACE_LOG_SITE(fmt, 3, a, b, c, 0)
+#define TRACE_LOG_4(fmt, a, b, c, d) TRACE_LOG_SITE(fmt, 4, a, b, c, d)
+
+#define TRACE_LOG_SITE(fmt, n, a, b, c, d)                                                                          \
+    do                                                                                                              \
+    {                                                                                                               \
+        static char const trace_fmt[] __attribute__((section(TRACE_FMT_SECTION), used)) = fmt;                      \
+        trace_record((uint32_t)(uintptr_t)trace_fmt,                                                                \
+                     (n),                                                                                           \
+                     (uint32_t)(uintptr_t)(a),                                                                      \
+                     (uint32_t)(uintptr_t)(b),                                                                      \
+                     (uint32_t)(uintptr_t)(c),                                                                      \
+                     (uint32_t)(uintptr_t)(d));                                                                     \
+    } while (0)
+
+// Usage: TRACE_LOG("format", args...), same as printf (up to TRACE_MAX_ARGS integer/pointer arguments)
+#define TRACE_LOG(...) TRACE_CAT(TRACE_LOG_, TRACE_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#elif defined(DEBUG_LOG)
+#include <stdio.h>
+#define TRACE_LOG(...) printf(__VA_ARGS__)
+#else
+#define TRACE_LOG(...) trace_discard(__VA_ARGS__)
+#endif
+
+// --- function declarations -------------------------------------------------------------------------------------------
+#if defined(BL_TRACE)
+void     trace_record(uint32_t id, uint32_t nargs, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
+uint16_t trace_read(uint8_t *buf, uint16_t max_len);
+uint32_t trace_get_dropped(void);
+#endif
+
+// --- static inline function definitions ------------------------------------------------------------------------------
+/**
+ * @brief Log sink when no log backend is selected. Keeps the arguments "used", so that no unused variable warnings
+ *        appear. It is optimized out.
+ *
+ * @param fmt
+ * @param ...
+ */
+static inline void
+trace_discard(char const *fmt, ...)
+{
+    (void)fmt;
+}
+
+#endif // TRACE_H
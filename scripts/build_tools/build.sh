@@ -3,6 +3,9 @@
 # Function to build a single project
 build_project() {
     local project=$1
+    # Optional: build folder name (default: build) and extra cmake arguments
+    local build_folder=${2:-build}
+    local cmake_args=$3
     local project_dir="$GIT_ROOT/projects/$project"
 
     if [ ! -d "$project_dir" ]; then
@@ -11,7 +14,7 @@ build_project() {
     fi
 
     # Create the build directory if it doesn't exist
-    local build_dir="$project_dir/build"
+    local build_dir="$project_dir/$build_folder"
     if [ ! -d "$build_dir" ]; then
         mkdir -p "$build_dir"
     else
@@ -24,7 +27,7 @@ build_project() {
 
     # Run cmake with Ninja generator in the parent directory
     echo "Running cmake command for $project..."
-    cmake -G "Ninja" ..
+    cmake -G "Ninja" $cmake_args ..
 
     # Run Ninja to build the project
     echo "Building $project with Ninja..."
@@ -48,6 +51,7 @@ create_dfu_image() {
     local version_minor=$4
     local version_patch=$5
     local private_key_path=$6
+    local slot=${7:-primary}
 
     # Check if the Python script exists
     if [ ! -f "create_dfu_image.py" ]; then
@@ -57,10 +61,10 @@ create_dfu_image() {
 
     echo "Creating DFU image..."
     pwd
-    python create_dfu_image.py "$GIT_ROOT/$binary_path" "$GIT_ROOT/$linker_script" "$version_major" "$version_minor" "$version_patch" "$GIT_ROOT/$private_key_path" 1
+    python create_dfu_image.py "$GIT_ROOT/$binary_path" "$GIT_ROOT/$linker_script" "$version_major" "$version_minor" "$version_patch" "$GIT_ROOT/$private_key_path" 1 "$slot"
     #if python fails, try with python3
     if [ $? -ne 0 ]; then
-        python3 create_dfu_image.py "$GIT_ROOT/$binary_path" "$GIT_ROOT/$linker_script" "$version_major" "$version_minor" "$version_patch" "$GIT_ROOT/$private_key_path"
+        python3 create_dfu_image.py "$GIT_ROOT/$binary_path" "$GIT_ROOT/$linker_script" "$version_major" "$version_minor" "$version_patch" "$GIT_ROOT/$private_key_path" 1 "$slot"
     fi
     #TODO: GPA: don't fail the rest of the script if the python script fails.
 }
@@ -162,11 +166,39 @@ process_project() {
         version_minor=$(yq e ".projects[] | select(.project_name == \"$project\") | .dfu_image.version.minor" "$YAML_FILE")
         version_patch=$(yq e ".projects[] | select(.project_name == \"$project\") | .dfu_image.version.patch" "$YAML_FILE")
         private_key_path=$(yq e ".projects[] | select(.project_name == \"$project\") | .dfu_image.private_key_path" "$YAML_FILE")
-
-        echo "Creating DFU image for project: $project"
-        create_dfu_image "$binary_path" "$linker_script" "$version_major" "$version_minor" "$version_patch" "$private_key_path"
-        if [ $? -ne 0 ]; then
-            echo "Failed to create DFU image for project '$project'. Continuing with the rest of the script..."
+        # Image slots to create a DFU image for (default: primary). The primary and compressed images are made from the
+        # build above, every other slot is built again, linked for that slot, under build_<slot>.
+        slots=$(yq e ".projects[] | select(.project_name == \"$project\") | .dfu_image.slots // [\"primary\"] | .[]" "$YAML_FILE")
+
+        # The images of the build above (primary, compressed) are created in one run of the script
+        build_slots=""
+        for slot in $slots; do
+            if [ "$slot" == "primary" ] || [ "$slot" == "compressed" ]; then
+                build_slots=${build_slots:+$build_slots,}$slot
+                continue
+            fi
+
+            echo "Building project: $project for the $slot slot"
+            build_project "$project" "build_$slot" "-DAPP_SLOT=$slot"
+            if [ $? -ne 0 ]; then
+                echo "Failed to build project '$project' for the $slot slot. Continuing with the rest of the script..."
+                continue
+            fi
+            slot_binary_path=${binary_path/\/build\//\/build_$slot\/}
+
+            echo "Creating DFU image for project: $project ($slot slot)"
+            create_dfu_image "$slot_binary_path" "$linker_script" "$version_major" "$version_minor" "$version_patch" "$private_key_path" "$slot"
+            if [ $? -ne 0 ]; then
+                echo "Failed to create DFU image for project '$project'. Continuing with the rest of the script..."
+            fi
+        done
+
+        if [ -n "$build_slots" ]; then
+            echo "Creating DFU image for project: $project ($build_slots)"
+            create_dfu_image "$binary_path" "$linker_script" "$version_major" "$version_minor" "$version_patch" "$private_key_path" "$build_slots"
+            if [ $? -ne 0 ]; then
+                echo "Failed to create DFU image for project '$project'. Continuing with the rest of the script..."
+            fi
         fi
     else
         echo "DFU image creation not enabled for project: $project"
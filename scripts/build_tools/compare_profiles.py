@@ -0,0 +1,35 @@
+import re
+import sys
+
+# Line of the bootloader profiling summary (BL_PROFILING), e.g.:
+# sha256                     calls: 1 total: 5210345 min: 5210345 max: 5210345 avg: 5210345
+PROFILE_LINE = re.compile(r'^(\S+)\s+calls: (\d+) total: (\d+) min: (\d+) max: (\d+) avg: (\d+)')
+
+def parse_profile(path):
+    """
+    Returns the average ticks per region, of a profiling summary read with bootloader_tool.py --profile.
+    """
+    regions = {}
+    with open(path, 'r', errors='replace') as profile_file:
+        for line in profile_file:
+            match = PROFILE_LINE.match(line.strip())
+            if match:
+                regions[match.group(1)] = int(match.group(6))
+    return regions
+
+def compare_profiles(baseline_path, candidate_path):
+    baseline = parse_profile(baseline_path)
+    candidate = parse_profile(candidate_path)
+    print(f"{'region':<26} {'baseline':>12} {'candidate':>12} {'speedup':>8}")
+    for region, baseline_avg in baseline.items():
+        if region not in candidate:
+            continue
+        candidate_avg = candidate[region]
+        speedup = f"{baseline_avg / candidate_avg:.2f}x" if candidate_avg else '-'
+        print(f"{region:<26} {baseline_avg:>12} {candidate_avg:>12} {speedup:>8}")
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("Usage: python compare_profiles.py <baseline_profile.txt> <candidate_profile.txt>")
+        sys.exit(1)
+    compare_profiles(sys.argv[1], sys.argv[2])
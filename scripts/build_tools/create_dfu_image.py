@@ -12,46 +12,321 @@
     The header of the DFU image is used by the bootloader to verify the integrity of the firmware image.
     The header of the DFU image does not participate in the CRC and SHA256 calculation and is not included in the size
     calculation.
+
+    The end of the (padded) firmware image holds the image index: the running CRC32 of the image at the end of each
+    chunk, the chunks following the flash sectors of the slot. It participates in the CRC and SHA256 calculation, and
+    lets the bootloader stop its CRC check at the first damaged chunk (see projects/bootloader/src/image_index).
+
+    Right before the image index, the image holds a Merkle tree over its 4 KB chunks (see
+    projects/bootloader/src/authentication/merkle.h). The signature covers the image root instead of the SHA256 of the
+    whole image: the node of the tree root and of a leaf over the image index (the index holds the CRC32 of the tree, so
+    it is hashed after it). The bootloader can verify a chunk on its own, through its path to the root.
+
+    A compressed DFU image (image type: compressed) is stored compressed in the secondary slot, and decompressed by the
+    bootloader while installing it to the primary slot:
+    - Compressed image header (magic, compressed size, CRC32 of the compressed stream, decompressed size)
+    - Compressed stream of the (padded) firmware image
+    - Padding, up to the footer of the secondary slot
+    - The footer of the firmware image (CRC32, version and signature of the decompressed image)
+
+    Next to every DFU image, a sparse image (.sparse) lists only its populated ranges: the image is mostly erased
+    (0xFF), between the firmware and the Merkle tree, index and footer at its end. bootloader_tool.py sends only these
+    ranges (FWUG_DATA_AT), and the bootloader leaves the gaps erased, so the CRC and the signature still cover the whole
+    image:
+    - Sparse image header (magic, image size, range count, CRC32 of the image)
+    - Per range: offset, length, data
+
+    Every output of an image (DFU image, sparse image, firmware_info.yaml) is written in one pass. The image type
+    argument takes several types (e.g. primary,compressed), and --batch creates the images of many binaries and versions
+    (a batch file) in parallel worker processes.
 """
 import re
 import sys
+import struct
 import hashlib
 import os
+import io
+import time
+import zlib
+import argparse
+import contextlib
+import functools
 import yaml
 import shutil
+from concurrent.futures import ProcessPoolExecutor
 from cryptography.hazmat.primitives import hashes, serialization
 from cryptography.hazmat.primitives.asymmetric import ec
-from cryptography.hazmat.primitives.asymmetric.utils import Prehashed
+from cryptography.hazmat.primitives.asymmetric.utils import Prehashed, decode_dss_signature
 
 CRC_SIZE_BYTES     = 4
 VERSION_SIZE_BYTES = 4
 SIGNATURE_SIZE_BYTES = 64  # Assuming ECDSA P-256 signature size
+SIGNATURE_INT_SIZE_BYTES = SIGNATURE_SIZE_BYTES // 2  # r and s, big endian, as uECC_verify expects them
 FOOTER_SIZE_BYTES = CRC_SIZE_BYTES + VERSION_SIZE_BYTES + SIGNATURE_SIZE_BYTES
 
+# Compressed image (see projects/bootloader/src/decompress/lz_decompress.h)
+LZ_IMAGE_MAGIC = 0x495A4C42
+LZ_IMAGE_HEADER_FORMAT = '<IIII'  # magic, compressed size, CRC32 of the compressed stream, decompressed size
+
+# Image index (see projects/bootloader/src/image_index/image_index.h)
+IMAGE_INDEX_MAGIC = 0x58444E49
+IMAGE_INDEX_MAX_CHUNKS = 16
+IMAGE_INDEX_CHUNK_FORMAT = '<II'    # end offset, CRC32 of the image up to the end offset
+IMAGE_INDEX_TRAILER_FORMAT = '<II'  # chunk count, magic
+
+# Sparse image (see scripts/firmware_update_tools/bootloader_tool.py)
+SPARSE_IMAGE_MAGIC = 0x53525053
+SPARSE_IMAGE_HEADER_FORMAT = '<IIII'  # magic, image size, range count, CRC32 of the image
+SPARSE_RANGE_FORMAT = '<II'           # offset, length
+# Erased gaps shorter than this (bytes) are kept inside the ranges: a range costs its offset and length
+SPARSE_MIN_GAP = 16
+
+# Merkle tree (see projects/bootloader/src/authentication/merkle.h)
+MERKLE_MAGIC = 0x4C4B524D
+MERKLE_TRAILER_FORMAT = '<III'  # leaf count, chunk size, magic
+
+# Flash sectors of the target (start address, size), as in flash_sectors[] of the bootloader flash driver
+FLASH_SECTORS = [
+    (0x08000000, 16 * 1024),
+    (0x08004000, 16 * 1024),
+    (0x08008000, 16 * 1024),
+    (0x0800C000, 16 * 1024),
+    (0x08010000, 64 * 1024),
+    (0x08020000, 128 * 1024),
+    (0x08040000, 128 * 1024),
+    (0x08060000, 128 * 1024),
+]
+
+# Image slots, with their start/end symbols in the bootloader linker script. The image must be linked for the slot it
+# is downloaded to: the primary slot, or the secondary slot for a bootloader built with BL_DIRECT_XIP (executes the
+# secondary slot in place).
+SLOT_SYMBOLS = {
+    "primary": ("__flash_app_start__", "__flash_app_end__"),
+    "secondary": ("__flash_app_secondary_start__", "__flash_app_secondary_end__"),
+}
+
+# Image types (the image slots, and compressed: a primary image stored compressed in the secondary slot)
+IMAGE_TYPES = list(SLOT_SYMBOLS) + ["compressed"]
+
 class CRC:
     @staticmethod
-    def compute_crc32(data):
+    def compute_crc32(data, crc=0):
         """
-        Computes the CRC32 checksum for the given data.
-        
+        Computes the CRC32 checksum for the given data: the CRC-32 of the bootloader crc32 driver (reflected polynomial
+        0xEDB88320, initial value and final XOR 0xFFFFFFFF), which is the CRC-32 of zlib.
+
         Args:
             data (bytearray): The binary data to compute the checksum for.
+            crc (int): The CRC32 of the preceding data, to continue the calculation (0 for the start of the data).
 
         Returns:
             int: The CRC32 checksum.
         """
-        crc = 0xFFFFFFFF
-        for byte in data:
-            crc ^= byte
-            for _ in range(8):
-                if crc & 1:
-                    crc = (crc >> 1) ^ 0xEDB88320
-                else:
-                    crc >>= 1
-        return crc ^ 0xFFFFFFFF
+        return zlib.crc32(data, crc)
+
+class LZ:
+    """
+    Compressor of the compressed secondary images: LZ4 block format sequences (token, literals, 16bit offset, match),
+    with the match offsets limited to the window of the bootloader decompressor.
+    """
+    WINDOW_SIZE = 4096  # LZ_WINDOW_SIZE of the bootloader
+    MIN_MATCH = 4
+    LENGTH_EXTENDED = 15
+
+    @staticmethod
+    def _encode_length(length):
+        encoded = bytearray()
+        while length >= 255:
+            encoded.append(255)
+            length -= 255
+        encoded.append(length)
+        return encoded
+
+    @classmethod
+    def _append_sequence(cls, stream, literals, offset=None, match_length=0):
+        literal_nibble = min(len(literals), cls.LENGTH_EXTENDED)
+        match_nibble = min(match_length - cls.MIN_MATCH, cls.LENGTH_EXTENDED) if offset else 0
+        stream.append((literal_nibble << 4) | match_nibble)
+        if literal_nibble == cls.LENGTH_EXTENDED:
+            stream.extend(cls._encode_length(len(literals) - cls.LENGTH_EXTENDED))
+        stream.extend(literals)
+        if offset:
+            stream.extend(offset.to_bytes(2, "little"))
+            if match_nibble == cls.LENGTH_EXTENDED:
+                stream.extend(cls._encode_length(match_length - cls.MIN_MATCH - cls.LENGTH_EXTENDED))
+
+    @classmethod
+    def compress(cls, data):
+        """
+        Compresses the data (greedy matching, on the last occurrence of each 4 byte sequence).
+
+        Args:
+            data (bytes): The data to compress.
+
+        Returns:
+            bytearray: The compressed stream.
+        """
+        stream = bytearray()
+        last_positions = {}
+        literal_start = 0
+        position = 0
+        while position + cls.MIN_MATCH <= len(data):
+            key = bytes(data[position:position + cls.MIN_MATCH])
+            candidate = last_positions.get(key)
+            last_positions[key] = position
+            if candidate is None or position - candidate > cls.WINDOW_SIZE:
+                position += 1
+                continue
+
+            match_length = cls.MIN_MATCH
+            while position + match_length < len(data) and data[candidate + match_length] == data[position + match_length]:
+                match_length += 1
+            cls._append_sequence(stream, data[literal_start:position], position - candidate, match_length)
+            for skipped in range(position + 1, min(position + match_length, len(data) - cls.MIN_MATCH + 1)):
+                last_positions[bytes(data[skipped:skipped + cls.MIN_MATCH])] = skipped
+            position += match_length
+            literal_start = position
+
+        # The last sequence has only literals
+        cls._append_sequence(stream, data[literal_start:])
+        return stream
+
+    @classmethod
+    def decompress(cls, stream):
+        """
+        Reference decompressor (same checks as the bootloader decompressor).
+
+        Args:
+            stream (bytes): The compressed stream.
+
+        Returns:
+            bytearray: The decompressed data.
+        """
+        def read_length(index, length):
+            while True:
+                byte = stream[index]
+                index += 1
+                length += byte
+                if byte != 255:
+                    return index, length
+
+        output = bytearray()
+        index = 0
+        while index < len(stream):
+            token = stream[index]
+            index += 1
+            literal_length = token >> 4
+            if literal_length == cls.LENGTH_EXTENDED:
+                index, literal_length = read_length(index, literal_length)
+            output.extend(stream[index:index + literal_length])
+            index += literal_length
+            if index == len(stream):
+                break
+            offset = int.from_bytes(stream[index:index + 2], "little")
+            index += 2
+            match_length = (token & 0x0F) + cls.MIN_MATCH
+            if token & 0x0F == cls.LENGTH_EXTENDED:
+                index, match_length = read_length(index, match_length)
+            if not 0 < offset <= min(cls.WINDOW_SIZE, len(output)):
+                raise ValueError(f"Invalid match offset {offset}")
+            for _ in range(match_length):
+                output.append(output[-offset])
+        return output
+
+class Merkle:
+    """
+    Merkle tree over the chunks of an image: the leaves are the SHA-256 of the chunks, and each node is the SHA-256 of
+    its two children (a node without a sibling is carried to the next level as is). The leaves and the nodes are
+    prefixed before they are hashed, as in the bootloader.
+    """
+    CHUNK_SIZE = 4096  # MERKLE_CHUNK_SIZE of the bootloader
+    MAX_LEAVES = 128
+    HASH_SIZE = 32
+    LEAF_PREFIX = b'\x00'
+    NODE_PREFIX = b'\x01'
+
+    @classmethod
+    def leaf_count(cls, data_size):
+        return (data_size + cls.CHUNK_SIZE - 1) // cls.CHUNK_SIZE
+
+    @staticmethod
+    def node_count(leaf_count):
+        count = leaf_count
+        while leaf_count > 1:
+            leaf_count = (leaf_count + 1) // 2
+            count += leaf_count
+        return count
+
+    @classmethod
+    def hash_node(cls, left, right):
+        return hashlib.sha256(cls.NODE_PREFIX + left + right).digest()
+
+    @classmethod
+    def build(cls, data):
+        """
+        Returns the levels of the tree over the data, from the leaves to the root.
+        """
+        level = [hashlib.sha256(cls.LEAF_PREFIX + data[offset:offset + cls.CHUNK_SIZE]).digest()
+                 for offset in range(0, len(data), cls.CHUNK_SIZE)]
+        levels = [level]
+        while len(level) > 1:
+            level = [cls.hash_node(level[i], level[i + 1]) if i + 1 < len(level) else level[i]
+                     for i in range(0, len(level), 2)]
+            levels.append(level)
+        return levels
+
+    @classmethod
+    def serialize(cls, levels):
+        """
+        Returns the tree as stored in the image: the nodes, level by level from the leaves to the root, and the trailer.
+        """
+        nodes = b''.join(node for level in levels for node in level)
+        return nodes + struct.pack(MERKLE_TRAILER_FORMAT, len(levels[0]), cls.CHUNK_SIZE, MERKLE_MAGIC)
+
+    @classmethod
+    def image_root(cls, root, tail):
+        """
+        Returns the image root, that the signature covers: the node of the tree root and of the leaf of the rest of the
+        image (the image index), as merkle_get_image_root() computes it.
+        """
+        return cls.hash_node(root, hashlib.sha256(cls.LEAF_PREFIX + tail).digest())
+
+    @classmethod
+    def verify(cls, image, tree_end):
+        """
+        Verifies every chunk of an image through its path to the root, reading the stored tree the way the bootloader
+        does (merkle_get_tree, merkle_check_chunk_path). Returns the root.
+        """
+        trailer_size = struct.calcsize(MERKLE_TRAILER_FORMAT)
+        leaf_count, chunk_size, magic = struct.unpack_from(MERKLE_TRAILER_FORMAT, image, tree_end - trailer_size)
+        if magic != MERKLE_MAGIC or chunk_size != cls.CHUNK_SIZE or not 0 < leaf_count <= cls.MAX_LEAVES:
+            raise ValueError("Invalid Merkle tree trailer")
+        node_count = cls.node_count(leaf_count)
+        tree_offset = tree_end - trailer_size - node_count * cls.HASH_SIZE
+        if cls.leaf_count(tree_offset) != leaf_count:
+            raise ValueError("The Merkle tree does not cover the image")
+        nodes = [image[offset:offset + cls.HASH_SIZE]
+                 for offset in range(tree_offset, tree_offset + node_count * cls.HASH_SIZE, cls.HASH_SIZE)]
+        root = nodes[-1]
+
+        for chunk_index in range(leaf_count):
+            chunk = image[chunk_index * cls.CHUNK_SIZE:min((chunk_index + 1) * cls.CHUNK_SIZE, tree_offset)]
+            node = hashlib.sha256(cls.LEAF_PREFIX + chunk).digest()
+            node_index, level_start, level_size = chunk_index, 0, leaf_count
+            while level_size > 1:
+                sibling_index = node_index ^ 1
+                if sibling_index < level_size:
+                    sibling = nodes[level_start + sibling_index]
+                    node = cls.hash_node(sibling, node) if node_index & 1 else cls.hash_node(node, sibling)
+                level_start += level_size
+                level_size = (level_size + 1) // 2
+                node_index //= 2
+            if node != root:
+                raise ValueError(f"Merkle path check failed for chunk {chunk_index}")
+        return root
 
 class BinaryAnalyzer:
-    def __init__(self, binary_data, linker_script_content, private_key):
+    def __init__(self, binary_data, linker_script_content, private_key, slot="primary", merkle=True):
         """
         Initializes the BinaryAnalyzer with the given binary data and linker script content.
         Appends padding and an empty footer to the binary data.
@@ -59,6 +334,8 @@ class BinaryAnalyzer:
         Args:
             binary_data (bytearray): The binary data to analyze and modify.
             linker_script_content (str): The content of the linker script.
+            slot (str): The image slot the binary is linked for (primary or secondary).
+            merkle (bool): Add a Merkle tree to the image, and sign its image root.
         """
         self.binary_data = binary_data
         self.linker_script_content = linker_script_content
@@ -66,10 +343,21 @@ class BinaryAnalyzer:
         self.version = None
         self.crc32 = None
         self.private_key = private_key
+        self.slot = slot
+        self.compressed_size = None
+        self.binary_size = len(binary_data)
+        self.merkle_root = None
+        self.merkle_tree_end = None
 
-        # Perform padding and footer appending during initialization
+        # Perform padding, Merkle tree, index and footer appending during initialization
         self._calculate_img_size()
+        self._check_link_address()
         self._append_padding()
+        if merkle:
+            self._add_merkle_tree()
+        self._add_index()
+        if merkle:
+            self._add_merkle_image_root()
         self._append_footer()
 
     def _calculate_img_size(self):
@@ -79,7 +367,17 @@ class BinaryAnalyzer:
         Raises:
             ValueError: If the linker script is invalid.
         """
-        symbols = ["__flash_app_start__", "__flash_app_end__"]
+        self.start, self.size = self._get_slot_range(self.slot)
+
+    def _get_slot_range(self, slot):
+        """
+        Returns the start address and the size of an image slot, using the linker script content.
+
+        Raises:
+            ValueError: If the linker script is invalid.
+        """
+        start_symbol, end_symbol = SLOT_SYMBOLS[slot]
+        symbols = [start_symbol, end_symbol]
         symbol_values = {}
 
         for symbol in symbols:
@@ -93,11 +391,24 @@ class BinaryAnalyzer:
             else:
                 symbol_values[symbol] = None
 
-        if symbol_values["__flash_app_start__"] is not None and symbol_values["__flash_app_end__"] is not None:
-            self.size = symbol_values["__flash_app_end__"] - symbol_values["__flash_app_start__"] + 1
+        if symbol_values[start_symbol] is not None and symbol_values[end_symbol] is not None:
+            return symbol_values[start_symbol], symbol_values[end_symbol] - symbol_values[start_symbol] + 1
         else:
             raise ValueError("Invalid linker script")
 
+    def _check_link_address(self):
+        """
+        Checks that the binary is linked for the selected slot: the reset handler (second entry of the vector table) must
+        be within the slot. The bootloader refuses to jump to an image linked for another slot.
+
+        Raises:
+            ValueError: If the binary is not linked for the slot.
+        """
+        reset_handler = int.from_bytes(self.binary_data[4:8], "little")
+        if not self.start <= reset_handler < self.start + self.size:
+            raise ValueError(f"The binary is not linked for the {self.slot} slot (reset handler at 0x{reset_handler:08X})")
+        print(f"Binary linked for the {self.slot} slot (0x{self.start:08X})")
+
     def _append_padding(self):
         """
         Appends padding to the binary data to match the calculated image size.
@@ -115,6 +426,87 @@ class BinaryAnalyzer:
         else:
             print("No padding needed")
 
+    def _get_index_chunks(self, image_size):
+        """
+        Returns the end offsets of the image index chunks: the chunks end at the flash sector boundaries within the slot,
+        and the last chunk ends at the index itself.
+        """
+        boundaries = [start + size - self.start for start, size in FLASH_SECTORS
+                      if self.start < start + size < self.start + image_size]
+        while True:
+            index_size = (len(boundaries) + 1) * struct.calcsize(IMAGE_INDEX_CHUNK_FORMAT) \
+                         + struct.calcsize(IMAGE_INDEX_TRAILER_FORMAT)
+            index_offset = image_size - index_size
+            if not boundaries or boundaries[-1] < index_offset:
+                return boundaries + [index_offset]
+            boundaries.pop()
+
+    def _add_merkle_tree(self):
+        """
+        Writes the Merkle tree of the image right before the image index. The tree covers the image up to the tree
+        itself.
+
+        Raises:
+            ValueError: If the binary overlaps the tree, or the tree cannot be placed.
+        """
+        tree_end = self._get_index_chunks(self.size - self.footer_size)[-1]
+        trailer_size = struct.calcsize(MERKLE_TRAILER_FORMAT)
+
+        # The tree size depends on the number of chunks before it: look for a consistent leaf count
+        for leaf_count in range(Merkle.leaf_count(tree_end), 0, -1):
+            tree_offset = tree_end - trailer_size - Merkle.node_count(leaf_count) * Merkle.HASH_SIZE
+            if Merkle.leaf_count(tree_offset) == leaf_count:
+                break
+        else:
+            raise ValueError("The Merkle tree cannot be placed")
+        if leaf_count > Merkle.MAX_LEAVES:
+            raise ValueError(f"The Merkle tree has too many leaves ({leaf_count})")
+        if self.binary_size > tree_offset:
+            raise ValueError(f"The binary ({self.binary_size} bytes) overlaps the Merkle tree (at {tree_offset})")
+
+        levels = Merkle.build(bytes(self.binary_data[:tree_offset]))
+        self.binary_data[tree_offset:tree_end] = Merkle.serialize(levels)
+        self.merkle_root = Merkle.verify(bytes(self.binary_data), tree_end)
+        if self.merkle_root != levels[-1][0]:
+            raise ValueError("Merkle tree self check failed")
+        self.merkle_tree_end = tree_end
+        print(f"Adding Merkle tree: {leaf_count} chunks, at offset {tree_offset}, root {self.merkle_root.hex()}")
+
+    def _add_merkle_image_root(self):
+        """
+        Combines the root of the Merkle tree with the image index, that follows the tree: the image root is the digest
+        that the signature covers, so the index is authenticated too.
+        """
+        self.merkle_root = Merkle.image_root(self.merkle_root, bytes(self.binary_data[self.merkle_tree_end:]))
+        print(f"Merkle image root (tree root and image index): {self.merkle_root.hex()}")
+
+    def _add_index(self):
+        """
+        Writes the image index at the end of the padded image: the running CRC32 of the image at the end of each chunk.
+
+        Raises:
+            ValueError: If the binary overlaps the index.
+        """
+        image_size = self.size - self.footer_size
+        end_offsets = self._get_index_chunks(image_size)
+        if len(end_offsets) > IMAGE_INDEX_MAX_CHUNKS:
+            raise ValueError(f"The image index has too many chunks ({len(end_offsets)})")
+        index_offset = end_offsets[-1]
+        if self.binary_size > index_offset:
+            raise ValueError(f"The binary ({self.binary_size} bytes) overlaps the image index (at {index_offset})")
+
+        index = bytearray()
+        crc = 0
+        chunk_start = 0
+        for end_offset in end_offsets:
+            crc = CRC.compute_crc32(self.binary_data[chunk_start:end_offset], crc)
+            index += struct.pack(IMAGE_INDEX_CHUNK_FORMAT, end_offset, crc)
+            chunk_start = end_offset
+        index += struct.pack(IMAGE_INDEX_TRAILER_FORMAT, len(end_offsets), IMAGE_INDEX_MAGIC)
+
+        print(f"Adding image index: {len(end_offsets)} chunks, at offset {index_offset}")
+        self.binary_data[index_offset:] = index
+
     def _append_footer(self):
         """
         Appends an empty footer to the binary data.
@@ -157,45 +549,93 @@ class BinaryAnalyzer:
         """
         Adds the ECDSA signature to the footer of the binary data.
         """
-        with open(self.private_key, "rb") as key_file:
-            private_key = serialization.load_pem_private_key(key_file.read(), password=None)
+        private_key = load_private_key(self.private_key)
 
-        # Calculate SHA-256 hash of the binary data
-        digest = hashlib.sha256(self.binary_data[:-self.footer_size]).digest()
-        print(f"\nCalculating SHA-256 hash of the binary data: {digest.hex()} with len: {len(digest)} bytes")
-        signature_length = 0
+        # Sign the Merkle image root, or the SHA-256 hash of the binary data
+        if self.merkle_root is not None:
+            digest = self.merkle_root
+            print(f"\nSigning the Merkle image root: {digest.hex()}")
+        else:
+            digest = hashlib.sha256(self.binary_data[:-self.footer_size]).digest()
+            print(f"\nCalculating SHA-256 hash of the binary data: {digest.hex()} with len: {len(digest)} bytes")
         # Sign the SHA-256 hash
-        while signature_length != 70:  # 70 bytes is the maximum length of an ECDSA P-256 signature that we support
-            try:
-                signature = private_key.sign(
-                    digest,
-                    ec.ECDSA(Prehashed(hashes.SHA256()))
-                )
-                signature_length = len(signature)
-            except:
-                raise ValueError("Error while signing the hash. Make sure the private key is correct.")
+        try:
+            signature = private_key.sign(digest, ec.ECDSA(Prehashed(hashes.SHA256())))
+        except Exception:
+            raise ValueError("Error while signing the hash. Make sure the private key is correct.")
 
         # Append the signature to the footer
         footer_start = len(self.binary_data) - self.footer_size + CRC_SIZE_BYTES + VERSION_SIZE_BYTES
         print(f"\nSignature is: {signature.hex()} of len: {len(signature)} bytes")
-        # post process signature to only keep r and s parts (4 first bytes useless, then 32 bytes r, then 2 bytes useless, then 32 bytes s)
-        signature = signature[4:36] + signature[38:70]
+        # The signature is DER encoded (r and s as signed integers of variable length): keep r and s, 32 bytes each
+        r, s = decode_dss_signature(signature)
+        signature = r.to_bytes(SIGNATURE_INT_SIZE_BYTES, "big") + s.to_bytes(SIGNATURE_INT_SIZE_BYTES, "big")
         print(f"\nAdding post processed signature to the footer: {signature.hex()} of len: {len(signature)} bytes")
         self.binary_data[footer_start:footer_start + SIGNATURE_SIZE_BYTES] = signature
 
-    def commit_to_file(self, file_path, export_bin_to_cwd=False):
+    def compress_to_secondary_slot(self):
+        """
+        Replaces the (signed) binary data with its compressed form, laid out for the secondary slot: compressed image
+        header, compressed stream, padding and the footer of the image. The bootloader decompresses it to the primary
+        slot, so the secondary slot can be smaller than the primary slot.
+
+        Raises:
+            ValueError: If the compressed image does not fit in the secondary slot.
+        """
+        image = bytes(self.binary_data[:-self.footer_size])
+        footer = self.binary_data[-self.footer_size:]
+        stream = LZ.compress(image)
+        if LZ.decompress(stream) != image:
+            raise ValueError("Compression self check failed")
+
+        _, secondary_size = self._get_slot_range("secondary")
+        header = struct.pack(LZ_IMAGE_HEADER_FORMAT, LZ_IMAGE_MAGIC, len(stream), CRC.compute_crc32(stream), len(image))
+        padding_size = secondary_size - self.footer_size - len(header) - len(stream)
+        if padding_size < 0:
+            raise ValueError(f"The compressed image ({len(stream)} bytes) does not fit in the secondary slot")
+        print(f"\nCompressed {len(image)} bytes to {len(stream)} bytes ({100 * len(stream) // len(image)}%)")
+
+        self.binary_data = bytearray(header) + stream + bytearray([0xFF] * padding_size) + footer
+        self.compressed_size = len(stream)
+
+    def get_sparse_image(self):
+        """
+        Returns the sparse image: the populated ranges of the image (the words that are not erased, with the erased
+        gaps shorter than SPARSE_MIN_GAP kept inside), over an erased image.
+        """
+        ranges = []
+        erased_word = b'\xFF' * 4
+        for offset in range(0, len(self.binary_data), 4):
+            if bytes(self.binary_data[offset:offset + 4]).ljust(4, b'\xFF') == erased_word:
+                continue
+            if ranges and offset - (ranges[-1][0] + ranges[-1][1]) < SPARSE_MIN_GAP:
+                ranges[-1][1] = min(offset + 4, len(self.binary_data)) - ranges[-1][0]
+            else:
+                ranges.append([offset, min(4, len(self.binary_data) - offset)])
+
+        sparse_image = bytearray(struct.pack(SPARSE_IMAGE_HEADER_FORMAT, SPARSE_IMAGE_MAGIC, len(self.binary_data),
+                                             len(ranges), CRC.compute_crc32(self.binary_data)))
+        for offset, length in ranges:
+            sparse_image += struct.pack(SPARSE_RANGE_FORMAT, offset, length)
+            sparse_image += self.binary_data[offset:offset + length]
+        return sparse_image
+
+    def commit_to_file(self, file_path, export_bin_to_cwd=False, update_folder=None):
         """
         Commits the modified binary data to the given file path.
 
         Args:
             file_path (str): The path of the file to write the binary data to.
+            update_folder (str): The folder of the firmware update files (default: update_firmware, next to file_path).
+
+        Returns:
+            dict: The information written to firmware_info.yaml.
         """
         # Create a directory to store the firmware update files
-        update_folder = os.path.join(os.path.dirname(file_path), "update_firmware")
+        update_folder, binary_filename, name_suffix = get_output_names(file_path, self.compressed_size is not None,
+                                                                       update_folder)
         os.makedirs(update_folder, exist_ok=True)
-    
-        # Determine the filename of the binary file
-        binary_filename = os.path.basename(file_path)
+
         # Create the full path to write the binary file inside the update folder
         if export_bin_to_cwd is False:
             update_file_path = os.path.join(update_folder, binary_filename)
@@ -207,61 +647,236 @@ class BinaryAnalyzer:
         # Write the binary data to the specified file path
         with open(update_file_path, "wb") as binary_file:
             binary_file.write(self.binary_data)
+        # And its populated ranges only, for the sparse transfer
+        sparse_image = self.get_sparse_image()
+        with open(os.path.splitext(update_file_path)[0] + ".sparse", "wb") as sparse_file:
+            sparse_file.write(sparse_image)
+        print(f"Sparse image: {len(sparse_image)} of {len(self.binary_data)} bytes")
 
         # Create a YAML file with specific information inside the update folder
         yaml_info = {
             "bin_crc": f"{self.crc32:08X}",
             "bin_auth": "none",
-            "version_info": f"{self.version}"
+            "version_info": f"{self.version}",
+            "slot": self.slot
         }
-        yaml_file_path = os.path.join(update_folder, "firmware_info.yaml")
+        if self.compressed_size is not None:
+            yaml_info["compressed_size"] = self.compressed_size
+        if self.merkle_root is not None:
+            yaml_info["merkle_root"] = self.merkle_root.hex()
+        yaml_info["sparse_size"] = len(sparse_image)
+        yaml_file_path = os.path.join(update_folder, f"firmware_info{name_suffix}.yaml")
         with open(yaml_file_path, "w") as yaml_file:
             yaml.dump(yaml_info, yaml_file, default_flow_style=False)
+        return yaml_info
+
+@functools.lru_cache(maxsize=None)
+def load_private_key(private_key_path):
+    """
+    Loads a PEM private key, once per process (a batch signs many images with the same key).
+    """
+    with open(private_key_path, "rb") as key_file:
+        return serialization.load_pem_private_key(key_file.read(), password=None)
+
+def get_output_names(file_path, compressed, update_folder=None):
+    """
+    Returns the folder, the file name and the name suffix of the firmware update files of an image.
+    """
+    if update_folder is None:
+        update_folder = os.path.join(os.path.dirname(file_path), "update_firmware")
+    binary_filename = os.path.basename(file_path)
+    # The compressed image is created from the same binary as the primary image: keep both
+    name_suffix = "_compressed" if compressed else ""
+    if name_suffix:
+        binary_filename = binary_filename.replace(".bin", f"{name_suffix}.bin")
+    return update_folder, binary_filename, name_suffix
+
+def create_dfu_image(binary_file_path, linker_script_path, version, private_key, image_type="primary",
+                     export_bin_to_cwd=False, update_folder=None):
+    """
+    Creates the DFU image of a binary for an image type, and writes its outputs (DFU image, sparse image and
+    firmware_info.yaml).
+
+    Args:
+        version (tuple): The version of the image (major, minor, patch).
+        image_type (str): primary, secondary or compressed.
+        update_folder (str): The folder of the outputs (default: update_firmware, next to the binary).
+
+    Returns:
+        dict: The information written to firmware_info.yaml.
+    """
+    # A compressed image is linked for the primary slot: the bootloader decompresses it there
+    compress = image_type == "compressed"
+    slot = "primary" if compress else image_type
+
+    with open(binary_file_path, "rb") as binary_file:
+        binary_data = bytearray(binary_file.read())
+
+    with open(linker_script_path, "r", encoding='utf-8') as linker_file:
+        linker_script_content = linker_file.read()
+
+    # Initialize and analyze the binary provided based on the linker script
+    # A compressed image is verified while it is decompressed (streamed): it is signed as a whole, without a tree
+    analyzer = BinaryAnalyzer(binary_data, linker_script_content, private_key, slot, merkle=not compress)
+
+    # Calculate CRC32 on the initialized binary data
+    crc32 = CRC.compute_crc32(analyzer.binary_data[:-FOOTER_SIZE_BYTES])  # Exclude last 40 bytes for footer
+
+    """
+    Add data to the binary. The data that will be added will be:
+    1. CRC32 (4 bytes)
+    2. Version (Major, Minor, Patch) (4 bytes)
+    3. Signature (64 bytes)
+    They will all exist in the end of the binary.
+    """
+    # Set version in the footer
+    analyzer.add_version_to_footer(*version)
+    # Add CRC32 to the footer
+    analyzer.add_crc_to_footer(crc32)
+    # Add Signature to the footer
+    analyzer.add_signature_to_footer()
+    if compress:
+        analyzer.compress_to_secondary_slot()
+
+    # Commit all the information to the binary (actually re-write the binary)
+    return analyzer.commit_to_file(binary_file_path, export_bin_to_cwd, update_folder)
+
+def run_batch_task(task):
+    """
+    Creates one image of a batch, in a worker process. Its messages are collected, so that the images of the batch do
+    not interleave them.
+
+    Returns:
+        tuple: The messages, the firmware info (None if the image failed), the error and the duration (s).
+    """
+    start_time = time.monotonic()
+    messages = io.StringIO()
+    info, error = None, None
+    with contextlib.redirect_stdout(messages):
+        try:
+            info = create_dfu_image(task["binary"], task["linker_script"], task["version"], task["private_key"],
+                                    task["image_type"], update_folder=task["update_folder"])
+        except Exception as e:
+            error = str(e)
+            print(f"Error: {e}")
+    return messages.getvalue(), info, error, time.monotonic() - start_time
+
+def load_batch(batch_file_path):
+    """
+    Reads a batch file: the images to create, with defaults for all of them. Paths are relative to the batch file.
+
+        linker_script: path/to/linker_script       # Defaults, for every image
+        private_key: path/to/private_key
+        images:
+          - binary: path/to/bin
+            version: {major: 0, minor: 2, patch: 0}
+            types: [primary, compressed]             # Optional, default: [primary]
+            output: path/to/folder                   # Optional, default: update_firmware next to the binary
+            (linker_script, private_key, version)    # Optional, override the defaults
+
+    Returns:
+        list: One task per image and type.
+
+    Raises:
+        ValueError: If the batch file is invalid, or two images would write the same files.
+    """
+    with open(batch_file_path, "r", encoding='utf-8') as batch_file:
+        batch = yaml.safe_load(batch_file)
+    base_folder = os.path.dirname(os.path.abspath(batch_file_path))
+    tasks = []
+    outputs = {}
+    for number, image in enumerate(batch.get("images") or [], 1):
+        def get_path(key):
+            value = image.get(key, batch.get(key))
+            if value is None:
+                raise ValueError(f"Image {number}: no {key}")
+            return os.path.join(base_folder, value)
+
+        version = image.get("version", batch.get("version")) or {}
+        if any(part not in version for part in ("major", "minor", "patch")):
+            raise ValueError(f"Image {number}: the version needs a major, minor and patch")
+        binary = get_path("binary")
+        update_folder = get_path("output") if "output" in image else None
+        for image_type in image.get("types", ["primary"]):
+            if image_type not in IMAGE_TYPES:
+                raise ValueError(f"Image {number}: unknown image type {image_type}")
+            # The outputs of an image, as commit_to_file names them: two images cannot share them
+            folder, binary_filename, name_suffix = get_output_names(binary, image_type == "compressed", update_folder)
+            for output_name in (binary_filename, f"firmware_info{name_suffix}.yaml"):
+                output = os.path.normpath(os.path.join(folder, output_name))
+                if output in outputs:
+                    raise ValueError(f"Images {outputs[output]} and {number} both write {output}, set their output")
+                outputs[output] = number
+            tasks.append({"binary": binary, "linker_script": get_path("linker_script"),
+                          "private_key": get_path("private_key"), "image_type": image_type,
+                          "version": (version["major"], version["minor"], version["patch"]),
+                          "update_folder": update_folder})
+    if not tasks:
+        raise ValueError("No images in the batch file")
+    return tasks
+
+def run_batch(tasks, workers=None):
+    """
+    Creates the images of a batch in parallel worker processes, and prints the messages of each image, then a summary.
+
+    Returns:
+        bool: True if every image was created.
+    """
+    start_time = time.monotonic()
+    with ProcessPoolExecutor(max_workers=workers) as executor:
+        results = list(executor.map(run_batch_task, tasks))
+
+    for task, (messages, _, _, _) in zip(tasks, results):
+        print(f"--- {task['binary']} ({task['image_type']}) ---")
+        print(messages)
+    print(f"{'Binary':<40}  {'Type':<10}  {'Version':<8}  {'CRC32':<8}  {'Sparse':>7}  {'Time':>6}  Result")
+    for task, (_, info, error, duration) in zip(tasks, results):
+        binary = os.path.relpath(task["binary"])
+        version = "v{}.{}.{}".format(*task["version"])
+        crc = info["bin_crc"] if info else ""
+        sparse_size = info["sparse_size"] if info else ""
+        print(f"{binary:<40}  {task['image_type']:<10}  {version:<8}  {crc:<8}  {sparse_size:>7}  {duration:>5.1f}s  "
+              f"{error or 'ok'}")
+    failed = sum(1 for _, info, _, _ in results if info is None)
+    print(f"{len(tasks) - failed}/{len(tasks)} images created in {time.monotonic() - start_time:.1f} s")
+    return failed == 0
 
 def main():
-    if len(sys.argv) not in (7, 8):
-        print(f"Usage: {sys.argv[0]} <binary_file> <linker_script> <version_major> <version_minor> <version_patch> <private_key> [export_bin_to_cwd]")
+    if len(sys.argv) > 1 and sys.argv[1] == "--batch":
+        parser = argparse.ArgumentParser(description='Create the DFU images of a batch file in parallel.')
+        parser.add_argument('--batch', metavar='FILE', required=True, help='Batch file (see load_batch)')
+        parser.add_argument('--workers', type=int, default=None,
+                            help='Worker processes (default: one per CPU)')
+        args = parser.parse_args()
+        try:
+            tasks = load_batch(args.batch)
+        except Exception as e:
+            print(f"Error: {e}")
+            sys.exit(1)
+        sys.exit(0 if run_batch(tasks, args.workers) else 1)
+
+    if len(sys.argv) not in (7, 8, 9):
+        print(f"Usage: {sys.argv[0]} <binary_file> <linker_script> <version_major> <version_minor> <version_patch> <private_key> [export_bin_to_cwd] [primary|secondary|compressed[,...]]")
+        print(f"       {sys.argv[0]} --batch <batch_file> [--workers N]")
         sys.exit(1)
 
     binary_file_path = sys.argv[1]
     linker_script_path = sys.argv[2]
-    version_major = int(sys.argv[3])
-    version_minor = int(sys.argv[4])
-    version_patch = int(sys.argv[5])
+    version = (int(sys.argv[3]), int(sys.argv[4]), int(sys.argv[5]))
     private_key = sys.argv[6]
     export_bin_to_cwd = True if len(sys.argv) == 7 or sys.argv[7].lower() == 'True' else False
+    # Several image types of the same binary (e.g. primary,compressed) are created in one run
+    image_types = sys.argv[8].split(",") if len(sys.argv) == 9 else ["primary"]
+    for image_type in image_types:
+        if image_type not in IMAGE_TYPES:
+            print(f"Unknown slot: {image_type}")
+            sys.exit(1)
 
     print(f"export_bin_to_cwd: {export_bin_to_cwd}")
 
     try:
-        with open(binary_file_path, "rb") as binary_file:
-            binary_data = bytearray(binary_file.read())
-
-        with open(linker_script_path, "r", encoding='utf-8') as linker_file:
-            linker_script_content = linker_file.read()
-
-        # Initialize and analyze the binary provided based on the linker script
-        analyzer = BinaryAnalyzer(binary_data, linker_script_content, private_key)
-
-        # Calculate CRC32 on the initialized binary data
-        crc32 = CRC.compute_crc32(analyzer.binary_data[:-FOOTER_SIZE_BYTES])  # Exclude last 40 bytes for footer
-
-        """
-        Add data to the binary. The data that will be added will be:
-        1. CRC32 (4 bytes)
-        2. Version (Major, Minor, Patch) (4 bytes)
-        3. Signature (64 bytes)
-        They will all exist in the end of the binary.
-        """
-        # Set version in the footer
-        analyzer.add_version_to_footer(version_major, version_minor, version_patch)
-        # Add CRC32 to the footer
-        analyzer.add_crc_to_footer(crc32)
-        # Add Signature to the footer
-        analyzer.add_signature_to_footer()
-
-        # Commit all the information to the binary (actually re-write the binary)
-        analyzer.commit_to_file(binary_file_path, export_bin_to_cwd)
+        for image_type in image_types:
+            create_dfu_image(binary_file_path, linker_script_path, version, private_key, image_type, export_bin_to_cwd)
 
     except Exception as e:
         print(f"Error: {e}")
@@ -1,16 +1,160 @@
 import argparse
+import glob
+import os
 import serial
+import threading
 import time
 import struct
+import zlib
+from concurrent.futures import ThreadPoolExecutor
+from trace_decoder import TraceDecoder
 
 # Constants
-FIRMWARE_UPDATE_PACKET_SIZE = 128
+COM_PROTO_VERSION = 2
+FIRMWARE_UPDATE_MIN_PACKET_SIZE = 128
+FIRMWARE_UPDATE_MAX_PACKET_SIZE = 2048
+COM_PROTO_HEADER_SIZE = 3  # 1 byte msg type + 2 bytes msg len (little endian)
+COM_PROTO_FOOTER_SIZE = 2  # crc16 (big endian)
+# Packets of a firmware update that the bootloader can receive with gaps (broadcast, FEC session)
+FIRMWARE_UPDATE_MAX_PACKET_COUNT = 1792
+# Largest frame (FWUG_DATA_AT): header + offset + payload + crc16 (COM_PROTO_MAX_FRAME_SIZE of the bootloader)
+COM_PROTO_MAX_FRAME_SIZE = COM_PROTO_HEADER_SIZE + 4 + FIRMWARE_UPDATE_MAX_PACKET_SIZE + COM_PROTO_FOOTER_SIZE
 COM_PROTO_MSG_TYPE_FWUG_START = 0x01
 COM_PROTO_MSG_TYPE_FWUG_DATA = 0x02
 COM_PROTO_MSG_TYPE_FWUG_STATUS = 0x03
 COM_PROTO_MSG_TYPE_FWUG_CANCEL = 0x04
-
+COM_PROTO_MSG_TYPE_REQ_DATA = 0x05
+COM_PROTO_MSG_TYPE_DATA = 0x06
+COM_PROTO_MSG_TYPE_CMD = 0x07
 COM_PROTO_MSG_TYPE_OP_RESULT = 0x08
+COM_PROTO_MSG_TYPE_ADDRESSED = 0x09
+COM_PROTO_MSG_TYPE_FWUG_PARITY = 0x0A
+COM_PROTO_MSG_TYPE_FWUG_DATA_AT = 0x0B
+COM_PROTO_MSG_TYPE_FWUG_COPY = 0x0C
+
+# Shared bus (BL_BUS_ADDRESS builds): frames addressed to every node
+COM_PROTO_ADDRESS_BROADCAST = 0xFF
+# Time between two broadcast frames (s): nobody answers them, and a node cannot receive while it programs a packet
+BUS_BROADCAST_GAP = 0.02
+# Times the packets that some node is missing are broadcast again
+BUS_REPAIR_ROUNDS = 5
+
+# Forward error correction: time between two FWUG_DATA frames of a group (s). The responses are not awaited, and the
+# bootloader cannot receive while it programs a packet.
+FEC_PACKET_GAP = 0.02
+
+# Commands (CMD)
+COM_PROTO_CMD_SET_BAUDRATE = 0xC4
+COM_PROTO_CMD_REBOOT = 0xC5
+
+# Feature flags (capabilities)
+COM_PROTO_FEATURE_BAUDRATE_SWITCH = 0x00000001
+COM_PROTO_FEATURE_DIRECT_INSTALL = 0x00000002
+COM_PROTO_FEATURE_BUS_ADDRESSING = 0x00000004
+COM_PROTO_FEATURE_FEC = 0x00000008
+COM_PROTO_FEATURE_RESUME = 0x00000010
+COM_PROTO_FEATURE_SPARSE = 0x00000020
+COM_PROTO_FEATURE_CHUNK_CHECKSUMS = 0x00000040
+COM_PROTO_FEATURE_SLOT_INFO = 0x00000080
+COM_PROTO_FEATURE_DIRECT_XIP = 0x00000100
+
+# Delta formats (capabilities)
+COM_PROTO_DELTA_CHUNK_COPY = 0x01
+
+# Sparse image file (create_dfu_image.py): header (magic, image size, range count, CRC32 of the image), then per
+# populated range: offset, length and data. The image is the ranges over an erased (0xFF) slot.
+SPARSE_IMAGE_MAGIC = 0x53525053
+SPARSE_IMAGE_HEADER_FORMAT = '<IIII'
+SPARSE_RANGE_FORMAT = '<II'
+# Sparse transfer: erased gaps shorter than this (bytes) are sent with the ranges around them, as one more FWUG_DATA_AT
+# round trip costs more line time than the gap
+SPARSE_MERGE_GAP = 256
+
+# Delta transfer: the image is compared with the installed image in chunks of this size (bytes). The chunks that match
+# are copied by the bootloader (FWUG_COPY), up to DELTA_MAX_COPY_CHUNKS at once (the copy blocks the bootloader).
+DELTA_CHUNK_SIZE = 4096
+DELTA_MAX_COPY_CHUNKS = 16
+
+# Baud rate the bootloader starts (and falls back) at
+UART_DEFAULT_BAUDRATE = 115200
+# The bootloader falls back to the default baud rate, if no valid frame is received at the new baud rate within this
+# time. A margin is added for the bootloader loop period.
+COM_PROTO_BAUDRATE_CONFIRM_TIMEOUT = 2.0
+COM_PROTO_BAUDRATE_FALLBACK_WAIT = COM_PROTO_BAUDRATE_CONFIRM_TIMEOUT + 1.5
+
+# Time to wait for a complete response frame (s). FWUG_START erases the download slot before it answers.
+COM_PROTO_RESPONSE_TIMEOUT = 3.0
+COM_PROTO_FWUG_START_TIMEOUT = 10.0
+# Attempts to send a firmware update packet
+FWUG_DATA_ATTEMPTS = 3
+# uart frame: start bit, 8 data bits, stop bit
+UART_BITS_PER_BYTE = 10
+
+# Data types (REQ_DATA/DATA)
+COM_PROTO_DATA_TYPE_DEBUG_INF = 0xD0
+COM_PROTO_DATA_TYPE_CAPABILITIES = 0xD1
+COM_PROTO_DATA_TYPE_TRACE = 0xD2
+COM_PROTO_DATA_TYPE_IMAGE_CHECK = 0xD3
+COM_PROTO_DATA_TYPE_MISSING_PACKETS = 0xD4
+COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS = 0xD5
+COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS = 0xD6
+COM_PROTO_DATA_TYPE_SLOT_INFO = 0xD7
+COM_PROTO_DATA_TYPE_PROFILE = 0xD8
+
+# Application slots (image check request)
+COM_PROTO_SLOTS = {'primary': 0x00, 'secondary': 0x01}
+
+# Debug info (statistics) request flags
+COM_PROTO_DEBUG_INF_FLAG_CLEAR = 0x01
+
+# Debug info payload: counters, accumulated timers (us) and the packet latency histogram (log2 us buckets)
+STATS_COUNTERS = ['frames received', 'CRC16 errors', 'sequence errors', 'uart overruns', 'uart recoveries',
+                  'FEC repairs']
+STATS_TIMERS = ['erase', 'program', 'CRC', 'SHA-256', 'ECDSA']
+STATS_LATENCY_BUCKET_COUNT = 24
+STATS_FORMAT = f'<{len(STATS_COUNTERS)}I{len(STATS_TIMERS)}I{STATS_LATENCY_BUCKET_COUNT}I'
+
+# Profile payload (BL_PROFILING builds): region_count, first_region. Followed by (calls, total, min, max cycles) of the
+# regions from first_region on, in the order of enum prof_region_e (profiling.h).
+PROFILE_FORMAT = '<BB'
+PROFILE_REGION_FORMAT = '<IQII'
+PROFILE_REGIONS = ['fsm_init_hdl', 'fsm_crc_check_hdl', 'fsm_auth_hdl', 'fsm_boot_app_hdl', 'fsm_bootloop_hdl',
+                   'crc32_driver_calculate', 'crc16_driver_calculate', 'authenticate_application', 'sha256',
+                   'ecdsa_verify', 'flash_driver_erase', 'flash_driver_program']
+
+# Capabilities payload: proto_version, max_packet_size, window_depth, compression_formats, delta_formats,
+# max_baudrate, features, app_primary_start, app_primary_size, app_secondary_start, app_secondary_size,
+# flash_sector_count. Followed by flash_sector_count * (start_address, size).
+CAPABILITIES_FORMAT = '<BHBBBIIIIIIB'
+FLASH_SECTOR_FORMAT = '<II'
+
+# Image check payload: slot, damaged_chunks (bitmask), chunk_count. Followed by chunk_count * (start_address, size).
+IMAGE_CHECK_FORMAT = '<BIB'
+IMAGE_CHUNK_FORMAT = '<II'
+
+# Missing packets payload: is_active, packet_size, packet_count, missing_count. Followed by the bitmap of the missing
+# packets (bit i: packet i), (packet_count + 7) // 8 bytes.
+MISSING_PACKETS_FORMAT = '<BHHH'
+
+# Download progress payload: packet_size, packet_count, prefix_crc32 (CRC32 of the packet_count packets in the
+# download space)
+DOWNLOAD_PROGRESS_FORMAT = '<HHI'
+
+# Chunk checksums request: slot, offset, chunk_size, chunk_count. The payload starts with the same fields, followed by
+# the CRC32 of each chunk, up to COM_PROTO_MAX_CHUNK_CHECKSUMS per request.
+CHUNK_CHECKSUMS_FORMAT = '<BIIB'
+COM_PROTO_MAX_CHUNK_CHECKSUMS = 61
+
+# Image footer, at the end of the slot: CRC32, version and signature
+IMAGE_FOOTER_SIZE = 72
+# Slot info payload: boot_path_flags, is_secondary_newer. Followed by the footer of each slot (COM_PROTO_SLOTS order)
+# and whether its image matches its CRC32, then the slot that the next update is downloaded to.
+SLOT_INFO_FORMAT = '<IB'
+SLOT_FOOTER_FORMAT = f'<{IMAGE_FOOTER_SIZE}sB'
+SLOT_INFO_DOWNLOAD_SLOT_FORMAT = '<B'
+# Boot path flags (boot_info.h): the checks of the last boot that an image failed
+BOOT_INFO_PATH_UPDATE_REJECTED = 0x00000004
+BOOT_INFO_PATH_PRIMARY_AUTH_FAIL = 0x00000010
 
 # Operation results
 COM_PROTO_OP_RESULT_NO_ERR = 0x00
@@ -19,184 +163,1596 @@ COM_PROTO_OP_RESULT_CRC_ERR = 0xE2
 COM_PROTO_OP_RESULT_AUTH_ERR = 0xE3
 COM_PROTO_OP_RESULT_UNKNOWN_MSG_ERR = 0xE4
 
-def send_message_via_serial(message, port='COM9', baudrate=115200, interval=0.01, max_wait_time=3):
-    # Open serial port
-    ser = serial.Serial(port, baudrate)
+class SerialSession:
+    """
+    Serial connection to the bootloader, kept open for a whole session. Each request is a single write, and its
+    response is read frame by frame: the header gives the frame length, so the reads block until the frame is complete
+    or the timeout expires. The response is read into a buffer that is reused for every frame. Messages go through log
+    (print by default), so that the sessions of a fleet update can tag them with their port. On a shared bus, the
+    requests are addressed to the node at address.
+    """
+    def __init__(self, port, baudrate, verbose=False, log=print, address=None):
+        self.serial = serial.Serial(port, baudrate, timeout=COM_PROTO_RESPONSE_TIMEOUT)
+        self.verbose = verbose
+        self.log = log
+        self.address = address
+        self.rx_buffer = bytearray(COM_PROTO_MAX_FRAME_SIZE)
+        self.rx_view = memoryview(self.rx_buffer)
 
-    # Create the buffer of 256 bytes. This depends on the packet size that we have to send to the bootloader.
-    # Currently only fixed size packets are supported (256 - Depends on bootloader firmware).
-    buffer_size = 256
-    buffer = bytearray(buffer_size)
+    @property
+    def baudrate(self):
+        return self.serial.baudrate
 
-    # Copy message into the buffer
-    buffer[:len(message)] = message
+    @baudrate.setter
+    def baudrate(self, baudrate):
+        self.serial.baudrate = baudrate
 
-    # Fill the rest of the buffer with 0xFF
-    for i in range(len(message), buffer_size):
-        buffer[i] = 0xFF
+    def close(self):
+        self.serial.close()
 
-    # Convert buffer to hex string
-    hex_buffer = buffer.hex()
+    def _read_until(self, received, size, deadline):
+        """
+        Reads into the rx buffer, until it holds size bytes or the deadline expires. Returns the bytes held.
+        """
+        while received < size:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                break
+            self.serial.timeout = remaining
+            count = self.serial.readinto(self.rx_view[received:size])
+            if not count:
+                break
+            received += count
+        return received
 
-    # Print hex buffer for verification
-    #print("Hex Buffer:", hex_buffer)
-    ser.write(bytes.fromhex(hex_buffer))
+    def transact(self, message, timeout=COM_PROTO_RESPONSE_TIMEOUT):
+        """
+        Sends a frame and waits for the response frame.
 
-    # Initialize variables for response handling
-    total_wait_time = 0
+        Returns:
+            memoryview: The response frame (valid until the next transaction), empty if no complete frame was received
+            within the timeout.
+        """
+        deadline = time.monotonic() + timeout
+        if self.address is not None:
+            message = create_addressed_frame(self.address, message)
+        # Drop what is left from a previous transaction (e.g. a response that arrived after its timeout)
+        self.serial.reset_input_buffer()
+        self.serial.write(message)
 
-    # Wait for the response
-    response = bytearray()
-    while total_wait_time < max_wait_time:
-        if ser.in_waiting > 0:
-            response.extend(ser.read(ser.in_waiting))
-            break
-        time.sleep(interval)
-        total_wait_time += interval
+        received = self._read_until(0, COM_PROTO_HEADER_SIZE, deadline)
+        if received < COM_PROTO_HEADER_SIZE:
+            self.log("No response received within the timeout")
+            return self.rx_view[:0]
+        msg_len = struct.unpack_from('<H', self.rx_buffer, 1)[0]
+        if not COM_PROTO_HEADER_SIZE + COM_PROTO_FOOTER_SIZE <= msg_len <= len(self.rx_buffer):
+            self.log(f"Invalid response frame length: {msg_len}")
+            return self.rx_view[:0]
+        if self._read_until(received, msg_len, deadline) < msg_len:
+            self.log("Incomplete response frame")
+            return self.rx_view[:0]
 
-    # Print the response in hex format for verification
-    if response:
-        print("Response (Hex):", response.hex())
-    else:
-        print("No response received within the maximum wait time")
+        if self.verbose:
+            self.log("Response (Hex):", self.rx_view[:msg_len].hex())
+        return self.rx_view[:msg_len]
+
+    def send(self, message, gap):
+        """
+        Sends a frame without waiting for its response (if any, it is dropped by the next transaction). The bootloader
+        gets gap seconds to process the frame before the next one.
+        """
+        if self.address is not None:
+            message = create_addressed_frame(self.address, message)
+        self.serial.write(message)
+        self.serial.flush()
+        time.sleep(gap)
+
+    def broadcast(self, message, gap=BUS_BROADCAST_GAP):
+        """
+        Sends a frame to every node of a shared bus. No node answers: the frame is sent, then the nodes get gap seconds
+        to process it before the next frame.
+        """
+        self.serial.write(create_addressed_frame(COM_PROTO_ADDRESS_BROADCAST, message))
+        self.serial.flush()
+        time.sleep(gap)
+
+
+def _create_crc16_table():
+    table = []
+    for byte in range(256):
+        crc = byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+        table.append(crc & 0xFFFF)
+    return table
 
-    # Close serial port
-    ser.close()
-    return response
+# CRC16-CCITT (0x1021), one byte at a time
+CRC16_TABLE = _create_crc16_table()
 
 def compute_crc16(data):
     crc = 0xFFFF
     for byte in data:
-        crc ^= byte << 8
-        for _ in range(8):
-            if crc & 0x8000:
-                crc = (crc << 1) ^ 0x1021
-            else:
-                crc <<= 1
-            crc &= 0xFFFF  # Ensure CRC remains 16-bit
+        crc = ((crc << 8) & 0xFFFF) ^ CRC16_TABLE[(crc >> 8) ^ byte]
     return crc
 
+def create_addressed_frame(address, frame):
+    """
+    Wraps a frame in an addressed message, for one node of a shared bus (or all of them: COM_PROTO_ADDRESS_BROADCAST).
+    """
+    msg_len = COM_PROTO_HEADER_SIZE + 1 + len(frame) + COM_PROTO_FOOTER_SIZE  # Header + address + frame + footer
+    message = struct.pack('<BHB', COM_PROTO_MSG_TYPE_ADDRESSED, msg_len, address) + bytes(frame)
+    return message + struct.pack('>H', compute_crc16(message))
+
+def parse_capabilities(payload):
+    """
+    Parses the payload of a COM_PROTO_DATA_TYPE_CAPABILITIES DATA message.
+
+    Args:
+        payload (bytes): The DATA message payload.
+
+    Returns:
+        dict: The bootloader capabilities, or None if the payload is malformed.
+    """
+    fixed_size = struct.calcsize(CAPABILITIES_FORMAT)
+    if len(payload) < fixed_size:
+        return None
+    fields = struct.unpack(CAPABILITIES_FORMAT, payload[:fixed_size])
+    names = ['proto_version', 'max_packet_size', 'window_depth', 'compression_formats', 'delta_formats',
+             'max_baudrate', 'features', 'app_primary_start', 'app_primary_size', 'app_secondary_start',
+             'app_secondary_size', 'flash_sector_count']
+    capabilities = dict(zip(names, fields))
+    sector_size = struct.calcsize(FLASH_SECTOR_FORMAT)
+    sectors = []
+    for i in range(capabilities['flash_sector_count']):
+        offset = fixed_size + i * sector_size
+        if len(payload) < offset + sector_size:
+            return None
+        sectors.append(struct.unpack(FLASH_SECTOR_FORMAT, payload[offset:offset + sector_size]))
+    capabilities['flash_sectors'] = sectors
+    return capabilities
+
+def print_capabilities(capabilities):
+    print("Bootloader capabilities:")
+    print(f"  protocol version:    {capabilities['proto_version']}")
+    print(f"  max packet size:     {capabilities['max_packet_size']} bytes")
+    print(f"  window depth:        {capabilities['window_depth']}")
+    print(f"  compression formats: 0x{capabilities['compression_formats']:02X}")
+    print(f"  delta formats:       0x{capabilities['delta_formats']:02X}")
+    print(f"  max baud rate:       {capabilities['max_baudrate']}")
+    print(f"  features:            0x{capabilities['features']:08X}")
+    if capabilities['features'] & COM_PROTO_FEATURE_DIRECT_INSTALL:
+        install_mode = 'direct to primary (no fallback)'
+    elif capabilities['features'] & COM_PROTO_FEATURE_DIRECT_XIP:
+        install_mode = 'slot not booted, booted in place'
+    else:
+        install_mode = 'secondary, then primary'
+    print(f"  update download:     {install_mode}")
+    print(f"  primary slot:        0x{capabilities['app_primary_start']:08X} ({capabilities['app_primary_size']} bytes)")
+    print(f"  secondary slot:      0x{capabilities['app_secondary_start']:08X} "
+          f"({capabilities['app_secondary_size']} bytes)")
+    for index, (start_address, size) in enumerate(capabilities['flash_sectors']):
+        print(f"  flash sector {index}:      0x{start_address:08X} ({size // 1024} kB)")
+
+def parse_image_check(payload):
+    """
+    Parses the payload of a COM_PROTO_DATA_TYPE_IMAGE_CHECK DATA message.
+
+    Returns:
+        dict: The slot, the chunks of its image index and the damaged chunks, or None if the payload is malformed.
+    """
+    fixed_size = struct.calcsize(IMAGE_CHECK_FORMAT)
+    chunk_size = struct.calcsize(IMAGE_CHUNK_FORMAT)
+    if len(payload) < fixed_size:
+        return None
+    slot, damaged_chunks, chunk_count = struct.unpack(IMAGE_CHECK_FORMAT, payload[:fixed_size])
+    if len(payload) < fixed_size + chunk_count * chunk_size:
+        return None
+    chunks = [struct.unpack_from(IMAGE_CHUNK_FORMAT, payload, fixed_size + i * chunk_size) for i in range(chunk_count)]
+    return {'slot': slot, 'damaged_chunks': damaged_chunks, 'chunks': chunks}
+
+def print_image_check(slot_name, image_check):
+    if not image_check['chunks']:
+        print(f"The {slot_name} slot image has no index: it can only be checked as a whole")
+        return
+    print(f"Image check of the {slot_name} slot:")
+    for index, (start_address, size) in enumerate(image_check['chunks']):
+        status = 'DAMAGED' if image_check['damaged_chunks'] & (1 << index) else 'ok'
+        print(f"  chunk {index:<2} 0x{start_address:08X} - 0x{start_address + size - 1:08X}: {status}")
+
+def parse_missing_packets(payload):
+    """
+    Parses the payload of a COM_PROTO_DATA_TYPE_MISSING_PACKETS DATA message.
+
+    Returns:
+        dict: The firmware update session of the node and its missing packet numbers, or None if the payload is
+        malformed.
+    """
+    fixed_size = struct.calcsize(MISSING_PACKETS_FORMAT)
+    if len(payload) < fixed_size:
+        return None
+    is_active, packet_size, packet_count, missing_count = struct.unpack(MISSING_PACKETS_FORMAT, payload[:fixed_size])
+    bitmap = payload[fixed_size:]
+    if len(bitmap) < (packet_count + 7) // 8:
+        return None
+    missing = [i for i in range(packet_count) if bitmap[i // 8] & (1 << (i % 8))]
+    return {'is_active': is_active, 'packet_size': packet_size, 'packet_count': packet_count, 'missing': missing}
+
+def parse_download_progress(payload):
+    """
+    Parses the payload of a COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS DATA message.
+
+    Returns:
+        dict: The packets of an interrupted download in the download space and their CRC32, or None if the payload is
+        malformed.
+    """
+    if len(payload) < struct.calcsize(DOWNLOAD_PROGRESS_FORMAT):
+        return None
+    packet_size, packet_count, prefix_crc32 = struct.unpack_from(DOWNLOAD_PROGRESS_FORMAT, payload)
+    return {'packet_size': packet_size, 'packet_count': packet_count, 'prefix_crc32': prefix_crc32}
+
+def parse_chunk_checksums(payload):
+    """
+    Parses the payload of a COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS DATA message.
+
+    Returns:
+        dict: The requested range and the CRC32 of each of its chunks, or None if the payload is malformed.
+    """
+    fixed_size = struct.calcsize(CHUNK_CHECKSUMS_FORMAT)
+    if len(payload) < fixed_size:
+        return None
+    slot, offset, chunk_size, chunk_count = struct.unpack_from(CHUNK_CHECKSUMS_FORMAT, payload)
+    if len(payload) < fixed_size + 4 * chunk_count:
+        return None
+    crc32s = list(struct.unpack_from(f'<{chunk_count}I', payload, fixed_size))
+    return {'slot': slot, 'offset': offset, 'chunk_size': chunk_size, 'crc32s': crc32s}
+
+def parse_slot_info(payload):
+    """
+    Parses the payload of a COM_PROTO_DATA_TYPE_SLOT_INFO DATA message.
+
+    Returns:
+        dict: The boot path flags, whether the next boot installs the secondary image, the footer of each slot (with
+        the result of its CRC32 check) and the download slot (None if not reported), or None if the payload is
+        malformed.
+    """
+    fixed_size = struct.calcsize(SLOT_INFO_FORMAT)
+    footer_size = struct.calcsize(SLOT_FOOTER_FORMAT)
+    slots_end = fixed_size + len(COM_PROTO_SLOTS) * footer_size
+    if len(payload) < slots_end:
+        return None
+    boot_path_flags, is_secondary_newer = struct.unpack_from(SLOT_INFO_FORMAT, payload)
+    slots = {}
+    for slot_name, slot in COM_PROTO_SLOTS.items():
+        footer, is_crc_ok = struct.unpack_from(SLOT_FOOTER_FORMAT, payload, fixed_size + slot * footer_size)
+        slots[slot_name] = {'footer': footer, 'is_crc_ok': bool(is_crc_ok)}
+    download_slot = None
+    if len(payload) >= slots_end + struct.calcsize(SLOT_INFO_DOWNLOAD_SLOT_FORMAT):
+        slot, = struct.unpack_from(SLOT_INFO_DOWNLOAD_SLOT_FORMAT, payload, slots_end)
+        download_slot = next((name for name, value in COM_PROTO_SLOTS.items() if value == slot), None)
+    return {'boot_path_flags': boot_path_flags, 'is_secondary_newer': bool(is_secondary_newer), 'slots': slots,
+            'download_slot': download_slot}
+
+def get_accepted_packet_size(requested_packet_size):
+    """
+    Returns the packet size that the bootloader accepts for a requested one: the largest power of two within the
+    limits, that does not exceed it.
+    """
+    packet_size = FIRMWARE_UPDATE_MIN_PACKET_SIZE
+    while packet_size < FIRMWARE_UPDATE_MAX_PACKET_SIZE and packet_size * 2 <= requested_packet_size:
+        packet_size *= 2
+    return packet_size
+
+def parse_stats(payload):
+    if len(payload) < struct.calcsize(STATS_FORMAT):
+        return None
+    values = struct.unpack(STATS_FORMAT, payload[:struct.calcsize(STATS_FORMAT)])
+    counters_end = len(STATS_COUNTERS)
+    timers_end = counters_end + len(STATS_TIMERS)
+    return {
+        'counters': dict(zip(STATS_COUNTERS, values[:counters_end])),
+        'timers_us': dict(zip(STATS_TIMERS, values[counters_end:timers_end])),
+        'packet_latency_hist': list(values[timers_end:]),
+    }
+
+def print_stats(stats):
+    print("Bootloader statistics:")
+    for name, value in stats['counters'].items():
+        print(f"  {name + ':':<21}{value}")
+    for name, value in stats['timers_us'].items():
+        print(f"  {name + ' time:':<21}{value / 1000:.1f} ms")
+    print("  packet latency histogram:")
+    for bucket, count in enumerate(stats['packet_latency_hist']):
+        if count:
+            low = 0 if bucket == 0 else 1 << bucket
+            high = '...' if bucket == STATS_LATENCY_BUCKET_COUNT - 1 else f"{(1 << (bucket + 1)) - 1} us"
+            print(f"    {low:>8} us - {high:<12}: {count}")
+
+def parse_profile(payload):
+    """
+    Parses the payload of a COM_PROTO_DATA_TYPE_PROFILE DATA message. Returns the region count, the first region and
+    the (calls, total, min, max) cycles of the reported regions.
+    """
+    fixed_size = struct.calcsize(PROFILE_FORMAT)
+    region_size = struct.calcsize(PROFILE_REGION_FORMAT)
+    if len(payload) < fixed_size or (len(payload) - fixed_size) % region_size:
+        return None
+    region_count, first_region = struct.unpack_from(PROFILE_FORMAT, payload)
+    regions = [struct.unpack_from(PROFILE_REGION_FORMAT, payload, offset)
+               for offset in range(fixed_size, len(payload), region_size)]
+    return region_count, first_region, regions
+
+def print_profile(regions):
+    """
+    Prints the profiled regions, in the format that scripts/build_tools/compare_profiles.py parses.
+    """
+    print("--- profiling (cycles) ---")
+    for index, (calls, total, min_cycles, max_cycles) in enumerate(regions):
+        if calls == 0:
+            continue
+        name = PROFILE_REGIONS[index] if index < len(PROFILE_REGIONS) else f"region_{index}"
+        print(f"{name:<26} calls: {calls} total: {total} min: {min_cycles} max: {max_cycles} avg: {total // calls}")
+
+def create_fwug_data_frame(packet_number, payload, packet_size):
+    """
+    Builds a FWUG_DATA frame. A payload shorter than the packet size (the last one) is padded with 0xFF (erased flash).
+    """
+    # Header + packet number + payload + footer
+    msg_len = COM_PROTO_HEADER_SIZE + 2 + packet_size + COM_PROTO_FOOTER_SIZE
+    frame = bytearray(b'\xFF' * msg_len)
+    struct.pack_into('<BHH', frame, 0, COM_PROTO_MSG_TYPE_FWUG_DATA, msg_len, packet_number)
+    payload_pos = COM_PROTO_HEADER_SIZE + 2
+    frame[payload_pos:payload_pos + len(payload)] = payload
+    crc_pos = msg_len - COM_PROTO_FOOTER_SIZE
+    struct.pack_into('>H', frame, crc_pos, compute_crc16(frame[:crc_pos]))
+    return bytes(frame)
+
+def create_fwug_parity_frame(packet_number, payloads, packet_size):
+    """
+    Builds a FWUG_PARITY frame: the XOR of the payloads of a group of packets, starting at packet_number. The payloads
+    are padded with 0xFF, as in their FWUG_DATA frames.
+    """
+    parity = 0
+    for payload in payloads:
+        parity ^= int.from_bytes(payload.ljust(packet_size, b'\xFF'), 'little')
+    # Header + packet number + group size + payload + footer
+    msg_len = COM_PROTO_HEADER_SIZE + 3 + packet_size + COM_PROTO_FOOTER_SIZE
+    frame = struct.pack('<BHHB', COM_PROTO_MSG_TYPE_FWUG_PARITY, msg_len, packet_number, len(payloads)) + \
+        parity.to_bytes(packet_size, 'little')
+    return frame + struct.pack('>H', compute_crc16(frame))
+
+def create_fwug_data_at_frame(offset, payload):
+    """
+    Builds a FWUG_DATA_AT frame: a populated range of a sparse image (or a part of it), at its offset in the image.
+    """
+    # Header + offset + payload + footer
+    msg_len = COM_PROTO_HEADER_SIZE + 4 + len(payload) + COM_PROTO_FOOTER_SIZE
+    frame = struct.pack('<BHI', COM_PROTO_MSG_TYPE_FWUG_DATA_AT, msg_len, offset) + payload
+    return frame + struct.pack('>H', compute_crc16(frame))
+
+def create_fwug_copy_frame(offset, length):
+    """
+    Builds a FWUG_COPY frame: a range of the image that the bootloader copies from the installed image (the primary
+    slot, or the slot that is not the download slot with BL_DIRECT_XIP).
+    """
+    # Header + offset + length + footer
+    msg_len = COM_PROTO_HEADER_SIZE + 8 + COM_PROTO_FOOTER_SIZE
+    frame = struct.pack('<BHII', COM_PROTO_MSG_TYPE_FWUG_COPY, msg_len, offset, length)
+    return frame + struct.pack('>H', compute_crc16(frame))
+
+def parse_sparse_image(data):
+    """
+    Expands a sparse image file to the image: its ranges over an erased (0xFF) image.
+
+    Returns:
+        bytes: The image, or None if the file is not a sparse image.
+
+    Raises:
+        ValueError: If the sparse image is malformed, or its CRC32 does not match.
+    """
+    header_size = struct.calcsize(SPARSE_IMAGE_HEADER_FORMAT)
+    if len(data) < header_size or struct.unpack_from('<I', data)[0] != SPARSE_IMAGE_MAGIC:
+        return None
+    _, image_size, range_count, crc32 = struct.unpack_from(SPARSE_IMAGE_HEADER_FORMAT, data)
+    image = bytearray(b'\xFF' * image_size)
+    position = header_size
+    for _ in range(range_count):
+        if len(data) < position + struct.calcsize(SPARSE_RANGE_FORMAT):
+            raise ValueError("Truncated sparse image")
+        offset, length = struct.unpack_from(SPARSE_RANGE_FORMAT, data, position)
+        position += struct.calcsize(SPARSE_RANGE_FORMAT)
+        if offset + length > image_size or len(data) < position + length:
+            raise ValueError("Sparse image range out of bounds")
+        image[offset:offset + length] = data[position:position + length]
+        position += length
+    if zlib.crc32(image) != crc32:
+        raise ValueError("Sparse image CRC32 mismatch")
+    return bytes(image)
+
+def find_populated_ranges(data, merge_gap):
+    """
+    Returns the populated ranges (offset, length) of an image: its words that are not erased (0xFF), with the erased
+    gaps shorter than merge_gap bytes kept inside the ranges. The offsets and lengths are word multiples.
+    """
+    ranges = []
+    erased_word = b'\xFF' * 4
+    for offset in range(0, len(data), 4):
+        if data[offset:offset + 4].ljust(4, b'\xFF') == erased_word:
+            continue
+        if ranges and offset - (ranges[-1][0] + ranges[-1][1]) < merge_gap:
+            ranges[-1][1] = offset + 4 - ranges[-1][0]
+        else:
+            ranges.append([offset, 4])
+    return [(offset, length) for offset, length in ranges]
+
+class FirmwareImage:
+    """
+    Firmware image, split in FWUG_DATA frames (packet number, payload padded with 0xFF, CRC16). The frames only depend
+    on the packet size, so they are built once per packet size and shared by every session that sends the image (e.g.
+    the devices of a fleet update). So are the FWUG_PARITY frames, per packet size and group size, and the FWUG_DATA_AT
+    frames of its populated ranges (sparse transfer), per packet size, and the CRC32 of its chunks (delta transfer),
+    per chunk size. The file can be a binary or a sparse image.
+    """
+    def __init__(self, file_path):
+        with open(file_path, 'rb') as f:
+            data = f.read()
+        sparse_data = parse_sparse_image(data)
+        self.data = sparse_data if sparse_data is not None else data
+        self.frames = {}
+        self.parity_frames = {}
+        self.range_frames = {}
+        self.chunk_crc32s = {}
+        self.lock = threading.Lock()
+
+    def get_packet_count(self, packet_size):
+        return (len(self.data) + packet_size - 1) // packet_size
+
+    def get_prefix_crc32(self, packet_size, packet_count):
+        """
+        Returns the CRC32 of the first packet_count packets of the image, as the bootloader computes it over the
+        download space (the last packet padded with 0xFF).
+        """
+        prefix_size = packet_size * packet_count
+        return zlib.crc32(self.data[:prefix_size].ljust(prefix_size, b'\xFF'))
+
+    def get_chunk_count(self, chunk_size):
+        return (len(self.data) + chunk_size - 1) // chunk_size
+
+    def get_chunk(self, chunk_size, chunk):
+        """
+        Returns a chunk of the image, padded with 0xFF as in the slot.
+        """
+        return self.data[chunk * chunk_size:(chunk + 1) * chunk_size].ljust(chunk_size, b'\xFF')
+
+    def get_chunk_crc32s(self, chunk_size):
+        """
+        Returns the CRC32 of each chunk of the image, as the bootloader computes it over a slot.
+        """
+        with self.lock:
+            if chunk_size not in self.chunk_crc32s:
+                self.chunk_crc32s[chunk_size] = [zlib.crc32(self.get_chunk(chunk_size, chunk))
+                                                 for chunk in range(self.get_chunk_count(chunk_size))]
+            return self.chunk_crc32s[chunk_size]
+
+    def get_parity_frames(self, packet_size, group_size):
+        """
+        Returns the FWUG_PARITY frames of the image: one per group of group_size packets (the last group can be
+        shorter).
+        """
+        with self.lock:
+            key = (packet_size, group_size)
+            if key not in self.parity_frames:
+                group_bytes = packet_size * group_size
+                self.parity_frames[key] = [
+                    create_fwug_parity_frame(offset // packet_size,
+                                             [self.data[packet_offset:packet_offset + packet_size] for packet_offset in
+                                              range(offset, min(offset + group_bytes, len(self.data)), packet_size)],
+                                             packet_size)
+                    for offset in range(0, len(self.data), group_bytes)]
+            return self.parity_frames[key]
+
+    def get_range_frames(self, packet_size):
+        """
+        Returns the FWUG_DATA_AT frames of the populated ranges of the image (offset, payload length, frame), split in
+        payloads of up to packet_size bytes.
+        """
+        with self.lock:
+            if packet_size not in self.range_frames:
+                frames = []
+                for range_offset, range_length in find_populated_ranges(self.data, SPARSE_MERGE_GAP):
+                    for offset in range(range_offset, range_offset + range_length, packet_size):
+                        length = min(packet_size, range_offset + range_length - offset)
+                        payload = self.data[offset:offset + length].ljust(length, b'\xFF')
+                        frames.append((offset, length, create_fwug_data_at_frame(offset, payload)))
+                self.range_frames[packet_size] = frames
+            return self.range_frames[packet_size]
+
+    def get_frames(self, packet_size):
+        with self.lock:
+            if packet_size not in self.frames:
+                payloads = [self.data[offset:offset + packet_size] for offset in range(0, len(self.data), packet_size)]
+                self.frames[packet_size] = [create_fwug_data_frame(packet_number, payload, packet_size)
+                                            for packet_number, payload in enumerate(payloads)]
+            return self.frames[packet_size]
+
 class FirmwareUpdateFactory:
-    def __init__(self, com_port='COM9', baud_rate=115200, file_path=None):
-        self.buffer = bytearray(256)
+    def __init__(self, com_port='COM9', baud_rate=UART_DEFAULT_BAUDRATE, file_path=None,
+                 packet_size=FIRMWARE_UPDATE_MAX_PACKET_SIZE, target_baud_rate=None, verbose=False, log=print,
+                 progress=None, image=None, address=None, fec_group_size=0, fec_gap=FEC_PACKET_GAP, resume=True,
+                 sparse=True, delta=True, reboot=False, secondary_file_path=None, secondary_image=None):
+        # Every message is built in place in this buffer, and sent from it (except the FWUG_DATA frames, see
+        # FirmwareImage)
+        self.buffer = bytearray(COM_PROTO_MAX_FRAME_SIZE)
+        self.buffer_view = memoryview(self.buffer)
+        self.session = None
+        self.verbose = verbose
+        # Messages and transfer progress (packets sent, packet count) go through these, so that a fleet update can
+        # report them per device
+        self.log = log
+        self.progress = progress if progress is not None else self.print_progress
         self.com_port = com_port
         self.baud_rate = baud_rate
         self.file_path = file_path
+        # The image to send: it can be shared between sessions
+        self.image = image
+        # With a bootloader that boots both slots in place (BL_DIRECT_XIP), the image is linked for the slot that the
+        # bootloader downloads to: FILE for the primary slot, and this one for the secondary slot
+        self.secondary_file_path = secondary_file_path
+        self.secondary_image = secondary_image
+        # Slot that the bootloader copies the unchanged chunks from (FWUG_COPY): the other slot than the download slot
+        self.source_slot = 'primary'
+        # Node address on a shared bus (None: point to point link)
+        self.address = address
+        # Throughput of the last transfer (bytes/s), and the bytes that the bootloader copied from the source slot
+        self.bytes_per_s = None
+        self.bytes_copied = 0
+        # Packet size proposed to the bootloader. The packet size actually used is the one the bootloader accepts.
+        self.requested_packet_size = packet_size
+        self.packet_size = FIRMWARE_UPDATE_MIN_PACKET_SIZE
+        # Baud rate to switch to for the transfer. The discovery always happens at baud_rate.
+        self.target_baud_rate = target_baud_rate
+        # Forward error correction: packets per FWUG_PARITY packet (0: every packet waits for its response), and the
+        # time between two packets of a group
+        self.fec_group_size = fec_group_size
+        self.fec_gap = fec_gap
+        # Resume an interrupted download of the same image, instead of starting over
+        self.resume = resume
+        # Send only the populated ranges of the image (FWUG_DATA_AT), instead of every packet
+        self.sparse = sparse
+        # Compare the image with the slots first: nothing is sent if a slot already holds it, and the chunks that the
+        # installed image holds are copied by the bootloader (FWUG_COPY), instead of being sent
+        self.delta = delta
+        self.chunk_copy = False
+        # Capabilities reported by the bootloader (None: unknown)
+        self.capabilities = None
+        # Reboot the bootloader after the update, so that it installs (or boots) the image
+        self.reboot = reboot
+        self.is_reboot_pending = False
+        # Packets received by the bootloader, as reported by the last FWUG_STATUS
+        self.packets_received = 0
 
-    def create_fwug_start_msg(self):
-        msg_len = 2 + 2  # Total length: 2 bytes header + 2 bytes footer
-        msg_header = struct.pack('BB', COM_PROTO_MSG_TYPE_FWUG_START, msg_len)
-        msg_footer = struct.pack('H', 0)
-        message = msg_header + msg_footer
-        crc16 = compute_crc16(message[:-2])
-        message = msg_header + struct.pack('>H', crc16)
-        self.buffer[:len(message)] = message
-        return self.buffer[:len(message)]
+    def __enter__(self):
+        self.open()
+        return self
 
-    def create_fwug_data_msg(self, packet_number, payload):
-        if len(payload) != FIRMWARE_UPDATE_PACKET_SIZE:
-            raise ValueError(f"Payload must be {FIRMWARE_UPDATE_PACKET_SIZE} bytes")
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
 
-        msg_len = 2 + 2 + FIRMWARE_UPDATE_PACKET_SIZE + 2  # Header + packet number + payload + footer
-        msg_header = struct.pack('BB', COM_PROTO_MSG_TYPE_FWUG_DATA, msg_len)
-        packet_num = struct.pack('<H', packet_number)  # Big-endian packet number
-        msg_footer = struct.pack('H', 0)  # Placeholder for CRC16
+    def open(self):
+        """
+        Opens the serial session, used for every message until close().
+        """
+        self.session = SerialSession(self.com_port, self.baud_rate, self.verbose, self.log, self.address)
 
-        message = msg_header + packet_num + payload + msg_footer
-        crc16 = compute_crc16(message[:-2])
-        message = msg_header + packet_num + payload + struct.pack('>H', crc16)
+    def close(self):
+        if self.session is not None:
+            self.session.close()
+            self.session = None
 
-        self.buffer[:len(message)] = message
-        return self.buffer[:len(message)]
+    def set_baud_rate(self, baud_rate):
+        self.baud_rate = baud_rate
+        self.session.baudrate = baud_rate
 
-    def create_fwug_cancel_msg(self):
-        msg_len = 2 + 2  # 2 bytes header + 2 bytes footer
-        msg_header = struct.pack('BB', COM_PROTO_MSG_TYPE_FWUG_CANCEL, msg_len)
-        msg_footer = struct.pack('H', 0)
-        message = msg_header + msg_footer
-        crc16 = compute_crc16(message[:-2])
-        message = msg_header + struct.pack('>H', crc16)
+    def finish_msg(self, msg_len):
+        """
+        Adds the CRC16 to the message in the buffer, and returns the message.
+        """
+        crc_pos = msg_len - COM_PROTO_FOOTER_SIZE
+        struct.pack_into('>H', self.buffer, crc_pos, compute_crc16(self.buffer_view[:crc_pos]))
+        return self.buffer_view[:msg_len]
+
+    def create_fwug_start_msg(self, resume_point=None):
+        if resume_point is not None:
+            # Header + requested packet size + FEC group size + resume point (packet count, prefix CRC32) + footer
+            msg_len = COM_PROTO_HEADER_SIZE + 9 + COM_PROTO_FOOTER_SIZE
+            struct.pack_into('<BHHBHI', self.buffer, 0, COM_PROTO_MSG_TYPE_FWUG_START, msg_len,
+                             self.requested_packet_size, self.fec_group_size, *resume_point)
+            return self.finish_msg(msg_len)
+        if self.fec_group_size:
+            # Header + requested packet size + FEC group size + footer
+            msg_len = COM_PROTO_HEADER_SIZE + 3 + COM_PROTO_FOOTER_SIZE
+            struct.pack_into('<BHHB', self.buffer, 0, COM_PROTO_MSG_TYPE_FWUG_START, msg_len,
+                             self.requested_packet_size, self.fec_group_size)
+            return self.finish_msg(msg_len)
+        msg_len = COM_PROTO_HEADER_SIZE + 2 + COM_PROTO_FOOTER_SIZE  # Header + requested packet size + footer
+        struct.pack_into('<BHH', self.buffer, 0, COM_PROTO_MSG_TYPE_FWUG_START, msg_len, self.requested_packet_size)
+        return self.finish_msg(msg_len)
+
+    def create_req_data_msg(self, data_type, params=b''):
+        msg_len = COM_PROTO_HEADER_SIZE + 1 + len(params) + COM_PROTO_FOOTER_SIZE  # Header + data type + params + footer
+        struct.pack_into('<BHB', self.buffer, 0, COM_PROTO_MSG_TYPE_REQ_DATA, msg_len, data_type)
+        self.buffer[COM_PROTO_HEADER_SIZE + 1:COM_PROTO_HEADER_SIZE + 1 + len(params)] = params
+        return self.finish_msg(msg_len)
+
+    def create_cmd_msg(self, cmd, params=b''):
+        msg_len = COM_PROTO_HEADER_SIZE + 1 + len(params) + COM_PROTO_FOOTER_SIZE  # Header + cmd + params + footer
+        struct.pack_into('<BHB', self.buffer, 0, COM_PROTO_MSG_TYPE_CMD, msg_len, cmd)
+        self.buffer[COM_PROTO_HEADER_SIZE + 1:COM_PROTO_HEADER_SIZE + 1 + len(params)] = params
+        return self.finish_msg(msg_len)
+
+    def parse_op_result_response(self, response):
+        """
+        Parses an OP_RESULT message and returns the operation result, or None if the response is not valid.
+        """
+        if not response or len(response) < COM_PROTO_HEADER_SIZE + 1 + COM_PROTO_FOOTER_SIZE:
+            self.log("No response received")
+            return None
+        msg_type, msg_len = struct.unpack('<BH', response[:COM_PROTO_HEADER_SIZE])
+        if msg_type != COM_PROTO_MSG_TYPE_OP_RESULT or msg_len > len(response):
+            self.log("Invalid OP_RESULT response")
+            return None
+        crc16 = struct.unpack('>H', response[msg_len - COM_PROTO_FOOTER_SIZE:msg_len])[0]
+        if crc16 != compute_crc16(response[:msg_len - COM_PROTO_FOOTER_SIZE]):
+            self.log("OP_RESULT response CRC mismatch")
+            return None
+        self.log(f"OP_RESULT: op_result={response[COM_PROTO_HEADER_SIZE]}")
+        return response[COM_PROTO_HEADER_SIZE]
+
+    def switch_baud_rate(self, capabilities):
+        """
+        Switches the bootloader and the host to target_baud_rate. The bootloader replies at the current baud rate and
+        then switches. A frame at the new baud rate confirms the switch. Without a confirmation, the bootloader falls
+        back to the default baud rate, and so does the host.
+        """
+        if self.target_baud_rate is None or self.target_baud_rate == self.baud_rate:
+            return
+        if capabilities is None or not (capabilities['features'] & COM_PROTO_FEATURE_BAUDRATE_SWITCH):
+            self.log("Bootloader does not support baud rate switching, staying at", self.baud_rate)
+            return
+        if self.target_baud_rate > capabilities['max_baudrate']:
+            self.log(f"Baud rate {self.target_baud_rate} above the bootloader max ({capabilities['max_baudrate']}), "
+                     f"staying at {self.baud_rate}")
+            return
+
+        cmd_msg = self.create_cmd_msg(COM_PROTO_CMD_SET_BAUDRATE, struct.pack('<I', self.target_baud_rate))
+        response = self.session.transact(cmd_msg)
+        if self.parse_op_result_response(response) != COM_PROTO_OP_RESULT_NO_ERR:
+            self.log(f"Baud rate {self.target_baud_rate} rejected, staying at {self.baud_rate}")
+            return
+
+        # Confirm the switch with a frame at the new baud rate
+        discovery_baud_rate = self.baud_rate
+        self.set_baud_rate(self.target_baud_rate)
+        if self.query_capabilities() is not None:
+            self.log(f"Switched to baud rate {self.baud_rate}")
+            return
+
+        self.log(f"Baud rate switch not confirmed, falling back to {discovery_baud_rate}")
+        time.sleep(COM_PROTO_BAUDRATE_FALLBACK_WAIT)
+        self.set_baud_rate(discovery_baud_rate)
 
-        self.buffer[:len(message)] = message
-        return self.buffer[:len(message)]
+    def parse_data_response(self, response, data_type):
+        """
+        Parses a DATA message and returns its payload, if it is of the expected data type.
+        """
+        if not response or len(response) < COM_PROTO_HEADER_SIZE + 1 + COM_PROTO_FOOTER_SIZE:
+            self.log("No response received")
+            return None
+        if response[0] == COM_PROTO_MSG_TYPE_OP_RESULT:
+            self.log(f"OP_RESULT: op_result={response[COM_PROTO_HEADER_SIZE]}")
+            return None
+        msg_type, msg_len = struct.unpack('<BH', response[:COM_PROTO_HEADER_SIZE])
+        if msg_type != COM_PROTO_MSG_TYPE_DATA or msg_len > len(response):
+            self.log("Invalid DATA response")
+            return None
+        crc16 = struct.unpack('>H', response[msg_len - COM_PROTO_FOOTER_SIZE:msg_len])[0]
+        if crc16 != compute_crc16(response[:msg_len - COM_PROTO_FOOTER_SIZE]):
+            self.log("DATA response CRC mismatch")
+            return None
+        if response[COM_PROTO_HEADER_SIZE] != data_type:
+            self.log("Unexpected DATA type")
+            return None
+        return response[COM_PROTO_HEADER_SIZE + 1:msg_len - COM_PROTO_FOOTER_SIZE]
 
-    def parse_fwug_response(self, response, packet_number_sent):
+    def query_capabilities(self):
+        """
+        Requests the bootloader capabilities (HELLO). Returns None if the bootloader does not support the request.
+        """
+        req_msg = self.create_req_data_msg(COM_PROTO_DATA_TYPE_CAPABILITIES)
+        response = self.session.transact(req_msg)
+        payload = self.parse_data_response(response, COM_PROTO_DATA_TYPE_CAPABILITIES)
+        if payload is None:
+            return None
+        return parse_capabilities(payload)
+
+    def query_stats(self, clear=False):
+        """
+        Requests the bootloader statistics (debug info). Optionally clears them after reading.
+        """
+        flags = COM_PROTO_DEBUG_INF_FLAG_CLEAR if clear else 0
+        req_msg = self.create_req_data_msg(COM_PROTO_DATA_TYPE_DEBUG_INF, struct.pack('<B', flags))
+        response = self.session.transact(req_msg)
+        payload = self.parse_data_response(response, COM_PROTO_DATA_TYPE_DEBUG_INF)
+        if payload is None:
+            return None
+        return parse_stats(payload)
+
+    def query_trace(self):
+        """
+        Drains the bootloader trace buffer (BL_TRACE builds). Returns the number of dropped records and the raw records,
+        or None if the bootloader does not support the request.
+        """
+        records = b''
+        while True:
+            req_msg = self.create_req_data_msg(COM_PROTO_DATA_TYPE_TRACE)
+            response = self.session.transact(req_msg)
+            payload = self.parse_data_response(response, COM_PROTO_DATA_TYPE_TRACE)
+            if payload is None or len(payload) < 4:
+                return None
+            dropped = struct.unpack('<I', payload[:4])[0]
+            if len(payload) == 4:
+                return dropped, records
+            records += payload[4:]
+
+    def query_profile(self):
+        """
+        Reads the profiled regions summary (BL_PROFILING builds), as many regions per request as fit. Returns the list
+        of (calls, total, min, max) cycles per region, or None if the bootloader does not support the request.
+        """
+        regions = []
+        while True:
+            req_msg = self.create_req_data_msg(COM_PROTO_DATA_TYPE_PROFILE, struct.pack('<B', len(regions)))
+            response = self.session.transact(req_msg)
+            payload = self.parse_data_response(response, COM_PROTO_DATA_TYPE_PROFILE)
+            profile = parse_profile(payload) if payload is not None else None
+            if profile is None or profile[1] != len(regions):
+                return None
+            region_count, _, new_regions = profile
+            regions += new_regions
+            if len(regions) >= region_count or not new_regions:
+                return regions[:region_count]
+
+    def query_image_check(self, slot_name):
+        """
+        Requests a check of the image in a slot, chunk by chunk. Returns None if the bootloader does not support the
+        request.
+        """
+        slot = struct.pack('<B', COM_PROTO_SLOTS[slot_name])
+        req_msg = self.create_req_data_msg(COM_PROTO_DATA_TYPE_IMAGE_CHECK, slot)
+        response = self.session.transact(req_msg)
+        payload = self.parse_data_response(response, COM_PROTO_DATA_TYPE_IMAGE_CHECK)
+        if payload is None:
+            return None
+        return parse_image_check(payload)
+
+    def query_missing_packets(self, packet_count):
+        """
+        Requests the packets of the firmware update that the bootloader has not received yet, out of packet_count.
+        Returns None if the bootloader does not support the request.
+        """
+        req_msg = self.create_req_data_msg(COM_PROTO_DATA_TYPE_MISSING_PACKETS, struct.pack('<H', packet_count))
+        response = self.session.transact(req_msg)
+        payload = self.parse_data_response(response, COM_PROTO_DATA_TYPE_MISSING_PACKETS)
+        if payload is None:
+            return None
+        return parse_missing_packets(payload)
+
+    def query_download_progress(self):
+        """
+        Requests the packets of an interrupted download that are in the download space, counted in the packet size
+        that the bootloader accepts for requested_packet_size. Returns None if the bootloader does not support the
+        request.
+        """
+        req_msg = self.create_req_data_msg(COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS,
+                                           struct.pack('<H', self.requested_packet_size))
+        response = self.session.transact(req_msg)
+        payload = self.parse_data_response(response, COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS)
+        if payload is None:
+            return None
+        return parse_download_progress(payload)
+
+    def query_chunk_checksums(self, slot_name, chunk_size, chunk_count):
+        """
+        Requests the CRC32 of the first chunk_count chunks of a slot, COM_PROTO_MAX_CHUNK_CHECKSUMS per request.
+        Returns None if the bootloader does not support the request, or the chunks exceed the slot.
+        """
+        crc32s = []
+        while len(crc32s) < chunk_count:
+            count = min(chunk_count - len(crc32s), COM_PROTO_MAX_CHUNK_CHECKSUMS)
+            params = struct.pack(CHUNK_CHECKSUMS_FORMAT, COM_PROTO_SLOTS[slot_name], len(crc32s) * chunk_size,
+                                 chunk_size, count)
+            response = self.session.transact(self.create_req_data_msg(COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS, params))
+            payload = self.parse_data_response(response, COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS)
+            report = parse_chunk_checksums(payload) if payload is not None else None
+            if report is None or len(report['crc32s']) != count:
+                return None
+            crc32s += report['crc32s']
+        return crc32s
+
+    def query_slot_info(self):
+        """
+        Requests the footers of the slots, their CRC32 check and the checks of the last boot. Returns None if the
+        bootloader does not support the request.
+        """
+        response = self.session.transact(self.create_req_data_msg(COM_PROTO_DATA_TYPE_SLOT_INFO))
+        payload = self.parse_data_response(response, COM_PROTO_DATA_TYPE_SLOT_INFO)
+        if payload is None:
+            return None
+        return parse_slot_info(payload)
+
+    def reboot_bootloader(self):
+        """
+        Reboots the bootloader (CMD: reboot). The next boot installs a newer secondary image, or boots the application.
+        """
+        if self.capabilities is None or not self.capabilities['features'] & COM_PROTO_FEATURE_SLOT_INFO:
+            self.log("Bootloader cannot be rebooted remotely, reset it to install the image")
+            return False
+        if self.parse_op_result_response(self.session.transact(self.create_cmd_msg(COM_PROTO_CMD_REBOOT))) != \
+                COM_PROTO_OP_RESULT_NO_ERR:
+            self.log("Reboot rejected")
+            return False
+        self.log("Bootloader rebooted")
+        return True
+
+    def find_image_footer(self, slot_info, slot_images):
+        """
+        Returns the slot whose footer (CRC32, version and signature) is the footer of its image (slot_images: the image
+        of each slot to compare), and whose image passed its checks: the CRC32 check, the authentication at the last
+        boot, and for the secondary slot, the next boot must install it (newer version). None if no slot does.
+        """
+        for slot_name, image in slot_images.items():
+            slot = slot_info['slots'][slot_name]
+            footer = bytes(image.data[-IMAGE_FOOTER_SIZE:])
+            if len(image.data) != self.capabilities[f'app_{slot_name}_size'] or slot['footer'] != footer:
+                continue
+            if not slot['is_crc_ok']:
+                self.log(f"The {slot_name} slot holds a damaged copy of this image")
+            elif slot_name == 'primary' and slot_info['boot_path_flags'] & BOOT_INFO_PATH_PRIMARY_AUTH_FAIL:
+                self.log("The primary slot holds this image, but it failed its authentication at the last boot")
+            elif slot_name == 'secondary' and slot_info['boot_path_flags'] & BOOT_INFO_PATH_UPDATE_REJECTED:
+                self.log("The secondary slot holds this image, but it was rejected at the last boot")
+            elif slot_name == 'secondary' and not slot_info['is_secondary_newer']:
+                self.log("The secondary slot holds this image, but it is not newer than the primary image")
+            else:
+                return slot_name
+        return None
+
+    def find_image_slot(self):
+        """
+        Returns the slot that already holds the image, or None. The footers of the slots (REQ_DATA: slot info) identify
+        the image in one request. Without it, the chunks of the slots are compared (REQ_DATA: chunk checksums).
+        """
+        if not self.delta or self.capabilities is None:
+            return None
+        if self.capabilities['features'] & COM_PROTO_FEATURE_DIRECT_XIP:
+            # Each slot boots in place: it can only hold the image linked for it
+            slot_images = {'primary': self.image}
+            if self.secondary_image is not None:
+                slot_images['secondary'] = self.secondary_image
+        elif self.capabilities['features'] & COM_PROTO_FEATURE_DIRECT_INSTALL:
+            # With a direct install, the secondary slot is never installed
+            slot_images = {'primary': self.image}
+        else:
+            slot_images = {'primary': self.image, 'secondary': self.image}
+        if self.capabilities['features'] & COM_PROTO_FEATURE_SLOT_INFO:
+            slot_info = self.query_slot_info()
+            if slot_info is not None:
+                return self.find_image_footer(slot_info, slot_images)
+        if self.capabilities['features'] & COM_PROTO_FEATURE_CHUNK_CHECKSUMS:
+            for slot_name, image in slot_images.items():
+                image_crc32s = image.get_chunk_crc32s(DELTA_CHUNK_SIZE)
+                if self.query_chunk_checksums(slot_name, DELTA_CHUNK_SIZE, len(image_crc32s)) == image_crc32s:
+                    return slot_name
+        return None
+
+    def select_image(self):
+        """
+        Selects the image to send. A bootloader that boots both slots in place (BL_DIRECT_XIP) downloads to the slot
+        that does not hold the booted image, as reported in its slot info: it gets the image linked for that slot, and
+        copies the unchanged chunks from the other slot. Returns False if the image for that slot is missing.
+        """
+        if self.capabilities is None or not self.capabilities['features'] & COM_PROTO_FEATURE_DIRECT_XIP:
+            return True
+        slot_info = self.query_slot_info()
+        if slot_info is None or slot_info['download_slot'] is None:
+            self.log("Could not read the download slot of the bootloader")
+            return False
+        if slot_info['download_slot'] == 'primary':
+            self.source_slot = 'secondary'
+            return True
+        if self.secondary_image is None:
+            self.log("The bootloader downloads to the secondary slot: an image linked for it is needed "
+                     "(--secondary-file)")
+            return False
+        self.log("The bootloader downloads to the secondary slot, sending the image linked for it")
+        self.source_slot = 'primary'
+        self.image = self.secondary_image
+        return True
+
+    def get_resume_point(self):
+        """
+        Returns the resume point of the download (packet count, prefix CRC32) if the download space holds the first
+        packets of this image, None otherwise.
+        """
+        if not self.resume:
+            return None
+        progress = self.query_download_progress()
+        if progress is None or not progress['packet_count']:
+            return None
+        packet_count = progress['packet_count']
+        if packet_count > self.image.get_packet_count(progress['packet_size']) or \
+                progress['prefix_crc32'] != self.image.get_prefix_crc32(progress['packet_size'], packet_count):
+            self.log(f"The download space holds {packet_count} packets of another image, starting over")
+            return None
+        return packet_count, progress['prefix_crc32']
+
+    def select_mode(self, capabilities):
+        """
+        Selects the fastest options that both the host tool and the bootloader support.
+        """
+        self.capabilities = capabilities
+        if capabilities is None:
+            self.log("Bootloader capabilities unknown, using the requested options")
+            return
+        self.requested_packet_size = min(self.requested_packet_size, capabilities['max_packet_size'])
+        self.log(f"Selected packet size: {self.requested_packet_size} bytes")
+        self.select_fec(capabilities)
+        self.select_sparse(capabilities)
+        self.select_delta(capabilities)
+        if self.resume and not capabilities['features'] & COM_PROTO_FEATURE_RESUME:
+            self.log("Bootloader cannot resume a download, starting over")
+            self.resume = False
+        self.switch_baud_rate(capabilities)
+
+    def select_fec(self, capabilities):
+        """
+        Keeps forward error correction only if the bootloader supports it, and can receive every packet of the image
+        with gaps.
+        """
+        if not self.fec_group_size:
+            return
+        if not capabilities['features'] & COM_PROTO_FEATURE_FEC:
+            self.log("Bootloader does not support FEC, every packet waits for its response")
+            self.fec_group_size = 0
+            return
+        if self.image is None:
+            self.image = FirmwareImage(self.file_path)
+        packet_size = get_accepted_packet_size(self.requested_packet_size)
+        if self.image.get_packet_count(packet_size) > FIRMWARE_UPDATE_MAX_PACKET_COUNT:
+            self.log(f"FEC needs at most {FIRMWARE_UPDATE_MAX_PACKET_COUNT} packets (larger packets), disabled")
+            self.fec_group_size = 0
+            return
+        self.log(f"FEC: one parity packet every {self.fec_group_size} packets")
+
+    def select_sparse(self, capabilities):
+        """
+        Keeps the sparse transfer only if the bootloader supports it. A FEC session sends every packet.
+        """
+        if not self.sparse:
+            return
+        if not capabilities['features'] & COM_PROTO_FEATURE_SPARSE:
+            self.log("Bootloader does not support sparse transfers, every packet is sent")
+            self.sparse = False
+        elif self.fec_group_size:
+            self.log("FEC sends every packet, sparse transfer disabled")
+            self.sparse = False
+
+    def select_delta(self, capabilities):
+        """
+        Keeps the comparison with the slots only if the bootloader reports its slot footers or chunk checksums. The
+        chunks of the source slot are copied only if the bootloader supports it, along with the sparse transfer.
+        """
+        if not self.delta:
+            return
+        if not capabilities['features'] & (COM_PROTO_FEATURE_SLOT_INFO | COM_PROTO_FEATURE_CHUNK_CHECKSUMS):
+            self.log("Bootloader does not report its slots, the image is sent without comparing it")
+            self.delta = False
+            return
+        self.chunk_copy = self.sparse and bool(capabilities['features'] & COM_PROTO_FEATURE_CHUNK_CHECKSUMS) and \
+            bool(capabilities['delta_formats'] & COM_PROTO_DELTA_CHUNK_COPY)
+
+    def get_delta_ranges(self, source_crc32s):
+        """
+        Returns the ranges of a delta transfer (offset, length, frame), in ascending order. The erased chunks of the
+        image are skipped, the chunks that the source slot holds are copied (frame None, consecutive chunks merged)
+        and the populated ranges of the other chunks are sent (FWUG_DATA_AT, up to packet_size bytes each).
+        """
+        image_crc32s = self.image.get_chunk_crc32s(DELTA_CHUNK_SIZE)
+        image_end = (len(self.image.data) + 3) // 4 * 4
+        erased_chunk = b'\xFF' * DELTA_CHUNK_SIZE
+        ranges = []
+        for chunk, crc32 in enumerate(image_crc32s):
+            chunk_offset = chunk * DELTA_CHUNK_SIZE
+            chunk_data = self.image.get_chunk(DELTA_CHUNK_SIZE, chunk)
+            if chunk_data == erased_chunk:
+                continue
+            if crc32 == source_crc32s[chunk]:
+                length = min(DELTA_CHUNK_SIZE, image_end - chunk_offset)
+                if ranges and ranges[-1][2] is None and ranges[-1][0] + ranges[-1][1] == chunk_offset and \
+                        ranges[-1][1] < DELTA_MAX_COPY_CHUNKS * DELTA_CHUNK_SIZE:
+                    ranges[-1] = (ranges[-1][0], ranges[-1][1] + length, None)
+                else:
+                    ranges.append((chunk_offset, length, None))
+                continue
+            for range_offset, range_length in find_populated_ranges(chunk_data, SPARSE_MERGE_GAP):
+                for offset in range(range_offset, range_offset + range_length, self.packet_size):
+                    length = min(self.packet_size, range_offset + range_length - offset)
+                    payload = chunk_data[offset:offset + length]
+                    ranges.append((chunk_offset + offset, length,
+                                   create_fwug_data_at_frame(chunk_offset + offset, payload)))
+        return ranges
+
+    def create_fwug_cancel_msg(self):
+        msg_len = COM_PROTO_HEADER_SIZE + COM_PROTO_FOOTER_SIZE  # 3 bytes header + 2 bytes footer
+        struct.pack_into('<BH', self.buffer, 0, COM_PROTO_MSG_TYPE_FWUG_CANCEL, msg_len)
+        return self.finish_msg(msg_len)
+
+    def parse_fwug_response(self, response, packet_number_sent, in_order=True):
+        """
+        Parses the response to a firmware update message. In order (the default), the packet must be the last one that
+        the bootloader received. Otherwise (FEC session), the packets can be received with gaps: only the operation
+        result counts.
+        """
         # Handle any exceptions
         if not response:
-            print("No response received")
+            self.log("No response received")
             return False
         # Check the message type
         if response[0] == COM_PROTO_MSG_TYPE_FWUG_STATUS:
-            if len(response) != 8:
-                print("Invalid response length")
+            if len(response) != 11:
+                self.log("Invalid response length")
                 return False
-            # Parse the response
-            op_result, is_active, packets_received = struct.unpack('>BBH', response[2:6]) # we care about bytes: 2, 3, 4, 5
-            # Reverse endianess of packets_received
-            packets_received = (packets_received >> 8) | ((packets_received & 0xFF) << 8)
-            print(f"FWUG_STATUS: op_result={op_result}, is_active={is_active}, packets_received={packets_received}")
-            if op_result == COM_PROTO_OP_RESULT_NO_ERR and packets_received == packet_number_sent + 1:
-                print("Firmware update message successful")
-            else:
-                print("Firmware update message failed")
-            # Return True if the operation result is no error and the packets received is equal to the packet number sent + 1
-            return (op_result == COM_PROTO_OP_RESULT_NO_ERR and packets_received == packet_number_sent + 1)
+            # A bit error could turn a failure into a success
+            if struct.unpack('>H', response[9:11])[0] != compute_crc16(response[:9]):
+                self.log("FWUG_STATUS response CRC mismatch")
+                return False
+            # Parse the response: header (3 bytes), op_result, is_active, packets_received, packet_size, crc16
+            op_result, is_active, packets_received, packet_size = struct.unpack('<BBHH', response[3:9])
+            is_ok = op_result == COM_PROTO_OP_RESULT_NO_ERR and packets_received == packet_number_sent + 1
+            if packet_number_sent >= 0 and is_active and packets_received == packet_number_sent + 1:
+                # A retry of a packet that was programmed, but whose response was lost: the bootloader rejects it as
+                # out of sequence, and reports that it already has it
+                is_ok = True
+            if not in_order:
+                is_ok = op_result == COM_PROTO_OP_RESULT_NO_ERR and is_active
+            if self.verbose or not is_ok:
+                self.log(f"FWUG_STATUS: op_result={op_result}, is_active={is_active}, "
+                         f"packets_received={packets_received}, packet_size={packet_size}")
+            if is_active:
+                # The bootloader reports the packet size that it accepted for this session
+                self.packet_size = packet_size
+                self.packets_received = packets_received
+            if not is_ok:
+                self.log("Firmware update message failed")
+            # True if the operation result is no error and the packets received is equal to the packet number sent + 1
+            return is_ok
         elif response[0] == COM_PROTO_MSG_TYPE_OP_RESULT:
             # Parse the response
-            op_result = response[2]
-            print(f"OP_RESULT: op_result={op_result}")
-            print("Firmware update message failed")
+            op_result = response[COM_PROTO_HEADER_SIZE]
+            self.log(f"OP_RESULT: op_result={op_result}")
+            self.log("Firmware update message failed")
             # Return False if the operation result message was returned instead of the firmware update status message
             return False
         
     # Function to perform firmware update
-    def perform_firmware_update(self):
+    def perform_firmware_update(self, report_stats=True):
+        # Discover what the bootloader supports and select the fastest mode
+        self.select_mode(self.query_capabilities())
+        # Clear the statistics, so that they only cover this session
+        if report_stats:
+            self.query_stats(clear=True)
+
+        result = self.transfer_firmware()
+
+        if report_stats:
+            stats = self.query_stats()
+            if stats is not None:
+                print_stats(stats)
+        if result and (self.reboot or self.is_reboot_pending):
+            self.reboot_bootloader()
+        return result
+
+    def print_progress(self, packets_sent, packet_count):
+        if not self.verbose:
+            print(f"\rSent packet {packets_sent}/{packet_count}", end='', flush=True)
+
+    def send_packet(self, data_msg, packet_number, in_order=True):
+        """
+        Sends a FWUG_DATA frame and waits for its response, up to FWUG_DATA_ATTEMPTS times.
+        """
+        for attempt in range(FWUG_DATA_ATTEMPTS):
+            if self.verbose:
+                self.log(f"Sending packet {packet_number}...")
+            if self.parse_fwug_response(self.session.transact(data_msg), packet_number, in_order):
+                return True
+            if attempt < FWUG_DATA_ATTEMPTS - 1:
+                self.log(f"Retrying packet {packet_number}...")
+        return False
+
+    def transfer_fec_groups(self, frames, start_packet=0):
+        """
+        FEC session: the packets of a group are sent without waiting for their responses (fec_gap apart, for the
+        bootloader to program each one), followed by the FWUG_PARITY packet of the group. The bootloader rebuilds a
+        single lost packet of the group from the parity, so only the response to the parity is awaited. If the group
+        still misses packets (or the parity was lost), the missing packets are resent one by one. The packets before
+        start_packet (resumed download) are not sent again.
+        """
+        parity_frames = self.image.get_parity_frames(self.packet_size, self.fec_group_size)
+        for group in range(start_packet // self.fec_group_size, len(parity_frames)):
+            parity_msg = parity_frames[group]
+            first_packet = group * self.fec_group_size
+            last_packet = min(first_packet + self.fec_group_size, len(frames)) - 1
+            for data_msg in frames[max(first_packet, start_packet):last_packet + 1]:
+                self.session.send(data_msg, self.fec_gap)
+            if not self.parse_fwug_response(self.session.transact(parity_msg), last_packet, in_order=False):
+                # Without a report, the whole group is resent (the packets already received are acknowledged)
+                report = self.query_missing_packets(last_packet + 1)
+                missing = report['missing'] if report is not None else range(first_packet, last_packet + 1)
+                for packet_number in (number for number in missing if number >= first_packet):
+                    if self.verbose:
+                        self.log(f"Resending packet {packet_number}...")
+                    if not self.send_packet(frames[packet_number], packet_number, in_order=False):
+                        return False
+            self.progress(last_packet + 1, len(frames))
+        return True
+
+    def transfer_ranges(self, ranges, start_packet):
+        """
+        Sparse transfer: only the given ranges of the image (offset, length, frame) are sent (FWUG_DATA_AT), or copied
+        from the source slot (FWUG_COPY, frame None), each one waiting for its response. The bootloader leaves the
+        gaps erased. The ranges before start_packet (resumed download) are not sent again. Returns the bytes sent, or
+        None if a range could not be sent.
+        """
+        start_offset = start_packet * self.packet_size
+        packet_count = self.image.get_packet_count(self.packet_size)
+        bytes_sent = 0
+        bytes_copied = 0
+        for offset, length, data_msg in ranges:
+            if offset + length <= start_offset:
+                continue
+            if offset < start_offset:
+                # The start of the range is already in the download space
+                length = offset + length - start_offset
+                offset = start_offset
+                if data_msg is not None:
+                    payload = self.image.data[offset:offset + length].ljust(length, b'\xFF')
+                    data_msg = create_fwug_data_at_frame(offset, payload)
+            if data_msg is None:
+                if self.verbose:
+                    self.log(f"Copying {length} bytes at offset {offset} from the {self.source_slot} slot...")
+                data_msg = create_fwug_copy_frame(offset, length)
+                bytes_copied += length
+            else:
+                bytes_sent += length
+            if not self.send_packet(data_msg, offset // self.packet_size, in_order=False):
+                return None
+            self.progress(min(-(-(offset + length) // self.packet_size), packet_count), packet_count)
+        self.progress(packet_count, packet_count)
+        self.bytes_copied = bytes_copied
+        return bytes_sent
+
+    def transfer_firmware(self):
         packet_number = -1
-        # Start firmware update
-        start_msg = self.create_fwug_start_msg()
-        print("FWUG_START Message:", start_msg)
-        response = send_message_via_serial(start_msg, self.com_port, self.baud_rate, 5, 10)
-        if not self.parse_fwug_response(response, packet_number):
+        if self.image is None:
+            self.image = FirmwareImage(self.file_path)
+        if self.secondary_image is None and self.secondary_file_path is not None:
+            self.secondary_image = FirmwareImage(self.secondary_file_path)
+        # Nothing to send if a slot already holds the image. A staged image only needs the reboot that installs it.
+        image_slot = self.find_image_slot()
+        if image_slot is not None:
+            self.log(f"The {image_slot} slot already holds this image, nothing to send")
+            self.bytes_per_s = None
+            self.is_reboot_pending = image_slot == 'secondary' and \
+                bool(self.capabilities['features'] & COM_PROTO_FEATURE_SLOT_INFO)
+            return True
+        if not self.select_image():
+            return False
+        # Start firmware update, after the packets already downloaded by an interrupted update of this image (if any)
+        resume_point = self.get_resume_point()
+        start_msg = self.create_fwug_start_msg(resume_point)
+        if self.verbose:
+            self.log("FWUG_START Message:", start_msg.hex())
+        response = self.session.transact(start_msg, COM_PROTO_FWUG_START_TIMEOUT)
+        # A resumed session starts at the packets received that the bootloader reports
+        if not self.parse_fwug_response(response, packet_number, in_order=resume_point is None):
             # If firmware update start failed, send a cancel message and return
-            cancel_msg = self.create_fwug_cancel_msg()
-            send_message_via_serial(cancel_msg, self.com_port, self.baud_rate)
-            print("Firmware update failed. Attempting to cancel... (and exiting)")
-            return
+            self.session.transact(self.create_fwug_cancel_msg())
+            self.log("Firmware update failed. Attempting to cancel... (and exiting)")
+            return False
+        packet_number = self.packets_received if resume_point is not None else 0
+        self.log(f"Firmware update started, using a packet size of {self.packet_size} bytes")
+        self.bytes_copied = 0
+
+        # Send the image in packets of the negotiated packet size (or its populated ranges only)
+        packet_count = self.image.get_packet_count(self.packet_size)
+        if packet_number:
+            self.log(f"Resuming the download at packet {packet_number}/{packet_count}")
+        first_packet = packet_number
+        start_time = time.monotonic()
+        if self.sparse:
+            source_crc32s = None
+            if self.chunk_copy:
+                source_crc32s = self.query_chunk_checksums(self.source_slot, DELTA_CHUNK_SIZE,
+                                                           self.image.get_chunk_count(DELTA_CHUNK_SIZE))
+            if source_crc32s is not None:
+                ranges = self.get_delta_ranges(source_crc32s)
+            else:
+                ranges = self.image.get_range_frames(self.packet_size)
+            bytes_sent = self.transfer_ranges(ranges, packet_number)
+            if bytes_sent is None:
+                self.log("Firmware update failed. Exiting...")
+                return False
         else:
-            packet_number += 1
-            print("Firmware update started")
-        
-        # Open the binary file and send the data in chunks of FIRMWARE_UPDATE_PACKET_SIZE bytes
-        with open(self.file_path, 'rb') as f:
-            while True:
-                data_chunk = f.read(FIRMWARE_UPDATE_PACKET_SIZE)
-                if not data_chunk:
-                    break
-                if len(data_chunk) < FIRMWARE_UPDATE_PACKET_SIZE:
-                    data_chunk += b'\xFF' * (FIRMWARE_UPDATE_PACKET_SIZE - len(data_chunk))
-                data_msg = self.create_fwug_data_msg(packet_number, data_chunk)
-                for i in range(3):
-                    print(f"Sending packet {packet_number}...")
-                    response = send_message_via_serial(data_msg, self.com_port, self.baud_rate)
-                    if self.parse_fwug_response(response, packet_number):
-                        packet_number += 1
+            frames = self.image.get_frames(self.packet_size)
+            if self.fec_group_size:
+                if not self.transfer_fec_groups(frames, packet_number):
+                    self.log("Firmware update failed. Exiting...")
+                    return False
+                packet_number = len(frames)
+            for data_msg in frames[packet_number:]:
+                if not self.send_packet(data_msg, packet_number):
+                    self.log("Firmware update failed. Exiting...")
+                    return False
+                packet_number += 1
+                self.progress(packet_number, len(frames))
+            bytes_sent = (packet_number - first_packet) * self.packet_size
+
+        elapsed = time.monotonic() - start_time
+        self.bytes_per_s = bytes_sent / elapsed if elapsed > 0 else 0
+        line_rate = self.baud_rate / UART_BITS_PER_BYTE
+        if not self.verbose and self.progress == self.print_progress:
+            print()
+        self.log(f"Transferred {bytes_sent} bytes in {elapsed:.2f} s: {self.bytes_per_s:.0f} bytes/s "
+                 f"({100 * self.bytes_per_s / line_rate:.0f}% of the {self.baud_rate} baud line rate)")
+        if self.bytes_copied:
+            self.log(f"Copied {self.bytes_copied} unchanged bytes from the {self.source_slot} slot")
+        return True
+
+def expand_ports(patterns):
+    """
+    Expands serial port glob patterns (e.g. /dev/ttyUSB*). A pattern that matches nothing is kept as is (e.g. COM9).
+    """
+    ports = []
+    for pattern in patterns:
+        matches = sorted(glob.glob(pattern)) if glob.has_magic(pattern) else [pattern]
+        ports.extend(port for port in matches if port not in ports)
+    return ports
+
+def read_manifest(manifest_path, default_file):
+    """
+    Reads a fleet manifest: one device per line, "<port or glob> [<firmware.bin>]". Devices without a firmware file get
+    default_file. Everything after a # is a comment.
+
+    Returns:
+        list: (port, firmware file) tuples.
+    """
+    devices = []
+    with open(manifest_path) as manifest:
+        for line_number, line in enumerate(manifest, 1):
+            fields = line.split('#', 1)[0].split()
+            if not fields:
+                continue
+            file_path = fields[1] if len(fields) > 1 else default_file
+            if len(fields) > 2 or file_path is None:
+                raise ValueError(f"{manifest_path}:{line_number}: expected <port> [<firmware.bin>]")
+            devices.extend((port, file_path) for port in expand_ports([fields[0]]))
+    return devices
+
+class FleetUpdate:
+    """
+    Updates many devices at once, one session per serial port. The sessions run in a thread pool: they spend their time
+    waiting for the serial ports, and the frames of each image are built once (FirmwareImage) and shared by all of them.
+    A device whose update fails is retried from FWUG_START, up to attempts times.
+    """
+    # Progress is reported every PROGRESS_STEP percent, per device
+    PROGRESS_STEP = 10
+
+    def __init__(self, devices, baud_rate, packet_size, target_baud_rate, attempts, verbose=False, fec_group_size=0,
+                 fec_gap=FEC_PACKET_GAP, resume=True, sparse=True, delta=True, reboot=False, secondary_file=None):
+        self.devices = devices
+        self.baud_rate = baud_rate
+        self.packet_size = packet_size
+        self.target_baud_rate = target_baud_rate
+        self.attempts = attempts
+        self.verbose = verbose
+        self.fec_group_size = fec_group_size
+        self.fec_gap = fec_gap
+        self.resume = resume
+        self.sparse = sparse
+        self.delta = delta
+        self.reboot = reboot
+        self.images = {file_path: FirmwareImage(file_path) for file_path in sorted({file for _, file in devices})}
+        # Image linked for the secondary slot, for the devices that download to it (BL_DIRECT_XIP)
+        self.secondary_image = FirmwareImage(secondary_file) if secondary_file is not None else None
+        self.port_width = max(len(port) for port, _ in devices)
+        self.print_lock = threading.Lock()
+
+    def log(self, port, *args):
+        with self.print_lock:
+            print(f"[{port:<{self.port_width}}]", *args, flush=True)
+
+    def update_device(self, port, file_path):
+        result = {'port': port, 'ok': False, 'attempts': 0, 'bytes_per_s': None}
+        log = lambda *args: self.log(port, *args)
+        last_step = [-1]
+
+        def progress(packets_sent, packet_count):
+            step = 100 * packets_sent // packet_count // self.PROGRESS_STEP
+            if step != last_step[0]:
+                last_step[0] = step
+                log(f"{step * self.PROGRESS_STEP}% ({packets_sent}/{packet_count} packets)")
+
+        start_time = time.monotonic()
+        for attempt in range(1, self.attempts + 1):
+            result['attempts'] = attempt
+            last_step[0] = -1
+            log(f"Attempt {attempt}/{self.attempts}: {os.path.basename(file_path)}")
+            try:
+                with FirmwareUpdateFactory(port, self.baud_rate, file_path, self.packet_size, self.target_baud_rate,
+                                           self.verbose, log, progress, self.images[file_path],
+                                           fec_group_size=self.fec_group_size, fec_gap=self.fec_gap,
+                                           resume=self.resume, sparse=self.sparse,
+                                           delta=self.delta, reboot=self.reboot,
+                                           secondary_image=self.secondary_image) as fwug_factory:
+                    if fwug_factory.perform_firmware_update(report_stats=False):
+                        result['ok'] = True
+                        result['bytes_per_s'] = fwug_factory.bytes_per_s
                         break
-                    
-                    if i < 3:
-                        print(f"Retrying packet {packet_number}...")
+            except (serial.SerialException, OSError) as error:
+                log(f"Serial port error: {error}")
+        result['duration'] = time.monotonic() - start_time
+        return result
+
+    def run(self):
+        """
+        Updates all the devices, then prints a summary table. Returns True if every device was updated.
+        """
+        with ThreadPoolExecutor(max_workers=len(self.devices)) as pool:
+            results = list(pool.map(lambda device: self.update_device(*device), self.devices))
+
+        print(f"\n{'Port':<{self.port_width}}  Result  Attempts  Time (s)  Throughput (bytes/s)")
+        for result in results:
+            throughput = f"{result['bytes_per_s']:.0f}" if result['bytes_per_s'] is not None else '-'
+            print(f"{result['port']:<{self.port_width}}  {'ok' if result['ok'] else 'FAILED':<6}  "
+                  f"{result['attempts']:<8}  {result['duration']:<8.1f}  {throughput}")
+        updated = sum(result['ok'] for result in results)
+        print(f"{updated}/{len(results)} devices updated")
+        return updated == len(results)
+
+class BusUpdate:
+    """
+    Updates all the nodes of a shared bus (BL_BUS_ADDRESS builds) at once. The firmware update packets are broadcast,
+    so every node programs them in the same pass. No node answers a broadcast frame, so the frames are paced (a node
+    cannot receive while it programs a packet), and a node can still miss some of them. Each node then reports the
+    packets it is missing, and only the union of the gaps is broadcast again, until every node has the whole image.
+    With FEC, a FWUG_PARITY packet follows every fec_group_size packets of the first pass: each node rebuilds a single
+    missed packet per group on its own, so fewer packets are left for the next passes.
+    """
+    def __init__(self, port, baud_rate, addresses, file_path, packet_size, gap=BUS_BROADCAST_GAP,
+                 rounds=BUS_REPAIR_ROUNDS, verbose=False, fec_group_size=0):
+        self.factory = FirmwareUpdateFactory(port, baud_rate, file_path, packet_size, verbose=verbose,
+                                             address=COM_PROTO_ADDRESS_BROADCAST)
+        self.image = FirmwareImage(file_path)
+        self.gap = gap
+        self.rounds = rounds
+        self.fec_group_size = fec_group_size
+        # Per node: error (None while the node is being updated), and the number of missing packets after each pass
+        self.nodes = {address: {'error': None, 'missing': []} for address in addresses}
+
+    def get_active_nodes(self):
+        return [address for address, node in self.nodes.items() if node['error'] is None]
+
+    def query_missing_packets(self, address, packet_count, timeout=COM_PROTO_RESPONSE_TIMEOUT):
+        """
+        Requests the missing packets of a node. A node that is busy (e.g. erasing its download slot) does not answer
+        until it is done, so the request is repeated up to timeout.
+        """
+        self.factory.session.address = address
+        deadline = time.monotonic() + timeout
+        while True:
+            report = self.factory.query_missing_packets(packet_count)
+            if report is not None or time.monotonic() >= deadline:
+                return report
 
-                    # After 3 retries, return
-                    if i == 2:
-                        print("Firmware update failed. Exiting...")
-                        return
+    def discover(self):
+        """
+        Checks that every node supports the shared bus, and returns the largest packet size that all of them accept.
+        """
+        packet_size = self.factory.requested_packet_size
+        for address in self.nodes:
+            self.factory.session.address = address
+            for _ in range(FWUG_DATA_ATTEMPTS):
+                capabilities = self.factory.query_capabilities()
+                if capabilities is not None:
+                    break
+            if capabilities is None:
+                self.nodes[address]['error'] = 'not found'
+            elif not capabilities['features'] & COM_PROTO_FEATURE_BUS_ADDRESSING:
+                self.nodes[address]['error'] = 'no bus support'
+            elif capabilities['features'] & COM_PROTO_FEATURE_DIRECT_XIP:
+                # Its download slot depends on the slot it boots: the broadcast image cannot suit every node
+                self.nodes[address]['error'] = 'direct XIP'
+            else:
+                packet_size = min(packet_size, capabilities['max_packet_size'])
+                if self.fec_group_size and not capabilities['features'] & COM_PROTO_FEATURE_FEC:
+                    print(f"Node {address} does not support FEC, disabled")
+                    self.fec_group_size = 0
+        return packet_size
+
+    def start(self, packet_size):
+        """
+        Starts the firmware update on every node at once. Returns the packet size that the nodes accepted.
+        """
+        session = self.factory.session
+        self.factory.requested_packet_size = packet_size
+        # A session left open (e.g. by an interrupted update) would reject FWUG_START
+        session.broadcast(self.factory.create_fwug_cancel_msg(), self.gap)
+        session.broadcast(self.factory.create_fwug_start_msg(), self.gap)
+
+        # All the nodes select the packet size the same way: the first report gives the session packet size
+        accepted_packet_size = None
+        for address in self.get_active_nodes():
+            report = self.query_missing_packets(address, 0, COM_PROTO_FWUG_START_TIMEOUT)
+            for _ in range(FWUG_DATA_ATTEMPTS):
+                if report is not None and report['is_active']:
+                    break
+                # The node missed a broadcast frame: it is started on its own
+                session.address = address
+                session.transact(self.factory.create_fwug_cancel_msg())
+                session.transact(self.factory.create_fwug_start_msg(), COM_PROTO_FWUG_START_TIMEOUT)
+                report = self.query_missing_packets(address, 0)
+            if report is None or not report['is_active']:
+                self.nodes[address]['error'] = 'not started'
+            elif accepted_packet_size is None:
+                accepted_packet_size = report['packet_size']
+            elif report['packet_size'] != accepted_packet_size:
+                self.nodes[address]['error'] = f"packet size {report['packet_size']}"
+        return accepted_packet_size
+
+    def run(self):
+        """
+        Updates all the nodes, then prints a summary table. Returns True if every node was updated.
+        """
+        start_time = time.monotonic()
+        with self.factory:
+            packet_size = self.start(self.discover()) if self.get_active_nodes() else None
+            if packet_size is not None:
+                print(f"Firmware update started on {len(self.get_active_nodes())} nodes, using a packet size of "
+                      f"{packet_size} bytes")
+                if self.image.get_packet_count(packet_size) > FIRMWARE_UPDATE_MAX_PACKET_COUNT:
+                    print(f"The image has more than {FIRMWARE_UPDATE_MAX_PACKET_COUNT} packets: use larger packets")
+                else:
+                    self.transfer(self.image.get_frames(packet_size), packet_size)
+        elapsed = time.monotonic() - start_time
+
+        results = {}
+        for address, node in self.nodes.items():
+            if node['error'] is None and node['missing'][-1:] == [0]:
+                results[address] = 'ok'
+            else:
+                results[address] = node['error'] or 'FAILED'
+        result_width = max(len('Result'), *(len(result) for result in results.values()))
+        print(f"\n{'Address':<7}  {'Result':<{result_width}}  Missing packets after each pass")
+        for address, node in self.nodes.items():
+            missing = ', '.join(str(count) for count in node['missing']) or '-'
+            print(f"{address:<7}  {results[address]:<{result_width}}  {missing}")
+        updated = list(results.values()).count('ok')
+        print(f"{updated}/{len(self.nodes)} nodes updated in {elapsed:.1f} s")
+        return updated == len(self.nodes)
+
+    def transfer(self, frames, packet_size):
+        session = self.factory.session
+        to_send = range(len(frames))
+        parity_frames = self.image.get_parity_frames(packet_size, self.fec_group_size) if self.fec_group_size else []
+        for pass_number in range(self.rounds + 1):
+            for count, packet_number in enumerate(to_send, 1):
+                session.broadcast(frames[packet_number], self.gap)
+                if pass_number == 0 and parity_frames and \
+                        (count % self.fec_group_size == 0 or count == len(to_send)):
+                    session.broadcast(parity_frames[(count - 1) // self.fec_group_size], self.gap)
+                print(f"\rPass {pass_number}: sent packet {count}/{len(to_send)}", end='', flush=True)
+            print()
+
+            # Every node reports its gaps: the union is broadcast again
+            missing = set()
+            is_complete = True
+            for address in self.get_active_nodes():
+                report = self.query_missing_packets(address, len(frames),
+                                                    FWUG_DATA_ATTEMPTS * COM_PROTO_RESPONSE_TIMEOUT)
+                if report is None:
+                    print(f"Node {address}: no report")
+                    is_complete = False
+                    continue
+                self.nodes[address]['missing'].append(len(report['missing']))
+                missing.update(report['missing'])
+            if is_complete and not missing:
+                return
+            to_send = sorted(missing)
 
 if __name__ == "__main__":
     # Parse command-line arguments
     parser = argparse.ArgumentParser(description='Send firmware update via serial.')
-    parser.add_argument('file', metavar='FILE', help='Path to binary file')
+    parser.add_argument('file', metavar='FILE', nargs='?', help='Path to binary file')
     parser.add_argument('--port', default='COM9', help='Serial port')
-    parser.add_argument('--baudrate', type=int, default=115200, help='Baud rate')
+    parser.add_argument('--baudrate', type=int, default=UART_DEFAULT_BAUDRATE,
+                        help='Baud rate used to discover the bootloader (its default baud rate)')
+    parser.add_argument('--target-baudrate', type=int, default=None,
+                        help='Baud rate to switch to for the firmware transfer, if the bootloader supports it')
+    parser.add_argument('--packet-size', type=int, default=FIRMWARE_UPDATE_MAX_PACKET_SIZE,
+                        help='Firmware update packet size to propose to the bootloader (negotiated during FWUG_START)')
+    parser.add_argument('--capabilities', action='store_true', help='Print the bootloader capabilities and exit')
+    parser.add_argument('--stats', action='store_true', help='Print the bootloader statistics and exit')
+    parser.add_argument('--clear-stats', action='store_true', help='Clear the statistics after printing them')
+    parser.add_argument('--trace', metavar='ELF', default=None,
+                        help='Read the bootloader trace and decode it with the given bootloader elf, then exit')
+    parser.add_argument('--profile', action='store_true',
+                        help='Print the profiling summary of the bootloader (BL_PROFILING builds) and exit')
+    parser.add_argument('--image-check', choices=COM_PROTO_SLOTS.keys(), default=None,
+                        help='Check the image in the given slot chunk by chunk, print the damaged regions and exit')
+    parser.add_argument('--verbose', action='store_true', help='Print every frame and firmware update status')
+    parser.add_argument('--fleet', metavar='PORT', nargs='+', default=None,
+                        help='Update the devices on all the given serial ports (globs allowed) at once, with FILE')
+    parser.add_argument('--manifest', default=None,
+                        help='Update the devices listed in a manifest file at once: "<port> [<firmware.bin>]" per line')
+    parser.add_argument('--fleet-attempts', type=int, default=2,
+                        help='Attempts to update each device of a fleet update')
+    parser.add_argument('--address', type=int, default=None,
+                        help='Address of the node to talk to, on a shared bus (bootloaders built with BL_BUS_ADDRESS)')
+    parser.add_argument('--bus', metavar='ADDRESS', type=int, nargs='+', default=None,
+                        help='Update the nodes at the given addresses of a shared bus at once (broadcast), with FILE')
+    parser.add_argument('--bus-gap', type=float, default=BUS_BROADCAST_GAP * 1000,
+                        help='Time between two broadcast frames (ms), for the nodes to program a packet')
+    parser.add_argument('--bus-rounds', type=int, default=BUS_REPAIR_ROUNDS,
+                        help='Times the packets that some node is missing are broadcast again')
+    parser.add_argument('--fec', metavar='N', type=int, default=0,
+                        help='Forward error correction: send a parity packet after every N packets (1 - 255)')
+    parser.add_argument('--fec-gap', type=float, default=FEC_PACKET_GAP * 1000,
+                        help='Time between two packets of a FEC group (ms), for the bootloader to program a packet')
+    parser.add_argument('--no-resume', action='store_true',
+                        help='Start the download over, even if the bootloader holds an interrupted download of FILE')
+    parser.add_argument('--no-sparse', action='store_true',
+                        help='Send every packet of FILE, including its erased (0xFF) ranges')
+    parser.add_argument('--no-delta', action='store_true',
+                        help='Send FILE without comparing it with the slots of the bootloader first')
+    parser.add_argument('--reboot', action='store_true',
+                        help='Reboot the bootloader after the update, to install (or boot) the image')
+    parser.add_argument('--secondary-file', metavar='FILE', default=None,
+                        help='FILE linked for the secondary slot, sent to bootloaders built with BL_DIRECT_XIP that '
+                             'download to the secondary slot (FILE is linked for the primary slot)')
     args = parser.parse_args()
+    if not 0 <= args.fec <= 255:
+        parser.error('--fec must be within 1 - 255 (0: no FEC)')
+    if args.bus is not None:
+        if args.file is None:
+            parser.error('FILE is required with --bus')
+        bus_update = BusUpdate(args.port, args.baudrate, args.bus, args.file, args.packet_size, args.bus_gap / 1000,
+                               args.bus_rounds, args.verbose, args.fec)
+        raise SystemExit(0 if bus_update.run() else 1)
+    if args.fleet is not None or args.manifest is not None:
+        devices = [(port, args.file) for port in expand_ports(args.fleet or [])]
+        if devices and args.file is None:
+            parser.error('FILE is required with --fleet')
+        if args.manifest is not None:
+            devices += read_manifest(args.manifest, args.file)
+        if not devices:
+            parser.error('No device to update')
+        fleet_update = FleetUpdate(devices, args.baudrate, args.packet_size, args.target_baudrate,
+                                   args.fleet_attempts, args.verbose, args.fec, args.fec_gap / 1000,
+                                   not args.no_resume, not args.no_sparse, not args.no_delta, args.reboot,
+                                   args.secondary_file)
+        raise SystemExit(0 if fleet_update.run() else 1)
+    if not args.capabilities and not args.stats and args.trace is None and not args.profile \
+            and args.image_check is None and args.file is None:
+        parser.error('FILE is required, unless --capabilities, --stats, --trace, --profile or --image-check is given')
 
     # Example binary file path
     binary_file_path = args.file
@@ -204,7 +1760,51 @@ if __name__ == "__main__":
     baud_rate = args.baudrate
 
     # --- Initiate firmware update ---
-    # Create the firmware update factory
-    fwug_factory = FirmwareUpdateFactory(com_port, baud_rate, binary_file_path)
-    # Perform firmware update
-    fwug_factory.perform_firmware_update()
+    # Create the firmware update factory. The serial port stays open for the whole session.
+    with FirmwareUpdateFactory(com_port, baud_rate, binary_file_path, args.packet_size, args.target_baudrate,
+                               args.verbose, address=args.address, fec_group_size=args.fec,
+                               fec_gap=args.fec_gap / 1000, resume=not args.no_resume,
+                               sparse=not args.no_sparse, delta=not args.no_delta,
+                               reboot=args.reboot, secondary_file_path=args.secondary_file) as fwug_factory:
+        if args.capabilities:
+            capabilities = fwug_factory.query_capabilities()
+            if capabilities is None:
+                print("Could not read the bootloader capabilities")
+            else:
+                print_capabilities(capabilities)
+            raise SystemExit(0)
+        if args.stats:
+            stats = fwug_factory.query_stats(args.clear_stats)
+            if stats is None:
+                print("Could not read the bootloader statistics")
+            else:
+                print_stats(stats)
+            raise SystemExit(0)
+        if args.trace:
+            trace_decoder = TraceDecoder(args.trace)
+            trace = fwug_factory.query_trace()
+            if trace is None:
+                print("Could not read the bootloader trace")
+            else:
+                dropped, records = trace
+                for timestamp_us, message in trace_decoder.decode(records):
+                    print(f"[{timestamp_us / 1000:10.3f} ms] {message}")
+                if dropped:
+                    print(f"{dropped} trace records were dropped (trace buffer full)")
+            raise SystemExit(0)
+        if args.profile:
+            profile = fwug_factory.query_profile()
+            if profile is None:
+                print("Could not read the bootloader profiling summary")
+            else:
+                print_profile(profile)
+            raise SystemExit(0)
+        if args.image_check:
+            image_check = fwug_factory.query_image_check(args.image_check)
+            if image_check is None:
+                print("Could not check the image")
+            else:
+                print_image_check(args.image_check, image_check)
+            raise SystemExit(0)
+        # Perform firmware update
+        fwug_factory.perform_firmware_update()
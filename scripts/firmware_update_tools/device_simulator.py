@@ -0,0 +1,421 @@
+import argparse
+import os
+import random
+import struct
+import threading
+import tty
+import zlib
+from bootloader_tool import *
+
+# Simulated bootloader: max baud rate and slot geometry reported in the capabilities (STM32F401RE layout)
+SIMULATOR_MAX_BAUDRATE = 2625000
+SIMULATOR_APP_PRIMARY_START = 0x08008000
+SIMULATOR_APP_SECONDARY_START = 0x08040000
+SIMULATOR_APP_SLOT_SIZE = 0x38000
+# Bound of the received packets map (FIRMWARE_UPDATE_MAX_PACKET_COUNT of the bootloader)
+SIMULATOR_MAX_PACKET_COUNT = SIMULATOR_APP_SLOT_SIZE // FIRMWARE_UPDATE_MIN_PACKET_SIZE
+
+
+class SimulatedDevice:
+    """
+    Bootloader in recovery mode. It answers the capabilities, debug info, missing packets, download progress, chunk
+    checksums, slot info, set baud rate, reboot and firmware update messages (parity packets, sparse ranges, copied
+    chunks and resumed downloads included) like the bootloader does (same packet size negotiation and sequence checks),
+    and keeps the downloaded image in memory. As the download space, the image is only erased by FWUG_START, so a
+    cancelled download can be resumed. The installed image (primary slot) is erased, unless one is given. A reboot
+    installs the downloaded image if it is newer and intact. The baud rate of a pty has no effect, so every switch
+    succeeds.
+
+    With an address, the device is a node of a shared bus (BL_BUS_ADDRESS build): it only processes the addressed frames
+    for its address or broadcast, and only answers the ones for its address. Broadcast firmware update packets can
+    arrive with gaps.
+    """
+    def __init__(self, write, address=None, primary=b''):
+        self.write = write
+        self.address = address
+        self.is_broadcast = False
+        self.is_active = False
+        self.packets_received = 0
+        self.packet_size = 0
+        self.fec_group_size = 0
+        self.range_end = 0
+        self.received = set()
+        self.image = bytearray()
+        self.primary = bytes(primary).ljust(SIMULATOR_APP_SLOT_SIZE, b'\xFF')
+        self.stats = [0] * (len(STATS_COUNTERS) + len(STATS_TIMERS) + STATS_LATENCY_BUCKET_COUNT)
+
+    def send_frame(self, msg_type, payload):
+        if self.is_broadcast:
+            return
+        msg_len = COM_PROTO_HEADER_SIZE + len(payload) + COM_PROTO_FOOTER_SIZE
+        frame = struct.pack('<BH', msg_type, msg_len) + payload
+        self.write(frame + struct.pack('>H', compute_crc16(frame)))
+
+    def send_op_result(self, op_result):
+        self.send_frame(COM_PROTO_MSG_TYPE_OP_RESULT, struct.pack('<B', op_result))
+
+    def send_fwug_status(self, op_result):
+        self.send_frame(COM_PROTO_MSG_TYPE_FWUG_STATUS,
+                        struct.pack('<BBHH', op_result, self.is_active, self.packets_received, self.packet_size))
+
+    def capabilities(self):
+        features = COM_PROTO_FEATURE_BAUDRATE_SWITCH | COM_PROTO_FEATURE_FEC | COM_PROTO_FEATURE_RESUME | \
+            COM_PROTO_FEATURE_SPARSE | COM_PROTO_FEATURE_CHUNK_CHECKSUMS | COM_PROTO_FEATURE_SLOT_INFO
+        if self.address is not None:
+            features |= COM_PROTO_FEATURE_BUS_ADDRESSING
+        # No flash sectors reported
+        return struct.pack(CAPABILITIES_FORMAT, COM_PROTO_VERSION, FIRMWARE_UPDATE_MAX_PACKET_SIZE, 1, 0,
+                           COM_PROTO_DELTA_CHUNK_COPY,
+                           SIMULATOR_MAX_BAUDRATE, features, SIMULATOR_APP_PRIMARY_START, SIMULATOR_APP_SLOT_SIZE,
+                           SIMULATOR_APP_SECONDARY_START, SIMULATOR_APP_SLOT_SIZE, 0)
+
+    def missing_packets(self, params):
+        packet_count = min(struct.unpack('<H', params)[0], SIMULATOR_MAX_PACKET_COUNT)
+        bitmap = bytearray((packet_count + 7) // 8)
+        missing = [i for i in range(packet_count) if not self.is_active or i not in self.received]
+        for i in missing:
+            bitmap[i // 8] |= 1 << (i % 8)
+        return struct.pack(MISSING_PACKETS_FORMAT, self.is_active, self.packet_size, packet_count, len(missing)) + \
+            bitmap
+
+    def download_progress(self, packet_size):
+        """
+        Returns the packets written to the download space (up to its last programmed word), and their CRC32.
+        """
+        written_size = len(self.image.rstrip(b'\xFF'))
+        written_size = (written_size + 3) // 4 * 4
+        packet_count = (written_size + packet_size - 1) // packet_size
+        return packet_count, zlib.crc32(self.image[:packet_count * packet_size])
+
+    def get_slots(self):
+        return {COM_PROTO_SLOTS['primary']: self.primary,
+                COM_PROTO_SLOTS['secondary']: bytes(self.image).ljust(SIMULATOR_APP_SLOT_SIZE, b'\xFF')}
+
+    def chunk_checksums(self, params):
+        """
+        Returns the CRC32 of the requested chunks of a slot, or None if the request exceeds the slot.
+        """
+        slot, offset, chunk_size, chunk_count = struct.unpack(CHUNK_CHECKSUMS_FORMAT, params)
+        slots = self.get_slots()
+        if slot not in slots or not chunk_size or chunk_count > COM_PROTO_MAX_CHUNK_CHECKSUMS or \
+                offset + chunk_size * chunk_count > SIMULATOR_APP_SLOT_SIZE:
+            return None
+        data = slots[slot]
+        crc32s = [zlib.crc32(data[start:start + chunk_size])
+                  for start in range(offset, offset + chunk_size * chunk_count, chunk_size)]
+        return struct.pack(CHUNK_CHECKSUMS_FORMAT, slot, offset, chunk_size, chunk_count) + \
+            struct.pack(f'<{chunk_count}I', *crc32s)
+
+    @staticmethod
+    def is_crc_ok(data):
+        return zlib.crc32(data[:-IMAGE_FOOTER_SIZE]) == struct.unpack_from('<I', data, len(data) - IMAGE_FOOTER_SIZE)[0]
+
+    def is_secondary_newer(self):
+        """
+        Compares the versions of the footers (major, minor, patch), as flash_api_is_secondary_newer() does.
+        """
+        slots = self.get_slots()
+        version_offset = SIMULATOR_APP_SLOT_SIZE - IMAGE_FOOTER_SIZE + 4
+        return struct.unpack_from('<BHB', slots[COM_PROTO_SLOTS['secondary']], version_offset) > \
+            struct.unpack_from('<BHB', slots[COM_PROTO_SLOTS['primary']], version_offset)
+
+    def slot_info(self):
+        """
+        Returns the footer of each slot and its CRC32 check. The simulated boots pass every check.
+        """
+        payload = struct.pack(SLOT_INFO_FORMAT, 0, self.is_secondary_newer())
+        for _, data in sorted(self.get_slots().items()):
+            payload += struct.pack(SLOT_FOOTER_FORMAT, data[-IMAGE_FOOTER_SIZE:], self.is_crc_ok(data))
+        return payload
+
+    def handle_reboot(self):
+        """
+        Answers, then boots: installs the downloaded image if it is newer and intact. The download space is kept.
+        """
+        self.send_op_result(COM_PROTO_OP_RESULT_NO_ERR)
+        secondary = self.get_slots()[COM_PROTO_SLOTS['secondary']]
+        if self.is_secondary_newer() and self.is_crc_ok(secondary):
+            self.primary = secondary
+        self.is_active = False
+        self.packets_received = 0
+        self.packet_size = 0
+        self.fec_group_size = 0
+
+    def handle_req_data(self, params):
+        data_type = params[0]
+        if data_type == COM_PROTO_DATA_TYPE_CAPABILITIES:
+            payload = self.capabilities()
+        elif data_type == COM_PROTO_DATA_TYPE_DEBUG_INF:
+            payload = struct.pack(STATS_FORMAT, *self.stats)
+            if len(params) > 1 and params[1] & COM_PROTO_DEBUG_INF_FLAG_CLEAR:
+                self.stats = [0] * len(self.stats)
+        elif data_type == COM_PROTO_DATA_TYPE_MISSING_PACKETS and len(params) == 3:
+            payload = self.missing_packets(params[1:])
+        elif data_type == COM_PROTO_DATA_TYPE_DOWNLOAD_PROGRESS and len(params) == 3:
+            packet_size = get_accepted_packet_size(struct.unpack('<H', params[1:])[0])
+            payload = struct.pack(DOWNLOAD_PROGRESS_FORMAT, packet_size, *self.download_progress(packet_size))
+        elif data_type == COM_PROTO_DATA_TYPE_CHUNK_CHECKSUMS and len(params) == 11:
+            payload = self.chunk_checksums(params[1:])
+            if payload is None:
+                self.send_op_result(COM_PROTO_OP_RESULT_GENERIC_ERR)
+                return
+        elif data_type == COM_PROTO_DATA_TYPE_SLOT_INFO:
+            payload = self.slot_info()
+        else:
+            self.send_op_result(COM_PROTO_OP_RESULT_GENERIC_ERR)
+            return
+        self.send_frame(COM_PROTO_MSG_TYPE_DATA, struct.pack('<B', data_type) + payload)
+
+    def handle_fwug_start(self, params):
+        packet_size = struct.unpack('<H', params[:2])[0] if len(params) in (2, 3, 9) else 0
+        if self.is_active:
+            self.send_fwug_status(COM_PROTO_OP_RESULT_GENERIC_ERR)
+            return
+        self.is_active = True
+        self.packets_received = 0
+        self.packet_size = get_accepted_packet_size(packet_size)
+        self.fec_group_size = params[2] if len(params) in (3, 9) else 0
+        self.range_end = 0
+        self.received = set()
+        if len(params) == 9:
+            # Resumed download: only if the download space holds exactly the packets of the host
+            packet_count, prefix_crc32 = struct.unpack('<HI', params[3:])
+            written_packets, _ = self.download_progress(self.packet_size)
+            prefix_size = packet_count * self.packet_size
+            if packet_count and written_packets <= packet_count and prefix_size <= len(self.image) and \
+                    zlib.crc32(self.image[:prefix_size]) == prefix_crc32:
+                self.packets_received = packet_count
+                self.received = set(range(packet_count))
+                self.send_fwug_status(COM_PROTO_OP_RESULT_NO_ERR)
+                return
+        self.image = bytearray(b'\xFF' * SIMULATOR_APP_SLOT_SIZE)
+        self.send_fwug_status(COM_PROTO_OP_RESULT_NO_ERR)
+
+    def handle_fwug_data(self, params):
+        packet_number = struct.unpack('<H', params[:2])[0] if len(params) >= 2 else 0
+        if not self.is_active or len(params) != 2 + self.packet_size or packet_number >= SIMULATOR_MAX_PACKET_COUNT:
+            self.send_fwug_status(COM_PROTO_OP_RESULT_GENERIC_ERR)
+            return
+        # Point to point: the packets must follow each other. Broadcast or FEC session: any packet not received yet.
+        is_unordered = self.is_broadcast or self.fec_group_size
+        if is_unordered and packet_number in self.received:
+            self.send_fwug_status(COM_PROTO_OP_RESULT_NO_ERR)
+            return
+        if packet_number != self.packets_received:
+            self.stats[STATS_COUNTERS.index('sequence errors')] += 1
+            if not is_unordered:
+                self.send_fwug_status(COM_PROTO_OP_RESULT_GENERIC_ERR)
+                return
+        if not self.write_packet(packet_number, params[2:]):
+            self.send_fwug_status(COM_PROTO_OP_RESULT_GENERIC_ERR)
+            return
+        self.send_fwug_status(COM_PROTO_OP_RESULT_NO_ERR)
+
+    def write_packet(self, packet_number, payload):
+        offset = packet_number * self.packet_size
+        if offset + self.packet_size > SIMULATOR_APP_SLOT_SIZE:
+            return False
+        self.image[offset:offset + self.packet_size] = payload
+        self.received.add(packet_number)
+        while self.packets_received in self.received:
+            self.packets_received += 1
+        return True
+
+    def handle_fwug_data_at(self, params):
+        """
+        Writes a populated range of a sparse image at its offset. The ranges must arrive in ascending order, a resent
+        range is acknowledged.
+        """
+        offset = struct.unpack('<I', params[:4])[0] if len(params) >= 4 else 0
+        data = params[4:]
+        is_ok = self.is_active and len(data) <= self.packet_size and self.write_range(offset, data)
+        self.send_fwug_status(COM_PROTO_OP_RESULT_NO_ERR if is_ok else COM_PROTO_OP_RESULT_GENERIC_ERR)
+
+    def handle_fwug_copy(self, params):
+        """
+        Copies a range of the primary slot to the same offset of the download space, in the order of the ranges.
+        """
+        offset, length = struct.unpack('<II', params) if len(params) == 8 else (0, 0)
+        is_ok = self.is_active and self.write_range(offset, self.primary[offset:offset + length])
+        self.send_fwug_status(COM_PROTO_OP_RESULT_NO_ERR if is_ok else COM_PROTO_OP_RESULT_GENERIC_ERR)
+
+    def write_range(self, offset, data):
+        """
+        Writes a range at its offset, after the ranges written before it. A resent range is acknowledged.
+        """
+        if not data or offset % 4 or len(data) % 4 or offset + len(data) > SIMULATOR_APP_SLOT_SIZE:
+            return False
+        written_end = max(self.range_end, self.packets_received * self.packet_size)
+        if offset + len(data) <= written_end:
+            return True
+        if offset < written_end:
+            self.stats[STATS_COUNTERS.index('sequence errors')] += 1
+            return False
+        self.image[offset:offset + len(data)] = data
+        self.range_end = offset + len(data)
+        self.packets_received = self.range_end // self.packet_size
+        self.received = set(range(self.packets_received))
+        return True
+
+    def handle_fwug_parity(self, params):
+        """
+        Rebuilds the single missing packet of a group (if any) from the parity of the group.
+        """
+        packet_number, group_size = struct.unpack('<HB', params[:3]) if len(params) >= 3 else (0, 0)
+        group = range(packet_number, packet_number + group_size)
+        if not self.is_active or len(params) != 3 + self.packet_size or not group_size or \
+                group.stop > SIMULATOR_MAX_PACKET_COUNT:
+            self.send_fwug_status(COM_PROTO_OP_RESULT_GENERIC_ERR)
+            return
+        missing = [i for i in group if i not in self.received]
+        if len(missing) == 1:
+            packet = int.from_bytes(params[3:], 'little')
+            for i in group:
+                if i != missing[0]:
+                    offset = i * self.packet_size
+                    packet ^= int.from_bytes(self.image[offset:offset + self.packet_size], 'little')
+            self.write_packet(missing[0], packet.to_bytes(self.packet_size, 'little'))
+            self.stats[STATS_COUNTERS.index('FEC repairs')] += 1
+            missing = []
+        self.send_fwug_status(COM_PROTO_OP_RESULT_NO_ERR if not missing else COM_PROTO_OP_RESULT_GENERIC_ERR)
+
+    def handle_frame(self, frame):
+        msg_type = frame[0]
+        params = bytes(frame[COM_PROTO_HEADER_SIZE:-COM_PROTO_FOOTER_SIZE])
+        self.stats[STATS_COUNTERS.index('frames received')] += 1
+        if struct.unpack('>H', frame[-COM_PROTO_FOOTER_SIZE:])[0] != compute_crc16(frame[:-COM_PROTO_FOOTER_SIZE]):
+            self.stats[STATS_COUNTERS.index('CRC16 errors')] += 1
+            self.send_op_result(COM_PROTO_OP_RESULT_CRC_ERR)
+        elif msg_type == COM_PROTO_MSG_TYPE_REQ_DATA and params:
+            self.handle_req_data(params)
+        elif msg_type == COM_PROTO_MSG_TYPE_CMD and params and params[0] == COM_PROTO_CMD_SET_BAUDRATE:
+            self.send_op_result(COM_PROTO_OP_RESULT_NO_ERR)
+        elif msg_type == COM_PROTO_MSG_TYPE_CMD and params and params[0] == COM_PROTO_CMD_REBOOT:
+            self.handle_reboot()
+        elif msg_type == COM_PROTO_MSG_TYPE_FWUG_START:
+            self.handle_fwug_start(params)
+        elif msg_type == COM_PROTO_MSG_TYPE_FWUG_DATA:
+            self.handle_fwug_data(params)
+        elif msg_type == COM_PROTO_MSG_TYPE_FWUG_PARITY:
+            self.handle_fwug_parity(params)
+        elif msg_type == COM_PROTO_MSG_TYPE_FWUG_DATA_AT:
+            self.handle_fwug_data_at(params)
+        elif msg_type == COM_PROTO_MSG_TYPE_FWUG_COPY:
+            self.handle_fwug_copy(params)
+        elif msg_type == COM_PROTO_MSG_TYPE_FWUG_CANCEL:
+            self.is_active = False
+            self.packets_received = 0
+            self.packet_size = 0
+            self.fec_group_size = 0
+            self.send_fwug_status(COM_PROTO_OP_RESULT_NO_ERR)
+        else:
+            self.send_op_result(COM_PROTO_OP_RESULT_UNKNOWN_MSG_ERR)
+
+    def handle_bus_frame(self, frame):
+        """
+        Shared bus: unwraps the addressed frames for this node. Any other frame is dropped without a response.
+        """
+        if frame[0] != COM_PROTO_MSG_TYPE_ADDRESSED or len(frame) < COM_PROTO_HEADER_SIZE + 1 + COM_PROTO_FOOTER_SIZE:
+            return
+        if struct.unpack('>H', frame[-COM_PROTO_FOOTER_SIZE:])[0] != compute_crc16(frame[:-COM_PROTO_FOOTER_SIZE]):
+            return
+        address = frame[COM_PROTO_HEADER_SIZE]
+        inner_frame = frame[COM_PROTO_HEADER_SIZE + 1:-COM_PROTO_FOOTER_SIZE]
+        if address not in (self.address, COM_PROTO_ADDRESS_BROADCAST) or len(inner_frame) < COM_PROTO_HEADER_SIZE \
+                or struct.unpack_from('<H', inner_frame, 1)[0] != len(inner_frame):
+            return
+        self.is_broadcast = address == COM_PROTO_ADDRESS_BROADCAST
+        self.handle_frame(inner_frame)
+        self.is_broadcast = False
+
+    def report(self):
+        if not self.received:
+            return "no image received"
+        image_size = (max(self.received) + 1) * self.packet_size
+        missing = image_size // self.packet_size - len(self.received)
+        return f"{len(self.received)} packets ({missing} missing), {image_size} bytes, " \
+               f"CRC32 0x{zlib.crc32(self.image[:image_size]):08X}"
+
+
+class SimulatedPort:
+    """
+    Pseudo terminal, that the host tool opens as a serial port (the slave side). Behind it, either one device (point to
+    point link), or several nodes of a shared bus that all receive every frame. A frame is lost with drop_rate: on a
+    point to point link, the response (to exercise the retries of the tool), and on a bus, the frame for one node (to
+    exercise the resend of the missing packets).
+    """
+    def __init__(self, bus_node_count=0, drop_rate=0.0, primary=b''):
+        self.master_fd, self.slave_fd = os.openpty()
+        # No echo, no line discipline: the frames are binary
+        tty.setraw(self.slave_fd)
+        self.port = os.ttyname(self.slave_fd)
+        self.drop_rate = drop_rate
+        self.rx_buffer = bytearray()
+        if bus_node_count:
+            self.devices = [SimulatedDevice(self.write, address, primary)
+                            for address in range(1, bus_node_count + 1)]
+        else:
+            self.devices = [SimulatedDevice(self.write_lossy, primary=primary)]
+
+    def write(self, frame):
+        os.write(self.master_fd, frame)
+
+    def write_lossy(self, frame):
+        if random.random() >= self.drop_rate:
+            self.write(frame)
+
+    def handle_frame(self, frame):
+        for device in self.devices:
+            if device.address is None:
+                device.handle_frame(frame)
+            elif random.random() >= self.drop_rate:
+                device.handle_bus_frame(frame)
+
+    def run(self):
+        while True:
+            self.rx_buffer += os.read(self.master_fd, COM_PROTO_MAX_FRAME_SIZE)
+            while len(self.rx_buffer) >= COM_PROTO_HEADER_SIZE:
+                msg_len = struct.unpack_from('<H', self.rx_buffer, 1)[0]
+                max_len = COM_PROTO_MAX_FRAME_SIZE + COM_PROTO_HEADER_SIZE + 1 + COM_PROTO_FOOTER_SIZE
+                if not COM_PROTO_HEADER_SIZE + COM_PROTO_FOOTER_SIZE <= msg_len <= max_len:
+                    # Not a frame start: resynchronize on the next byte
+                    del self.rx_buffer[0]
+                    continue
+                if len(self.rx_buffer) < msg_len:
+                    break
+                frame = self.rx_buffer[:msg_len]
+                del self.rx_buffer[:msg_len]
+                self.handle_frame(frame)
+
+    def report(self):
+        for device in self.devices:
+            node = f" node {device.address}" if device.address is not None else ''
+            print(f"{self.port}{node}: {device.report()}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Simulate bootloaders in recovery mode on pseudo terminals.')
+    parser.add_argument('--devices', type=int, default=4, help='Number of simulated devices (one pty each)')
+    parser.add_argument('--bus', metavar='NODES', type=int, default=0,
+                        help='Simulate a shared bus instead: one pty, with nodes at the addresses 1 - NODES')
+    parser.add_argument('--drop-rate', type=float, default=0.0,
+                        help='Probability that a frame is lost (0.0 - 1.0): a response, or a frame for a bus node')
+    parser.add_argument('--primary', metavar='FILE', default=None,
+                        help='Image installed in the primary slot of every device (binary or sparse image)')
+    args = parser.parse_args()
+
+    primary = FirmwareImage(args.primary).data if args.primary is not None else b''
+    if args.bus:
+        ports = [SimulatedPort(args.bus, args.drop_rate, primary)]
+    else:
+        ports = [SimulatedPort(drop_rate=args.drop_rate, primary=primary) for _ in range(args.devices)]
+    for port in ports:
+        threading.Thread(target=port.run, daemon=True).start()
+        print(port.port, flush=True)
+
+    try:
+        threading.Event().wait()
+    except KeyboardInterrupt:
+        print()
+        for port in ports:
+            port.report()
@@ -0,0 +1,153 @@
+import argparse
+import math
+import random
+import statistics
+from bootloader_tool import *
+from device_simulator import SimulatedDevice
+
+# Time the bootloader needs to program a firmware update packet (s per byte): ~16 us per 32bit word (STM32F4, x32
+# parallelism)
+BENCHMARK_PROGRAM_TIME = 4e-6
+# Time the bootloader needs to process any other frame (s)
+BENCHMARK_FRAME_TIME = 0.0002
+# Host turnaround (s): from the end of a response to the next request (e.g. USB serial latency)
+BENCHMARK_HOST_LATENCY = 0.002
+
+
+class NoisyLink:
+    """
+    Serial session over a simulated noisy line, with a virtual clock: frames take their time on the line (baud rate),
+    the bootloader takes its time to process them, and every bit of a frame (either direction) is flipped with the bit
+    error rate. It replaces the SerialSession of a FirmwareUpdateFactory, so that the tool runs as it would over a
+    serial port, without waiting for real.
+
+    A bit error in the header of a request makes the bootloader lose the frame (wrong length: it cannot find the next
+    frame start until the line is idle), so the host waits for the response timeout. A bit error anywhere else is
+    caught by the CRC16 of the frame.
+    """
+    def __init__(self, device, baud_rate, ber, rng, host_latency=BENCHMARK_HOST_LATENCY):
+        self.device = device
+        self.baudrate = baud_rate
+        self.ber = ber
+        self.rng = rng
+        self.host_latency = host_latency
+        self.address = None
+        self.clock = 0.0
+        self.responses = []
+        device.write = self.responses.append
+
+    def close(self):
+        pass
+
+    def line_time(self, frame):
+        return len(frame) * UART_BITS_PER_BYTE / self.baudrate
+
+    def corrupt(self, frame):
+        """
+        Flips each bit of the frame with the bit error rate. The distance between two bit errors is geometric.
+        """
+        frame = bytearray(frame)
+        if self.ber <= 0:
+            return frame
+        bit = -1
+        while True:
+            bit += 1 + int(math.log(1.0 - self.rng.random()) / math.log(1.0 - self.ber))
+            if bit >= len(frame) * 8:
+                return frame
+            frame[bit // 8] ^= 1 << (bit % 8)
+
+    def process_time(self, frame):
+        if frame[0] in (COM_PROTO_MSG_TYPE_FWUG_DATA, COM_PROTO_MSG_TYPE_FWUG_PARITY, COM_PROTO_MSG_TYPE_FWUG_DATA_AT):
+            return BENCHMARK_FRAME_TIME + BENCHMARK_PROGRAM_TIME * (len(frame) - COM_PROTO_HEADER_SIZE)
+        return BENCHMARK_FRAME_TIME
+
+    def deliver(self, message):
+        """
+        Sends a request over the line. Returns the response of the bootloader, or None if the request was lost.
+        """
+        self.clock += self.line_time(message)
+        frame = self.corrupt(message)
+        if frame[:COM_PROTO_HEADER_SIZE] != message[:COM_PROTO_HEADER_SIZE]:
+            return None
+        del self.responses[:]
+        self.device.handle_frame(frame)
+        return self.responses[-1] if self.responses else None
+
+    def send(self, message, gap):
+        # The response (if any) is sent while the host waits for the gap
+        self.deliver(message)
+        self.clock += max(gap, self.process_time(message))
+
+    def transact(self, message, timeout=COM_PROTO_RESPONSE_TIMEOUT):
+        response = self.deliver(message)
+        if response is None:
+            self.clock += timeout
+            return b''
+        self.clock += self.process_time(message) + self.line_time(response) + self.host_latency
+        received = self.corrupt(response)
+        msg_len = struct.unpack_from('<H', received, 1)[0]
+        if msg_len > len(response) and msg_len <= COM_PROTO_MAX_FRAME_SIZE:
+            # The host waits for bytes that never come
+            self.clock += timeout
+            return b''
+        return bytes(received[:msg_len])
+
+
+class BenchmarkFactory(FirmwareUpdateFactory):
+    """
+    Firmware update over a NoisyLink, instead of a serial port. Every packet is sent (no sparse or delta transfer), so
+    that the modes are compared on the same bytes.
+    """
+    def __init__(self, link, image, packet_size, fec_group_size):
+        super().__init__(packet_size=packet_size, log=lambda *args: None, progress=lambda *args: None, image=image,
+                         fec_group_size=fec_group_size, fec_gap=0, sparse=False, delta=False)
+        self.link = link
+
+    def open(self):
+        self.session = self.link
+
+
+def run_update(image, baud_rate, ber, packet_size, fec_group_size, seed):
+    """
+    Runs one firmware update. Returns the goodput (image bytes per second of line time, 0 if the update failed) and the
+    packets that the bootloader rebuilt from a parity packet.
+    """
+    device = SimulatedDevice(None)
+    link = NoisyLink(device, baud_rate, ber, random.Random(seed))
+    with BenchmarkFactory(link, image, packet_size, fec_group_size) as factory:
+        is_ok = factory.perform_firmware_update(report_stats=False)
+    is_ok = is_ok and device.image[:len(image.data)] == image.data
+    repairs = device.stats[STATS_COUNTERS.index('FEC repairs')]
+    return (len(image.data) / link.clock if is_ok else 0.0), repairs
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description='Compare the firmware update goodput with and without forward error correction, over a simulated '
+                    'serial line with bit errors.')
+    parser.add_argument('file', metavar='FILE', help='Path to binary file')
+    parser.add_argument('--baudrate', type=int, default=UART_DEFAULT_BAUDRATE, help='Line baud rate')
+    parser.add_argument('--packet-size', type=int, default=512, help='Firmware update packet size')
+    parser.add_argument('--ber', type=float, nargs='+', default=[0, 1e-6, 1e-5, 3e-5, 1e-4],
+                        help='Bit error rates to simulate')
+    parser.add_argument('--fec', metavar='N', type=int, nargs='+', default=[8, 16],
+                        help='FEC group sizes to compare with no FEC')
+    parser.add_argument('--runs', type=int, default=5, help='Updates per bit error rate and mode')
+    args = parser.parse_args()
+
+    image = FirmwareImage(args.file)
+    line_rate = args.baudrate / UART_BITS_PER_BYTE
+    modes = [0] + args.fec
+    print(f"{len(image.data)} bytes, {args.packet_size} byte packets, {args.baudrate} baud, {args.runs} runs each")
+    print(f"{'BER':<8}  {'Mode':<7}  {'Updated':<7}  {'Goodput (bytes/s)':<17}  {'Line rate':<9}  FEC repairs")
+    for ber in args.ber:
+        for fec_group_size in modes:
+            results = [run_update(image, args.baudrate, ber, args.packet_size, fec_group_size, run)
+                       for run in range(args.runs)]
+            goodputs = [goodput for goodput, _ in results if goodput > 0]
+            goodput = statistics.mean(goodputs) if goodputs else 0.0
+            repairs = statistics.mean(repairs for _, repairs in results)
+            mode = f"FEC {fec_group_size}" if fec_group_size else 'no FEC'
+            updated = f"{len(goodputs)}/{args.runs}"
+            share = f"{100 * goodput / line_rate:.0f}%"
+            print(f"{ber:<8.0e}  {mode:<7}  {updated:<7}  {goodput:<17.0f}  {share:<9}  {repairs:.1f}")
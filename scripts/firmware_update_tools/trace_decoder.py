@@ -0,0 +1,102 @@
+import re
+import struct
+
+# The bootloader trace (BL_TRACE) stores, for each log site, the id of its format string and its raw arguments. The
+# format strings are kept in the .trace_fmt section of the bootloader elf (not loaded to the target): the id of a format
+# string is its offset in that section.
+TRACE_FMT_SECTION = '.trace_fmt'
+TRACE_RECORD_ID_MASK = 0x00FFFFFF
+TRACE_RECORD_NARGS_POS = 24
+TRACE_RECORD_HEADER_WORDS = 2
+
+# printf conversion specifiers, as used by the bootloader log sites (integer/pointer arguments only)
+PRINTF_SPEC = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(?:hh|h|ll|l|z)?([diouxXpc%])')
+
+
+def read_elf_section(elf_path, section_name):
+    """
+    Returns the contents of a section of a little endian elf file (32bit target elf, or 64bit host build elf), or None
+    if the section does not exist.
+    """
+    with open(elf_path, 'rb') as elf_file:
+        elf = elf_file.read()
+    if elf[:4] != b'\x7fELF' or elf[4] not in (1, 2) or elf[5] != 1:
+        raise ValueError(f"{elf_path} is not a little endian elf file")
+
+    if elf[4] == 1:
+        # e_shoff, then e_shentsize, e_shnum, e_shstrndx. Section header: name, type, flags, addr, offset, size ...
+        sh_offset = struct.unpack_from('<I', elf, 0x20)[0]
+        sh_entry_size, sh_count, sh_str_index = struct.unpack_from('<HHH', elf, 0x2E)
+        section_format = '<IIIIII'
+    else:
+        sh_offset = struct.unpack_from('<Q', elf, 0x28)[0]
+        sh_entry_size, sh_count, sh_str_index = struct.unpack_from('<HHH', elf, 0x3A)
+        section_format = '<IIQQQQ'
+    sections = [struct.unpack_from(section_format, elf, sh_offset + i * sh_entry_size) for i in range(sh_count)]
+    str_table_offset = sections[sh_str_index][4]
+    for section in sections:
+        name_start = str_table_offset + section[0]
+        name = elf[name_start:elf.index(b'\x00', name_start)].decode()
+        if name == section_name:
+            return elf[section[4]:section[4] + section[5]]
+    return None
+
+
+def c_format(fmt, args):
+    """
+    Formats a printf format string with 32bit integer arguments.
+    """
+    args = list(args)
+
+    def convert(match):
+        flags, width, precision, conversion = match.groups()
+        if conversion == '%':
+            return '%'
+        value = args.pop(0) if args else 0
+        if conversion in 'di':
+            value = value - (1 << 32) if value & 0x80000000 else value
+            conversion = 'd'
+        elif conversion == 'u':
+            conversion = 'd'
+        elif conversion == 'p':
+            return f"0x{value:08x}"
+        elif conversion == 'c':
+            value = chr(value & 0xFF)
+        spec = '%' + flags + width + (f".{precision}" if precision else '') + conversion
+        return spec % value
+
+    return PRINTF_SPEC.sub(convert, fmt)
+
+
+class TraceDecoder:
+    def __init__(self, elf_path):
+        self.formats = read_elf_section(elf_path, TRACE_FMT_SECTION)
+        if self.formats is None:
+            raise ValueError(f"No {TRACE_FMT_SECTION} section in {elf_path}: was it built with BL_LOG_BACKEND=trace?")
+
+    def get_format(self, fmt_id):
+        if fmt_id >= len(self.formats):
+            return None
+        return self.formats[fmt_id:self.formats.index(b'\x00', fmt_id)].decode(errors='replace')
+
+    def decode(self, records):
+        """
+        Decodes trace records (as read through REQ_DATA: trace) to (timestamp_us, message) tuples.
+        """
+        messages = []
+        words = struct.unpack(f'<{len(records) // 4}I', records[:len(records) // 4 * 4])
+        index = 0
+        while index + TRACE_RECORD_HEADER_WORDS <= len(words):
+            header, timestamp_us = words[index:index + TRACE_RECORD_HEADER_WORDS]
+            fmt_id = header & TRACE_RECORD_ID_MASK
+            nargs = header >> TRACE_RECORD_NARGS_POS
+            args = words[index + TRACE_RECORD_HEADER_WORDS:index + TRACE_RECORD_HEADER_WORDS + nargs]
+            index += TRACE_RECORD_HEADER_WORDS + nargs
+
+            fmt = self.get_format(fmt_id)
+            if fmt is None:
+                message = f"<unknown trace id 0x{fmt_id:06X}> " + ' '.join(f"0x{arg:08X}" for arg in args)
+            else:
+                message = c_format(fmt, args).rstrip('\r\n')
+            messages.append((timestamp_us, message))
+        return messages